@@ -1,7 +1,55 @@
 // Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
 
 #include "FPSCppTemplate.h"
+#include "KZAssetLoader.h"
+#include "KZBenchmark.h"
+#include "KZNetTest.h"
+#include "KZRunStore.h"
+#include "Misc/CommandLine.h"
 #include "Modules/ModuleManager.h"
+#include "UObject/UObjectGlobals.h"
 
-IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, FPSCppTemplate, "FPSCppTemplate" );
- 
\ No newline at end of file
+DEFINE_STAT(STAT_PortalTeleport);
+
+CSV_DEFINE_CATEGORY_MODULE(FPSCPPTEMPLATE_API, Portal, true);
+CSV_DEFINE_CATEGORY_MODULE(FPSCPPTEMPLATE_API, Projectile, true);
+CSV_DEFINE_CATEGORY_MODULE(FPSCPPTEMPLATE_API, KZ, true);
+
+class FFPSCppTemplateModule : public FDefaultGameModuleImpl
+{
+public:
+	virtual void StartupModule() override
+	{
+		// Before the engine ticks, so the allocator is swapped while no game code runs yet
+		if (FParse::Param(FCommandLine::Get(), TEXT("KZBenchmark")) || FParse::Param(FCommandLine::Get(), TEXT("KZBenchmarkAllocs")))
+			FKZBenchmarkRecorder::InstallAllocationCounter();
+
+		// The first map load, the main menu, starts streaming in the assets of the playable maps
+		PreLoadMapHandle = FCoreUObjectDelegates::PreLoadMap.AddStatic(&FKZAssetLoader::OnPreLoadMap);
+		PostLoadMapHandle = FCoreUObjectDelegates::PostLoadMapWithWorld.AddStatic(&FKZAssetLoader::OnPostLoadMap);
+		RunStoreHandle = FCoreUObjectDelegates::PostLoadMapWithWorld.AddStatic(&FKZRunStore::OnPostLoadMap);
+
+		// Command line runs start from here rather than from a game mode, the maps use Blueprint game modes
+		BenchmarkHandle = FCoreUObjectDelegates::PostLoadMapWithWorld.AddStatic(&AKZBenchmark::OnPostLoadMap);
+		NetTestHandle = FCoreUObjectDelegates::PostLoadMapWithWorld.AddStatic(&AKZNetTest::OnPostLoadMap);
+	}
+
+	virtual void ShutdownModule() override
+	{
+		FCoreUObjectDelegates::PreLoadMap.Remove(PreLoadMapHandle);
+		FCoreUObjectDelegates::PostLoadMapWithWorld.Remove(PostLoadMapHandle);
+		FCoreUObjectDelegates::PostLoadMapWithWorld.Remove(RunStoreHandle);
+		FCoreUObjectDelegates::PostLoadMapWithWorld.Remove(BenchmarkHandle);
+		FCoreUObjectDelegates::PostLoadMapWithWorld.Remove(NetTestHandle);
+		FKZBenchmarkRecorder::RemoveAllocationCounter();
+	}
+
+private:
+	FDelegateHandle PreLoadMapHandle;
+	FDelegateHandle PostLoadMapHandle;
+	FDelegateHandle RunStoreHandle;
+	FDelegateHandle BenchmarkHandle;
+	FDelegateHandle NetTestHandle;
+};
+
+IMPLEMENT_PRIMARY_GAME_MODULE( FFPSCppTemplateModule, FPSCppTemplate, "FPSCppTemplate" );
@@ -3,3 +3,33 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+
+/** Stat group for the portal systems, use "stat Portal" to display */
+DECLARE_STATS_GROUP(TEXT("Portal"), STATGROUP_Portal, STATCAT_Advanced);
+
+/** Stat group for the projectile systems, use "stat Projectile" to display */
+DECLARE_STATS_GROUP(TEXT("Projectile"), STATGROUP_Projectile, STATCAT_Advanced);
+
+/** Stat group for the KZ movement, use "stat KZ" to display */
+DECLARE_STATS_GROUP(TEXT("KZ"), STATGROUP_KZ, STATCAT_Advanced);
+
+/** Shared by the character and projectile teleports */
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Teleport"), STAT_PortalTeleport, STATGROUP_Portal, FPSCPPTEMPLATE_API);
+
+/**
+ * The same systems in the CSV profiler, one row per frame in Saved/Profiling/CSV.
+ * Record with "csvprofile start" / "csvprofile stop" or the -csvCaptureFrames=N command line switch
+ */
+CSV_DECLARE_CATEGORY_MODULE_EXTERN(FPSCPPTEMPLATE_API, Portal);
+CSV_DECLARE_CATEGORY_MODULE_EXTERN(FPSCPPTEMPLATE_API, Projectile);
+CSV_DECLARE_CATEGORY_MODULE_EXTERN(FPSCPPTEMPLATE_API, KZ);
+
+/**
+ * SCOPE_CYCLE_COUNTER that also times the scope in CsvCategory while a CSV capture runs.
+ * Each half compiles out with its profiler (STATS, CSV_PROFILER), e.g. both in shipping builds
+ */
+#define FPS_SCOPE_CYCLE_COUNTER(CsvCategory, Stat) \
+	SCOPE_CYCLE_COUNTER(Stat); \
+	CSV_SCOPED_TIMING_STAT(CsvCategory, Stat)
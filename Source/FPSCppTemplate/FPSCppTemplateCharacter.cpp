@@ -1,24 +1,47 @@
 // Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
 
 #include "FPSCppTemplateCharacter.h"
+#include "FPSCppTemplate.h"
 #include "FPSCppTemplateProjectile.h"
+#include "FPSCppTemplateHUD.h"
+#include "KZBenchmark.h"
+#include "KZFootstepComponent.h"
+#include "KZGhostManager.h"
+#include "KZRunStore.h"
+#include "PortalManager.h"
+#include "ProjectilePool.h"
+#include "ProjectileBatchManager.h"
 #include "Animation/AnimInstance.h"
 #include "Camera/CameraComponent.h"
 #include "Components/CapsuleComponent.h"
 #include "Components/InputComponent.h"
 #include "GameFramework/InputSettings.h"
+#include "GameFramework/PlayerState.h"
 #include "HeadMountedDisplayFunctionLibrary.h"
 #include "Kismet/GameplayStatics.h"
 #include "MotionControllerComponent.h"
 #include "XRMotionControllerBase.h" // for FXRMotionControllerBase::RightHandSourceId
 #include "Engine.h"
+#include "EngineUtils.h"
+#include "Misc/App.h"
+#include "Misc/Paths.h"
 
 DEFINE_LOG_CATEGORY_STATIC(LogFPChar, Warning, All);
 
+DECLARE_CYCLE_STAT(TEXT("Jump Input"), STAT_KZJumpInput, STATGROUP_KZ);
+DECLARE_CYCLE_STAT(TEXT("Move Forward Input"), STAT_KZMoveForwardInput, STATGROUP_KZ);
+DECLARE_CYCLE_STAT(TEXT("Move Right Input"), STAT_KZMoveRightInput, STATGROUP_KZ);
+DECLARE_CYCLE_STAT(TEXT("Turn Input"), STAT_KZTurnInput, STATGROUP_KZ);
+DECLARE_CYCLE_STAT(TEXT("Look Up Input"), STAT_KZLookUpInput, STATGROUP_KZ);
+DECLARE_CYCLE_STAT(TEXT("Character Portal Crossings"), STAT_KZPortalCrossings, STATGROUP_KZ);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Speed"), STAT_KZSpeed, STATGROUP_KZ);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Sync Rate"), STAT_KZSyncRate, STATGROUP_KZ);
+
 //////////////////////////////////////////////////////////////////////////
 // AFPSCppTemplateCharacter
 
-AFPSCppTemplateCharacter::AFPSCppTemplateCharacter()
+AFPSCppTemplateCharacter::AFPSCppTemplateCharacter(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer.SetDefaultSubobjectClass<UKZCharacterMovementComponent>(ACharacter::CharacterMovementComponentName))
 {
 	// Set size for collision capsule
 	GetCapsuleComponent()->InitCapsuleSize(55.f, 96.0f);
@@ -79,7 +102,8 @@ AFPSCppTemplateCharacter::AFPSCppTemplateCharacter()
 	VR_MuzzleLocation->SetRelativeLocation(FVector(0.000004, 53.999992, 10.000000));
 	VR_MuzzleLocation->SetRelativeRotation(FRotator(0.0f, 90.0f, 0.0f));		// Counteract the rotation of the VR gun model.
 
-	PlayerController = nullptr;
+	Footsteps = CreateDefaultSubobject<UKZFootstepComponent>(TEXT("Footsteps"));
+
 	MovementComponent = nullptr;
 }
 
@@ -88,8 +112,18 @@ void AFPSCppTemplateCharacter::BeginPlay()
 	// Call the base class  
 	Super::BeginPlay();
 
-	if (PlayerController == nullptr) PlayerController = UGameplayStatics::GetPlayerController(GetWorld(), 0);
-	if (MovementComponent == nullptr) MovementComponent = GetCharacterMovement();
+	if (MovementComponent == nullptr) MovementComponent = CastChecked<UKZCharacterMovementComponent>(GetCharacterMovement());
+
+	OnCharacterMovementUpdated.AddDynamic(this, &AFPSCppTemplateCharacter::OnKZMovementUpdated);
+
+	MovementComponent->ResetStrafe(fMinMovement * fMovementMultiplier);
+
+	// Spawn the projectiles up front so firing never has to
+	if (ProjectileClass != NULL)
+	{
+		if (AProjectilePool* ProjectilePool = AProjectilePool::Get(GetWorld()))
+			ProjectilePool->Prewarm(ProjectileClass);
+	}
 
 	//Attach gun mesh component to Skeleton, doing it here because the skeleton is not yet created in the constructor
 	FP_Gun->AttachToComponent(Mesh1P, FAttachmentTransformRules(EAttachmentRule::SnapToTarget, true), TEXT("GripPoint"));
@@ -141,16 +175,19 @@ void AFPSCppTemplateCharacter::SetupPlayerInputComponent(class UInputComponent*
 
 void AFPSCppTemplateCharacter::TeleportActor(const APortalC* TeleportTo, const APortalC* TeleportFrom)
 {
+	// A replay runs the recorded teleports itself, live overlaps would teleport a second time
+	if (InputReplay.IsValid())
+		return;
+
+	// The overlap of a portal UpdatePortalCrossings just went through reports the same crossing again, explicit calls still teleport
+	if (bUseSweptPortalCrossing && GFrameCounter - SweptCrossingFrame <= 1 && SweptCrossingEntries.Contains(TeleportFrom))
+		return;
+
 	// Get 'indentical coordniate matrix' (in terms of portal)
 	FMatrix PFromKCoordInvMat = TeleportFrom->KCoordInvMat;
 	FMatrix PToJCoordMat = TeleportTo->JCoordMat;
 
 	FVector ActorDeltaLocation = GetActorLocation() - TeleportFrom->Origin;
-	FVector ActorRotationVector = GetFirstPersonCameraComponent()->GetComponentRotation().Vector();
-	FVector Velocity = GetVelocity();
-
-	if (PlayerController == nullptr) PlayerController = UGameplayStatics::GetPlayerController(GetWorld(), 0);
-	if (MovementComponent == nullptr) MovementComponent = GetCharacterMovement();
 
 	// Part 1. Location
 	// Teleport Location is X-axis mirroring
@@ -160,55 +197,147 @@ void AFPSCppTemplateCharacter::TeleportActor(const APortalC* TeleportTo, const A
 	// In order to prevent triggering the teleport condition in the other portal
 	temp1.X = TeleportTo->ActorTeleportPositiveOffset;
 	FVector NewDeltaLocation = FVector((PToJCoordMat.TransformVector(temp1)));
-	FVector NewLocation = TeleportTo->Origin + NewDeltaLocation;
+	TeleportThroughPortal(TeleportTo, TeleportFrom, TeleportTo->Origin + NewDeltaLocation);
+}
+
+void AFPSCppTemplateCharacter::TeleportThroughPortal(const APortalC* TeleportTo, const APortalC* TeleportFrom, const FVector& NewLocation)
+{
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalTeleport);
+	if (MovementComponent == nullptr) MovementComponent = CastChecked<UKZCharacterMovementComponent>(GetCharacterMovement());
+
+	// Moves replayed after a correction cross their portals again, everything but the move itself already happened the first time
+	const bool bReplayingMove = MovementComponent->IsReplayingMoves();
+	APortalManager* PortalManager = bReplayingMove ? nullptr : APortalManager::Get(GetWorld(), false);
+	if (PortalManager)
+		PortalManager->NotifyTeleport(TeleportFrom);
+
+	// Swept crossings and TeleportActor calls alike, a replay puts the character at the recorded exit through this function again
+	if (InputRecorder.IsValid() && !bReplayingMove)
+		RecordFrame.Teleports.Add({ TeleportTo->GetFName(), TeleportFrom->GetFName(), NewLocation });
+
+	// Cached From->To matrix shared with the portal scene capture
+	const FMatrix& PortalPairMatrix = TeleportFrom->GetPortalPairMatrix(TeleportTo);
+
+	FVector ActorRotationVector = GetFirstPersonCameraComponent()->GetComponentRotation().Vector();
+	FVector Velocity = GetVelocity();
+	const FVector OldLocation = GetActorLocation();
+	const FRotator OldControlRotation = GetControlRotation();
+
+	// Part 1. Location
 	SetActorLocation(NewLocation,false,nullptr,ETeleportType::None);
 
 	// Part 2. Rotation
-	// Use player controller to set rotation (using controller Roll, Pitch, Yaw set to 1 s.t. camera rotation = controller rotation)
-	FVector NewRotationVector = FVector(PToJCoordMat.TransformVector(PFromKCoordInvMat.TransformVector(ActorRotationVector)));
-	PlayerController->SetControlRotation(NewRotationVector.Rotation()); // #include "Kismet/GameplayStatics.h"
+	// Use our own controller to set rotation (using controller Roll, Pitch, Yaw set to 1 s.t. camera rotation = controller rotation),
+	// the server turns remote players and the client its own, whose next moves carry the new rotation
+	FVector NewRotationVector = PortalPairMatrix.TransformVector(ActorRotationVector);
+	if (Controller && !bReplayingMove)
+		Controller->SetControlRotation(NewRotationVector.Rotation());
 
 	// Part 3. Velocity
 	// Use chracter movement component to set velocity
-	FVector NewVelocity = FVector(PToJCoordMat.TransformVector(PFromKCoordInvMat.TransformVector(Velocity)));
+	FVector NewVelocity = PortalPairMatrix.TransformVector(Velocity);
 	MovementComponent->Velocity = NewVelocity; // #include "GameFramework/CharacterMovementComponent.h"
 
-	if (GEngine && bPrintTeleport)
+	// Ghosts jump through the portal instead of sliding from the entry to the exit
+	if (GhostRecorder.IsValid() && !bReplayingMove)
+		GhostRecorder->AddTeleport(GetWorld()->GetTimeSeconds() - GhostRecordStartTime, OldLocation, OldControlRotation, NewLocation, GetControlRotation());
+
+	FKZDebugOverlay* DebugOverlay = bPrintTeleport && !bReplayingMove ? AFPSCppTemplateHUD::GetDebugOverlay(GetWorld()) : nullptr;
+	if (DebugOverlay)
+	{
+		const FVector ExitOffset = NewLocation - TeleportTo->Origin;
+		DebugOverlay->AddMessage(2.f, FColor::Blue, TEXT("Old V %f, New V %f"), Velocity.Size(), NewVelocity.Size());
+		DebugOverlay->AddMessage(2.f, FColor::Yellow, TEXT("X=%3.3f Y=%3.3f Z=%3.3f"), NewVelocity.X, NewVelocity.Y, NewVelocity.Z);
+		DebugOverlay->AddMessage(2.f, FColor::Red, TEXT("X=%3.3f Y=%3.3f Z=%3.3f"), ExitOffset.X, ExitOffset.Y, ExitOffset.Z);
+		DebugOverlay->AddMessage(2.f, FColor::Green, TEXT("X=%3.3f Y=%3.3f Z=%3.3f"), NewRotationVector.X, NewRotationVector.Y, NewRotationVector.Z);
+	}
+}
+
+void AFPSCppTemplateCharacter::OnKZMovementUpdated(float DeltaSeconds, FVector OldLocation, FVector OldVelocity)
+{
+	// A replay runs the recorded crossings itself
+	if (bUseSweptPortalCrossing && !InputReplay.IsValid())
+		UpdatePortalCrossings(OldLocation, GetActorLocation());
+}
+
+void AFPSCppTemplateCharacter::UpdatePortalCrossings(FVector Start, FVector End)
+{
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZPortalCrossings);
+
+	APortalManager* PortalManager = APortalManager::Get(GetWorld(), false);
+	if (PortalManager == nullptr)
+		return;
+
+	// Several portals can be crossed within one move at KZ speeds: after each crossing the rest of the segment
+	// is carried through the pair and tested again, never against the portal we just came out of
+	const APortalC* LastExit = nullptr;
+	TArray<const APortalC*, TInlineAllocator<4>> Entries;
+	while (Entries.Num() < MaxPortalCrossingsPerMove)
 	{
-		GEngine->AddOnScreenDebugMessage(-1, 2.0f, FColor::Blue, FString::Printf(TEXT("Old V %f, New V %f"), Velocity.Size(), NewVelocity.Size()));
-		GEngine->AddOnScreenDebugMessage(-1, 2.0f, FColor::Yellow, NewVelocity.ToString());
-		GEngine->AddOnScreenDebugMessage(-1, 2.0f, FColor::Red, NewDeltaLocation.ToString());
-		GEngine->AddOnScreenDebugMessage(-1, 2.0f, FColor::Green, NewRotationVector.ToString());
+		float Time;
+		const APortalC* TeleportFrom = PortalManager->FindFirstCrossing(Start, End, LastExit, Time);
+		if (TeleportFrom == nullptr)
+			break;
+
+		const APortalC* TeleportTo = TeleportFrom->PortalToCPP;
+		const FMatrix& PortalPairMatrix = TeleportFrom->GetPortalPairMatrix(TeleportTo);
+		Start = PortalPairMatrix.TransformPosition(FMath::Lerp(Start, End, Time));
+		End = PortalPairMatrix.TransformPosition(End);
+
+		// Keep the exit point in front of the destination so the overshoot is not lost but never counts as a crossing back
+		const float EndX = FVector::DotProduct(End - TeleportTo->Origin, TeleportTo->X);
+		if (EndX < TeleportTo->ActorTeleportPositiveOffset)
+			End += (TeleportTo->ActorTeleportPositiveOffset - EndX) * TeleportTo->X;
+
+		if (SweptCrossingFrame != GFrameCounter)
+		{
+			SweptCrossingFrame = GFrameCounter;
+			SweptCrossingEntries.Reset();
+		}
+		SweptCrossingEntries.AddUnique(TeleportFrom);
+
+		TeleportThroughPortal(TeleportTo, TeleportFrom, End);
+		Entries.Add(TeleportFrom);
+		LastExit = TeleportTo;
 	}
+
+	if (Entries.Num() > 0)
+		MovementComponent->OnPortalCrossings(Entries);
 }
 
 void AFPSCppTemplateCharacter::OnFire()
 {
+	KZ_BENCHMARK_SCOPE(Fire);
+
 	// try and fire a projectile
 	if (ProjectileClass != NULL)
 	{
-		UWorld* const World = GetWorld();
-		if (World != NULL)
+		FRotator SpawnRotation;
+		FVector SpawnLocation;
+		if (bUsingMotionControllers)
 		{
-			if (bUsingMotionControllers)
-			{
-				const FRotator SpawnRotation = VR_MuzzleLocation->GetComponentRotation();
-				const FVector SpawnLocation = VR_MuzzleLocation->GetComponentLocation();
-				World->SpawnActor<AFPSCppTemplateProjectile>(ProjectileClass, SpawnLocation, SpawnRotation);
-			}
-			else
-			{
-				const FRotator SpawnRotation = GetControlRotation();
-				// MuzzleOffset is in camera space, so transform it to world space before offsetting from the character location to find the final muzzle position
-				const FVector SpawnLocation = ((FP_MuzzleLocation != nullptr) ? FP_MuzzleLocation->GetComponentLocation() : GetActorLocation()) + SpawnRotation.RotateVector(GunOffset);
-
-				//Set Spawn Collision Handling Override
-				FActorSpawnParameters ActorSpawnParams;
-				ActorSpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButDontSpawnIfColliding;
-
-				// spawn the projectile at the muzzle
-				World->SpawnActor<AFPSCppTemplateProjectile>(ProjectileClass, SpawnLocation, SpawnRotation, ActorSpawnParams);
-			}
+			SpawnRotation = VR_MuzzleLocation->GetComponentRotation();
+			SpawnLocation = VR_MuzzleLocation->GetComponentLocation();
+		}
+		else
+		{
+			SpawnRotation = GetControlRotation();
+			// MuzzleOffset is in camera space, so transform it to world space before offsetting from the character location to find the final muzzle position
+			SpawnLocation = ((FP_MuzzleLocation != nullptr) ? FP_MuzzleLocation->GetComponentLocation() : GetActorLocation()) + SpawnRotation.RotateVector(GunOffset);
+		}
+
+		if (bUseLightweightProjectiles)
+		{
+			if (AProjectileBatchManager* const BatchManager = AProjectileBatchManager::Get(GetWorld(), ProjectileClass))
+				BatchManager->Fire(SpawnLocation, SpawnRotation);
+		}
+		// Projectiles are recycled through the world's projectile pool instead of spawned and destroyed
+		else if (AProjectilePool* const ProjectilePool = AProjectilePool::Get(GetWorld()))
+		{
+			// fire the projectile from the muzzle, with the same spawn collision handling as before
+			ProjectilePool->Acquire(ProjectileClass, SpawnLocation, SpawnRotation, bUsingMotionControllers
+				? ESpawnActorCollisionHandlingMethod::AlwaysSpawn
+				: ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButDontSpawnIfColliding);
 		}
 	}
 
@@ -262,6 +391,8 @@ void AFPSCppTemplateCharacter::EndTouch(const ETouchIndex::Type FingerIndex, con
 
 void AFPSCppTemplateCharacter::JumpByAxis(float Value)
 {
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZJumpInput);
+	Value = RecordOrReplayAxis(EKZInputAxis::Jump, Value);
 	if (Value != 0.0f)
 	{
 		this->Jump();
@@ -274,7 +405,9 @@ void AFPSCppTemplateCharacter::JumpByAxis(float Value)
 
 void AFPSCppTemplateCharacter::KZMoveForward(float Value)
 {
-	if (MovementComponent == nullptr) MovementComponent = GetCharacterMovement();
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZMoveForwardInput);
+	Value = RecordOrReplayAxis(EKZInputAxis::MoveForward, Value);
+	if (MovementComponent == nullptr) MovementComponent = CastChecked<UKZCharacterMovementComponent>(GetCharacterMovement());
 	FMovementInput = Value;
 	FVector downVector = FVector(0, 0, -1);
 	FVector forwardVector = GetActorForwardVector() - FVector::DotProduct(GetActorForwardVector(), downVector) * downVector;
@@ -305,6 +438,8 @@ void AFPSCppTemplateCharacter::KZMoveForward(float Value)
 
 void AFPSCppTemplateCharacter::KZMoveRight(float Value)
 {
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZMoveRightInput);
+	Value = RecordOrReplayAxis(EKZInputAxis::MoveRight, Value);
 	RMovementInput = Value;
 
 	if (Value != 0.0f)
@@ -312,42 +447,32 @@ void AFPSCppTemplateCharacter::KZMoveRight(float Value)
 		RMovementInput /= FMath::Sqrt((pow(RMovementInput, 2) + pow(FMovementInput, 2)));
 		AddMovementInput(GetActorRightVector(), RMovementInput);
 	}
+
+	if (MovementComponent == nullptr) MovementComponent = CastChecked<UKZCharacterMovementComponent>(GetCharacterMovement());
+	MovementComponent->SetStrafeInput(RMovementInput);
 }
 
 void AFPSCppTemplateCharacter::KZJumpTurn(float Rate)
 {
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZTurnInput);
+	Rate = RecordOrReplayAxis(EKZInputAxis::Turn, Rate);
+
 	// calculate delta for this frame from the rate information
 	AddControllerYawInput(Rate* BaseTurnRate * GetWorld()->GetDeltaSeconds());
-	if (MovementComponent == nullptr) MovementComponent = GetCharacterMovement();
-
-	if (MovementComponent->IsFalling())
-	{
-		float DeltaSpeed = fBaseMovementIncrementRate * fMovementMultiplier * GetWorld()->GetDeltaSeconds();
 
-		if (MovementComponent->MaxWalkSpeed < fMaxMovement && MovementComponent->MaxWalkSpeedCrouched < fMaxMovement)
-		{
-			if (Rate * RMovementInput > 0.f)
-			{
-				if (fabs(Rate) >= .99f && fabs(Rate) < 10.0f)
-				{
-					fSynRateNumerator += 1.;
-
-					MovementComponent->MaxWalkSpeed += DeltaSpeed;
-					MovementComponent->MaxWalkSpeedCrouched += DeltaSpeed;
-				}
-				fSynRateDenominator += 1.;
-			}
-		}
-	}
+	// Speed gain is simulated at a fixed step within the next move, with the turn input of the whole frame
+	if (MovementComponent == nullptr) MovementComponent = CastChecked<UKZCharacterMovementComponent>(GetCharacterMovement());
+	MovementComponent->AddTurnInput(Rate);
 
-	if (GEngine && bPrintTurnRate)
-	{
-		GEngine->AddOnScreenDebugMessage(-1, -1.f, FColor::FColor(0, 255, 255), FString::Printf(TEXT("Camera Turn Rate (Horizontal): %.2f "), Rate));
-	}
+	FKZDebugOverlay* DebugOverlay = bPrintTurnRate ? AFPSCppTemplateHUD::GetDebugOverlay(GetWorld()) : nullptr;
+	if (DebugOverlay)
+		DebugOverlay->SetChannel(EKZDebugChannel::TurnRate, FColor(0, 255, 255), TEXT("Camera Turn Rate (Horizontal): %.2f"), Rate);
 }
 
 void AFPSCppTemplateCharacter::KZJumpLookUp(float Rate)
 {
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZLookUpInput);
+	Rate = RecordOrReplayAxis(EKZInputAxis::LookUp, Rate);
 	AddControllerPitchInput(Rate* BaseLookUpRate * GetWorld()->GetDeltaSeconds());
 }
 
@@ -380,22 +505,39 @@ bool AFPSCppTemplateCharacter::EnableTouchscreenMovement(class UInputComponent*
 
 void AFPSCppTemplateCharacter::ResetSyncRate()
 {
+	if (MovementComponent)
+		MovementComponent->ResetSyncRate();
 	fSyncRate = 0.;
 }
 
+FKZStrafeSettings AFPSCppTemplateCharacter::GetKZStrafeSettings() const
+{
+	FKZStrafeSettings Settings;
+	Settings.FixedTimeStep = 1.f / FMath::Max(fStrafeStepRate, 1.f);
+	Settings.MinSpeed = fMinMovement * fMovementMultiplier;
+	Settings.MaxSpeed = fMaxMovement;
+	Settings.IncrementRate = fBaseMovementIncrementRate * fMovementMultiplier;
+	Settings.ResetSpeed = fMinMovement * fMovementMultiplier * fMovementResetThreshold;
+	Settings.MinSyncTurnSpeed = fMinSyncTurnSpeed;
+	Settings.MaxSyncTurnSpeed = fMaxSyncTurnSpeed;
+	return Settings;
+}
+
 void AFPSCppTemplateCharacter::Tick(float DeltaSeconds)
 {
+	KZ_BENCHMARK_SCOPE(CharacterTick);
+
 	// Call any parent class Tick implementation
 	Super::Tick(DeltaSeconds);
 
-	if (MovementComponent == nullptr) MovementComponent = GetCharacterMovement();
+	if (MovementComponent == nullptr) MovementComponent = CastChecked<UKZCharacterMovementComponent>(GetCharacterMovement());
 
-	// Ajust movement by multiplier
-	if (MovementComponent->Velocity.Size2D() <= (fMinMovement * fMovementMultiplier * fMovementResetThreshold))
-	{
-		MovementComponent->MaxWalkSpeed = fMinMovement * fMovementMultiplier;
-		MovementComponent->MaxWalkSpeedCrouched = fMinMovement * fMovementMultiplier;
-	}
+	ApplyReplayTeleports();
+
+	// The strafe simulation runs in the movement component, as part of every move
+	UpdateStrafeTelemetry();
+	fSyncRate = MovementComponent->GetStrafe().GetSyncRate();
+	fBaseMovement = MovementComponent->GetStrafe().GetSpeed();
 
 	// Condition to turn on auto Move forward while falling
 	if (EnableAutoMoveForward)
@@ -406,19 +548,289 @@ void AFPSCppTemplateCharacter::Tick(float DeltaSeconds)
 		}
 	}
 
-	// Calculate Sync Rate
-	if (fSynRateDenominator == 0.)
+	if (IsLocallyControlled())
+	{
+		SET_FLOAT_STAT(STAT_KZSpeed, MovementComponent->Velocity.Size2D());
+		SET_FLOAT_STAT(STAT_KZSyncRate, fSyncRate);
+		CSV_CUSTOM_STAT(KZ, Speed, MovementComponent->Velocity.Size2D(), ECsvCustomStatOp::Set);
+		CSV_CUSTOM_STAT(KZ, SyncRate, fSyncRate, ECsvCustomStatOp::Set);
+	}
+
+	FKZDebugOverlay* DebugOverlay = bPrintSpeed ? AFPSCppTemplateHUD::GetDebugOverlay(GetWorld()) : nullptr;
+	if (DebugOverlay)
+	{
+		// Display speed in cm/s or inch/s
+		const float Speed = MovementComponent->Velocity.Size2D() / fInch2centimeterFactor;
+		DebugOverlay->SetChannel(EKZDebugChannel::Speed, FColor(0, 255, 255), TEXT("Speed: %.2f units/s"), Speed);
+		DebugOverlay->SetChannel(EKZDebugChannel::SyncRate, FColor(0, 255, 255), TEXT("Sync Rate: %.1f%%"), fSyncRate * 100.f);
+		DebugOverlay->AddGraphSample(EKZDebugGraph::Speed, Speed);
+	}
+
+	UpdateInputRecording(DeltaSeconds);
+}
+
+void AFPSCppTemplateCharacter::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	KZRecordStop();
+	KZReplayStop();
+	// The engine frame time is global, it must not stay at the replay's once the character is gone
+	RestoreReplayFrameTime();
+
+	if (MovementComponent)
+		MovementComponent->SetStrafeTelemetry(nullptr);
+	StrafeTelemetry.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AFPSCppTemplateCharacter::UpdateStrafeTelemetry()
+{
+	const bool bWantTelemetry = bStrafeTelemetry && IsLocallyControlled();
+	if (bWantTelemetry != StrafeTelemetry.IsValid())
+	{
+		MovementComponent->SetStrafeTelemetry(nullptr);
+		StrafeTelemetry.Reset();
+		if (bWantTelemetry)
+		{
+			const FString CsvFilename = bSaveStrafeTelemetry ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("KZTelemetry"), FDateTime::Now().ToString() + TEXT(".csv")) : FString();
+			StrafeTelemetry = FKZStrafeTelemetry::Create(StrafeTelemetryWindow, CsvFilename);
+			MovementComponent->SetStrafeTelemetry(StrafeTelemetry.Get());
+		}
+	}
+
+	if (!StrafeTelemetry.IsValid())
+		return;
+
+	FKZJumpReport Report;
+	while (StrafeTelemetry->PopJumpReport(Report))
+	{
+		LastJumpStats = Report.Jump;
+		WindowJumpStats = Report.Window;
+
+		FKZDebugOverlay* DebugOverlay = bPrintJumpStats ? AFPSCppTemplateHUD::GetDebugOverlay(GetWorld()) : nullptr;
+		if (DebugOverlay)
+		{
+			DebugOverlay->AddMessage(5.f, FColor(0, 255, 255), TEXT("Jump %d: sync %.1f%% (%d/%d steps), %d strafe switches, gain %.1f, last %d jumps sync %.1f%%"),
+				LastJumpStats.FirstJump, LastJumpStats.GetSyncRate() * 100.f, LastJumpStats.SyncSteps, LastJumpStats.StrafeSteps, LastJumpStats.StrafeSwitches,
+				LastJumpStats.GetGain() / fInch2centimeterFactor, WindowJumpStats.NumJumps, WindowJumpStats.GetSyncRate() * 100.f);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Run timing
+
+FString AFPSCppTemplateCharacter::GetKZPlayerId() const
+{
+	return PlayerState && PlayerState->UniqueId.IsValid() ? PlayerState->UniqueId.ToString() : FString(TEXT("Local"));
+}
+
+void AFPSCppTemplateCharacter::KZRunStart()
+{
+	KZRunStartTime = GetWorld()->GetTimeSeconds();
+	KZRunSplits.Reset();
+}
+
+void AFPSCppTemplateCharacter::KZRunSplit()
+{
+	if (IsKZRunActive())
+		KZRunSplits.Add(GetWorld()->GetTimeSeconds() - KZRunStartTime);
+}
+
+float AFPSCppTemplateCharacter::KZRunFinish()
+{
+	if (!IsKZRunActive())
+		return -1.f;
+
+	FKZRunResult Run;
+	Run.PlayerId = GetKZPlayerId();
+	Run.Time = GetWorld()->GetTimeSeconds() - KZRunStartTime;
+	Run.Splits = KZRunSplits;
+	Run.Date = FDateTime::UtcNow();
+	KZRunStartTime = -1.f;
+
+	// Results are the server's, the store writes them out in the background
+	if (HasAuthority())
+	{
+		FKZRunStore& RunStore = FKZRunStore::Get();
+		const FString Map = FKZRunStore::GetMapKey(GetWorld());
+		FKZRunResult PersonalBest;
+		const bool bHadPersonalBest = RunStore.GetPersonalBest(Map, Run.PlayerId, PersonalBest);
+		const bool bNewPersonalBest = RunStore.SubmitRun(Map, Run);
+
+		if (FKZDebugOverlay* DebugOverlay = IsLocallyControlled() ? AFPSCppTemplateHUD::GetDebugOverlay(GetWorld()) : nullptr)
+		{
+			if (bHadPersonalBest)
+				DebugOverlay->AddMessage(5.f, bNewPersonalBest ? FColor::Green : FColor::White, TEXT("Run %.3f s (%+.3f s)"), Run.Time, Run.Time - PersonalBest.Time);
+			else
+				DebugOverlay->AddMessage(5.f, FColor::Green, TEXT("Run %.3f s"), Run.Time);
+		}
+	}
+	return Run.Time;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Input recording and replay
+
+FString AFPSCppTemplateCharacter::GetKZRunFilename(const FString& Name)
+{
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("KZRuns"), Name.IsEmpty() ? TEXT("Run") : *Name) + TEXT(".kzr");
+}
+
+void AFPSCppTemplateCharacter::KZRecordStart(const FString& Name)
+{
+	KZRecordStop();
+	PendingRecordFilename = GetKZRunFilename(Name);
+}
+
+void AFPSCppTemplateCharacter::KZRecordStop()
+{
+	PendingRecordFilename.Empty();
+	InputRecorder.Reset();
+	GhostRecorder.Reset();
+}
+
+void AFPSCppTemplateCharacter::KZReplayStart(const FString& Name)
+{
+	KZReplayStop();
+	PendingReplayFilename = GetKZRunFilename(Name);
+}
+
+void AFPSCppTemplateCharacter::KZReplayStop()
+{
+	PendingReplayFilename.Empty();
+	InputReplay.Reset();
+	ReplayPortals.Reset();
+	RestoreReplayFrameTime();
+}
+
+void AFPSCppTemplateCharacter::RestoreReplayFrameTime()
+{
+	if (!bReplayFrameTimeApplied)
+		return;
+
+	bReplayFrameTimeApplied = false;
+	FApp::SetUseFixedTimeStep(bSavedUseFixedTimeStep);
+	FApp::SetFixedDeltaTime(SavedFixedDeltaTime);
+}
+
+float AFPSCppTemplateCharacter::RecordOrReplayAxis(EKZInputAxis Axis, float Value)
+{
+	if (InputReplay.IsValid())
+		return ReplayFrame.Axis[(int32)Axis];
+
+	// Recorded runs play the axis as the recording stores it, so their replays move the same
+	if (InputRecorder.IsValid())
+	{
+		Value = FKZInputRecorder::QuantizeAxis(Value);
+		RecordFrame.Axis[(int32)Axis] = Value;
+	}
+	return Value;
+}
+
+void AFPSCppTemplateCharacter::ApplyReplayTeleports()
+{
+	if (!InputReplay.IsValid() || ReplayFrame.Teleports.Num() == 0)
+		return;
+
+	for (const FKZTeleportEvent& Teleport : ReplayFrame.Teleports)
+	{
+		const APortalC* TeleportTo = FindReplayPortal(Teleport.To);
+		const APortalC* TeleportFrom = FindReplayPortal(Teleport.From);
+		if (TeleportTo && TeleportFrom)
+			TeleportThroughPortal(TeleportTo, TeleportFrom, Teleport.Location);
+	}
+	ReplayFrame.Teleports.Reset();
+}
+
+const APortalC* AFPSCppTemplateCharacter::FindReplayPortal(FName Name)
+{
+	// Names missing from the world map to null, only a destroyed portal maps them again
+	if (const TWeakObjectPtr<const APortalC>* Portal = ReplayPortals.Find(Name))
+	{
+		if (Portal->IsValid() || Portal->IsExplicitlyNull())
+			return Portal->Get();
+	}
+
+	ReplayPortals.Reset();
+	for (TActorIterator<APortalC> It(GetWorld()); It; ++It)
+		ReplayPortals.Add(It->GetFName(), *It);
+	return ReplayPortals.FindOrAdd(Name).Get();
+}
+
+void AFPSCppTemplateCharacter::UpdateInputRecording(float DeltaSeconds)
+{
+	if (InputRecorder.IsValid())
+	{
+		RecordFrame.DeltaTime = DeltaSeconds;
+		InputRecorder->WriteFrame(RecordFrame);
+		RecordFrame.Teleports.Reset();
+		GhostRecorder->Sample(GetWorld()->GetTimeSeconds() - GhostRecordStartTime, GetActorLocation(), GetControlRotation());
+	}
+	else if (!PendingRecordFilename.IsEmpty())
+	{
+		// Recordings start between two frames, from the state the next frame starts with
+		FKZRecordingHeader Header;
+		Header.Location = GetActorLocation();
+		Header.ControlRotation = GetControlRotation();
+		Header.Velocity = MovementComponent->Velocity;
+		Header.StrafeSpeed = MovementComponent->GetStrafe().GetSpeed();
+		InputRecorder = FKZInputRecorder::Create(PendingRecordFilename, Header);
+
+		// The ghost of the run goes next to the recording, keyed from the same state
+		if (InputRecorder.IsValid())
+		{
+			GhostRecorder = MakeUnique<FKZGhostRecorder>(FPaths::ChangeExtension(PendingRecordFilename, TEXT("kzg")), GhostKeyInterval);
+			GhostRecordStartTime = GetWorld()->GetTimeSeconds();
+			GhostRecorder->Sample(0.f, Header.Location, Header.ControlRotation);
+		}
+		PendingRecordFilename.Empty();
+		RecordFrame = FKZInputFrame();
+	}
+
+	if (InputReplay.IsValid())
 	{
-		fSyncRate = 0.;
+		if (!InputReplay->ReadFrame(ReplayFrame))
+		{
+			KZReplayStop();
+			return;
+		}
+	}
+	else if (!PendingReplayFilename.IsEmpty())
+	{
+		InputReplay = FKZInputReplay::Open(PendingReplayFilename);
+		PendingReplayFilename.Empty();
+		if (!InputReplay.IsValid())
+			return;
+
+		const FKZRecordingHeader& Header = InputReplay->GetHeader();
+		SetActorLocation(Header.Location, false, nullptr, ETeleportType::TeleportPhysics);
+		if (Controller)
+			Controller->SetControlRotation(Header.ControlRotation);
+		MovementComponent->Velocity = Header.Velocity;
+		MovementComponent->ResetStrafe(Header.StrafeSpeed);
+
+		if (!InputReplay->ReadFrame(ReplayFrame))
+		{
+			KZReplayStop();
+			return;
+		}
 	}
 	else
 	{
-		fSyncRate = fSynRateNumerator / fSynRateDenominator;
+		return;
 	}
 
-	if (GEngine && bPrintSpeed)
+	// The frame just read is the next one, run it with its recorded frame time
+	if (bReplayRecordedFrameTimes)
 	{
-		// Display speed in cm/s or inch/s
-		GEngine->AddOnScreenDebugMessage(-1, -1.f, FColor::FColor(0,255,255), FString::Printf(TEXT("Speed: %.2f units/s"), MovementComponent->Velocity.Size2D() / fInch2centimeterFactor));
+		if (!bReplayFrameTimeApplied)
+		{
+			bReplayFrameTimeApplied = true;
+			bSavedUseFixedTimeStep = FApp::UseFixedTimeStep();
+			SavedFixedDeltaTime = FApp::GetFixedDeltaTime();
+		}
+		FApp::SetUseFixedTimeStep(true);
+		FApp::SetFixedDeltaTime(ReplayFrame.DeltaTime);
 	}
-}
\ No newline at end of file
+}
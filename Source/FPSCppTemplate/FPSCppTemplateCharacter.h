@@ -6,7 +6,11 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Character.h"
-#include "GameFramework/CharacterMovementComponent.h"
+#include "KZStrafeSimulation.h"
+#include "KZStrafeTelemetry.h"
+#include "KZInputRecorder.h"
+#include "KZGhost.h"
+#include "KZCharacterMovementComponent.h"
 #include "FPSCppTemplateCharacter.generated.h"
 
 class UInputComponent;
@@ -16,6 +20,12 @@ class AFPSCppTemplateCharacter : public ACharacter
 {
 	GENERATED_BODY()
 
+	/** Drives the protected input functions in scripted performance runs */
+	friend class AKZBenchmark;
+
+	/** Carries the character through the portal a server teleport event says it missed */
+	friend class UKZCharacterMovementComponent;
+
 	/** Pawn mesh: 1st person view (arms; seen only by self) */
 	UPROPERTY(VisibleDefaultsOnly, Category=Mesh)
 	class USkeletalMeshComponent* Mesh1P;
@@ -48,8 +58,12 @@ class AFPSCppTemplateCharacter : public ACharacter
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
 	class UMotionControllerComponent* L_MotionController;
 
+	/** Footstep, jump and landing sounds by surface */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Audio, meta = (AllowPrivateAccess = "true"))
+	class UKZFootstepComponent* Footsteps;
+
 public:
-	AFPSCppTemplateCharacter();
+	AFPSCppTemplateCharacter(const FObjectInitializer& ObjectInitializer);
 
 	// Begin AActor overrides
 	virtual void BeginPlay() override;
@@ -74,6 +88,10 @@ public:
 	UPROPERTY(EditDefaultsOnly, Category=Projectile)
 	TSubclassOf<class AFPSCppTemplateProjectile> ProjectileClass;
 
+	/** Fire projectiles simulated in bulk by AProjectileBatchManager instead of projectile actors */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category=Projectile)
+	bool bUseLightweightProjectiles = false;
+
 	/** Sound to play each time we fire */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category=Gameplay)
 	class USoundBase* FireSound;
@@ -113,6 +131,92 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Jump")
 	bool EnableAutoMoveForward = false;
 
+	/** Rate of the fixed step strafe simulation, in steps per second. Speed gain and sync rate do not depend on the frame rate */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Jump", meta = (ClampMin = "1"))
+	float fStrafeStepRate = 120.f;
+
+	/** Turn input per second at which a strafe starts to gain speed (0.99 per frame at 60 fps) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Jump")
+	float fMinSyncTurnSpeed = .99f * 60.f;
+
+	/** Turn input per second above which a strafe no longer gains speed (10 per frame at 60 fps) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Jump")
+	float fMaxSyncTurnSpeed = 10.f * 60.f;
+
+	/** Collects per-jump strafe statistics on a worker thread, for the locally controlled character */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Telemetry")
+	bool bStrafeTelemetry = false;
+
+	/** Number of recent jumps WindowJumpStats covers */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Telemetry", meta = (ClampMin = "1"))
+	int32 StrafeTelemetryWindow = 10;
+
+	/** Also appends every jump to Saved/KZTelemetry/<date>.csv */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Telemetry")
+	bool bSaveStrafeTelemetry = false;
+
+	/** Strafe statistics of the last finished jump */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	FKZJumpStats LastJumpStats;
+
+	/** Strafe statistics of the last StrafeTelemetryWindow jumps */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	FKZJumpStats WindowJumpStats;
+
+	/** Detect portal crossings natively by sweeping each move against the portal planes. TeleportActor calls for a portal the sweep crossed this or the last frame are ignored while set */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal")
+	bool bUseSweptPortalCrossing = true;
+
+	/** Maximum number of chained portal crossings handled within a single move */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal")
+	int32 MaxPortalCrossingsPerMove = 4;
+
+	/** Replays run every frame with the frame time it was recorded with, so the movement matches the recording */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Replay")
+	bool bReplayRecordedFrameTimes = true;
+
+	/** Seconds between two keys of the ghost recorded with a run, teleports always add keys */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "KZ Replay")
+	float GhostKeyInterval = 1.f / 30.f;
+
+	/** Starts recording the KZ inputs to Saved/KZRuns/<Name>.kzr, and its ghost to <Name>.kzg, from the next frame */
+	UFUNCTION(Exec, BlueprintCallable, Category = "KZ Replay")
+	void KZRecordStart(const FString& Name);
+
+	UFUNCTION(Exec, BlueprintCallable, Category = "KZ Replay")
+	void KZRecordStop();
+
+	/** Moves the character to the start of Saved/KZRuns/<Name>.kzr and feeds the recorded inputs in place of the live ones */
+	UFUNCTION(Exec, BlueprintCallable, Category = "KZ Replay")
+	void KZReplayStart(const FString& Name);
+
+	UFUNCTION(Exec, BlueprintCallable, Category = "KZ Replay")
+	void KZReplayStop();
+
+	UFUNCTION(BlueprintPure, Category = "KZ Replay")
+	bool IsReplayingInput() const { return InputReplay.IsValid(); }
+
+	/** Starts timing a run, called by the start trigger of the map */
+	UFUNCTION(BlueprintCallable, Category = "KZ Run")
+	void KZRunStart();
+
+	/** Records the time of the next split, called by the checkpoint triggers of the map */
+	UFUNCTION(BlueprintCallable, Category = "KZ Run")
+	void KZRunSplit();
+
+	/** Stops the timer and stores the run on the server, returns the run time or a negative value if no run was timed */
+	UFUNCTION(BlueprintCallable, Category = "KZ Run")
+	float KZRunFinish();
+
+	UFUNCTION(BlueprintPure, Category = "KZ Run")
+	bool IsKZRunActive() const { return KZRunStartTime >= 0.f; }
+
+	/** Player the runs are stored for: the online id, or "Local" without one */
+	FString GetKZPlayerId() const;
+
+	/** Strafe settings from the "KZ Jump" properties */
+	FKZStrafeSettings GetKZStrafeSettings() const;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Screen Debug")
 	bool bPrintTeleport = false;
 
@@ -122,13 +226,68 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Screen Debug")
 	bool bPrintTurnRate = false;
 
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Screen Debug")
+	bool bPrintJumpStats = false;
+
 protected:
 
 	UFUNCTION(BlueprintCallable, Category = "BPI Teleport CPP")
 	void TeleportActor(const APortalC* TeleportTo, const APortalC* TeleportFrom);
 
-	AController* PlayerController;
-	UCharacterMovementComponent* MovementComponent;
+	/** Moves the actor to NewLocation and remaps control rotation and velocity from TeleportFrom to TeleportTo */
+	void TeleportThroughPortal(const APortalC* TeleportTo, const APortalC* TeleportFrom, const FVector& NewLocation);
+
+	/** Runs after every CharacterMovement update, sweeps the move against the portals */
+	UFUNCTION()
+	void OnKZMovementUpdated(float DeltaSeconds, FVector OldLocation, FVector OldVelocity);
+
+	/** Teleports through every portal the segment Start->End crosses, in order */
+	void UpdatePortalCrossings(FVector Start, FVector End);
+
+	/** Portals the swept crossings of SweptCrossingFrame entered, only compared against, never dereferenced */
+	TArray<const APortalC*, TInlineAllocator<4>> SweptCrossingEntries;
+	uint64 SweptCrossingFrame = 0;
+
+	UKZCharacterMovementComponent* MovementComponent;
+
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/** Records Value for the current frame, or returns the replayed value in its place while a replay runs */
+	float RecordOrReplayAxis(EKZInputAxis Axis, float Value);
+
+	/** Writes the current frame, reads the next replayed one and starts pending recordings and replays. Called at the end of Tick */
+	void UpdateInputRecording(float DeltaSeconds);
+
+	/** Runs the portal teleports of the replayed frame */
+	void ApplyReplayTeleports();
+
+	/** Portal of the replay named Name, the portals of the world are mapped by name the first time one is not found */
+	const APortalC* FindReplayPortal(FName Name);
+
+	static FString GetKZRunFilename(const FString& Name);
+
+	TUniquePtr<FKZInputRecorder> InputRecorder;
+	TUniquePtr<FKZInputReplay> InputReplay;
+	TUniquePtr<FKZGhostRecorder> GhostRecorder;
+	/** World time the ghost recording started at */
+	float GhostRecordStartTime = 0.f;
+	FString PendingRecordFilename;
+	FString PendingReplayFilename;
+	FKZInputFrame RecordFrame;
+	FKZInputFrame ReplayFrame;
+	TMap<FName, TWeakObjectPtr<const APortalC>> ReplayPortals;
+
+	/** World time the timed run started at, negative if none, and the time of each split since */
+	float KZRunStartTime = -1.f;
+	TArray<float> KZRunSplits;
+
+	/** Engine frame time settings to restore after a replay, saved when it first runs a recorded frame time */
+	bool bReplayFrameTimeApplied = false;
+	bool bSavedUseFixedTimeStep = false;
+	double SavedFixedDeltaTime = 0.;
+
+	/** Gives the engine back the frame time settings a replay replaced, if it did */
+	void RestoreReplayFrameTime();
 
 	/** Custom Jump Function with Axis Binding*/
 	UFUNCTION(BlueprintCallable, Category = "KZ Jump")
@@ -142,9 +301,11 @@ protected:
 	/** Reset Sync Rate to 0. */
 	UFUNCTION(BlueprintCallable, Category = "KZ Jump")
 	void ResetSyncRate();
-	
-	float fSynRateNumerator = 0.;
-	float fSynRateDenominator = 0.;
+
+	/** Starts or stops the strafe telemetry to match bStrafeTelemetry and picks up the jumps it finished */
+	void UpdateStrafeTelemetry();
+
+	TUniquePtr<FKZStrafeTelemetry> StrafeTelemetry;
 
 	/** Fires a projectile. */
 	void OnFire();
@@ -209,6 +370,8 @@ public:
 	FORCEINLINE class USkeletalMeshComponent* GetMesh1P() const { return Mesh1P; }
 	/** Returns FirstPersonCameraComponent subobject **/
 	FORCEINLINE class UCameraComponent* GetFirstPersonCameraComponent() const { return FirstPersonCameraComponent; }
+	/** Returns Footsteps subobject **/
+	FORCEINLINE class UKZFootstepComponent* GetFootsteps() const { return Footsteps; }
 
 };
 
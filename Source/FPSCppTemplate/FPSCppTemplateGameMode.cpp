@@ -3,15 +3,28 @@
 #include "FPSCppTemplateGameMode.h"
 #include "FPSCppTemplateHUD.h"
 #include "FPSCppTemplateCharacter.h"
-#include "UObject/ConstructorHelpers.h"
+#include "KZAssetLoader.h"
+#include "GameFramework/DefaultPawn.h"
 
 AFPSCppTemplateGameMode::AFPSCppTemplateGameMode()
 	: Super()
 {
 	// set default pawn class to our Blueprinted character
-	static ConstructorHelpers::FClassFinder<APawn> PlayerPawnClassFinder(TEXT("/Game/MyFirstPerson/Blueprints/FPSCharacter"));
-	DefaultPawnClass = PlayerPawnClassFinder.Class;
+	PlayerPawnClass = TSoftClassPtr<APawn>(FSoftObjectPath(TEXT("/Game/MyFirstPerson/Blueprints/FPSCharacter.FPSCharacter_C")));
 
 	// use our custom HUD class
 	HUDClass = AFPSCppTemplateHUD::StaticClass();
 }
+
+void AFPSCppTemplateGameMode::InitGame(const FString& MapName, const FString& Options, FString& ErrorMessage)
+{
+	Super::InitGame(MapName, Options, ErrorMessage);
+
+	// Resolved while the map loads, before the first player spawns. Free after the main menu preloaded it, otherwise it waits
+	// for the preload the map load started
+	if (DefaultPawnClass == ADefaultPawn::StaticClass())
+	{
+		if (UClass* PawnClass = FKZAssetLoader::Get().LoadSynchronous(PlayerPawnClass))
+			DefaultPawnClass = PawnClass;
+	}
+}
@@ -13,6 +13,12 @@ class AFPSCppTemplateGameMode : public AGameModeBase
 
 public:
 	AFPSCppTemplateGameMode();
+
+	/** Pawn spawned for the players unless a subclass sets DefaultPawnClass, preloaded by the main menu */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = Classes)
+	TSoftClassPtr<APawn> PlayerPawnClass;
+
+	virtual void InitGame(const FString& MapName, const FString& Options, FString& ErrorMessage) override;
 };
 
 
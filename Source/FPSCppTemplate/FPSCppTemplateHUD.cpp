@@ -5,13 +5,28 @@
 #include "Engine/Texture2D.h"
 #include "TextureResource.h"
 #include "CanvasItem.h"
-#include "UObject/ConstructorHelpers.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "KZAssetLoader.h"
 
 AFPSCppTemplateHUD::AFPSCppTemplateHUD()
 {
 	// Set the crosshair texture
-	static ConstructorHelpers::FObjectFinder<UTexture2D> CrosshairTexObj(TEXT("/Game/FirstPerson/Textures/FirstPersonCrosshair"));
-	CrosshairTex = CrosshairTexObj.Object;
+	CrosshairTexture = TSoftObjectPtr<UTexture2D>(FSoftObjectPath(TEXT("/Game/FirstPerson/Textures/FirstPersonCrosshair.FirstPersonCrosshair")));
+	CrosshairTex = nullptr;
+}
+
+void AFPSCppTemplateHUD::BeginPlay()
+{
+	Super::BeginPlay();
+
+	// Already in memory when the main menu preloaded it
+	FKZAssetLoader::Get().RequestAsyncLoad(CrosshairTexture.ToSoftObjectPath(), FStreamableDelegate::CreateUObject(this, &AFPSCppTemplateHUD::OnCrosshairLoaded));
+}
+
+void AFPSCppTemplateHUD::OnCrosshairLoaded()
+{
+	CrosshairTex = CrosshairTexture.Get();
 }
 
 
@@ -29,7 +44,29 @@ void AFPSCppTemplateHUD::DrawHUD()
 										   (Center.Y + 20.0f));
 
 	// draw the crosshair
-	FCanvasTileItem TileItem( CrosshairDrawPosition, CrosshairTex->Resource, FLinearColor::White);
-	TileItem.BlendMode = SE_BLEND_Translucent;
-	Canvas->DrawItem( TileItem );
+	if (CrosshairTex)
+	{
+		FCanvasTileItem TileItem( CrosshairDrawPosition, CrosshairTex->Resource, FLinearColor::White);
+		TileItem.BlendMode = SE_BLEND_Translucent;
+		Canvas->DrawItem( TileItem );
+	}
+
+	if (bShowFrameTimeGraph)
+		DebugOverlay.AddGraphSample(EKZDebugGraph::FrameTime, RenderDelta * 1000.f);
+	DebugOverlay.Draw(Canvas, DebugOverlayPosition.X, DebugOverlayPosition.Y);
+}
+
+FKZDebugOverlay* AFPSCppTemplateHUD::GetDebugOverlay(UWorld* World)
+{
+	APlayerController* PlayerController = World ? World->GetFirstPlayerController() : nullptr;
+	if (PlayerController == nullptr)
+		return nullptr;
+
+	AFPSCppTemplateHUD* HUD = Cast<AFPSCppTemplateHUD>(PlayerController->GetHUD());
+	if (HUD)
+		return &HUD->DebugOverlay;
+
+	// Another HUD class draws nothing of ours, the text goes to the engine on-screen messages like it did before the overlay
+	static FKZDebugOverlay OnScreenMessages(true);
+	return &OnScreenMessages;
 }
@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/HUD.h"
+#include "KZDebugOverlay.h"
 #include "FPSCppTemplateHUD.generated.h"
 
 UCLASS()
@@ -14,12 +15,37 @@ class AFPSCppTemplateHUD : public AHUD
 public:
 	AFPSCppTemplateHUD();
 
+	/** Crosshair drawn in the middle of the screen, streamed in on BeginPlay, nothing is drawn until it is in */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "HUD")
+	TSoftObjectPtr<class UTexture2D> CrosshairTexture;
+
 	/** Primary draw call for the HUD */
 	virtual void DrawHUD() override;
 
+	/**
+	 * Screen debug overlay of the first local player, nullptr without one (e.g. on a dedicated server).
+	 * Players with another HUD class get an overlay forwarding to the engine on-screen debug messages
+	 */
+	static FKZDebugOverlay* GetDebugOverlay(UWorld* World);
+
+	/** Draws a rolling graph of the frame time in the debug overlay */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Screen Debug")
+	bool bShowFrameTimeGraph = false;
+
+	/** Top left corner of the debug overlay */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Screen Debug")
+	FVector2D DebugOverlayPosition = FVector2D(32.f, 96.f);
+
 private:
+	virtual void BeginPlay() override;
+
+	void OnCrosshairLoaded();
+
 	/** Crosshair asset pointer */
+	UPROPERTY(Transient)
 	class UTexture2D* CrosshairTex;
 
+	FKZDebugOverlay DebugOverlay;
+
 };
 
@@ -1,8 +1,14 @@
 // Copyright 1998-2018 Epic Games, Inc. All Rights Reserved.
 
 #include "FPSCppTemplateProjectile.h"
+#include "FPSCppTemplate.h"
 #include "GameFramework/ProjectileMovementComponent.h"
 #include "Components/SphereComponent.h"
+#include "ProjectilePool.h"
+#include "PortalC.h"
+#include "PortalPhysicsManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("Projectile Hit"), STAT_ProjectileHit, STATGROUP_Projectile);
 
 AFPSCppTemplateProjectile::AFPSCppTemplateProjectile() 
 {
@@ -33,11 +39,94 @@ AFPSCppTemplateProjectile::AFPSCppTemplateProjectile()
 
 void AFPSCppTemplateProjectile::OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit)
 {
+	FPS_SCOPE_CYCLE_COUNTER(Projectile, STAT_ProjectileHit);
+
 	// Only add impulse and destroy projectile if we hit a physics
 	if ((OtherActor != NULL) && (OtherActor != this) && (OtherComp != NULL) && OtherComp->IsSimulatingPhysics())
 	{
 		OtherComp->AddImpulseAtLocation(GetVelocity() * 100.0f, GetActorLocation());
+		// Bodies that started simulating after they spawned are not known to the portals yet
+		if (APortalPhysicsManager* PhysicsManager = APortalPhysicsManager::Get(GetWorld(), false))
+			PhysicsManager->AddBody(OtherComp);
+
+		ReturnToPool();
+	}
+}
 
+void AFPSCppTemplateProjectile::LifeSpanExpired()
+{
+	if (OwningPool.IsValid())
+	{
+		ReturnToPool();
+		return;
+	}
+	Super::LifeSpanExpired();
+}
+
+void AFPSCppTemplateProjectile::FellOutOfWorld(const UDamageType& DamageType)
+{
+	if (OwningPool.IsValid())
+	{
+		ReturnToPool();
+		return;
+	}
+	Super::FellOutOfWorld(DamageType);
+}
+
+void AFPSCppTemplateProjectile::ReturnToPool()
+{
+	if (OwningPool.IsValid())
+	{
+		OwningPool->Release(this);
+	}
+	else
+	{
 		Destroy();
 	}
-}
\ No newline at end of file
+}
+
+void AFPSCppTemplateProjectile::ActivateProjectile(const FVector& Location, const FRotator& Rotation)
+{
+	bProjectileActive = true;
+	SetActorLocationAndRotation(Location, Rotation, false, nullptr, ETeleportType::TeleportPhysics);
+	SetActorHiddenInGame(false);
+	SetActorEnableCollision(true);
+
+	// StopSimulating may have detached the movement from the sphere
+	ProjectileMovement->SetUpdatedComponent(CollisionComp);
+	ProjectileMovement->Velocity = Rotation.Vector() * ProjectileMovement->InitialSpeed;
+	ProjectileMovement->UpdateComponentVelocity();
+	ProjectileMovement->SetActive(true);
+
+	// Die after the default life span again
+	SetLifeSpan(GetDefault<AFPSCppTemplateProjectile>(GetClass())->InitialLifeSpan);
+}
+
+void AFPSCppTemplateProjectile::DeactivateProjectile()
+{
+	bProjectileActive = false;
+	SetLifeSpan(0.f);
+	ProjectileMovement->StopMovementImmediately();
+	ProjectileMovement->SetActive(false);
+	SetActorEnableCollision(false);
+	SetActorHiddenInGame(true);
+}
+
+void AFPSCppTemplateProjectile::TeleportThroughPortal(const APortalC* TeleportFrom, const FVector& HitLocation)
+{
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalTeleport);
+
+	// Same cached From->To matrix the character teleport uses
+	const APortalC* TeleportTo = TeleportFrom->PortalToCPP;
+	const FMatrix& PortalPairMatrix = TeleportFrom->GetPortalPairMatrix(TeleportTo);
+
+	// Come out one radius in front of the destination so the sphere does not touch the exit surface
+	const FVector NewLocation = PortalPairMatrix.TransformPosition(HitLocation) + TeleportTo->X * CollisionComp->GetScaledSphereRadius();
+	FMatrix Rotation = PortalPairMatrix;
+	Rotation.RemoveTranslation();
+	const FRotator NewRotation = (FRotationMatrix(GetActorRotation()) * Rotation).Rotator();
+	SetActorLocationAndRotation(NewLocation, NewRotation, false, nullptr, ETeleportType::TeleportPhysics);
+
+	ProjectileMovement->Velocity = PortalPairMatrix.TransformVector(ProjectileMovement->Velocity);
+	ProjectileMovement->UpdateComponentVelocity();
+}
@@ -26,6 +26,37 @@ public:
 	UFUNCTION()
 	void OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit);
 
+	/** Puts a pooled projectile back into play at Location/Rotation, flying at InitialSpeed */
+	void ActivateProjectile(const FVector& Location, const FRotator& Rotation);
+
+	/** Hides the projectile and stops its collision, movement and life span until it is activated again */
+	void DeactivateProjectile();
+
+	/** Hands the projectile back to its pool, or destroys it if it was not pooled */
+	void ReturnToPool();
+
+	FORCEINLINE bool IsProjectileActive() const { return bProjectileActive; }
+
+	/** Moves the projectile from HitLocation on TeleportFrom's opening to the linked portal, remapping rotation and velocity */
+	void TeleportThroughPortal(const class APortalC* TeleportFrom, const FVector& HitLocation);
+
+	/** Pool this projectile was spawned by, nullptr for projectiles spawned directly */
+	TWeakObjectPtr<class AProjectilePool> OwningPool;
+
+	/** False for projectiles spawned past the pool size, they are destroyed when they expire */
+	bool bPooled = false;
+
+	/** Slot in the pool's active list, INDEX_NONE while inactive */
+	int32 ActiveIndex = INDEX_NONE;
+
+protected:
+	virtual void LifeSpanExpired() override;
+	virtual void FellOutOfWorld(const class UDamageType& DamageType) override;
+
+	bool bProjectileActive = true;
+
+public:
+
 	/** Returns CollisionComp subobject **/
 	FORCEINLINE class USphereComponent* GetCollisionComp() const { return CollisionComp; }
 	/** Returns ProjectileMovement subobject **/
@@ -0,0 +1,43 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "GameFramework/WorldSettings.h"
+
+/**
+ * Empty game world for the automation tests, playing for as long as the object lives.
+ * Actors spawned into it begin play right away. It has no game mode, tests tick the actors they look at themselves
+ */
+class FFPSTestWorld
+{
+public:
+	FFPSTestWorld()
+	{
+		World = UWorld::CreateWorld(EWorldType::Game, false);
+		FWorldContext& Context = GEngine->CreateNewWorldContext(EWorldType::Game);
+		Context.SetCurrentWorld(World);
+
+		World->InitializeActorsForPlay(FURL());
+		World->GetWorldSettings()->NotifyBeginPlay();
+	}
+
+	~FFPSTestWorld()
+	{
+		GEngine->DestroyWorldContext(World);
+		World->DestroyWorld(false);
+	}
+
+	UWorld* operator->() const { return World; }
+	UWorld* Get() const { return World; }
+
+private:
+	UWorld* World;
+};
+
+#endif
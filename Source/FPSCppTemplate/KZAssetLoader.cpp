@@ -0,0 +1,188 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZAssetLoader.h"
+#include "FPSCppTemplate.h"
+#include "FPSCppTemplateGameMode.h"
+#include "FPSCppTemplateHUD.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/CommandLine.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/CoreDelegates.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZAssetLoader, Log, All);
+
+FKZAssetLoader* FKZAssetLoader::Instance = nullptr;
+
+FKZAssetLoader::FKZAssetLoader()
+	: PreloadStartTime(-1.)
+	, PreloadEndTime(-1.)
+	, NumPreloadAssets(0)
+{
+	TickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FKZAssetLoader::Tick));
+	ExitHandle = FCoreDelegates::OnPreExit.AddLambda([]()
+	{
+		delete Instance;
+		Instance = nullptr;
+	});
+}
+
+FKZAssetLoader::~FKZAssetLoader()
+{
+	if (PreloadHandle.IsValid())
+		PreloadHandle->ReleaseHandle();
+	FTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+	FCoreDelegates::OnPreExit.Remove(ExitHandle);
+}
+
+FKZAssetLoader& FKZAssetLoader::Get()
+{
+	check(IsInGameThread());
+	if (Instance == nullptr)
+		Instance = new FKZAssetLoader();
+	return *Instance;
+}
+
+void FKZAssetLoader::OnPreLoadMap(const FString& MapName)
+{
+	// The editor loads maps for editing through here too
+	if (!GIsEditor)
+		Get().PreloadStartupAssets();
+}
+
+void FKZAssetLoader::OnPostLoadMap(UWorld* World)
+{
+	if (World && World->IsGameWorld())
+		Get().PreloadStartupAssets();
+}
+
+void FKZAssetLoader::RequestAsyncLoad(const FSoftObjectPath& Path, FStreamableDelegate Delegate)
+{
+	if (Path.IsNull() || Path.ResolveObject())
+	{
+		Delegate.ExecuteIfBound();
+		return;
+	}
+
+	// The manager keeps the load going until the delegate ran, the caller holds on to the asset from there
+	StreamableManager.RequestAsyncLoad(Path, Delegate);
+}
+
+void FKZAssetLoader::RequestAsyncLoad(const TArray<FSoftObjectPath>& Paths, FStreamableDelegate Delegate)
+{
+	TArray<FSoftObjectPath> PendingPaths;
+	for (const FSoftObjectPath& Path : Paths)
+	{
+		if (!Path.IsNull() && Path.ResolveObject() == nullptr)
+			PendingPaths.AddUnique(Path);
+	}
+
+	if (PendingPaths.Num() == 0)
+	{
+		Delegate.ExecuteIfBound();
+		return;
+	}
+
+	StreamableManager.RequestAsyncLoad(PendingPaths, Delegate);
+}
+
+UObject* FKZAssetLoader::LoadSynchronous(const FSoftObjectPath& Path)
+{
+	if (Path.IsNull())
+		return nullptr;
+
+	UObject* Object = Path.ResolveObject();
+	if (Object == nullptr)
+	{
+		UE_LOG(LogKZAssetLoader, Log, TEXT("%s was not preloaded, loading it synchronously"), *Path.ToString());
+		Object = StreamableManager.LoadSynchronous(Path);
+	}
+	return Object;
+}
+
+TArray<FSoftObjectPath> FKZAssetLoader::GetStartupAssets() const
+{
+	TArray<FSoftObjectPath> Assets;
+	Assets.AddUnique(GetDefault<AFPSCppTemplateHUD>()->CrosshairTexture.ToSoftObjectPath());
+	Assets.AddUnique(GetDefault<AFPSCppTemplateGameMode>()->PlayerPawnClass.ToSoftObjectPath());
+
+	// The game mode Blueprint the playable maps run on, its hard references to the pawn and HUD come with it
+	FString DefaultGameMode;
+	if (GConfig->GetString(TEXT("/Script/EngineSettings.GameMapsSettings"), TEXT("GlobalDefaultGameMode"), DefaultGameMode, GEngineIni))
+		Assets.AddUnique(FSoftObjectPath(DefaultGameMode));
+
+	// Blueprints and assets only the content refers to
+	TArray<FString> ConfigAssets;
+	GConfig->GetArray(TEXT("/Script/FPSCppTemplate.KZAssetLoader"), TEXT("PreloadAssets"), ConfigAssets, GGameIni);
+	for (const FString& Asset : ConfigAssets)
+		Assets.AddUnique(FSoftObjectPath(Asset));
+
+	Assets.RemoveAll([](const FSoftObjectPath& Asset) { return Asset.IsNull(); });
+	return Assets;
+}
+
+void FKZAssetLoader::PreloadStartupAssets()
+{
+	if (PreloadStartTime >= 0. || FParse::Param(FCommandLine::Get(), TEXT("KZNoAssetPreload")))
+		return;
+
+	const TArray<FSoftObjectPath> Assets = GetStartupAssets();
+	PreloadStartTime = FPlatformTime::Seconds() - GStartTime;
+	NumPreloadAssets = Assets.Num();
+	if (Assets.Num() == 0)
+	{
+		PreloadEndTime = PreloadStartTime;
+		return;
+	}
+
+	// The handle is kept, so the assets stay loaded between maps
+	PreloadHandle = StreamableManager.RequestAsyncLoad(Assets, FStreamableDelegate::CreateRaw(this, &FKZAssetLoader::OnStartupAssetsLoaded),
+		FStreamableManager::AsyncLoadHighPriority);
+}
+
+void FKZAssetLoader::OnStartupAssetsLoaded()
+{
+	PreloadEndTime = FPlatformTime::Seconds() - GStartTime;
+	UE_LOG(LogKZAssetLoader, Log, TEXT("%d startup assets preloaded in %.3f s"), NumPreloadAssets, PreloadEndTime - PreloadStartTime);
+}
+
+bool FKZAssetLoader::Tick(float DeltaTime)
+{
+	// First frame a local player controls a pawn
+	for (const FWorldContext& Context : GEngine->GetWorldContexts())
+	{
+		UWorld* World = Context.World();
+		APlayerController* PlayerController = (World && World->IsGameWorld()) ? World->GetFirstPlayerController() : nullptr;
+		if (PlayerController == nullptr || !PlayerController->IsLocalController() || PlayerController->GetPawn() == nullptr)
+			continue;
+
+		const double FirstPlayableTime = FPlatformTime::Seconds() - GStartTime;
+		UE_LOG(LogKZAssetLoader, Display, TEXT("First playable frame %.3f s after the launch, in %s"), FirstPlayableTime, *World->GetMapName());
+		if (FParse::Param(FCommandLine::Get(), TEXT("KZStartupTiming")))
+			FinishStartupTiming(FirstPlayableTime);
+
+		TickerHandle.Reset();
+		return false;
+	}
+	return true;
+}
+
+void FKZAssetLoader::FinishStartupTiming(double FirstPlayableTime)
+{
+	FString Report = TEXT("Metric,Seconds\n");
+	Report += FString::Printf(TEXT("FirstPlayableFrame,%.4f\n"), FirstPlayableTime);
+	Report += FString::Printf(TEXT("PreloadStart,%.4f\n"), PreloadStartTime);
+	Report += FString::Printf(TEXT("PreloadEnd,%.4f\n"), PreloadEndTime);
+
+	const FString Filename = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Benchmarks"), FString::Printf(TEXT("KZStartup-%s.csv"), *FDateTime::Now().ToString()));
+	if (FFileHelper::SaveStringToFile(Report, *Filename))
+		UE_LOG(LogKZAssetLoader, Display, TEXT("Startup timing report written to %s"), *Filename);
+	else
+		UE_LOG(LogKZAssetLoader, Error, TEXT("Could not write startup timing report %s"), *Filename);
+
+	FPlatformMisc::RequestExit(false);
+}
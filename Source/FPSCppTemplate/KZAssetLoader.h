@@ -0,0 +1,87 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "Engine/StreamableManager.h"
+
+class UWorld;
+
+/**
+ * Loads the soft referenced defaults of the game (HUD and game mode assets, portal meshes in the editor) through one streamable manager.
+ * The load of the first map starts them streaming in the background, next to the map package, and keeps them loaded, so the
+ * first playable map finds them in memory. Besides the native defaults this preloads the global default game mode Blueprint,
+ * which pulls in the pawn and HUD Blueprints it refers to, while the main menu runs on its own game mode. Requests for an asset already loading share its load, a synchronous load of one waits for that load
+ * instead of starting its own.
+ * Also measures the startup: the time from launch to the first frame a local player controls a pawn is logged, and with the
+ * -KZStartupTiming switch written to a CSV report under Saved/Benchmarks before the game quits, e.g.
+ * UE4Editor FPSCppTemplate -game -KZStartupTiming [-KZNoAssetPreload]
+ * The FPSCppTemplate.Startup.Preload automation test opens the game default map and fails if it does not play with every
+ * startup asset in memory within MaxStartupSeconds of the KZAssetLoader config.
+ */
+class FPSCPPTEMPLATE_API FKZAssetLoader
+{
+public:
+	static FKZAssetLoader& Get();
+
+	/** Loads Path in the background and calls Delegate on the game thread once it is in, right away if it already is */
+	void RequestAsyncLoad(const FSoftObjectPath& Path, FStreamableDelegate Delegate);
+
+	/** Loads Paths in the background and calls Delegate once all of them are in, right away if they already are */
+	void RequestAsyncLoad(const TArray<FSoftObjectPath>& Paths, FStreamableDelegate Delegate);
+
+	/** Returns the asset of Path, loading it now if it is neither loaded nor preloaded yet */
+	UObject* LoadSynchronous(const FSoftObjectPath& Path);
+
+	template<typename T>
+	T* LoadSynchronous(const TSoftObjectPtr<T>& Asset)
+	{
+		return Cast<T>(LoadSynchronous(Asset.ToSoftObjectPath()));
+	}
+
+	template<typename T>
+	UClass* LoadSynchronous(const TSoftClassPtr<T>& Class)
+	{
+		return Cast<UClass>(LoadSynchronous(Class.ToSoftObjectPath()));
+	}
+
+	/** Starts streaming the startup assets in, once. They stay loaded for the rest of the game */
+	void PreloadStartupAssets();
+
+	FORCEINLINE bool IsPreloadFinished() const { return PreloadEndTime >= 0.; }
+
+	/** Soft references of the native class defaults, the default game mode and the PreloadAssets of the config */
+	TArray<FSoftObjectPath> GetStartupAssets() const;
+
+	/** Called before every map load, the first one in a game starts the preload */
+	static void OnPreLoadMap(const FString& MapName);
+
+	/** Called for every loaded map, starts the preload for game worlds the editor plays without loading a map */
+	static void OnPostLoadMap(UWorld* World);
+
+private:
+	FKZAssetLoader();
+	~FKZAssetLoader();
+
+	void OnStartupAssetsLoaded();
+
+	/** Waits for the first playable frame */
+	bool Tick(float DeltaTime);
+
+	/** Writes the -KZStartupTiming report and quits */
+	void FinishStartupTiming(double FirstPlayableTime);
+
+	FStreamableManager StreamableManager;
+	TSharedPtr<FStreamableHandle> PreloadHandle;
+
+	/** Seconds since the launch, negative until it happened */
+	double PreloadStartTime;
+	double PreloadEndTime;
+	int32 NumPreloadAssets;
+
+	FDelegateHandle TickerHandle;
+	FDelegateHandle ExitHandle;
+
+	static FKZAssetLoader* Instance;
+};
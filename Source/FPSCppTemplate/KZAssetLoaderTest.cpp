@@ -0,0 +1,64 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZAssetLoader.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/PackageName.h"
+#include "Tests/AutomationCommon.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "HAL/PlatformTime.h"
+
+/** Waits for the opened map to play with every startup asset in memory, failing after MaxSeconds */
+DEFINE_LATENT_AUTOMATION_COMMAND_THREE_PARAMETER(FKZWaitForStartupAssetsCommand, FAutomationTestBase*, Test, double, StartTime, float, MaxSeconds);
+
+bool FKZWaitForStartupAssetsCommand::Update()
+{
+	bool bPlaying = false;
+	for (const FWorldContext& Context : GEngine->GetWorldContexts())
+	{
+		if (Context.WorldType == EWorldType::Game && Context.World() && Context.World()->HasBegunPlay())
+			bPlaying = true;
+	}
+
+	FKZAssetLoader& Loader = FKZAssetLoader::Get();
+	const double Seconds = FPlatformTime::Seconds() - StartTime;
+	if (!bPlaying || !Loader.IsPreloadFinished())
+	{
+		if (Seconds <= MaxSeconds)
+			return false;
+
+		Test->AddError(FString::Printf(TEXT("%s after %.2f s, limit %.2f s"),
+			bPlaying ? TEXT("Startup assets still loading") : TEXT("Map not playing"), Seconds, MaxSeconds));
+		return true;
+	}
+
+	Test->AddInfo(FString::Printf(TEXT("Map playing with the startup assets in memory %.3f s after opening it, limit %.2f s"), Seconds, MaxSeconds));
+	for (const FSoftObjectPath& Asset : Loader.GetStartupAssets())
+		Test->TestNotNull(FString::Printf(TEXT("Preloaded %s"), *Asset.ToString()), Asset.ResolveObject());
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKZStartupPreloadTest, "FPSCppTemplate.Startup.Preload",
+	EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FKZStartupPreloadTest::RunTest(const FString& Parameters)
+{
+	FString Map;
+	GConfig->GetString(TEXT("/Script/EngineSettings.GameMapsSettings"), TEXT("GameDefaultMap"), Map, GEngineIni);
+	if (!TestFalse(TEXT("Game default map set"), Map.IsEmpty()))
+		return false;
+
+	float MaxSeconds = 10.f;
+	GConfig->GetFloat(TEXT("/Script/FPSCppTemplate.KZAssetLoader"), TEXT("MaxStartupSeconds"), MaxSeconds, GGameIni);
+
+	const double StartTime = FPlatformTime::Seconds();
+	AutomationOpenMap(FPackageName::ObjectPathToPackageName(Map));
+	ADD_LATENT_AUTOMATION_COMMAND(FKZWaitForStartupAssetsCommand(this, StartTime, MaxSeconds));
+	return true;
+}
+
+#endif
@@ -0,0 +1,666 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZBenchmark.h"
+#include "FPSCppTemplateCharacter.h"
+#include "KZGhost.h"
+#include "KZGhostManager.h"
+#include "PortalC.h"
+#include "PortalManager.h"
+#include "PortalPhysicsManager.h"
+#include "EngineUtils.h"
+#include "Algo/BinarySearch.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/CollisionProfile.h"
+#include "Engine/GameInstance.h"
+#include "Engine/LocalPlayer.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/StaticMeshActor.h"
+#include "GameFramework/GameModeBase.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/MemoryBase.h"
+#include "Kismet/GameplayStatics.h"
+#include "Misc/App.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Templates/TypeCompatibleBytes.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZBenchmark, Log, All);
+
+bool FKZBenchmarkRecorder::bRecording = false;
+uint64 FKZBenchmarkRecorder::GameThreadAllocations = 0;
+bool FKZBenchmarkRecorder::bCountingAllocations = false;
+uint64 FKZBenchmarkRecorder::FrameCycles[(int32)EKZBenchmarkSection::Num] = {};
+uint64 FKZBenchmarkRecorder::FrameAllocations[(int32)EKZBenchmarkSection::Num] = {};
+uint64 FKZBenchmarkRecorder::Footsteps = 0;
+uint64 FKZBenchmarkRecorder::PortalPhysicsTeleports = 0;
+
+static const TCHAR* KZBenchmarkSectionNames[(int32)EKZBenchmarkSection::Num] =
+{
+	TEXT("Frame"),
+	TEXT("PortalTick"),
+	TEXT("PortalCapture"),
+	TEXT("CharacterTick"),
+	TEXT("Fire"),
+	TEXT("ProjectilePool"),
+	TEXT("ProjectileBatch"),
+	TEXT("Footsteps"),
+	TEXT("PortalPhysics"),
+	TEXT("Ghosts"),
+	TEXT("DebugOverlay"),
+	TEXT("PortalQueries"),
+};
+
+/** Forwards to the engine allocator and counts the game thread allocations while a benchmark records */
+class FKZBenchmarkMallocProxy final : public FMalloc
+{
+public:
+	explicit FKZBenchmarkMallocProxy(FMalloc* InUsedMalloc) : UsedMalloc(InUsedMalloc) {}
+
+	virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return UsedMalloc->Malloc(Count, Alignment);
+	}
+
+	virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		if (Count > 0)
+			CountAllocation();
+		return UsedMalloc->Realloc(Original, Count, Alignment);
+	}
+
+	virtual void Free(void* Original) override { UsedMalloc->Free(Original); }
+	virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return UsedMalloc->QuantizeSize(Count, Alignment); }
+	virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return UsedMalloc->GetAllocationSize(Original, SizeOut); }
+	virtual void Trim() override { UsedMalloc->Trim(); }
+	virtual void SetupTLSCachesOnCurrentThread() override { UsedMalloc->SetupTLSCachesOnCurrentThread(); }
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override { UsedMalloc->ClearAndDisableTLSCachesOnCurrentThread(); }
+	virtual void InitializeStatsMetadata() override { UsedMalloc->InitializeStatsMetadata(); }
+	virtual void UpdateStats() override { UsedMalloc->UpdateStats(); }
+	virtual void GetAllocatorStats(FGenericMemoryStats& OutStats) override { UsedMalloc->GetAllocatorStats(OutStats); }
+	virtual void DumpAllocatorStats(FOutputDevice& Ar) override { UsedMalloc->DumpAllocatorStats(Ar); }
+	virtual bool IsInternallyThreadSafe() const override { return UsedMalloc->IsInternallyThreadSafe(); }
+	virtual bool ValidateHeap() override { return UsedMalloc->ValidateHeap(); }
+	virtual const TCHAR* GetDescriptiveName() override { return UsedMalloc->GetDescriptiveName(); }
+
+	FMalloc* const UsedMalloc;
+
+private:
+	static FORCEINLINE void CountAllocation()
+	{
+		if (FKZBenchmarkRecorder::bRecording && IsInGameThread())
+			++FKZBenchmarkRecorder::GameThreadAllocations;
+	}
+};
+
+/** Never destroyed, a thread still inside the proxy after it was removed keeps forwarding to the engine allocator */
+static TTypeCompatibleBytes<FKZBenchmarkMallocProxy> KZBenchmarkMallocProxy;
+
+void FKZBenchmarkRecorder::InstallAllocationCounter()
+{
+	// Once per process. Blocks allocated before go through the proxy to the allocator that made them, so nothing is freed by the wrong one
+	static bool bInstalled = false;
+	if (bInstalled)
+		return;
+
+	FKZBenchmarkMallocProxy* Proxy = new (KZBenchmarkMallocProxy.GetTypedPtr()) FKZBenchmarkMallocProxy(GMalloc);
+	FPlatformAtomics::InterlockedExchangePtr((void**)&GMalloc, Proxy);
+	bInstalled = true;
+	bCountingAllocations = true;
+}
+
+void FKZBenchmarkRecorder::RemoveAllocationCounter()
+{
+	if (bCountingAllocations)
+	{
+		FPlatformAtomics::InterlockedCompareExchangePointer((void**)&GMalloc, KZBenchmarkMallocProxy.GetTypedPtr()->UsedMalloc, KZBenchmarkMallocProxy.GetTypedPtr());
+		bCountingAllocations = false;
+	}
+}
+
+AKZBenchmark::AKZBenchmark()
+{
+	// Ticks first so every frame's scripted input is in before the characters move
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.TickGroup = TG_PrePhysics;
+	PrimaryActorTick.bHighPriority = true;
+
+	NumPortalPairs = 8;
+	NumCharacters = 4;
+	ProjectilesPerSecond = 30.f;
+	NumPhysicsProps = 500;
+	NumLocalPlayers = 1;
+	NumGhosts = 16;
+	GhostBudgetMs = 1.f;
+	bDebugOverlay = true;
+	NumFrames = 1800;
+	WarmupFrames = 120;
+	FrameRate = 60.f;
+	FrameBudgetMs = 0.f;
+	PathRadius = 3000.f;
+	PortalClass = TSoftClassPtr<APortalC>(FSoftObjectPath(TEXT("/Game/MyPortals/BP_Portal.BP_Portal_C")));
+	CharacterClass = TSoftClassPtr<AFPSCppTemplateCharacter>(FSoftObjectPath(TEXT("/Game/MyFirstPerson/Blueprints/FPSCharacter.FPSCharacter_C")));
+
+	FrameIndex = 0;
+	FireAccumulator = 0.f;
+	FrameStartCycles = 0;
+	FrameStartAllocations = 0;
+	CulledCaptures = 0;
+	CapturePrimitivesConsidered = 0;
+	CapturePrimitivesShown = 0;
+	CaptureViews = 0;
+	SceneCaptures = 0;
+	bSavedUseFixedTimeStep = false;
+	SavedFixedDeltaTime = 0.;
+}
+
+AKZBenchmark* AKZBenchmark::Start(UWorld* World, const TCHAR* Params, bool bQuitWhenDone)
+{
+	if (World == nullptr)
+		return nullptr;
+
+	for (TActorIterator<AKZBenchmark> It(World); It; ++It)
+	{
+		UE_LOG(LogKZBenchmark, Warning, TEXT("A KZ benchmark is already running"));
+		return *It;
+	}
+
+	// The path is centered on the player so it starts on the map's floor
+	FTransform Center = FTransform::Identity;
+	if (APlayerController* PlayerController = World->GetFirstPlayerController())
+	{
+		if (APawn* Pawn = PlayerController->GetPawn())
+			Center.SetLocation(Pawn->GetActorLocation());
+	}
+
+	AKZBenchmark* Benchmark = World->SpawnActorDeferred<AKZBenchmark>(AKZBenchmark::StaticClass(), Center);
+	if (Benchmark == nullptr)
+		return nullptr;
+
+	FParse::Value(Params, TEXT("Portals="), Benchmark->NumPortalPairs);
+	FParse::Value(Params, TEXT("Characters="), Benchmark->NumCharacters);
+	FParse::Value(Params, TEXT("Projectiles="), Benchmark->ProjectilesPerSecond);
+	FParse::Value(Params, TEXT("PhysicsProps="), Benchmark->NumPhysicsProps);
+	FParse::Value(Params, TEXT("LocalPlayers="), Benchmark->NumLocalPlayers);
+	FParse::Value(Params, TEXT("Ghosts="), Benchmark->NumGhosts);
+	FParse::Bool(Params, TEXT("DebugOverlay="), Benchmark->bDebugOverlay);
+	FParse::Value(Params, TEXT("Frames="), Benchmark->NumFrames);
+	FParse::Value(Params, TEXT("FrameBudget="), Benchmark->FrameBudgetMs);
+	FParse::Value(Params, TEXT("Report="), Benchmark->ReportFilename);
+
+	// Compares the capture cost with and without culling to the portal openings, the setting stays for the rest of the map
+	bool bCullCapturePrimitives;
+	APortalManager* PortalManager = APortalManager::Get(World);
+	if (PortalManager && FParse::Bool(Params, TEXT("PortalCulling="), bCullCapturePrimitives))
+		PortalManager->bCullCapturePrimitives = bCullCapturePrimitives;
+
+	Benchmark->bQuitWhenDone = bQuitWhenDone;
+	Benchmark->FinishSpawning(Center);
+	return Benchmark;
+}
+
+void AKZBenchmark::OnPostLoadMap(UWorld* World)
+{
+	// Headless performance runs, e.g. -game -nullrhi -KZBenchmark -Portals=16 -Report=Base.csv
+	static bool bStarted = false;
+	if (!bStarted && World && World->IsGameWorld() && FParse::Param(FCommandLine::Get(), TEXT("KZBenchmark")))
+	{
+		bStarted = true;
+		Start(World, FCommandLine::Get(), true);
+	}
+}
+
+void AKZBenchmark::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (!FKZBenchmarkRecorder::bCountingAllocations)
+		UE_LOG(LogKZBenchmark, Display, TEXT("Game thread allocations are only counted with the -KZBenchmarkAllocs switch"));
+
+	bSavedUseFixedTimeStep = FApp::UseFixedTimeStep();
+	SavedFixedDeltaTime = FApp::GetFixedDeltaTime();
+	FApp::SetUseFixedTimeStep(true);
+	FApp::SetFixedDeltaTime(1. / FMath::Max(FrameRate, 1.f));
+
+	SpawnCharacters();
+	AddLocalPlayers();
+	SpawnPortals();
+	SpawnGhosts();
+
+	UE_LOG(LogKZBenchmark, Display, TEXT("KZ benchmark: %d portal pairs, %d characters, %d local players, %.0f projectiles/s, %d physics props, %d ghosts, %d frames at %.0f fps"),
+		Portals.Num() / 2, Characters.Num(), AddedPlayers.Num() + 1, ProjectilesPerSecond, NumPhysicsProps, NumGhosts, NumFrames, FrameRate);
+	FrameStartCycles = FPlatformTime::Cycles64();
+}
+
+void AKZBenchmark::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (FrameIndex >= 0)
+	{
+		FKZBenchmarkRecorder::bRecording = false;
+		FApp::SetUseFixedTimeStep(bSavedUseFixedTimeStep);
+		FApp::SetFixedDeltaTime(SavedFixedDeltaTime);
+		FrameIndex = INDEX_NONE;
+	}
+
+	if (AKZGhostManager* GhostManager = AKZGhostManager::Get(GetWorld(), false))
+		GhostManager->ClearGhosts();
+
+	UGameInstance* GameInstance = GetGameInstance();
+	for (APlayerController* Player : AddedPlayers)
+	{
+		if (GameInstance && Player && Player->GetLocalPlayer())
+			GameInstance->RemoveLocalPlayer(Player->GetLocalPlayer());
+	}
+	AddedPlayers.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AKZBenchmark::SpawnCharacters()
+{
+	UClass* Class = CharacterClass.LoadSynchronous();
+	if (Class == nullptr)
+		Class = AFPSCppTemplateCharacter::StaticClass();
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	for (int32 Index = 0; Index < NumCharacters; ++Index)
+	{
+		// Evenly spaced on the circle, looking along it
+		const float Angle = 2.f * PI * Index / NumCharacters;
+		const FVector Radial(FMath::Cos(Angle), FMath::Sin(Angle), 0.f);
+		const FVector Tangent(-Radial.Y, Radial.X, 0.f);
+		AFPSCppTemplateCharacter* Character = GetWorld()->SpawnActor<AFPSCppTemplateCharacter>(Class, GetActorLocation() + Radial * PathRadius, Tangent.Rotation(), SpawnParams);
+		if (Character == nullptr)
+			continue;
+
+		Character->SpawnDefaultController();
+		if (Character->GetController())
+			Character->GetController()->SetControlRotation(Tangent.Rotation());
+
+		// Lines changing every frame, the overlay of the player's HUD shows them
+		if (bDebugOverlay && Characters.Num() == 0)
+			Character->bPrintSpeed = true;
+		Characters.Add(Character);
+	}
+}
+
+void AKZBenchmark::AddLocalPlayers()
+{
+	const int32 NumPlayers = FMath::Clamp(NumLocalPlayers, 1, 4);
+	if (NumPlayers > Characters.Num())
+		UE_LOG(LogKZBenchmark, Warning, TEXT("%d split-screen players need as many benchmark characters, %d are spawned"), NumPlayers, Characters.Num());
+
+	// The first player keeps its pawn, player N drives character N through the same scripted input as the AI
+	for (int32 Index = 1; Index < FMath::Min(NumPlayers, Characters.Num()); ++Index)
+	{
+		APlayerController* Player = UGameplayStatics::CreatePlayer(GetWorld(), INDEX_NONE, true);
+		AFPSCppTemplateCharacter* Character = Characters[Index];
+		if (Player == nullptr || Character == nullptr)
+			continue;
+		AddedPlayers.Add(Player);
+
+		// The pawn the game mode gave the new player would be one more character in the frame
+		APawn* DefaultPawn = Player->GetPawn();
+		const FRotator Rotation = Character->GetControlRotation();
+		if (AController* Controller = Character->GetController())
+		{
+			Controller->UnPossess();
+			Controller->Destroy();
+		}
+		Player->Possess(Character);
+		Player->SetControlRotation(Rotation);
+		if (DefaultPawn && DefaultPawn != Character)
+			DefaultPawn->Destroy();
+	}
+}
+
+void AKZBenchmark::SpawnPortals()
+{
+	UClass* Class = PortalClass.LoadSynchronous();
+	if (Class == nullptr)
+	{
+		UE_LOG(LogKZBenchmark, Warning, TEXT("KZ benchmark portal class %s not found, running without portals"), *PortalClass.ToString());
+		return;
+	}
+
+	for (int32 Pair = 0; Pair < NumPortalPairs; ++Pair)
+	{
+		// Both portals of a pair sit on the path on opposite sides of the circle, facing the characters running into them
+		APortalC* PairPortals[2];
+		FTransform Transforms[2];
+		for (int32 Side = 0; Side < 2; ++Side)
+		{
+			const float Angle = 2.f * PI * (Pair + .5f) / FMath::Max(NumPortalPairs, 1) + Side * PI;
+			const FVector Radial(FMath::Cos(Angle), FMath::Sin(Angle), 0.f);
+			const FVector Tangent(-Radial.Y, Radial.X, 0.f);
+			Transforms[Side] = FTransform((-Tangent).Rotation(), GetActorLocation() + Radial * PathRadius);
+			PairPortals[Side] = GetWorld()->SpawnActorDeferred<APortalC>(Class, Transforms[Side], nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+		}
+
+		if (PairPortals[0] == nullptr || PairPortals[1] == nullptr)
+			continue;
+
+		for (int32 Side = 0; Side < 2; ++Side)
+		{
+			PairPortals[Side]->PortalToCPP = PairPortals[1 - Side];
+			PairPortals[Side]->PlayerRefCPP = Characters.Num() > 0 ? Characters[0] : nullptr;
+			PairPortals[Side]->FinishSpawning(Transforms[Side]);
+			Portals.Add(PairPortals[Side]);
+		}
+	}
+
+	if (NumPhysicsProps > 0)
+		SpawnPhysicsProps(Class);
+}
+
+void AKZBenchmark::SpawnPhysicsProps(UClass* Class)
+{
+	UStaticMesh* Cube = LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Cube.Cube"));
+	if (Cube == nullptr)
+		return;
+
+	// Two portals facing each other in the middle of the circle, off the characters' path, what leaves one flies into the other
+	const FVector Center = GetActorLocation() + FVector(0.f, 0.f, 200.f);
+	const float PairDistance = 400.f;
+	APortalC* PairPortals[2];
+	FTransform Transforms[2];
+	Transforms[0] = FTransform(FRotator(0.f, 0.f, 0.f), Center - FVector(PairDistance, 0.f, 0.f));
+	Transforms[1] = FTransform(FRotator(0.f, 180.f, 0.f), Center + FVector(PairDistance, 0.f, 0.f));
+	for (int32 Side = 0; Side < 2; ++Side)
+		PairPortals[Side] = GetWorld()->SpawnActorDeferred<APortalC>(Class, Transforms[Side], nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+
+	if (PairPortals[0] == nullptr || PairPortals[1] == nullptr)
+		return;
+
+	for (int32 Side = 0; Side < 2; ++Side)
+	{
+		PairPortals[Side]->PortalToCPP = PairPortals[1 - Side];
+		PairPortals[Side]->PlayerRefCPP = Characters.Num() > 0 ? Characters[0] : nullptr;
+		PairPortals[Side]->FinishSpawning(Transforms[Side]);
+		Portals.Add(PairPortals[Side]);
+	}
+
+	// Small weightless cubes in a grid filling the opening, with a gap so none starts out touching another. Once a layer is full
+	// the next one goes behind it along the flight path, layers are centered between the portals. All fly into the first portal
+	const float PropScale = .15f;
+	const float Spacing = 100.f * PropScale + 5.f;
+	const FVector2D HalfExtent = PairPortals[0]->GetOpeningHalfExtent();
+	const int32 Columns = FMath::Max(FMath::FloorToInt(2.f * HalfExtent.X / Spacing), 1);
+	const int32 Rows = FMath::Max(FMath::FloorToInt(2.f * HalfExtent.Y / Spacing), 1);
+	const int32 MaxLayers = FMath::Max(FMath::FloorToInt(2.f * PairDistance / Spacing) - 2, 1);
+	const int32 NumProps = FMath::Min(NumPhysicsProps, Columns * Rows * MaxLayers);
+	const int32 NumLayers = FMath::DivideAndRoundUp(NumProps, Columns * Rows);
+	if (NumProps < NumPhysicsProps)
+		UE_LOG(LogKZBenchmark, Warning, TEXT("Only %d physics props fit between the portals"), NumProps);
+
+	APortalPhysicsManager* PhysicsManager = APortalPhysicsManager::Get(GetWorld());
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	for (int32 Index = 0; Index < NumProps; ++Index)
+	{
+		const int32 Column = Index % Columns;
+		const int32 Row = Index / Columns % Rows;
+		const int32 Layer = Index / (Columns * Rows);
+		const FVector Offset((Layer - (NumLayers - 1) * .5f) * Spacing, (Column - (Columns - 1) * .5f) * Spacing, (Row - (Rows - 1) * .5f) * Spacing);
+		AStaticMeshActor* Prop = GetWorld()->SpawnActor<AStaticMeshActor>(Center + Offset, FRotator::ZeroRotator, SpawnParams);
+		if (Prop == nullptr)
+			continue;
+
+		UStaticMeshComponent* Mesh = Prop->GetStaticMeshComponent();
+		Mesh->SetMobility(EComponentMobility::Movable);
+		Mesh->SetStaticMesh(Cube);
+		Mesh->SetWorldScale3D(FVector(PropScale));
+		Mesh->SetCollisionProfileName(UCollisionProfile::PhysicsActor_ProfileName);
+		Mesh->SetEnableGravity(false);
+		Mesh->SetSimulatePhysics(true);
+		Mesh->SetPhysicsLinearVelocity(FVector(-600.f, 0.f, 0.f));
+		if (PhysicsManager)
+			PhysicsManager->AddBody(Mesh);
+	}
+}
+
+void AKZBenchmark::SpawnGhosts()
+{
+	if (NumGhosts <= 0)
+		return;
+
+	// One lap around the circle at KZ speed, the ghosts loop it for the whole run
+	const FString Filename = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Benchmarks"), TEXT("KZBenchmarkGhost.kzg"));
+	const float Speed = 600.f;
+	const float LapTime = 2.f * PI * PathRadius / Speed;
+	const float KeyInterval = 1.f / 30.f;
+	{
+		FKZGhostRecorder Recorder(Filename, KeyInterval);
+		for (float Time = 0.f; Time <= LapTime; Time += KeyInterval)
+		{
+			const float Angle = Time / LapTime * 2.f * PI;
+			const FVector Radial(FMath::Cos(Angle), FMath::Sin(Angle), 0.f);
+			const FVector Tangent(-Radial.Y, Radial.X, 0.f);
+			Recorder.Sample(Time, GetActorLocation() + Radial * PathRadius, Tangent.Rotation());
+		}
+		if (!Recorder.WriteFile())
+			return;
+	}
+
+	// The files open on the thread pool, the ghosts are in long before the warm up ends
+	AKZGhostManager* GhostManager = AKZGhostManager::Get(GetWorld());
+	if (GhostManager == nullptr)
+		return;
+
+	GhostManager->ClearGhosts();
+	for (int32 Ghost = 0; Ghost < NumGhosts; ++Ghost)
+		GhostManager->AddGhost(Filename, Ghost * LapTime / NumGhosts);
+}
+
+void AKZBenchmark::DriveCharacter(AFPSCppTemplateCharacter* Character, float Time, float DeltaTime)
+{
+	AController* Controller = Character ? Character->GetController() : nullptr;
+	if (Controller == nullptr)
+		return;
+
+	// Bunny hop around the circle, switching the strafe side every second
+	const float Side = (FMath::FloorToInt(Time) % 2 == 0) ? 1.f : -1.f;
+
+	// AI controllers ignore yaw input, so the view follows the circle directly and the strafe simulation gets a sync turn speed
+	const float TurnSpeed = (Character->fMinSyncTurnSpeed + Character->fMaxSyncTurnSpeed) * .5f;
+	Controller->SetControlRotation(Controller->GetControlRotation() + FRotator(0.f, Side * 60.f * DeltaTime, 0.f));
+
+	Character->KZMoveForward(1.f);
+	Character->KZMoveRight(Side);
+	Character->KZJumpTurn(Side * TurnSpeed * DeltaTime);
+	Character->KZJumpLookUp(0.f);
+	Character->JumpByAxis(1.f);
+}
+
+void AKZBenchmark::DriveCharacters(float Time, float DeltaTime)
+{
+	for (AFPSCppTemplateCharacter* Character : Characters)
+		DriveCharacter(Character, Time, DeltaTime);
+
+	FireAccumulator += ProjectilesPerSecond * DeltaTime;
+	for (; FireAccumulator >= 1.f && Characters.Num() > 0; FireAccumulator -= 1.f)
+	{
+		AFPSCppTemplateCharacter* Shooter = Characters[FrameIndex % Characters.Num()];
+		if (Shooter)
+			Shooter->OnFire();
+	}
+}
+
+void AKZBenchmark::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (FrameIndex == INDEX_NONE)
+		return;
+
+	CommitFrame();
+	if (FrameIndex == WarmupFrames)
+	{
+		FKZBenchmarkRecorder::bRecording = true;
+		FKZBenchmarkRecorder::Footsteps = 0;
+		FKZBenchmarkRecorder::PortalPhysicsTeleports = 0;
+	}
+
+	if (FrameIndex >= WarmupFrames + NumFrames)
+	{
+		Finish();
+		return;
+	}
+
+	DriveCharacters(FrameIndex / FMath::Max(FrameRate, 1.f), DeltaTime);
+	++FrameIndex;
+}
+
+void AKZBenchmark::CommitFrame()
+{
+	const uint64 Now = FPlatformTime::Cycles64();
+	if (FKZBenchmarkRecorder::bRecording)
+	{
+		FKZBenchmarkRecorder::FrameCycles[(int32)EKZBenchmarkSection::Frame] = Now - FrameStartCycles;
+		FKZBenchmarkRecorder::FrameAllocations[(int32)EKZBenchmarkSection::Frame] = FKZBenchmarkRecorder::GameThreadAllocations - FrameStartAllocations;
+		for (int32 Section = 0; Section < (int32)EKZBenchmarkSection::Num; ++Section)
+		{
+			SampleTimes[Section].Add(FPlatformTime::ToMilliseconds64(FKZBenchmarkRecorder::FrameCycles[Section]));
+			SampleAllocations[Section].Add(uint32(FKZBenchmarkRecorder::FrameAllocations[Section]));
+		}
+
+		if (const APortalManager* PortalManager = APortalManager::Get(GetWorld(), false))
+		{
+			CulledCaptures += PortalManager->CaptureStats.CulledCaptures;
+			CapturePrimitivesConsidered += PortalManager->CaptureStats.PrimitivesConsidered;
+			CapturePrimitivesShown += PortalManager->CaptureStats.PrimitivesShown;
+			CaptureViews += PortalManager->CaptureStats.Executed;
+			SceneCaptures += PortalManager->CaptureStats.SceneCaptures;
+		}
+	}
+
+	FMemory::Memzero(FKZBenchmarkRecorder::FrameCycles);
+	FMemory::Memzero(FKZBenchmarkRecorder::FrameAllocations);
+	FrameStartCycles = Now;
+	FrameStartAllocations = FKZBenchmarkRecorder::GameThreadAllocations;
+}
+
+void AKZBenchmark::Finish()
+{
+	FKZBenchmarkRecorder::bRecording = false;
+
+	FString Filename = ReportFilename.IsEmpty() ? FString::Printf(TEXT("KZBenchmark-%s.csv"), *FDateTime::Now().ToString()) : ReportFilename;
+	if (FPaths::IsRelative(Filename))
+		Filename = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Benchmarks"), Filename);
+
+	// Samples of every section are counted against the whole frame budget, only the frame itself is checked
+	const float BudgetMs = FrameBudgetMs > 0.f ? FrameBudgetMs : 1000.f / FMath::Max(FrameRate, 1.f);
+	FString Report = TEXT("Section,Frames,MeanMs,P50Ms,P99Ms,MaxMs,MeanAllocs,MaxAllocs,TotalAllocs,OverBudget\n");
+	for (int32 Section = 0; Section < (int32)EKZBenchmarkSection::Num; ++Section)
+	{
+		TArray<float>& Times = SampleTimes[Section];
+		const int32 NumSamples = Times.Num();
+		if (NumSamples == 0)
+			continue;
+
+		Times.Sort();
+		auto Percentile = [&Times, NumSamples](float P) { return Times[FMath::Clamp(FMath::CeilToInt(P * NumSamples) - 1, 0, NumSamples - 1)]; };
+
+		double TimeSum = 0.;
+		for (float Time : Times)
+			TimeSum += Time;
+
+		uint64 TotalAllocations = 0;
+		uint32 MaxAllocations = 0;
+		for (uint32 Allocations : SampleAllocations[Section])
+		{
+			TotalAllocations += Allocations;
+			MaxAllocations = FMath::Max(MaxAllocations, Allocations);
+		}
+
+		// Sorted, the samples over budget are the last ones
+		const int32 OverBudget = NumSamples - Algo::UpperBound(Times, BudgetMs);
+
+		const FString Line = FString::Printf(TEXT("%s,%d,%.4f,%.4f,%.4f,%.4f,%.2f,%u,%llu,%d"), KZBenchmarkSectionNames[Section], NumSamples,
+			TimeSum / NumSamples, Percentile(.5f), Percentile(.99f), Times.Last(), double(TotalAllocations) / NumSamples, MaxAllocations, TotalAllocations, OverBudget);
+		UE_LOG(LogKZBenchmark, Display, TEXT("%s"), *Line);
+		Report += Line + TEXT("\n");
+
+		if (Section == (int32)EKZBenchmarkSection::Frame)
+		{
+			if (OverBudget > 0)
+				UE_LOG(LogKZBenchmark, Warning, TEXT("%d of %d frames over the %.2f ms frame budget, p99 %.2f ms"), OverBudget, NumSamples, BudgetMs, Percentile(.99f));
+			else
+				UE_LOG(LogKZBenchmark, Display, TEXT("Every frame within the %.2f ms frame budget"), BudgetMs);
+		}
+	}
+
+	// Steps are rare next to frames, their cost is the footstep time spread over the steps played
+	const TArray<float>& FootstepTimes = SampleTimes[(int32)EKZBenchmarkSection::Footsteps];
+	if (FKZBenchmarkRecorder::Footsteps > 0)
+	{
+		double FootstepSum = 0.;
+		for (float Time : FootstepTimes)
+			FootstepSum += Time;
+		UE_LOG(LogKZBenchmark, Display, TEXT("%llu footsteps, %.2f us per step"), FKZBenchmarkRecorder::Footsteps,
+			FootstepSum * 1000. / FKZBenchmarkRecorder::Footsteps);
+	}
+
+	const TArray<float>& PortalPhysicsTimes = SampleTimes[(int32)EKZBenchmarkSection::PortalPhysics];
+	if (FKZBenchmarkRecorder::PortalPhysicsTeleports > 0)
+	{
+		double PortalPhysicsSum = 0.;
+		for (float Time : PortalPhysicsTimes)
+			PortalPhysicsSum += Time;
+		UE_LOG(LogKZBenchmark, Display, TEXT("%llu physics body teleports, %.2f us per teleport"), FKZBenchmarkRecorder::PortalPhysicsTeleports,
+			PortalPhysicsSum * 1000. / FKZBenchmarkRecorder::PortalPhysicsTeleports);
+	}
+
+	// Split-screen multiplies the portal views, the capture cost per view tells whether they stay affordable
+	const TArray<float>& CaptureTimes = SampleTimes[(int32)EKZBenchmarkSection::PortalCapture];
+	if (CaptureViews > 0 && CaptureTimes.Num() > 0)
+	{
+		double CaptureSum = 0.;
+		for (float Time : CaptureTimes)
+			CaptureSum += Time;
+		UE_LOG(LogKZBenchmark, Display, TEXT("%d local players: %.1f portal views and %.1f scene captures per frame, %.3f ms per portal view"), AddedPlayers.Num() + 1,
+			double(CaptureViews) / CaptureTimes.Num(), double(SceneCaptures) / CaptureTimes.Num(), CaptureSum / CaptureViews);
+	}
+
+	const TArray<float>& GhostTimes = SampleTimes[(int32)EKZBenchmarkSection::Ghosts];
+	const AKZGhostManager* GhostManager = AKZGhostManager::Get(GetWorld(), false);
+	if (GhostManager && GhostManager->NumGhosts() > 0 && GhostTimes.Num() > 0)
+	{
+		double GhostSum = 0.;
+		for (float Time : GhostTimes)
+			GhostSum += Time;
+		const double GhostMeanMs = GhostSum / GhostTimes.Num();
+		if (GhostMeanMs > GhostBudgetMs)
+			UE_LOG(LogKZBenchmark, Warning, TEXT("%d ghosts take %.3f ms per frame, over the %.2f ms ghost budget"), GhostManager->NumGhosts(), GhostMeanMs, GhostBudgetMs);
+		else
+			UE_LOG(LogKZBenchmark, Display, TEXT("%d ghosts take %.3f ms per frame"), GhostManager->NumGhosts(), GhostMeanMs);
+	}
+
+	if (CulledCaptures > 0)
+	{
+		UE_LOG(LogKZBenchmark, Display, TEXT("%llu culled portal captures, %.1f primitives per capture before culling, %.1f after"), CulledCaptures,
+			double(CapturePrimitivesConsidered) / CulledCaptures, double(CapturePrimitivesShown) / CulledCaptures);
+	}
+
+	if (FFileHelper::SaveStringToFile(Report, *Filename))
+		UE_LOG(LogKZBenchmark, Display, TEXT("KZ benchmark report written to %s"), *Filename);
+	else
+		UE_LOG(LogKZBenchmark, Error, TEXT("Could not write KZ benchmark report %s"), *Filename);
+
+	const bool bQuit = bQuitWhenDone;
+	Destroy();
+	if (bQuit)
+		FPlatformMisc::RequestExit(false);
+}
+
+static FAutoConsoleCommand KZBenchmarkCommand(
+	TEXT("KZ.Benchmark"),
+	TEXT("Runs the KZ performance benchmark in the current map and writes a CSV report. Optional arguments: Portals= Characters= Projectiles= PhysicsProps= LocalPlayers= Ghosts= DebugOverlay= Frames= FrameBudget= Report= PortalCulling="),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		AKZBenchmark::Start(World, *FString::Join(Args, TEXT(" ")), false);
+	}));
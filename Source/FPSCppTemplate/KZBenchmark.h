@@ -0,0 +1,247 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "KZBenchmark.generated.h"
+
+class APortalC;
+class AFPSCppTemplateCharacter;
+class APlayerController;
+
+/** Game thread sections timed by the benchmark */
+enum class EKZBenchmarkSection : uint8
+{
+	Frame,
+	PortalTick,
+	PortalCapture,
+	CharacterTick,
+	Fire,
+	ProjectilePool,
+	ProjectileBatch,
+	Footsteps,
+	PortalPhysics,
+	Ghosts,
+	DebugOverlay,
+	/** Portal and primitive spatial index queries, also counted in the sections they run in */
+	PortalQueries,
+	Num
+};
+
+/** Per-frame time and game thread allocations of every section while a benchmark runs */
+struct FPSCPPTEMPLATE_API FKZBenchmarkRecorder
+{
+	/** Set while a benchmark measures, scopes cost one branch otherwise */
+	static bool bRecording;
+
+	/** Game thread allocations so far, counted while the allocation counter is installed */
+	static uint64 GameThreadAllocations;
+	static bool bCountingAllocations;
+
+	static uint64 FrameCycles[(int32)EKZBenchmarkSection::Num];
+	static uint64 FrameAllocations[(int32)EKZBenchmarkSection::Num];
+
+	/** Footsteps played while recording, to report the cost per step */
+	static uint64 Footsteps;
+
+	/** Physics bodies carried through portals while recording, to report the cost per teleport */
+	static uint64 PortalPhysicsTeleports;
+
+	/**
+	 * Wraps GMalloc in a proxy counting the game thread allocations. Called by the module startup with -KZBenchmark or
+	 * -KZBenchmarkAllocs, before the engine ticks, the allocation columns of the report are 0 without it
+	 */
+	static void InstallAllocationCounter();
+
+	/** Puts the wrapped allocator back, called by the module shutdown */
+	static void RemoveAllocationCounter();
+};
+
+/** Adds the time and allocations of the enclosing scope to Section of the current benchmark frame */
+struct FKZBenchmarkScope
+{
+	FORCEINLINE explicit FKZBenchmarkScope(EKZBenchmarkSection InSection)
+		: Section(InSection)
+		, bActive(FKZBenchmarkRecorder::bRecording)
+	{
+		if (bActive)
+		{
+			StartAllocations = FKZBenchmarkRecorder::GameThreadAllocations;
+			StartCycles = FPlatformTime::Cycles64();
+		}
+	}
+
+	FORCEINLINE ~FKZBenchmarkScope()
+	{
+		if (bActive)
+		{
+			FKZBenchmarkRecorder::FrameCycles[(int32)Section] += FPlatformTime::Cycles64() - StartCycles;
+			FKZBenchmarkRecorder::FrameAllocations[(int32)Section] += FKZBenchmarkRecorder::GameThreadAllocations - StartAllocations;
+		}
+	}
+
+	EKZBenchmarkSection Section;
+	bool bActive;
+	uint64 StartCycles;
+	uint64 StartAllocations;
+};
+
+#define KZ_BENCHMARK_SCOPE(Section) FKZBenchmarkScope PREPROCESSOR_JOIN(KZBenchmarkScope, __LINE__)(EKZBenchmarkSection::Section)
+
+/**
+ * Repeatable performance run: fills the loaded map with portal pairs, AI driven KZ characters, projectiles, physics props
+ * looping through a facing portal pair and ghosts racing a lap of the path, runs a scripted
+ * strafe path around a circle at a fixed frame time and writes per-section frame timings (mean, p50, p99, max) and game thread
+ * allocation counts to a CSV report. Allocations are counted in processes launched with -KZBenchmark or -KZBenchmarkAllocs.
+ * The log also reports the primitives each portal capture considers before and after culling them to the portal opening, and
+ * the capture cost per portal view, which LocalPlayers=2 or more measures in split-screen.
+ * Start it with "KZ.Benchmark [Key=Value...]" or the -KZBenchmark command line switch, which runs in the first map loaded and
+ * quits when done, whatever its game mode, e.g.
+ * UE4Editor FPSCppTemplate MapName -game -nullrhi -KZBenchmark -Portals=16 -Report=Base.csv
+ * Compare two reports with the KZBenchmarkCompare commandlet.
+ */
+UCLASS(config=Game, notplaceable)
+class FPSCPPTEMPLATE_API AKZBenchmark : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AKZBenchmark();
+
+	/** Spawns a benchmark in World, Params overrides the config values (Portals=, Characters=, Projectiles=, PhysicsProps=, LocalPlayers=, Ghosts=, DebugOverlay=, Frames=, FrameBudget=, Report=, PortalCulling=) */
+	static AKZBenchmark* Start(UWorld* World, const TCHAR* Params, bool bQuitWhenDone);
+
+	/** Called for every loaded map, the first game map starts the -KZBenchmark run */
+	static void OnPostLoadMap(UWorld* World);
+
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+	/** Feeds one frame of the scripted strafe input to Character, Time is the time since the start */
+	static void DriveCharacter(AFPSCppTemplateCharacter* Character, float Time, float DeltaTime);
+
+	/** Portal pairs placed around the path */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	int32 NumPortalPairs;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	int32 NumCharacters;
+
+	/** Shots per second, spread over the characters */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	float ProjectilesPerSecond;
+
+	/** Simulating props bouncing between two facing portals, 0 leaves the pair out */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	int32 NumPhysicsProps;
+
+	/**
+	 * Split-screen players, every portal is captured once per player. Players past the first take over benchmark characters,
+	 * so run with at least as many characters. Compare the PortalCapture section with a single player run for the cost per view
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark", meta = (ClampMin = "1", ClampMax = "4"))
+	int32 NumLocalPlayers;
+
+	/** Ghosts racing a run recorded along the path, their update should stay within GhostBudgetMs */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	int32 NumGhosts;
+
+	/** Mean ghost update time per frame the report warns about */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	float GhostBudgetMs;
+
+	/** Shows the speed and sync rate lines and the speed graph of the first character on the debug overlay */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	bool bDebugOverlay;
+
+	/** Frames measured after the warm up */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	int32 NumFrames;
+
+	/** Frames run before measuring, so pools and render targets are allocated */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	int32 WarmupFrames;
+
+	/** Fixed frame rate of the run, so every run simulates the same frames */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	float FrameRate;
+
+	/** Game thread time a frame may take, 0 for the frame time of FrameRate. The report counts the frames over it and warns about them */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	float FrameBudgetMs;
+
+	/** Radius of the circle the characters strafe around */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	float PathRadius;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	TSoftClassPtr<APortalC> PortalClass;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Benchmark")
+	TSoftClassPtr<AFPSCppTemplateCharacter> CharacterClass;
+
+	/** Report file, relative paths are under Saved/Benchmarks. Defaults to a timestamped name */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Benchmark")
+	FString ReportFilename;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Benchmark")
+	bool bQuitWhenDone = false;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	void SpawnPortals();
+	void SpawnCharacters();
+
+	/** Creates the split-screen players past the first, each possessing one of the benchmark characters */
+	void AddLocalPlayers();
+
+	/** Spawns a facing portal pair in the middle of the circle and NumPhysicsProps props flying back and forth through it */
+	void SpawnPhysicsProps(UClass* Class);
+
+	/** Writes a ghost run around the circle and has NumGhosts ghosts race it, spaced along the path */
+	void SpawnGhosts();
+
+	/** Feeds this frame's scripted input to every character, Time is the time since the start */
+	void DriveCharacters(float Time, float DeltaTime);
+
+	/** Moves the section totals of the frame that just ended into the samples */
+	void CommitFrame();
+
+	/** Writes the report and stops */
+	void Finish();
+
+	UPROPERTY(Transient)
+	TArray<APortalC*> Portals;
+
+	UPROPERTY(Transient)
+	TArray<AFPSCppTemplateCharacter*> Characters;
+
+	int32 FrameIndex;
+	float FireAccumulator;
+	uint64 FrameStartCycles;
+	uint64 FrameStartAllocations;
+
+	/** Frame time and allocations of every measured frame, per section */
+	TArray<float> SampleTimes[(int32)EKZBenchmarkSection::Num];
+	TArray<uint32> SampleAllocations[(int32)EKZBenchmarkSection::Num];
+
+	/** Portal capture culling totals of the measured frames, see FPortalCaptureStats */
+	uint64 CulledCaptures;
+	uint64 CapturePrimitivesConsidered;
+	uint64 CapturePrimitivesShown;
+
+	/** Portal views captured and scene captures rendered over the measured frames */
+	uint64 CaptureViews;
+	uint64 SceneCaptures;
+
+	/** Split-screen players the benchmark added, removed when it ends */
+	UPROPERTY(Transient)
+	TArray<APlayerController*> AddedPlayers;
+
+	/** Engine frame time settings to restore afterwards */
+	bool bSavedUseFixedTimeStep;
+	double SavedFixedDeltaTime;
+};
@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZBenchmarkCompareCommandlet.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZBenchmarkCompare, Log, All);
+
+namespace
+{
+	struct FKZBenchmarkRow
+	{
+		float P50Ms = 0.f;
+		float P99Ms = 0.f;
+		float MeanAllocs = 0.f;
+	};
+
+	/** Reads the rows of a benchmark report by section name, false if the file is missing or not a report */
+	bool LoadReport(FString Filename, TMap<FString, FKZBenchmarkRow>& OutRows)
+	{
+		if (FPaths::IsRelative(Filename) && !FPaths::FileExists(Filename))
+			Filename = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Benchmarks"), Filename);
+
+		TArray<FString> Lines;
+		if (!FFileHelper::LoadFileToStringArray(Lines, *Filename) || Lines.Num() == 0)
+		{
+			UE_LOG(LogKZBenchmarkCompare, Error, TEXT("Could not read benchmark report %s"), *Filename);
+			return false;
+		}
+
+		// Columns are looked up by name so reports with added columns still compare
+		TArray<FString> Columns;
+		Lines[0].ParseIntoArray(Columns, TEXT(","));
+		const int32 SectionColumn = Columns.IndexOfByKey(TEXT("Section"));
+		const int32 P50Column = Columns.IndexOfByKey(TEXT("P50Ms"));
+		const int32 P99Column = Columns.IndexOfByKey(TEXT("P99Ms"));
+		const int32 AllocsColumn = Columns.IndexOfByKey(TEXT("MeanAllocs"));
+		if (SectionColumn == INDEX_NONE || P50Column == INDEX_NONE || P99Column == INDEX_NONE || AllocsColumn == INDEX_NONE)
+		{
+			UE_LOG(LogKZBenchmarkCompare, Error, TEXT("%s is not a KZ benchmark report"), *Filename);
+			return false;
+		}
+
+		for (int32 LineIndex = 1; LineIndex < Lines.Num(); ++LineIndex)
+		{
+			TArray<FString> Values;
+			Lines[LineIndex].ParseIntoArray(Values, TEXT(","));
+			if (Values.Num() != Columns.Num())
+				continue;
+
+			FKZBenchmarkRow& Row = OutRows.Add(Values[SectionColumn]);
+			Row.P50Ms = FCString::Atof(*Values[P50Column]);
+			Row.P99Ms = FCString::Atof(*Values[P99Column]);
+			Row.MeanAllocs = FCString::Atof(*Values[AllocsColumn]);
+		}
+		return true;
+	}
+}
+
+int32 UKZBenchmarkCompareCommandlet::Main(const FString& Params)
+{
+	FString BaseFilename, NewFilename;
+	float Tolerance = 10.f;
+	FParse::Value(*Params, TEXT("Base="), BaseFilename);
+	FParse::Value(*Params, TEXT("New="), NewFilename);
+	FParse::Value(*Params, TEXT("Tolerance="), Tolerance);
+
+	TMap<FString, FKZBenchmarkRow> BaseRows, NewRows;
+	if (!LoadReport(BaseFilename, BaseRows) || !LoadReport(NewFilename, NewRows))
+		return 2;
+
+	const float Scale = 1.f + Tolerance / 100.f;
+	int32 NumRegressions = 0;
+	for (const TPair<FString, FKZBenchmarkRow>& Base : BaseRows)
+	{
+		const FKZBenchmarkRow* New = NewRows.Find(Base.Key);
+		if (New == nullptr)
+		{
+			UE_LOG(LogKZBenchmarkCompare, Warning, TEXT("%s: missing from the new report"), *Base.Key);
+			continue;
+		}
+
+		const bool bP50 = New->P50Ms > Base.Value.P50Ms * Scale;
+		const bool bP99 = New->P99Ms > Base.Value.P99Ms * Scale;
+		const bool bAllocs = New->MeanAllocs > Base.Value.MeanAllocs * Scale + 1.f;
+		const bool bRegressed = bP50 || bP99 || bAllocs;
+		NumRegressions += bRegressed ? 1 : 0;
+
+		UE_LOG(LogKZBenchmarkCompare, Display, TEXT("%-16s p50 %.3f -> %.3f ms%s, p99 %.3f -> %.3f ms%s, allocs %.1f -> %.1f%s"), *Base.Key,
+			Base.Value.P50Ms, New->P50Ms, bP50 ? TEXT(" REGRESSED") : TEXT(""),
+			Base.Value.P99Ms, New->P99Ms, bP99 ? TEXT(" REGRESSED") : TEXT(""),
+			Base.Value.MeanAllocs, New->MeanAllocs, bAllocs ? TEXT(" REGRESSED") : TEXT(""));
+	}
+
+	UE_LOG(LogKZBenchmarkCompare, Display, TEXT("KZ benchmark comparison %s (%d sections regressed, tolerance %.0f%%)"),
+		NumRegressions > 0 ? TEXT("FAILED") : TEXT("passed"), NumRegressions, Tolerance);
+	return NumRegressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,21 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "KZBenchmarkCompareCommandlet.generated.h"
+
+/**
+ * Compares two AKZBenchmark reports and fails when a section got slower or allocates more, for regression gating:
+ * UE4Editor-Cmd FPSCppTemplate -run=KZBenchmarkCompare -Base=Base.csv -New=New.csv [-Tolerance=10]
+ * P50 and P99 frame times may grow by Tolerance percent, mean allocations by Tolerance percent plus one.
+ */
+UCLASS()
+class UKZBenchmarkCompareCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,522 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZCharacterMovementComponent.h"
+#include "FPSCppTemplate.h"
+#include "FPSCppTemplateCharacter.h"
+#include "PortalC.h"
+#include "GameFramework/Character.h"
+#include "Net/UnrealNetwork.h"
+
+DECLARE_CYCLE_STAT(TEXT("Strafe Simulation"), STAT_KZStrafeSimulation, STATGROUP_KZ);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Client Corrections"), STAT_KZClientCorrections, STATGROUP_KZ);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Server Corrections"), STAT_KZServerCorrections, STATGROUP_KZ);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Teleport Corrections"), STAT_KZTeleportCorrections, STATGROUP_KZ);
+
+namespace KZMovement
+{
+	/** Strafe speed differences below this are left to the next correction */
+	static const float StrafeSpeedTolerance = .01f;
+
+	/** Seconds after a crossing the server waits for the client to catch up with a crossing it missed, about the worst round trip */
+	static const float TeleportFixupWindow = 1.f;
+
+	/** Corrections this many seconds after a crossing count as teleport corrections */
+	static const float TeleportCorrectionWindow = .5f;
+
+	/** Added to the exit push of the portal for the location a client that missed a crossing may report */
+	static const float TeleportFixupMargin = 10.f;
+}
+
+UKZCharacterMovementComponent::UKZCharacterMovementComponent()
+	: StrafeDirection(0)
+	, TurnClass(EKZTurnClass::None)
+	, PendingTurnInput(0.f)
+	, PendingStrafeInput(0.f)
+	, StrafeTelemetry(nullptr)
+	, bPerformingMove(false)
+	, ServerTeleportMatrix(FMatrix::Identity)
+	, ServerTeleportTolerance(0.f)
+	, LastTeleportTime(-BIG_NUMBER)
+	, bApplyingShortCorrection(false)
+	, NumClientCorrections(0)
+	, NumServerCorrections(0)
+	, NumStrafeResyncs(0)
+	, NumTeleports(0)
+	, NumTeleportCorrections(0)
+	, NumConfirmedTeleports(0)
+	, NumTeleportFixups(0)
+{
+	// For ServerStrafeState
+	SetIsReplicated(true);
+}
+
+void UKZCharacterMovementComponent::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME_CONDITION(UKZCharacterMovementComponent, ServerStrafeState, COND_OwnerOnly);
+}
+
+void UKZCharacterMovementComponent::ResetStrafe(float Speed)
+{
+	Strafe.Reset(Speed);
+	MaxWalkSpeed = Speed;
+	MaxWalkSpeedCrouched = Speed;
+}
+
+FKZStrafeSettings UKZCharacterMovementComponent::GetStrafeSettings() const
+{
+	const AFPSCppTemplateCharacter* Character = Cast<AFPSCppTemplateCharacter>(CharacterOwner);
+	return Character ? Character->GetKZStrafeSettings() : FKZStrafeSettings();
+}
+
+float UKZCharacterMovementComponent::GetMoveTurnSpeed(int8 Direction, EKZTurnClass InTurnClass, const FKZStrafeSettings& Settings)
+{
+	switch (InTurnClass)
+	{
+	case EKZTurnClass::Slow:
+		return Direction * Settings.MinSyncTurnSpeed * .5f;
+	case EKZTurnClass::Sync:
+		return Direction * (Settings.MinSyncTurnSpeed + Settings.MaxSyncTurnSpeed) * .5f;
+	case EKZTurnClass::Fast:
+		return Direction * Settings.MaxSyncTurnSpeed * 2.f;
+	default:
+		return 0.f;
+	}
+}
+
+void UKZCharacterMovementComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	// Only the controlling side has input, received and replayed moves take theirs from the compressed flags
+	if (CharacterOwner && CharacterOwner->IsLocallyControlled())
+		UpdateStrafeInput(DeltaTime);
+
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+}
+
+void UKZCharacterMovementComponent::UpdateStrafeInput(float DeltaTime)
+{
+	const float TurnSpeed = DeltaTime > 0.f ? PendingTurnInput / DeltaTime : 0.f;
+	PendingTurnInput = 0.f;
+
+	StrafeDirection = PendingStrafeInput > 0.f ? 1 : (PendingStrafeInput < 0.f ? -1 : 0);
+	TurnClass = EKZTurnClass::None;
+	if (StrafeDirection != 0 && TurnSpeed * StrafeDirection > 0.f)
+	{
+		const FKZStrafeSettings Settings = GetStrafeSettings();
+		const float AbsTurnSpeed = FMath::Abs(TurnSpeed);
+		if (AbsTurnSpeed < Settings.MinSyncTurnSpeed)
+			TurnClass = EKZTurnClass::Slow;
+		else if (AbsTurnSpeed < Settings.MaxSyncTurnSpeed)
+			TurnClass = EKZTurnClass::Sync;
+		else
+			TurnClass = EKZTurnClass::Fast;
+	}
+}
+
+void UKZCharacterMovementComponent::PerformMovement(float DeltaTime)
+{
+	// Strafe speed gain, speed cap and reset run at a fixed step within the move, the move gets the speed interpolated between steps
+	{
+		FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZStrafeSimulation);
+		const FKZStrafeSettings Settings = GetStrafeSettings();
+
+		// Replays of corrected moves already sampled their steps the first time
+		Strafe.SetTelemetry(bClientUpdating ? nullptr : StrafeTelemetry);
+		Strafe.Advance(Settings, DeltaTime, GetMoveTurnSpeed(StrafeDirection, TurnClass, Settings) * DeltaTime, StrafeDirection, IsFalling(), Velocity.Size2D());
+
+		MaxWalkSpeed = Strafe.GetInterpolatedSpeed(Settings);
+		MaxWalkSpeedCrouched = MaxWalkSpeed;
+	}
+
+	MovePortals.Reset();
+	bPerformingMove = true;
+	Super::PerformMovement(DeltaTime);
+	bPerformingMove = false;
+}
+
+void UKZCharacterMovementComponent::OnPortalCrossings(const TArray<const APortalC*, TInlineAllocator<4>>& Entries)
+{
+	// Simulated proxies and teleports from overlaps outside of moves have nothing to predict
+	if (!bPerformingMove || CharacterOwner == nullptr || Entries.Num() == 0)
+		return;
+	for (const APortalC* Entry : Entries)
+	{
+		if (Entry == nullptr || Entry->PortalToCPP == nullptr)
+			return;
+	}
+
+	MovePortals = Entries;
+
+	if (bClientUpdating)
+		return;
+
+	const APortalC* Exit = Entries.Last()->PortalToCPP;
+	++NumTeleports;
+	LastTeleportTime = GetWorld()->GetTimeSeconds();
+	ServerTeleportMatrix = GetPortalPathMatrix(Entries);
+	ServerTeleportTolerance = Exit->ActorTeleportPositiveOffset + KZMovement::TeleportFixupMargin;
+
+	// The owning client of a remote player gets the crossings of its move as an event, it predicted them or carries itself
+	// through. Portals are sent by reference, one spawned only here would reach the client as null
+	const bool bRemoteClient = CharacterOwner->Role == ROLE_Authority && CharacterOwner->GetRemoteRole() == ROLE_AutonomousProxy && !CharacterOwner->IsLocallyControlled();
+	const FNetworkPredictionData_Server_Character* ServerData = bRemoteClient ? GetPredictionData_Server_Character() : nullptr;
+	if (ServerData == nullptr)
+		return;
+	for (const APortalC* Entry : Entries)
+	{
+		if (!Entry->IsSupportedForNetworking())
+			return;
+	}
+
+	const FVector ExitOffset = UpdatedComponent->GetComponentLocation() - Exit->Origin;
+
+	FKZPortalTeleport Teleport;
+	Teleport.TimeStamp = ServerData->CurrentClientTimeStamp;
+	Teleport.Portals.Reserve(Entries.Num());
+	for (const APortalC* Entry : Entries)
+		Teleport.Portals.Add(const_cast<APortalC*>(Entry));
+	Teleport.ExitOffset = FVector(FVector::DotProduct(ExitOffset, Exit->X), FVector::DotProduct(ExitOffset, Exit->Y), FVector::DotProduct(ExitOffset, Exit->Z));
+	ClientPortalTeleport(Teleport);
+}
+
+FMatrix UKZCharacterMovementComponent::GetPortalPathMatrix(const TArray<const APortalC*, TInlineAllocator<4>>& Entries)
+{
+	// Row vectors, the first crossing is applied first
+	FMatrix Matrix = FMatrix::Identity;
+	for (const APortalC* Entry : Entries)
+		Matrix = Matrix * Entry->GetPortalPairMatrix(Entry->PortalToCPP);
+	return Matrix;
+}
+
+bool UKZCharacterMovementComponent::IsAwaitingTeleportFixup(const FVector& ClientLocation) const
+{
+	if (GetWorld()->GetTimeSeconds() - LastTeleportTime > KZMovement::TeleportFixupWindow)
+		return false;
+
+	// Both sides moved the same since the crossing, only on either side of the portal. The exit push is all that differs
+	return FVector::DistSquared(ServerTeleportMatrix.TransformPosition(ClientLocation), UpdatedComponent->GetComponentLocation()) <= FMath::Square(ServerTeleportTolerance);
+}
+
+void UKZCharacterMovementComponent::ClientPortalTeleport_Implementation(const FKZPortalTeleport& Teleport)
+{
+	FNetworkPredictionData_Client_Character* ClientData = HasValidData() ? GetPredictionData_Client_Character() : nullptr;
+	AFPSCppTemplateCharacter* Character = Cast<AFPSCppTemplateCharacter>(CharacterOwner);
+	if (ClientData == nullptr || Character == nullptr || Teleport.Portals.Num() == 0)
+		return;
+
+	TArray<const APortalC*, TInlineAllocator<4>> Entries;
+	for (const APortalC* Entry : Teleport.Portals)
+	{
+		if (Entry == nullptr || Entry->PortalToCPP == nullptr)
+			return;
+		Entries.Add(Entry);
+	}
+
+	// The move is acknowledged by now, or still waiting for its acknowledgment. Older moves are gone with their crossing
+	FSavedMove_KZ* TeleportMove = nullptr;
+	int32 FirstLaterMove = 0;
+	if (ClientData->LastAckedMove.IsValid() && ClientData->LastAckedMove->TimeStamp == Teleport.TimeStamp)
+	{
+		TeleportMove = static_cast<FSavedMove_KZ*>(ClientData->LastAckedMove.Get());
+	}
+	else
+	{
+		const int32 MoveIndex = ClientData->SavedMoves.IndexOfByPredicate([&Teleport](const FSavedMovePtr& Move) { return Move->TimeStamp == Teleport.TimeStamp; });
+		if (MoveIndex == INDEX_NONE)
+			return;
+		TeleportMove = static_cast<FSavedMove_KZ*>(ClientData->SavedMoves[MoveIndex].Get());
+		FirstLaterMove = MoveIndex + 1;
+	}
+
+	if (TeleportMove->Portals.Num() > 0)
+	{
+		// Predicted. Different crossings are left to the correction that follows
+		if (TeleportMove->Portals == Entries)
+			++NumConfirmedTeleports;
+		return;
+	}
+
+	// Missed: the end of the move and every later move are carried through every portal the move crossed, the server already
+	// expects the locations of the other side and no correction is needed
+	const APortalC* Exit = Entries.Last()->PortalToCPP;
+	const FMatrix PortalPairMatrix = GetPortalPathMatrix(Entries);
+	const FVector ServerLocation = Exit->Origin + Teleport.ExitOffset.X * Exit->X + Teleport.ExitOffset.Y * Exit->Y + Teleport.ExitOffset.Z * Exit->Z;
+	const FVector ClientLocation = TeleportMove->SavedLocation;
+	auto RemapLocation = [&](const FVector& Location) { return ServerLocation + PortalPairMatrix.TransformVector(Location - ClientLocation); };
+	auto RemapRotation = [&](const FRotator& Rotation) { return PortalPairMatrix.TransformVector(Rotation.Vector()).Rotation(); };
+
+	TeleportMove->SavedLocation = ServerLocation;
+	TeleportMove->SavedVelocity = PortalPairMatrix.TransformVector(TeleportMove->SavedVelocity);
+	TeleportMove->SavedRotation = RemapRotation(TeleportMove->SavedRotation);
+	TeleportMove->SavedControlRotation = RemapRotation(TeleportMove->SavedControlRotation);
+	TeleportMove->Portals = Entries;
+
+	for (int32 MoveIndex = FirstLaterMove; MoveIndex < ClientData->SavedMoves.Num(); ++MoveIndex)
+	{
+		FSavedMove_KZ* Move = static_cast<FSavedMove_KZ*>(ClientData->SavedMoves[MoveIndex].Get());
+		Move->StartLocation = RemapLocation(Move->StartLocation);
+		Move->StartVelocity = PortalPairMatrix.TransformVector(Move->StartVelocity);
+		Move->StartRotation = RemapRotation(Move->StartRotation);
+		Move->StartControlRotation = RemapRotation(Move->StartControlRotation);
+		Move->SavedLocation = RemapLocation(Move->SavedLocation);
+		Move->SavedVelocity = PortalPairMatrix.TransformVector(Move->SavedVelocity);
+		Move->SavedRotation = RemapRotation(Move->SavedRotation);
+		Move->SavedControlRotation = RemapRotation(Move->SavedControlRotation);
+		Move->Acceleration = PortalPairMatrix.TransformVector(Move->Acceleration);
+		Move->AccelNormal = PortalPairMatrix.TransformVector(Move->AccelNormal);
+	}
+
+	// Location, velocity and view of the character now, through every pair in order so each portal sees its crossing.
+	// The crossings before the last only pass the character through, the server location is set by the last
+	const FVector CurrentLocation = UpdatedComponent->GetComponentLocation();
+	FVector Location = CurrentLocation;
+	for (int32 Index = 0; Index < Entries.Num(); ++Index)
+	{
+		const APortalC* Entry = Entries[Index];
+		Location = Index == Entries.Num() - 1 ? RemapLocation(CurrentLocation) : Entry->GetPortalPairMatrix(Entry->PortalToCPP).TransformPosition(Location);
+		Character->TeleportThroughPortal(Entry->PortalToCPP, Entry, Location);
+	}
+
+	++NumTeleports;
+	++NumTeleportFixups;
+	LastTeleportTime = GetWorld()->GetTimeSeconds();
+}
+
+void UKZCharacterMovementComponent::RestoreStrafe(const FKZStrafeSimulation& State)
+{
+	Strafe = State;
+	// Set again by the next move
+	Strafe.SetTelemetry(nullptr);
+}
+
+void UKZCharacterMovementComponent::UpdateFromCompressedFlags(uint8 Flags)
+{
+	Super::UpdateFromCompressedFlags(Flags);
+
+	StrafeDirection = (Flags & FSavedMove_KZ::FLAG_StrafeLeft) ? -1 : ((Flags & FSavedMove_KZ::FLAG_StrafeRight) ? 1 : 0);
+	TurnClass = EKZTurnClass(((Flags & FSavedMove_KZ::FLAG_TurnClass0) ? 1 : 0) | ((Flags & FSavedMove_KZ::FLAG_TurnClass1) ? 2 : 0));
+}
+
+FNetworkPredictionData_Client* UKZCharacterMovementComponent::GetPredictionData_Client() const
+{
+	if (ClientPredictionData == nullptr)
+	{
+		UKZCharacterMovementComponent* MutableThis = const_cast<UKZCharacterMovementComponent*>(this);
+		MutableThis->ClientPredictionData = new FNetworkPredictionData_Client_KZ(*this);
+	}
+	return ClientPredictionData;
+}
+
+void UKZCharacterMovementComponent::ClientAdjustPosition_Implementation(float TimeStamp, FVector NewLoc, FVector NewVel, UPrimitiveComponent* NewBase, FName NewBaseBoneName, bool bHasBase, bool bBaseRelativePosition, uint8 ServerMovementMode)
+{
+	if (!bApplyingShortCorrection)
+		CountClientCorrection();
+
+	Super::ClientAdjustPosition_Implementation(TimeStamp, NewLoc, NewVel, NewBase, NewBaseBoneName, bHasBase, bBaseRelativePosition, ServerMovementMode);
+}
+
+void UKZCharacterMovementComponent::ClientVeryShortAdjustPosition_Implementation(float TimeStamp, FVector NewLoc, UPrimitiveComponent* NewBase, FName NewBaseBoneName, bool bHasBase, bool bBaseRelativePosition, uint8 ServerMovementMode)
+{
+	CountClientCorrection();
+
+	TGuardValue<bool> ShortCorrection(bApplyingShortCorrection, true);
+	Super::ClientVeryShortAdjustPosition_Implementation(TimeStamp, NewLoc, NewBase, NewBaseBoneName, bHasBase, bBaseRelativePosition, ServerMovementMode);
+}
+
+void UKZCharacterMovementComponent::CountClientCorrection()
+{
+	++NumClientCorrections;
+	INC_DWORD_STAT(STAT_KZClientCorrections);
+	if (GetWorld()->GetTimeSeconds() - LastTeleportTime < KZMovement::TeleportCorrectionWindow)
+	{
+		++NumTeleportCorrections;
+		INC_DWORD_STAT(STAT_KZTeleportCorrections);
+	}
+}
+
+bool UKZCharacterMovementComponent::ClientUpdatePositionAfterServerUpdate()
+{
+	FNetworkPredictionData_Client_Character* ClientData = HasValidData() ? GetPredictionData_Client_Character() : nullptr;
+	if (ClientData == nullptr || !ClientData->bUpdatePosition)
+		return Super::ClientUpdatePositionAfterServerUpdate();
+
+	// The saved moves are replayed from the corrected one, so is the strafe simulation
+	if (const FSavedMove_KZ* CorrectedMove = static_cast<const FSavedMove_KZ*>(ClientData->LastAckedMove.Get()))
+		RestoreStrafe(CorrectedMove->StrafeAfterMove);
+
+	// Replayed moves set the strafe input from their flags, the input of the move about to be made is put back afterwards
+	const int8 NewStrafeDirection = StrafeDirection;
+	const EKZTurnClass NewTurnClass = TurnClass;
+	const bool bResult = Super::ClientUpdatePositionAfterServerUpdate();
+	StrafeDirection = NewStrafeDirection;
+	TurnClass = NewTurnClass;
+	return bResult;
+}
+
+void UKZCharacterMovementComponent::OnRep_ServerStrafeState()
+{
+	FNetworkPredictionData_Client_Character* ClientData = HasValidData() ? GetPredictionData_Client_Character() : nullptr;
+	if (ClientData == nullptr)
+		return;
+
+	// The corrected move is acknowledged by now, or still waiting for its correction if the RPC is behind
+	FSavedMove_KZ* CorrectedMove = nullptr;
+	int32 FirstLaterMove = 0;
+	if (ClientData->LastAckedMove.IsValid() && ClientData->LastAckedMove->TimeStamp == ServerStrafeState.TimeStamp)
+	{
+		CorrectedMove = static_cast<FSavedMove_KZ*>(ClientData->LastAckedMove.Get());
+	}
+	else
+	{
+		const int32 MoveIndex = ClientData->SavedMoves.IndexOfByPredicate([this](const FSavedMovePtr& Move) { return Move->TimeStamp == ServerStrafeState.TimeStamp; });
+		if (MoveIndex == INDEX_NONE)
+			return;
+		CorrectedMove = static_cast<FSavedMove_KZ*>(ClientData->SavedMoves[MoveIndex].Get());
+		FirstLaterMove = MoveIndex + 1;
+	}
+
+	// Below the speed cap the gain of a step does not depend on the speed, so shifting every later state by the error is replaying from the server's
+	const float SpeedError = ServerStrafeState.Speed - CorrectedMove->StrafeAfterMove.GetSpeed();
+	if (FMath::Abs(SpeedError) < KZMovement::StrafeSpeedTolerance)
+		return;
+
+	++NumStrafeResyncs;
+	CorrectedMove->StrafeAfterMove.OffsetSpeed(SpeedError);
+	for (int32 MoveIndex = FirstLaterMove; MoveIndex < ClientData->SavedMoves.Num(); ++MoveIndex)
+	{
+		FSavedMove_KZ* Move = static_cast<FSavedMove_KZ*>(ClientData->SavedMoves[MoveIndex].Get());
+		Move->StrafeBeforeMove.OffsetSpeed(SpeedError);
+		Move->StrafeAfterMove.OffsetSpeed(SpeedError);
+	}
+	Strafe.OffsetSpeed(SpeedError);
+}
+
+void UKZCharacterMovementComponent::ServerMoveHandleClientError(float ClientTimeStamp, float DeltaTime, const FVector& Accel, const FVector& RelativeClientLocation, UPrimitiveComponent* ClientMovementBase, FName ClientBaseBoneName, uint8 ClientMovementMode)
+{
+	Super::ServerMoveHandleClientError(ClientTimeStamp, DeltaTime, Accel, RelativeClientLocation, ClientMovementBase, ClientBaseBoneName, ClientMovementMode);
+
+	FNetworkPredictionData_Server_Character* ServerData = GetPredictionData_Server_Character();
+	if (ServerData && ServerData->PendingAdjustment.TimeStamp == ClientTimeStamp && !ServerData->PendingAdjustment.bAckGoodMove)
+	{
+		// A client that missed our crossing reports locations from the other side of the portal until the teleport event
+		// reaches it, and the event carries it through without a correction
+		if (ClientMovementBase == nullptr && IsAwaitingTeleportFixup(RelativeClientLocation))
+		{
+			ServerData->PendingAdjustment.bAckGoodMove = true;
+			return;
+		}
+
+		// The correction carries the position after this move, the strafe speed goes along with it
+		ServerStrafeState.TimeStamp = ClientTimeStamp;
+		ServerStrafeState.Speed = Strafe.GetSpeed();
+	}
+}
+
+void UKZCharacterMovementComponent::SendClientAdjustment()
+{
+	const FNetworkPredictionData_Server_Character* ServerData = HasValidData() ? GetPredictionData_Server_Character() : nullptr;
+	if (ServerData && ServerData->PendingAdjustment.TimeStamp > 0.f && !ServerData->PendingAdjustment.bAckGoodMove)
+	{
+		++NumServerCorrections;
+		INC_DWORD_STAT(STAT_KZServerCorrections);
+		if (GetWorld()->GetTimeSeconds() - LastTeleportTime < KZMovement::TeleportCorrectionWindow)
+		{
+			++NumTeleportCorrections;
+			INC_DWORD_STAT(STAT_KZTeleportCorrections);
+		}
+	}
+
+	Super::SendClientAdjustment();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// FSavedMove_KZ
+
+void FSavedMove_KZ::Clear()
+{
+	Super::Clear();
+
+	StrafeDirection = 0;
+	TurnClass = EKZTurnClass::None;
+	Portals.Reset();
+	bRevertStrafe = false;
+}
+
+uint8 FSavedMove_KZ::GetCompressedFlags() const
+{
+	uint8 Flags = Super::GetCompressedFlags();
+
+	if (StrafeDirection < 0)
+		Flags |= FLAG_StrafeLeft;
+	else if (StrafeDirection > 0)
+		Flags |= FLAG_StrafeRight;
+
+	if ((uint8)TurnClass & 1)
+		Flags |= FLAG_TurnClass0;
+	if ((uint8)TurnClass & 2)
+		Flags |= FLAG_TurnClass1;
+
+	return Flags;
+}
+
+bool FSavedMove_KZ::CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* Character, float MaxDelta) const
+{
+	// A combined move would be run again from before the portal, the crossing must stay in its own move
+	if (Portals.Num() > 0)
+		return false;
+
+	FSavedMove_KZ* NewKZMove = static_cast<FSavedMove_KZ*>(NewMove.Get());
+	if (StrafeDirection != NewKZMove->StrafeDirection || TurnClass != NewKZMove->TurnClass)
+		return false;
+
+	if (!Super::CanCombineWith(NewMove, Character, MaxDelta))
+		return false;
+
+	// A combined move is run again from this move's start, the strafe simulation has to go back there with the character
+	NewKZMove->bRevertStrafe = true;
+	NewKZMove->RevertStrafe = StrafeBeforeMove;
+	return true;
+}
+
+void FSavedMove_KZ::SetMoveFor(ACharacter* Character, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData)
+{
+	Super::SetMoveFor(Character, InDeltaTime, NewAccel, ClientData);
+
+	if (const UKZCharacterMovementComponent* Movement = Cast<UKZCharacterMovementComponent>(Character->GetCharacterMovement()))
+	{
+		StrafeDirection = Movement->StrafeDirection;
+		TurnClass = Movement->TurnClass;
+	}
+}
+
+void FSavedMove_KZ::SetInitialPosition(ACharacter* Character)
+{
+	Super::SetInitialPosition(Character);
+
+	UKZCharacterMovementComponent* Movement = Cast<UKZCharacterMovementComponent>(Character->GetCharacterMovement());
+	if (Movement == nullptr)
+		return;
+
+	// Called again once the character is reverted for a combined move
+	if (bRevertStrafe)
+	{
+		Movement->RestoreStrafe(RevertStrafe);
+		bRevertStrafe = false;
+	}
+	StrafeBeforeMove = Movement->Strafe;
+}
+
+void FSavedMove_KZ::PostUpdate(ACharacter* Character, EPostUpdateMode PostUpdateMode)
+{
+	Super::PostUpdate(Character, PostUpdateMode);
+
+	const UKZCharacterMovementComponent* Movement = Cast<UKZCharacterMovementComponent>(Character->GetCharacterMovement());
+	if (Movement == nullptr)
+		return;
+
+	StrafeAfterMove = Movement->Strafe;
+	// Replays keep the crossings the server confirms
+	if (PostUpdateMode == PostUpdate_Record)
+		Portals = Movement->MovePortals;
+}
@@ -0,0 +1,248 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/CharacterMovementComponent.h"
+#include "KZStrafeSimulation.h"
+#include "KZCharacterMovementComponent.generated.h"
+
+class APortalC;
+class FKZStrafeTelemetry;
+
+/** How a move turned relative to its strafe direction, the part of the turn input that decides the speed gain */
+enum class EKZTurnClass : uint8
+{
+	/** Not turning, or turning away from the strafe direction */
+	None,
+	/** Turning into the strafe direction below the sync turn speed */
+	Slow,
+	Sync,
+	/** Turning into the strafe direction at or above the maximum sync turn speed */
+	Fast,
+};
+
+/** Strafe speed of the server after a corrected move, so the client can pick up the authoritative speed with the correction */
+USTRUCT()
+struct FKZServerStrafeState
+{
+	GENERATED_BODY()
+
+	/** Client time stamp of the corrected move */
+	UPROPERTY()
+	float TimeStamp = 0.f;
+
+	UPROPERTY()
+	float Speed = 0.f;
+};
+
+/** A move of the owning client that crossed portals on the server, sent in place of a correction with the full transform */
+USTRUCT()
+struct FKZPortalTeleport
+{
+	GENERATED_BODY()
+
+	/** Client time stamp of the move */
+	UPROPERTY()
+	float TimeStamp = 0.f;
+
+	/** Portals entered by the move in order, the character came out of the PortalToCPP of the last. Null on a client a portal does not exist on */
+	UPROPERTY()
+	TArray<APortalC*> Portals;
+
+	/** Location after the move in the frame of the last exit portal */
+	UPROPERTY()
+	FVector_NetQuantize10 ExitOffset;
+};
+
+/**
+ * Character movement that runs the KZ strafe simulation as part of every move.
+ * The strafe direction and turn class of a move travel in the custom compressed flags of its saved move, so the server, the
+ * owning client and client replays advance the same strafe simulation from the same move inputs and time, and reach the same
+ * speed cap without sending anything beyond the flags byte every move already has. The rare correction also sends the
+ * server's strafe speed.
+ * Portal crossings are predicted by the owning client and confirmed by a small event from the server. A client that missed
+ * a crossing carries its move history through the portal on the event, and the server does not correct it meanwhile.
+ */
+UCLASS()
+class FPSCPPTEMPLATE_API UKZCharacterMovementComponent : public UCharacterMovementComponent
+{
+	GENERATED_BODY()
+
+	friend class FSavedMove_KZ;
+
+public:
+	UKZCharacterMovementComponent();
+
+	/** Turn axis input of the owning character, summed until the next move */
+	FORCEINLINE void AddTurnInput(float TurnInput) { PendingTurnInput += TurnInput; }
+
+	/** Normalized MoveRight axis input of the owning character, held until it changes */
+	FORCEINLINE void SetStrafeInput(float StrafeInput) { PendingStrafeInput = StrafeInput; }
+
+	/** Clears the strafe simulation and sets the strafe speed */
+	void ResetStrafe(float Speed);
+
+	FORCEINLINE void ResetSyncRate() { Strafe.ResetSyncRate(); }
+
+	FORCEINLINE const FKZStrafeSimulation& GetStrafe() const { return Strafe; }
+
+	/** Every strafe step of new moves is sampled into Telemetry, nullptr to stop. Replayed moves are not sampled again */
+	FORCEINLINE void SetStrafeTelemetry(FKZStrafeTelemetry* Telemetry) { StrafeTelemetry = Telemetry; }
+
+	/** Position corrections received, on the owning client */
+	FORCEINLINE int32 GetNumClientCorrections() const { return NumClientCorrections; }
+
+	/** Position corrections sent, on the server */
+	FORCEINLINE int32 GetNumServerCorrections() const { return NumServerCorrections; }
+
+	/** Corrections after which the client strafe speed differed from the server's */
+	FORCEINLINE int32 GetNumStrafeResyncs() const { return NumStrafeResyncs; }
+
+	/** Moves that crossed portals, predicted ones on the owning client */
+	FORCEINLINE int32 GetNumTeleports() const { return NumTeleports; }
+
+	/** Corrections received or sent shortly after a teleport */
+	FORCEINLINE int32 GetNumTeleportCorrections() const { return NumTeleportCorrections; }
+
+	/** Predicted crossings of the owning client the server confirmed */
+	FORCEINLINE int32 GetNumConfirmedTeleports() const { return NumConfirmedTeleports; }
+
+	/** Crossings of the server the owning client missed and caught up with from the teleport event */
+	FORCEINLINE int32 GetNumTeleportFixups() const { return NumTeleportFixups; }
+
+	/** True while saved moves are replayed after a correction, side effects of the first run like view changes must not repeat */
+	FORCEINLINE bool IsReplayingMoves() const { return bClientUpdating; }
+
+	/** Called by the character after its current move crossed portals, Entries being the ones entered in order */
+	void OnPortalCrossings(const TArray<const APortalC*, TInlineAllocator<4>>& Entries);
+
+	// UActorComponent
+	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
+	// UCharacterMovementComponent
+	virtual void UpdateFromCompressedFlags(uint8 Flags) override;
+	virtual FNetworkPredictionData_Client* GetPredictionData_Client() const override;
+	virtual void ClientAdjustPosition_Implementation(float TimeStamp, FVector NewLoc, FVector NewVel, UPrimitiveComponent* NewBase, FName NewBaseBoneName, bool bHasBase, bool bBaseRelativePosition, uint8 ServerMovementMode) override;
+	virtual void ClientVeryShortAdjustPosition_Implementation(float TimeStamp, FVector NewLoc, UPrimitiveComponent* NewBase, FName NewBaseBoneName, bool bHasBase, bool bBaseRelativePosition, uint8 ServerMovementMode) override;
+	virtual void ServerMoveHandleClientError(float ClientTimeStamp, float DeltaTime, const FVector& Accel, const FVector& RelativeClientLocation, UPrimitiveComponent* ClientMovementBase, FName ClientBaseBoneName, uint8 ClientMovementMode) override;
+	virtual void SendClientAdjustment() override;
+
+protected:
+	virtual void PerformMovement(float DeltaTime) override;
+	virtual bool ClientUpdatePositionAfterServerUpdate() override;
+
+	/** Turns the input gathered since the last move into the strafe direction and turn class of the next move */
+	void UpdateStrafeInput(float DeltaTime);
+
+	/** Replaces the strafe simulation state with one saved by a move */
+	void RestoreStrafe(const FKZStrafeSimulation& State);
+
+	UFUNCTION()
+	void OnRep_ServerStrafeState();
+
+	/** Confirms the crossings of a move to the owning client, or carries the client through the portals if it missed them. Reliable, as missing it costs corrections */
+	UFUNCTION(Client, Reliable)
+	void ClientPortalTeleport(const FKZPortalTeleport& Teleport);
+
+	/** True if the client location reported for a move is ours carried back through the portals the server's last move crossed */
+	bool IsAwaitingTeleportFixup(const FVector& ClientLocation) const;
+
+	/** Pair matrices of the crossings of Entries combined in order */
+	static FMatrix GetPortalPathMatrix(const TArray<const APortalC*, TInlineAllocator<4>>& Entries);
+
+	/** Counts a correction received by the owning client */
+	void CountClientCorrection();
+
+	/** Strafe settings of the owning character */
+	FKZStrafeSettings GetStrafeSettings() const;
+
+	/** Turn speed every move of the given class runs the strafe simulation with, identical on the server and the client */
+	static float GetMoveTurnSpeed(int8 Direction, EKZTurnClass TurnClass, const FKZStrafeSettings& Settings);
+
+	FKZStrafeSimulation Strafe;
+
+	/** Inputs of the current move, from the local input or the compressed flags of a received or replayed move */
+	int8 StrafeDirection;
+	EKZTurnClass TurnClass;
+
+	float PendingTurnInput;
+	float PendingStrafeInput;
+
+	UPROPERTY(ReplicatedUsing = OnRep_ServerStrafeState)
+	FKZServerStrafeState ServerStrafeState;
+
+	FKZStrafeTelemetry* StrafeTelemetry;
+
+	/** Set within PerformMovement, portal crossings outside of it are not part of a move */
+	bool bPerformingMove;
+
+	/** Portals entered by the current move, for its saved move */
+	TArray<const APortalC*, TInlineAllocator<4>> MovePortals;
+
+	/** Pair matrices of the last move's crossings combined, for the server to recognize client locations from before them */
+	FMatrix ServerTeleportMatrix;
+	float ServerTeleportTolerance;
+
+	/** World time of the last crossing */
+	float LastTeleportTime;
+
+	/** Set while a very short correction, already counted, is applied as a full one */
+	bool bApplyingShortCorrection;
+
+	int32 NumClientCorrections;
+	int32 NumServerCorrections;
+	int32 NumStrafeResyncs;
+	int32 NumTeleports;
+	int32 NumTeleportCorrections;
+	int32 NumConfirmedTeleports;
+	int32 NumTeleportFixups;
+};
+
+/** Saved move carrying the strafe input of the move in the custom compressed flags */
+class FPSCPPTEMPLATE_API FSavedMove_KZ : public FSavedMove_Character
+{
+public:
+	typedef FSavedMove_Character Super;
+
+	enum EStrafeFlags : uint8
+	{
+		FLAG_StrafeLeft = FLAG_Custom_0,
+		FLAG_StrafeRight = FLAG_Custom_1,
+		/** Two bits of EKZTurnClass */
+		FLAG_TurnClass0 = FLAG_Custom_2,
+		FLAG_TurnClass1 = FLAG_Custom_3,
+	};
+
+	virtual void Clear() override;
+	virtual uint8 GetCompressedFlags() const override;
+	virtual bool CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* Character, float MaxDelta) const override;
+	virtual void SetMoveFor(ACharacter* Character, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData) override;
+	virtual void SetInitialPosition(ACharacter* Character) override;
+	virtual void PostUpdate(ACharacter* Character, EPostUpdateMode PostUpdateMode) override;
+
+	int8 StrafeDirection = 0;
+	EKZTurnClass TurnClass = EKZTurnClass::None;
+
+	/** Strafe simulation before and after the move, to revert combined moves and to replay from corrections */
+	FKZStrafeSimulation StrafeBeforeMove;
+	FKZStrafeSimulation StrafeAfterMove;
+
+	/** Portals entered by the move in order, moves that crossed are never combined. Only compared against */
+	TArray<const APortalC*, TInlineAllocator<4>> Portals;
+
+	/** Set when this move is combined with the pending move, whose start state the strafe simulation is reverted to */
+	bool bRevertStrafe = false;
+	FKZStrafeSimulation RevertStrafe;
+};
+
+class FPSCPPTEMPLATE_API FNetworkPredictionData_Client_KZ : public FNetworkPredictionData_Client_Character
+{
+public:
+	typedef FNetworkPredictionData_Client_Character Super;
+
+	FNetworkPredictionData_Client_KZ(const UCharacterMovementComponent& ClientMovement) : Super(ClientMovement) {}
+
+	virtual FSavedMovePtr AllocateNewMove() override { return FSavedMovePtr(new FSavedMove_KZ()); }
+};
@@ -0,0 +1,152 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZDebugOverlay.h"
+#include "KZBenchmark.h"
+#include "CanvasItem.h"
+#include "Engine/Canvas.h"
+#include "Engine/Engine.h"
+#include "Engine/Font.h"
+#include "Misc/App.h"
+
+namespace KZDebugOverlay
+{
+	/** Channels and graphs stay up this many frames after their last update */
+	static const uint64 VisibleFrames = 2;
+
+	static const float GraphWidth = 256.f;
+	static const float GraphHeight = 48.f;
+
+	/** On-screen message key of the first channel, each channel replaces its own message */
+	static const int32 OnScreenChannelKey = 0x4B5A0000;
+}
+
+FKZDebugOverlay::FKZDebugOverlay(bool bInOnScreenMessages)
+	: bOnScreenMessages(bInOnScreenMessages)
+	, NextMessage(0)
+{
+	for (FLine& Line : Channels)
+		Line.Text[0] = 0;
+	for (FLine& Line : Messages)
+		Line.Text[0] = 0;
+	for (FGraph& Graph : Graphs)
+		Graph.Caption.Text[0] = 0;
+	GraphText[0] = 0;
+}
+
+void FKZDebugOverlay::AddGraphSample(EKZDebugGraph GraphIndex, float Value)
+{
+	FGraph& Graph = Graphs[(int32)GraphIndex];
+	Graph.Samples[Graph.Head] = Value;
+	Graph.Head = (Graph.Head + 1) % GraphSamples;
+	Graph.Num = FMath::Min(Graph.Num + 1, GraphSamples);
+	Graph.Frame = GFrameCounter;
+}
+
+bool FKZDebugOverlay::IsRecent(uint64 Frame)
+{
+	return Frame != 0 && GFrameCounter - Frame < KZDebugOverlay::VisibleFrames;
+}
+
+void FKZDebugOverlay::ShowOnScreenChannel(EKZDebugChannel Channel) const
+{
+	// Shown as long as the overlay would show it, set again every frame while its debug flag is
+	const FLine& Line = Channels[(int32)Channel];
+	if (GEngine)
+		GEngine->AddOnScreenDebugMessage(KZDebugOverlay::OnScreenChannelKey + (int32)Channel, FApp::GetDeltaTime() * KZDebugOverlay::VisibleFrames, Line.Color, Line.Text);
+}
+
+void FKZDebugOverlay::ShowOnScreenMessage(const FLine& Line, float Duration) const
+{
+	if (GEngine)
+		GEngine->AddOnScreenDebugMessage(INDEX_NONE, Duration, Line.Color, Line.Text);
+}
+
+void FKZDebugOverlay::Draw(UCanvas* Canvas, float X, float Y)
+{
+	if (Canvas == nullptr || GEngine == nullptr || GEngine->GetSmallFont() == nullptr)
+		return;
+
+	KZ_BENCHMARK_SCOPE(DebugOverlay);
+	for (FLine& Line : Channels)
+	{
+		if (IsRecent(Line.Frame))
+			Y += DrawLine(Canvas, Line, X, Y);
+	}
+
+	static const TCHAR* GraphLabels[(int32)EKZDebugGraph::Num] = { TEXT("Speed"), TEXT("Frame ms") };
+	for (int32 GraphIndex = 0; GraphIndex < (int32)EKZDebugGraph::Num; ++GraphIndex)
+	{
+		if (IsRecent(Graphs[GraphIndex].Frame))
+			Y += DrawGraph(Canvas, Graphs[GraphIndex], GraphLabels[GraphIndex], X, Y, KZDebugOverlay::GraphWidth, KZDebugOverlay::GraphHeight);
+	}
+
+	// Newest message first
+	const double Now = FPlatformTime::Seconds();
+	for (int32 Age = 1; Age <= MaxMessages; ++Age)
+	{
+		FLine& Line = Messages[(NextMessage - Age + MaxMessages) % MaxMessages];
+		if (Line.ExpireTime > Now)
+			Y += DrawLine(Canvas, Line, X, Y);
+	}
+}
+
+float FKZDebugOverlay::DrawLine(UCanvas* Canvas, FLine& Line, float X, float Y)
+{
+	// A line that did not change is drawn from the text built for it before, without allocating
+	if (Line.bTextChanged)
+	{
+		Line.DisplayText = FText::FromString(Line.Text);
+		Line.bTextChanged = false;
+	}
+
+	const UFont* Font = GEngine->GetSmallFont();
+	FCanvasTextItem Item(FVector2D(X, Y), Line.DisplayText, Font, Line.Color);
+	Item.EnableShadow(FLinearColor::Black);
+	Canvas->DrawItem(Item);
+	return Font->GetMaxCharHeight();
+}
+
+float FKZDebugOverlay::DrawGraph(UCanvas* Canvas, FGraph& Graph, const TCHAR* Label, float X, float Y, float Width, float Height)
+{
+	const int32 First = (Graph.Head - Graph.Num + GraphSamples) % GraphSamples;
+	float Min = Graph.Samples[First];
+	float Max = Min;
+	for (int32 Index = 1; Index < Graph.Num; ++Index)
+	{
+		const float Value = Graph.Samples[(First + Index) % GraphSamples];
+		Min = FMath::Min(Min, Value);
+		Max = FMath::Max(Max, Value);
+	}
+
+	const float Last = Graph.Samples[(Graph.Head - 1 + GraphSamples) % GraphSamples];
+	FCString::Snprintf(GraphText, MaxLineLength, TEXT("%s %.1f (%.1f - %.1f)"), Label, Last, Min, Max);
+	if (FCString::Strcmp(GraphText, Graph.Caption.Text) != 0)
+	{
+		FCString::Strcpy(Graph.Caption.Text, GraphText);
+		Graph.Caption.bTextChanged = true;
+	}
+	const float TextHeight = DrawLine(Canvas, Graph.Caption, X, Y);
+	Y += TextHeight;
+
+	FCanvasTileItem Background(FVector2D(X, Y), FVector2D(Width, Height), FLinearColor(0.f, 0.f, 0.f, 0.5f));
+	Background.BlendMode = SE_BLEND_Translucent;
+	Canvas->DrawItem(Background);
+
+	// Samples fill the width from the left, scaled to the range in view
+	const float Range = FMath::Max(Max - Min, KINDA_SMALL_NUMBER);
+	const float Step = Width / (GraphSamples - 1);
+	FCanvasLineItem Line;
+	Line.SetColor(FLinearColor::Green);
+	FVector2D Previous(X, Y + Height * (1.f - (Graph.Samples[First] - Min) / Range));
+	for (int32 Index = 1; Index < Graph.Num; ++Index)
+	{
+		const float Value = Graph.Samples[(First + Index) % GraphSamples];
+		const FVector2D Point(X + Index * Step, Y + Height * (1.f - (Value - Min) / Range));
+		Line.Origin = FVector(Previous, 0.f);
+		Line.EndPos = FVector(Point, 0.f);
+		Canvas->DrawItem(Line);
+		Previous = Point;
+	}
+
+	return TextHeight + Height + 4.f;
+}
@@ -0,0 +1,124 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CoreGlobals.h"
+
+class UCanvas;
+class UFont;
+
+/** Lines of the overlay refreshed every frame while their debug flag is set, in drawing order */
+enum class EKZDebugChannel : uint8
+{
+	Speed,
+	SyncRate,
+	TurnRate,
+	PortalCaptures,
+	PortalLinks,
+	Num
+};
+
+enum class EKZDebugGraph : uint8
+{
+	Speed,
+	FrameTime,
+	Num
+};
+
+/**
+ * Screen debug text and graphs drawn by AFPSCppTemplateHUD, replacing per-frame AddOnScreenDebugMessage calls.
+ * Channels, timed messages and graph samples live in fixed-size buffers. Every line is drawn as one text item from the
+ * display text it keeps, which is only rebuilt when the line's text changed, so a steady overlay allocates nothing.
+ * Drawing is timed in the DebugOverlay section of the KZ benchmark.
+ * An overlay made for on-screen messages forwards its text to AddOnScreenDebugMessage instead, for players without the HUD.
+ */
+class FPSCPPTEMPLATE_API FKZDebugOverlay
+{
+public:
+	static const int32 MaxLineLength = 128;
+	static const int32 MaxMessages = 12;
+	static const int32 GraphSamples = 128;
+
+	/** @param bInOnScreenMessages	Show channels and messages as engine on-screen debug messages, graphs are not shown */
+	explicit FKZDebugOverlay(bool bInOnScreenMessages = false);
+
+	/** Sets the text of Channel for this frame, printf style. Channels not set for a few frames are hidden */
+	template <typename FmtType, typename... Types>
+	void SetChannel(EKZDebugChannel Channel, const FColor& Color, const FmtType& Format, Types... Args)
+	{
+		FLine& Line = Channels[(int32)Channel];
+		FCString::Snprintf(Line.Text, MaxLineLength, Format, Args...);
+		Line.bTextChanged = true;
+		Line.Color = Color;
+		Line.Frame = GFrameCounter;
+		if (bOnScreenMessages)
+			ShowOnScreenChannel(Channel);
+	}
+
+	/** Shows a printf style message for Duration seconds, the oldest message is replaced once all slots are used */
+	template <typename FmtType, typename... Types>
+	void AddMessage(float Duration, const FColor& Color, const FmtType& Format, Types... Args)
+	{
+		FLine& Line = Messages[NextMessage];
+		NextMessage = (NextMessage + 1) % MaxMessages;
+		FCString::Snprintf(Line.Text, MaxLineLength, Format, Args...);
+		Line.bTextChanged = true;
+		Line.Color = Color;
+		Line.ExpireTime = FPlatformTime::Seconds() + Duration;
+		if (bOnScreenMessages)
+			ShowOnScreenMessage(Line, Duration);
+	}
+
+	/** Appends a value to the rolling graph, graphs without samples for a few frames are hidden */
+	void AddGraphSample(EKZDebugGraph Graph, float Value);
+
+	/** Draws everything visible with its top left corner at X, Y */
+	void Draw(UCanvas* Canvas, float X, float Y);
+
+private:
+	struct FLine
+	{
+		TCHAR Text[MaxLineLength];
+		FColor Color = FColor::White;
+		uint64 Frame = 0;
+		double ExpireTime = 0.;
+
+		/** Text as drawn, rebuilt from Text on the next draw when it changed */
+		FText DisplayText;
+		bool bTextChanged = false;
+	};
+
+	struct FGraph
+	{
+		float Samples[GraphSamples];
+		int32 Head = 0;
+		int32 Num = 0;
+		uint64 Frame = 0;
+
+		/** Label and value line of the graph */
+		FLine Caption;
+	};
+
+	/** Draws Line as one text item, returns the line height */
+	float DrawLine(UCanvas* Canvas, FLine& Line, float X, float Y);
+
+	/** Draws Graph as a line strip in a Width x Height box, returns the height used */
+	float DrawGraph(UCanvas* Canvas, FGraph& Graph, const TCHAR* Label, float X, float Y, float Width, float Height);
+
+	static bool IsRecent(uint64 Frame);
+
+	/** Forward a channel or message to the engine on-screen debug messages */
+	void ShowOnScreenChannel(EKZDebugChannel Channel) const;
+	void ShowOnScreenMessage(const FLine& Line, float Duration) const;
+
+	bool bOnScreenMessages;
+
+	FLine Channels[(int32)EKZDebugChannel::Num];
+	FLine Messages[MaxMessages];
+	int32 NextMessage;
+	FGraph Graphs[(int32)EKZDebugGraph::Num];
+
+	/** Graph captions are formatted here at draw time and only copied to the caption when they differ */
+	TCHAR GraphText[MaxLineLength];
+};
@@ -0,0 +1,320 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZFootstepComponent.h"
+#include "FPSCppTemplate.h"
+#include "KZAssetLoader.h"
+#include "KZBenchmark.h"
+#include "Components/AudioComponent.h"
+#include "Components/CapsuleComponent.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/Character.h"
+#include "GameFramework/CharacterMovementComponent.h"
+#include "Materials/MaterialInterface.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#include "Sound/SoundAttenuation.h"
+#include "Sound/SoundBase.h"
+#include "Sound/SoundCue.h"
+#include "Sound/SoundNodeSwitch.h"
+
+DECLARE_CYCLE_STAT(TEXT("Footsteps"), STAT_KZFootstepUpdate, STATGROUP_KZ);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Footsteps Played"), STAT_KZFootsteps, STATGROUP_KZ);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Footstep Floor Traces"), STAT_KZFootstepTraces, STATGROUP_KZ);
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZFootsteps, Log, All);
+
+namespace KZFootsteps
+{
+	/** First switch node below Node choosing its input by ParameterName */
+	static const USoundNodeSwitch* FindSwitch(const USoundNode* Node, FName ParameterName)
+	{
+		if (Node == nullptr)
+			return nullptr;
+
+		const USoundNodeSwitch* Switch = Cast<USoundNodeSwitch>(Node);
+		if (Switch && Switch->IntParameterName == ParameterName)
+			return Switch;
+
+		for (const USoundNode* Child : Node->ChildNodes)
+		{
+			if (const USoundNodeSwitch* ChildSwitch = FindSwitch(Child, ParameterName))
+				return ChildSwitch;
+		}
+		return nullptr;
+	}
+}
+
+UKZFootstepComponent::UKZFootstepComponent()
+{
+	PrimaryComponentTick.bCanEverTick = true;
+	PrimaryComponentTick.TickGroup = TG_PostPhysics;
+	PrimaryComponentTick.bStartWithTickEnabled = false;
+
+	bNativeFootsteps = false;
+
+	SurfaceParameterName = TEXT("floor");
+	StrideLength = 150.f;
+	AudioPoolSize = 4;
+
+	Movement = nullptr;
+	LoadedDefaultSound = nullptr;
+	LoadedJumpStartSound = nullptr;
+	LoadedJumpEndSound = nullptr;
+	NextAudio = 0;
+	CachedSurface = INDEX_NONE;
+	bTraceFloor = false;
+	StrideDistance = 0.f;
+	bWasFalling = false;
+	LastLocation = FVector::ZeroVector;
+}
+
+void UKZFootstepComponent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	ACharacter* Character = Cast<ACharacter>(GetOwner());
+	Movement = Character ? Character->GetCharacterMovement() : nullptr;
+	if (!bNativeFootsteps || Movement == nullptr || GetNetMode() == NM_DedicatedServer)
+	{
+		Movement = nullptr;
+		return;
+	}
+
+	// Steps follow the move of the frame
+	AddTickPrerequisiteComponent(Movement);
+
+	TArray<FSoftObjectPath> Assets;
+	Assets.Add(DefaultFootstepSound.ToSoftObjectPath());
+	Assets.Add(JumpStartSound.ToSoftObjectPath());
+	Assets.Add(JumpEndSound.ToSoftObjectPath());
+	Assets.Add(Attenuation.ToSoftObjectPath());
+	for (const FKZFootstepSurface& Surface : Surfaces)
+	{
+		Assets.Add(Surface.PhysicalMaterial.ToSoftObjectPath());
+		Assets.Add(Surface.FootstepSound.ToSoftObjectPath());
+	}
+	FKZAssetLoader::Get().RequestAsyncLoad(Assets, FStreamableDelegate::CreateUObject(this, &UKZFootstepComponent::OnAssetsLoaded));
+}
+
+void UKZFootstepComponent::OnAssetsLoaded()
+{
+	// Play ended before the load finished
+	ACharacter* Character = Cast<ACharacter>(GetOwner());
+	if (Movement == nullptr || Character == nullptr || !HasBegunPlay())
+		return;
+
+	LoadedDefaultSound = DefaultFootstepSound.Get();
+	LoadedJumpStartSound = JumpStartSound.Get();
+	LoadedJumpEndSound = JumpEndSound.Get();
+	for (const FKZFootstepSurface& Surface : Surfaces)
+	{
+		SurfaceMaterials.Add(Surface.PhysicalMaterial.Get());
+		USoundBase* Sound = Surface.FootstepSound.Get();
+		SurfaceSounds.Add(Sound ? Sound : LoadedDefaultSound);
+	}
+
+	// The first input of a switch plays when the parameter is unset, surface N plays input N + 1
+	const USoundCue* DefaultCue = Cast<USoundCue>(LoadedDefaultSound);
+	if (DefaultCue && !SurfaceParameterName.IsNone())
+	{
+		const USoundNodeSwitch* Switch = KZFootsteps::FindSwitch(DefaultCue->FirstNode, SurfaceParameterName);
+		if (Switch == nullptr)
+			UE_LOG(LogKZFootsteps, Warning, TEXT("%s does not switch on %s, footsteps sound the same on every surface"), *DefaultCue->GetName(), *SurfaceParameterName.ToString());
+		else if (Switch->ChildNodes.Num() - 1 != Surfaces.Num())
+			UE_LOG(LogKZFootsteps, Warning, TEXT("%s switches between %d surfaces on %s, %d are configured"), *DefaultCue->GetName(), Switch->ChildNodes.Num() - 1, *SurfaceParameterName.ToString(), Surfaces.Num());
+	}
+
+	USoundAttenuation* AttenuationSettings = Attenuation.Get();
+	const FVector FeetOffset(0.f, 0.f, -Character->GetCapsuleComponent()->GetScaledCapsuleHalfHeight());
+	for (int32 Index = 0; Index < AudioPoolSize; ++Index)
+	{
+		UAudioComponent* Audio = NewObject<UAudioComponent>(Character);
+		Audio->bAutoActivate = false;
+		Audio->bAutoDestroy = false;
+		Audio->AttenuationSettings = AttenuationSettings;
+		Audio->SetupAttachment(Character->GetRootComponent());
+		Audio->SetRelativeLocation(FeetOffset);
+		Audio->RegisterComponent();
+		AudioPool.Add(Audio);
+	}
+
+	TraceDelegate.BindUObject(this, &UKZFootstepComponent::OnFloorTraced);
+	LastLocation = Movement->GetActorFeetLocation();
+	bWasFalling = Movement->IsFalling();
+	SetComponentTickEnabled(true);
+}
+
+void UKZFootstepComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	for (UAudioComponent* Audio : AudioPool)
+	{
+		if (Audio)
+			Audio->DestroyComponent();
+	}
+	AudioPool.Reset();
+
+	TraceDelegate.Unbind();
+	PendingTrace = FTraceHandle();
+	PendingEvents.Reset();
+	Movement = nullptr;
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void UKZFootstepComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZFootstepUpdate);
+	KZ_BENCHMARK_SCOPE(Footsteps);
+
+	const FVector Location = Movement->GetActorFeetLocation();
+	const bool bFalling = Movement->IsFalling();
+	if (bFalling != bWasFalling)
+	{
+		// Walking off a ledge is no jump
+		if (bFalling && Movement->Velocity.Z > 0.f)
+			PlayEvent(EKZFootstepEvent::JumpStart);
+		else if (!bFalling && Movement->IsMovingOnGround())
+			PlayEvent(EKZFootstepEvent::JumpEnd);
+		StrideDistance = 0.f;
+	}
+	else if (Movement->IsMovingOnGround())
+	{
+		// A portal teleport counts as one stride at most
+		StrideDistance += FMath::Min(FVector::Dist2D(Location, LastLocation), StrideLength);
+		if (StrideDistance >= StrideLength)
+		{
+			StrideDistance -= StrideLength;
+			PlayEvent(EKZFootstepEvent::Step);
+		}
+	}
+
+	bWasFalling = bFalling;
+	LastLocation = Location;
+}
+
+void UKZFootstepComponent::PlayEvent(EKZFootstepEvent Event)
+{
+	// Jumps start with the floor already cleared, they play on the floor the character stood on last
+	int32 Surface = CachedSurface;
+	if (Movement && Movement->CurrentFloor.IsWalkableFloor() && !GetFloorSurface(Movement->CurrentFloor, Surface))
+	{
+		PendingEvents.Add(Event);
+		return;
+	}
+
+	Play(Event, Surface);
+}
+
+bool UKZFootstepComponent::GetFloorSurface(const FFindFloorResult& Floor, int32& OutSurface)
+{
+	const UPrimitiveComponent* FloorComponent = Floor.HitResult.Component.Get();
+	if (FloorComponent == nullptr)
+	{
+		OutSurface = CachedSurface;
+		return true;
+	}
+
+	if (FloorComponent != CachedFloor.Get())
+	{
+		CachedFloor = FloorComponent;
+		const UPhysicalMaterial* PhysicalMaterial = GetSinglePhysicalMaterial(FloorComponent);
+		bTraceFloor = PhysicalMaterial == nullptr;
+		if (!bTraceFloor)
+			CachedSurface = FindSurface(PhysicalMaterial);
+	}
+
+	if (!bTraceFloor)
+	{
+		OutSurface = CachedSurface;
+		return true;
+	}
+
+	// The movement sweeps do not return materials, the point the floor was found at is traced for it
+	if (!PendingTrace.IsValid())
+	{
+		FCollisionQueryParams Params(SCENE_QUERY_STAT(KZFootstepFloor), true, GetOwner());
+		Params.bReturnPhysicalMaterial = true;
+		const FVector TraceOffset(0.f, 0.f, 10.f);
+		PendingTrace = GetWorld()->AsyncLineTraceByChannel(EAsyncTraceType::Single, Floor.HitResult.ImpactPoint + TraceOffset,
+			Floor.HitResult.ImpactPoint - TraceOffset, Movement->UpdatedComponent->GetCollisionObjectType(), Params,
+			FCollisionResponseParams::DefaultResponseParam, &TraceDelegate);
+		INC_DWORD_STAT(STAT_KZFootstepTraces);
+	}
+	return false;
+}
+
+const UPhysicalMaterial* UKZFootstepComponent::GetSinglePhysicalMaterial(const UPrimitiveComponent* Component)
+{
+	// With several materials only a trace tells which one is underfoot
+	if (Component->GetNumMaterials() > 1)
+		return nullptr;
+
+	const UMaterialInterface* Material = Component->GetMaterial(0);
+	return Material ? Material->GetPhysicalMaterial() : nullptr;
+}
+
+int32 UKZFootstepComponent::FindSurface(const UPhysicalMaterial* PhysicalMaterial) const
+{
+	// A handful of surfaces, looked up only when the floor changes
+	return PhysicalMaterial ? SurfaceMaterials.IndexOfByKey(PhysicalMaterial) : INDEX_NONE;
+}
+
+void UKZFootstepComponent::OnFloorTraced(const FTraceHandle& Handle, FTraceDatum& Datum)
+{
+	if (Handle != PendingTrace)
+		return;
+	PendingTrace = FTraceHandle();
+
+	for (const FHitResult& Hit : Datum.OutHits)
+	{
+		if (Hit.bBlockingHit)
+		{
+			CachedSurface = FindSurface(Hit.PhysMaterial.Get());
+			break;
+		}
+	}
+
+	for (EKZFootstepEvent Event : PendingEvents)
+		Play(Event, CachedSurface);
+	PendingEvents.Reset();
+}
+
+void UKZFootstepComponent::Play(EKZFootstepEvent Event, int32 Surface)
+{
+	PlaySound(SurfaceSounds.IsValidIndex(Surface) ? SurfaceSounds[Surface] : LoadedDefaultSound, Surface);
+	if (Event == EKZFootstepEvent::JumpStart)
+		PlaySound(LoadedJumpStartSound, Surface);
+	else if (Event == EKZFootstepEvent::JumpEnd)
+		PlaySound(LoadedJumpEndSound, Surface);
+
+	INC_DWORD_STAT(STAT_KZFootsteps);
+	if (FKZBenchmarkRecorder::bRecording)
+		++FKZBenchmarkRecorder::Footsteps;
+}
+
+void UKZFootstepComponent::PlaySound(USoundBase* Sound, int32 Surface)
+{
+	if (Sound == nullptr || AudioPool.Num() == 0)
+		return;
+
+	// First idle component after the last one started, so a busy pool takes over the one started the longest ago
+	int32 Index = NextAudio;
+	for (int32 Offset = 0; Offset < AudioPool.Num(); ++Offset)
+	{
+		const int32 Candidate = (NextAudio + Offset) % AudioPool.Num();
+		if (!AudioPool[Candidate]->IsPlaying())
+		{
+			Index = Candidate;
+			break;
+		}
+	}
+	NextAudio = (Index + 1) % AudioPool.Num();
+
+	UAudioComponent* Audio = AudioPool[Index];
+	Audio->SetSound(Sound);
+	if (!SurfaceParameterName.IsNone())
+		Audio->SetIntParameter(SurfaceParameterName, Surface);
+	Audio->Play();
+}
@@ -0,0 +1,160 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+#include "WorldCollision.h"
+#include "KZFootstepComponent.generated.h"
+
+class UAudioComponent;
+class UCharacterMovementComponent;
+class UPhysicalMaterial;
+class UPrimitiveComponent;
+class USoundAttenuation;
+class USoundBase;
+struct FFindFloorResult;
+
+/** Sound of one physical surface */
+USTRUCT(BlueprintType)
+struct FKZFootstepSurface
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Footsteps")
+	TSoftObjectPtr<UPhysicalMaterial> PhysicalMaterial;
+
+	/** Footstep sound of the surface, DefaultFootstepSound if not set */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Footsteps")
+	TSoftObjectPtr<USoundBase> FootstepSound;
+};
+
+enum class EKZFootstepEvent : uint8
+{
+	Step,
+	JumpStart,
+	JumpEnd,
+};
+
+/**
+ * Footsteps of a character, played every StrideLength walked on the ground and when it jumps and lands.
+ * The surface under the character is the one its movement component already found the floor on: a floor component with a
+ * single material gives its physical material directly and is cached until the character steps on another one, only floors
+ * with several materials (landscapes, multi-material meshes) are traced, asynchronously, and the event plays once the trace
+ * is in. Sounds play from a small pool of audio components at the feet, so steps never spawn components.
+ */
+UCLASS(config=Game, ClassGroup=(Audio), meta=(BlueprintSpawnableComponent))
+class FPSCPPTEMPLATE_API UKZFootstepComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	UKZFootstepComponent();
+
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+
+	/** Plays Event on the surface the character stands on */
+	void PlayEvent(EKZFootstepEvent Event);
+
+	/** Plays the footsteps of the character. Off while the FPSCharacter Blueprint graph plays them, every step would sound twice */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Config, Category = "Footsteps")
+	bool bNativeFootsteps;
+
+	/**
+	 * Surfaces by physical material, their index is passed to the sounds in SurfaceParameterName.
+	 * Listed in the order of the surface switch inputs of DefaultFootstepSound: carpet, concrete, grass ... wood for the Footsteps cue
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Footsteps")
+	TArray<FKZFootstepSurface> Surfaces;
+
+	/** Played on surfaces without a sound of their own and on unknown surfaces */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Footsteps")
+	TSoftObjectPtr<USoundBase> DefaultFootstepSound;
+
+	/** Played along with the footstep when the character jumps */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Footsteps")
+	TSoftObjectPtr<USoundBase> JumpStartSound;
+
+	/** Played along with the footstep when the character lands */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Footsteps")
+	TSoftObjectPtr<USoundBase> JumpEndSound;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Footsteps")
+	TSoftObjectPtr<USoundAttenuation> Attenuation;
+
+	/** Integer sound parameter set to the surface index, -1 on unknown surfaces. The Footsteps cue switches on "floor" */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Footsteps")
+	FName SurfaceParameterName;
+
+	/** Distance walked on the ground between two footsteps */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Footsteps", meta = (ClampMin = "1"))
+	float StrideLength;
+
+	/** Audio components of the pool, the one playing the longest is taken over when all are busy */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Footsteps", meta = (ClampMin = "1"))
+	int32 AudioPoolSize;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/**
+	 * Surface index of the floor the character stands on, -1 if unknown.
+	 * Returns false if the floor has to be traced first, the trace is started and the event queued in the meantime
+	 */
+	bool GetFloorSurface(const FFindFloorResult& Floor, int32& OutSurface);
+
+	/** Physical material of Component if it has a single one */
+	static const UPhysicalMaterial* GetSinglePhysicalMaterial(const UPrimitiveComponent* Component);
+
+	int32 FindSurface(const UPhysicalMaterial* PhysicalMaterial) const;
+
+	/** Takes the sounds and materials once they are loaded, sets up the audio pool and starts ticking */
+	void OnAssetsLoaded();
+
+	void OnFloorTraced(const FTraceHandle& Handle, FTraceDatum& Datum);
+
+	void Play(EKZFootstepEvent Event, int32 Surface);
+
+	void PlaySound(USoundBase* Sound, int32 Surface);
+
+	UPROPERTY(Transient)
+	UCharacterMovementComponent* Movement;
+
+	/** Loaded Surfaces, by index */
+	UPROPERTY(Transient)
+	TArray<UPhysicalMaterial*> SurfaceMaterials;
+
+	UPROPERTY(Transient)
+	TArray<USoundBase*> SurfaceSounds;
+
+	UPROPERTY(Transient)
+	USoundBase* LoadedDefaultSound;
+
+	UPROPERTY(Transient)
+	USoundBase* LoadedJumpStartSound;
+
+	UPROPERTY(Transient)
+	USoundBase* LoadedJumpEndSound;
+
+	UPROPERTY(Transient)
+	TArray<UAudioComponent*> AudioPool;
+
+	/** Next audio component to take over when the whole pool is playing */
+	int32 NextAudio;
+
+	/** Floor component of the last lookup and its surface */
+	TWeakObjectPtr<const UPrimitiveComponent> CachedFloor;
+	int32 CachedSurface;
+
+	/** The floor is traced for its own material on every event, its components have several */
+	bool bTraceFloor;
+
+	FTraceHandle PendingTrace;
+	FTraceDelegate TraceDelegate;
+	TArray<EKZFootstepEvent, TInlineAllocator<2>> PendingEvents;
+
+	float StrideDistance;
+	bool bWasFalling;
+	FVector LastLocation;
+};
@@ -0,0 +1,314 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZGhost.h"
+#include "Async/Async.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZGhost, Log, All);
+
+namespace KZGhostFormat
+{
+	static const uint32 Magic = 0x31475A4B; // "KZG1"
+	static const uint8 Version = 1;
+
+	// Key flag bits
+	static const uint8 Teleport = 1 << 0;
+	static const uint8 StepChanged = 1 << 1;
+
+	/** Locations are stored in millimeters */
+	static const float LocationScale = 10.f;
+
+	static void WriteVarint(TArray<uint8>& Out, uint32 Value)
+	{
+		while (Value >= 0x80)
+		{
+			Out.Add(uint8(Value) | 0x80);
+			Value >>= 7;
+		}
+		Out.Add(uint8(Value));
+	}
+
+	static bool ReadVarint(const uint8*& Cursor, const uint8* End, uint32& OutValue)
+	{
+		OutValue = 0;
+		for (int32 Shift = 0; Shift < 35 && Cursor < End; Shift += 7)
+		{
+			const uint8 Byte = *Cursor++;
+			OutValue |= uint32(Byte & 0x7F) << Shift;
+			if ((Byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	/** Signed difference as a varint, small differences of either sign take one byte */
+	static void WriteDelta(TArray<uint8>& Out, int32 Delta)
+	{
+		WriteVarint(Out, (uint32(Delta) << 1) ^ uint32(Delta >> 31));
+	}
+
+	static bool ReadDelta(const uint8*& Cursor, const uint8* End, int32& InOutValue)
+	{
+		uint32 ZigZag;
+		if (!ReadVarint(Cursor, End, ZigZag))
+			return false;
+		InOutValue += int32(ZigZag >> 1) ^ -int32(ZigZag & 1);
+		return true;
+	}
+
+	/** Angle difference taking the short way around */
+	static int32 AngleDelta(int32 Angle, int32 PreviousAngle)
+	{
+		return int16(uint16(Angle - PreviousAngle));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// FKZGhostRecorder
+
+FKZGhostRecorder::FKZGhostRecorder(const FString& InFilename, float InKeyInterval)
+	: Filename(InFilename)
+	, KeyInterval(InKeyInterval)
+	, NumKeys(0)
+	, PreviousTimeMs(0)
+	, PreviousStepMs(0)
+	, PreviousLocation(FIntVector::ZeroValue)
+	, PreviousYaw(0)
+	, PreviousPitch(0)
+	, LastKeyTime(0.f)
+{
+	// About ten minutes at 30 keys per second before the first reallocation
+	Encoded.Reserve(256 * 1024);
+	Encoded.Append(reinterpret_cast<const uint8*>(&KZGhostFormat::Magic), sizeof(uint32));
+	Encoded.Add(KZGhostFormat::Version);
+	Encoded.Append(reinterpret_cast<const uint8*>(&KeyInterval), sizeof(float));
+}
+
+FKZGhostRecorder::~FKZGhostRecorder()
+{
+	if (NumKeys == 0)
+		return;
+
+	UE_LOG(LogKZGhost, Log, TEXT("KZ ghost %s: %d keys, %d bytes"), *Filename, NumKeys, Encoded.Num());
+	AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [Data = MoveTemp(Encoded), File = Filename]()
+	{
+		FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*FPaths::GetPath(File));
+		if (!FFileHelper::SaveArrayToFile(Data, *File))
+			UE_LOG(LogKZGhost, Warning, TEXT("Could not write KZ ghost %s"), *File);
+	});
+}
+
+bool FKZGhostRecorder::WriteFile()
+{
+	FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*FPaths::GetPath(Filename));
+	const bool bWritten = FFileHelper::SaveArrayToFile(Encoded, *Filename);
+	if (!bWritten)
+		UE_LOG(LogKZGhost, Warning, TEXT("Could not write KZ ghost %s"), *Filename);
+
+	Encoded.Empty();
+	NumKeys = 0;
+	return bWritten;
+}
+
+void FKZGhostRecorder::Sample(float Time, const FVector& Location, const FRotator& Rotation)
+{
+	if (NumKeys == 0 || Time - LastKeyTime >= KeyInterval)
+		WriteKey(Time, Location, Rotation, false);
+}
+
+void FKZGhostRecorder::AddTeleport(float Time, const FVector& OldLocation, const FRotator& OldRotation, const FVector& NewLocation, const FRotator& NewRotation)
+{
+	WriteKey(Time, OldLocation, OldRotation, false);
+	WriteKey(Time, NewLocation, NewRotation, true);
+}
+
+void FKZGhostRecorder::WriteKey(float Time, const FVector& Location, const FRotator& Rotation, bool bTeleport)
+{
+	const int32 TimeMs = FMath::RoundToInt(Time * 1000.f);
+	const int32 StepMs = TimeMs - PreviousTimeMs;
+	const FIntVector KeyLocation(
+		FMath::RoundToInt(Location.X * KZGhostFormat::LocationScale),
+		FMath::RoundToInt(Location.Y * KZGhostFormat::LocationScale),
+		FMath::RoundToInt(Location.Z * KZGhostFormat::LocationScale));
+	const int32 Yaw = FRotator::CompressAxisToShort(Rotation.Yaw);
+	const int32 Pitch = FRotator::CompressAxisToShort(Rotation.Pitch);
+
+	uint8 Flags = bTeleport ? KZGhostFormat::Teleport : 0;
+	if (StepMs != PreviousStepMs)
+		Flags |= KZGhostFormat::StepChanged;
+	Encoded.Add(Flags);
+
+	if (Flags & KZGhostFormat::StepChanged)
+		KZGhostFormat::WriteDelta(Encoded, StepMs - PreviousStepMs);
+	KZGhostFormat::WriteDelta(Encoded, KeyLocation.X - PreviousLocation.X);
+	KZGhostFormat::WriteDelta(Encoded, KeyLocation.Y - PreviousLocation.Y);
+	KZGhostFormat::WriteDelta(Encoded, KeyLocation.Z - PreviousLocation.Z);
+	KZGhostFormat::WriteDelta(Encoded, KZGhostFormat::AngleDelta(Yaw, PreviousYaw));
+	KZGhostFormat::WriteDelta(Encoded, KZGhostFormat::AngleDelta(Pitch, PreviousPitch));
+
+	PreviousTimeMs = TimeMs;
+	PreviousStepMs = StepMs;
+	PreviousLocation = KeyLocation;
+	PreviousYaw = Yaw;
+	PreviousPitch = Pitch;
+	LastKeyTime = Time;
+	++NumKeys;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// FKZGhostTrack
+
+FKZGhostTrack* FKZGhostTrack::Open(const FString& Filename)
+{
+	TUniquePtr<FKZGhostTrack> Track(new FKZGhostTrack());
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	Track->MappedHandle = PlatformFile.OpenMapped(*Filename);
+	if (Track->MappedHandle)
+		Track->MappedRegion = Track->MappedHandle->MapRegion();
+
+	if (Track->MappedRegion)
+	{
+		Track->Cursor = Track->MappedRegion->GetMappedPtr();
+		Track->End = Track->Cursor + Track->MappedRegion->GetMappedSize();
+
+		// Fault every page in now, so decoding on the game thread never waits for the disk
+		uint8 Touched = 0;
+		for (const uint8* Page = Track->Cursor; Page < Track->End; Page += 4096)
+			Touched ^= *static_cast<const volatile uint8*>(Page);
+		(void)Touched;
+	}
+	else if (FFileHelper::LoadFileToArray(Track->Loaded, *Filename, FILEREAD_Silent))
+	{
+		Track->Cursor = Track->Loaded.GetData();
+		Track->End = Track->Cursor + Track->Loaded.Num();
+	}
+	else
+	{
+		UE_LOG(LogKZGhost, Warning, TEXT("Could not open KZ ghost %s"), *Filename);
+		return nullptr;
+	}
+
+	uint32 Magic = 0;
+	uint8 Version = 0;
+	const int32 HeaderSize = sizeof(uint32) + sizeof(uint8) + sizeof(float);
+	if (Track->End - Track->Cursor >= HeaderSize)
+	{
+		FMemory::Memcpy(&Magic, Track->Cursor, sizeof(uint32));
+		Version = Track->Cursor[sizeof(uint32)];
+	}
+	if (Magic != KZGhostFormat::Magic || Version != KZGhostFormat::Version)
+	{
+		UE_LOG(LogKZGhost, Warning, TEXT("%s is not a KZ ghost"), *Filename);
+		return nullptr;
+	}
+
+	Track->FirstKey = Track->Cursor + HeaderSize;
+	Track->Restart();
+	return Track.Release();
+}
+
+FKZGhostTrack::~FKZGhostTrack()
+{
+	delete MappedRegion;
+	delete MappedHandle;
+}
+
+void FKZGhostTrack::Restart()
+{
+	Cursor = FirstKey;
+	TimeMs = 0;
+	StepMs = 0;
+	Location = FIntVector::ZeroValue;
+	Yaw = 0;
+	Pitch = 0;
+	Time = 0.f;
+
+	// Previous and Next both start at the first key
+	bFinished = !DecodeKey();
+	Previous = Next;
+	Time = Next.Time;
+	if (!bFinished)
+		DecodeKey();
+}
+
+bool FKZGhostTrack::DecodeKey()
+{
+	if (Cursor >= End)
+		return false;
+
+	const uint8* KeyStart = Cursor;
+	const uint8 Flags = *Cursor++;
+	int32 NewStepMs = StepMs;
+	FIntVector NewLocation = Location;
+	int32 NewYaw = Yaw;
+	int32 NewPitch = Pitch;
+	if (((Flags & KZGhostFormat::StepChanged) && !KZGhostFormat::ReadDelta(Cursor, End, NewStepMs))
+		|| !KZGhostFormat::ReadDelta(Cursor, End, NewLocation.X)
+		|| !KZGhostFormat::ReadDelta(Cursor, End, NewLocation.Y)
+		|| !KZGhostFormat::ReadDelta(Cursor, End, NewLocation.Z)
+		|| !KZGhostFormat::ReadDelta(Cursor, End, NewYaw)
+		|| !KZGhostFormat::ReadDelta(Cursor, End, NewPitch))
+	{
+		// Truncated, e.g. written out while the game quit
+		Cursor = KeyStart;
+		return false;
+	}
+
+	StepMs = NewStepMs;
+	TimeMs += StepMs;
+	Location = NewLocation;
+	Yaw = NewYaw & 0xFFFF;
+	Pitch = NewPitch & 0xFFFF;
+
+	Previous = Next;
+	Next.Time = TimeMs / 1000.f;
+	Next.Location = FVector(Location) / KZGhostFormat::LocationScale;
+	Next.Rotation = FRotator(FRotator::DecompressAxisFromShort(uint16(Pitch)), FRotator::DecompressAxisFromShort(uint16(Yaw)), 0.f);
+	Next.bTeleport = (Flags & KZGhostFormat::Teleport) != 0;
+	return true;
+}
+
+void FKZGhostTrack::Advance(float DeltaTime, bool bLoop)
+{
+	if (bFinished)
+		return;
+
+	Time += DeltaTime;
+	while (Time >= Next.Time)
+	{
+		if (!DecodeKey())
+		{
+			if (bLoop)
+			{
+				Restart();
+			}
+			else
+			{
+				// Stays on the last key
+				Previous = Next;
+				bFinished = true;
+			}
+			return;
+		}
+	}
+}
+
+void FKZGhostTrack::GetPose(FVector& OutLocation, FRotator& OutRotation) const
+{
+	const float KeyTime = Next.Time - Previous.Time;
+	if (Next.bTeleport || KeyTime <= 0.f || bFinished)
+	{
+		// Nothing to slide over, the ghost waits at the portal entry until it comes out of the exit
+		OutLocation = Previous.Location;
+		OutRotation = Previous.Rotation;
+		return;
+	}
+
+	const float Alpha = FMath::Clamp((Time - Previous.Time) / KeyTime, 0.f, 1.f);
+	OutLocation = FMath::Lerp(Previous.Location, Next.Location, Alpha);
+	OutRotation = FQuat::Slerp(FQuat(Previous.Rotation), FQuat(Next.Rotation), Alpha).Rotator();
+}
@@ -0,0 +1,117 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/** Pawn pose of a ghost at one point of the run */
+struct FKZGhostKey
+{
+	float Time = 0.f;
+	FVector Location = FVector::ZeroVector;
+	/** Yaw and pitch of the view, the ghost mesh only turns with the yaw */
+	FRotator Rotation = FRotator::ZeroRotator;
+	/** Set on the first key after a portal teleport, the ghost jumps to it instead of sliding over from the previous key */
+	bool bTeleport = false;
+};
+
+/**
+ * Collects the keyframes of a ghost run in memory while the run is recorded.
+ * Keys are taken every KeyInterval seconds and on both sides of every portal teleport. Each key is a flags byte, the time
+ * step in milliseconds when it changed, the location in millimeters and the view yaw and pitch in 16-bit steps, all as
+ * zigzag varints of the difference to the previous key, so a key at KZ speeds is about ten bytes (about 1 MB per hour at
+ * 30 keys per second). The file is written on a background thread when the recorder is destroyed.
+ */
+class FPSCPPTEMPLATE_API FKZGhostRecorder
+{
+public:
+	FKZGhostRecorder(const FString& InFilename, float InKeyInterval);
+
+	/** Writes the file out in the background */
+	~FKZGhostRecorder();
+
+	/** Adds a key if KeyInterval passed since the last one. Time is in seconds since the start of the run */
+	void Sample(float Time, const FVector& Location, const FRotator& Rotation);
+
+	/** Adds a key at the entry and a teleport key at the exit of a portal */
+	void AddTeleport(float Time, const FVector& OldLocation, const FRotator& OldRotation, const FVector& NewLocation, const FRotator& NewRotation);
+
+	FORCEINLINE int32 GetNumKeys() const { return NumKeys; }
+
+	/** Writes the file now on the calling thread, for ghosts played right away. The recorder is empty afterwards */
+	bool WriteFile();
+
+private:
+	void WriteKey(float Time, const FVector& Location, const FRotator& Rotation, bool bTeleport);
+
+	FString Filename;
+	float KeyInterval;
+	TArray<uint8> Encoded;
+	int32 NumKeys;
+
+	// Quantized previous key
+	int32 PreviousTimeMs;
+	int32 PreviousStepMs;
+	FIntVector PreviousLocation;
+	int32 PreviousYaw;
+	int32 PreviousPitch;
+	float LastKeyTime;
+};
+
+/**
+ * Plays back a ghost file. The file is memory mapped (or loaded where mapping is not supported) and every page is touched
+ * by Open(), which is meant to run off the game thread. Advance() then decodes the keys around the playback time one at a
+ * time from the mapping, so a ghost costs two keys of memory however long the run is.
+ */
+class FPSCPPTEMPLATE_API FKZGhostTrack
+{
+public:
+	/** Opens Filename and reads its header, nullptr if it is missing or not a KZ ghost. Safe to call from any thread */
+	static FKZGhostTrack* Open(const FString& Filename);
+
+	~FKZGhostTrack();
+
+	/** Moves the playback time forward by DeltaTime, decoding the keys passed. Starts over at the end if bLoop is set */
+	void Advance(float DeltaTime, bool bLoop);
+
+	/** Interpolated pose at the playback time */
+	void GetPose(FVector& OutLocation, FRotator& OutRotation) const;
+
+	/** Playback time back to the first key */
+	void Restart();
+
+	/** Set once the last key is reached without bLoop */
+	FORCEINLINE bool IsFinished() const { return bFinished; }
+
+	FORCEINLINE float GetTime() const { return Time; }
+
+private:
+	FKZGhostTrack() {}
+
+	/** Decodes the key after Next into Next, keeping the old one in Previous. False at the end of the file or on corrupt data */
+	bool DecodeKey();
+
+	IMappedFileHandle* MappedHandle = nullptr;
+	IMappedFileRegion* MappedRegion = nullptr;
+	/** File contents when it could not be mapped */
+	TArray<uint8> Loaded;
+
+	const uint8* FirstKey = nullptr;
+	const uint8* Cursor = nullptr;
+	const uint8* End = nullptr;
+
+	FKZGhostKey Previous;
+	FKZGhostKey Next;
+	float Time = 0.f;
+	bool bFinished = false;
+
+	// Quantized last decoded key
+	int32 TimeMs = 0;
+	int32 StepMs = 0;
+	FIntVector Location = FIntVector::ZeroValue;
+	int32 Yaw = 0;
+	int32 Pitch = 0;
+};
@@ -0,0 +1,224 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZGhostManager.h"
+#include "FPSCppTemplate.h"
+#include "KZAssetLoader.h"
+#include "KZBenchmark.h"
+#include "EngineUtils.h"
+#include "Async/Async.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "HAL/IConsoleManager.h"
+#include "Materials/MaterialInterface.h"
+#include "Misc/Paths.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZGhostManager, Log, All);
+
+DECLARE_CYCLE_STAT(TEXT("Ghosts"), STAT_KZGhostUpdate, STATGROUP_KZ);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Ghosts"), STAT_KZGhosts, STATGROUP_KZ);
+
+AKZGhostManager::AKZGhostManager()
+{
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.TickGroup = TG_PrePhysics;
+
+	InstancedMesh = CreateDefaultSubobject<UInstancedStaticMeshComponent>(TEXT("InstancedMesh"));
+	InstancedMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	InstancedMesh->SetMobility(EComponentMobility::Movable);
+	InstancedMesh->SetGenerateOverlapEvents(false);
+	InstancedMesh->SetCastShadow(false);
+	RootComponent = InstancedMesh;
+
+	GhostMesh = TSoftObjectPtr<UStaticMesh>(FSoftObjectPath(TEXT("/Engine/BasicShapes/Cylinder.Cylinder")));
+	GhostMeshScale = FVector(.8f, .8f, 1.9f);
+	bLoopGhosts = true;
+	MaxGhosts = 64;
+	NumInstances = 0;
+}
+
+AKZGhostManager* AKZGhostManager::Get(UWorld* World, bool bCreateIfMissing)
+{
+	if (World == nullptr)
+		return nullptr;
+
+	for (TActorIterator<AKZGhostManager> It(World); It; ++It)
+	{
+		if (!It->IsPendingKill())
+			return *It;
+	}
+
+	if (!bCreateIfMissing || World->bIsTearingDown)
+		return nullptr;
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	return World->SpawnActor<AKZGhostManager>(SpawnParams);
+}
+
+FString AKZGhostManager::GetGhostFilename(const FString& Name)
+{
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("KZRuns"), Name.IsEmpty() ? TEXT("Run") : *Name) + TEXT(".kzg");
+}
+
+void AKZGhostManager::BeginPlay()
+{
+	Super::BeginPlay();
+
+	// Ghost files take a while to open as well, the instances usually have their mesh before the first ghost runs
+	TArray<FSoftObjectPath> Assets;
+	Assets.Add(GhostMesh.ToSoftObjectPath());
+	Assets.Add(GhostMaterial.ToSoftObjectPath());
+	FKZAssetLoader::Get().RequestAsyncLoad(Assets, FStreamableDelegate::CreateUObject(this, &AKZGhostManager::OnGhostAssetsLoaded));
+}
+
+void AKZGhostManager::OnGhostAssetsLoaded()
+{
+	if (UStaticMesh* Mesh = GhostMesh.Get())
+		InstancedMesh->SetStaticMesh(Mesh);
+	if (UMaterialInterface* Material = GhostMaterial.Get())
+		InstancedMesh->SetMaterial(0, Material);
+}
+
+void AKZGhostManager::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	ClearGhosts();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AKZGhostManager::AddGhost(const FString& Filename, float StartTime)
+{
+	if (Ghosts.Num() + PendingGhosts.Num() >= MaxGhosts)
+	{
+		UE_LOG(LogKZGhostManager, Warning, TEXT("%d ghosts already, %s not added"), MaxGhosts, *Filename);
+		return;
+	}
+
+	// Opening maps the file and touches its pages, which may wait for the disk
+	FPendingGhost Pending;
+	Pending.Track = Async<FKZGhostTrack*>(EAsyncExecution::ThreadPool, [Filename]() { return FKZGhostTrack::Open(Filename); });
+	Pending.StartTime = StartTime;
+	PendingGhosts.Add(MoveTemp(Pending));
+}
+
+void AKZGhostManager::RestartGhosts()
+{
+	for (const TUniquePtr<FKZGhostTrack>& Ghost : Ghosts)
+		Ghost->Restart();
+}
+
+void AKZGhostManager::ClearGhosts()
+{
+	// Loads still running are waited for in the background, their track is owned by nobody else
+	for (FPendingGhost& Pending : PendingGhosts)
+	{
+		if (Pending.Track.IsReady())
+		{
+			delete Pending.Track.Get();
+			continue;
+		}
+
+		TSharedRef<TFuture<FKZGhostTrack*>, ESPMode::ThreadSafe> Track = MakeShared<TFuture<FKZGhostTrack*>, ESPMode::ThreadSafe>(MoveTemp(Pending.Track));
+		AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [Track]()
+		{
+			delete Track->Get();
+		});
+	}
+	PendingGhosts.Reset();
+
+	DEC_DWORD_STAT_BY(STAT_KZGhosts, Ghosts.Num());
+	Ghosts.Reset();
+	InstancedMesh->ClearInstances();
+	NumInstances = 0;
+}
+
+void AKZGhostManager::CollectLoadedGhosts()
+{
+	for (int32 Index = PendingGhosts.Num() - 1; Index >= 0; --Index)
+	{
+		FPendingGhost& Pending = PendingGhosts[Index];
+		if (!Pending.Track.IsReady())
+			continue;
+
+		if (FKZGhostTrack* Track = Pending.Track.Get())
+		{
+			Track->Advance(Pending.StartTime, bLoopGhosts);
+			Ghosts.Emplace(Track);
+			INC_DWORD_STAT(STAT_KZGhosts);
+		}
+		PendingGhosts.RemoveAtSwap(Index, 1, false);
+	}
+}
+
+void AKZGhostManager::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZGhostUpdate);
+	KZ_BENCHMARK_SCOPE(Ghosts);
+	if (PendingGhosts.Num() > 0)
+		CollectLoadedGhosts();
+
+	if (Ghosts.Num() == 0)
+		return;
+
+	for (const TUniquePtr<FKZGhostTrack>& Ghost : Ghosts)
+		Ghost->Advance(DeltaTime, bLoopGhosts);
+
+	UpdateInstances();
+}
+
+void AKZGhostManager::UpdateInstances()
+{
+	// Ghost i is drawn by instance i, ghosts are only removed all at once. The render state is sent once, with the last instance
+	for (int32 Index = 0; Index < Ghosts.Num(); ++Index)
+	{
+		FVector Location;
+		FRotator Rotation;
+		Ghosts[Index]->GetPose(Location, Rotation);
+
+		// The pawn stands upright, only the view pitches
+		const FTransform Transform(FRotator(0.f, Rotation.Yaw, 0.f), Location, GhostMeshScale);
+		if (Index < NumInstances)
+			InstancedMesh->UpdateInstanceTransform(Index, Transform, true, Index == Ghosts.Num() - 1, true);
+		else
+			InstancedMesh->AddInstanceWorldSpace(Transform);
+	}
+
+	NumInstances = FMath::Max(NumInstances, Ghosts.Num());
+}
+
+// "KZ.Ghost.Add Run 16 0.5" races 16 ghosts of Saved/KZRuns/Run.kzg, each half a second behind the previous one
+static FAutoConsoleCommand GhostAddCommand(
+	TEXT("KZ.Ghost.Add"),
+	TEXT("Adds ghosts of a recorded KZ run. Arguments: run name, optional number of ghosts and seconds between them."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		AKZGhostManager* Manager = AKZGhostManager::Get(World);
+		if (Manager == nullptr)
+			return;
+
+		const FString Filename = AKZGhostManager::GetGhostFilename(Args.Num() > 0 ? Args[0] : FString());
+		const int32 Count = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : 1;
+		const float Spacing = Args.Num() > 2 ? FCString::Atof(*Args[2]) : .5f;
+		for (int32 Ghost = 0; Ghost < Count; ++Ghost)
+			Manager->AddGhost(Filename, Ghost * Spacing);
+	}));
+
+static FAutoConsoleCommand GhostRestartCommand(
+	TEXT("KZ.Ghost.Restart"),
+	TEXT("Sends every ghost back to the start of its run."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		if (AKZGhostManager* Manager = AKZGhostManager::Get(World, false))
+			Manager->RestartGhosts();
+	}));
+
+static FAutoConsoleCommand GhostClearCommand(
+	TEXT("KZ.Ghost.Clear"),
+	TEXT("Removes every ghost."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		if (AKZGhostManager* Manager = AKZGhostManager::Get(World, false))
+			Manager->ClearGhosts();
+	}));
@@ -0,0 +1,94 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "Async/Future.h"
+#include "KZGhost.h"
+#include "KZGhostManager.generated.h"
+
+class UInstancedStaticMeshComponent;
+class UMaterialInterface;
+class UStaticMesh;
+
+/**
+ * Plays back ghost runs recorded along with the KZ input recordings (Saved/KZRuns/<Name>.kzg), spawned on demand.
+ * Ghost files are opened on the thread pool and join the race once ready, every ghost is one instance of a single
+ * instanced mesh, and a frame only decodes the keys the ghosts passed, so ghosts never allocate once they are loaded.
+ */
+UCLASS(config=Game, notplaceable)
+class FPSCPPTEMPLATE_API AKZGhostManager : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AKZGhostManager();
+
+	/** Returns the manager of World, spawning one if bCreateIfMissing is set */
+	static AKZGhostManager* Get(UWorld* World, bool bCreateIfMissing = true);
+
+	/** Ghost file of the run recorded as Name */
+	static FString GetGhostFilename(const FString& Name);
+
+	/** Starts loading a ghost in the background, it starts running StartTime seconds into the run once loaded */
+	void AddGhost(const FString& Filename, float StartTime = 0.f);
+
+	/** Sends every ghost back to the start of its run */
+	void RestartGhosts();
+
+	/** Removes every ghost, loaded or not */
+	void ClearGhosts();
+
+	FORCEINLINE int32 NumGhosts() const { return Ghosts.Num(); }
+
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Ghost")
+	TSoftObjectPtr<UStaticMesh> GhostMesh;
+
+	/** Material of the ghost mesh, the mesh's own if not set */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Ghost")
+	TSoftObjectPtr<UMaterialInterface> GhostMaterial;
+
+	/** Scale of the ghost mesh, sized to the character capsule */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Ghost")
+	FVector GhostMeshScale;
+
+	/** Ghosts start over at the end of their run, or stay at the finish */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Ghost")
+	bool bLoopGhosts;
+
+	/** Ghosts running or loading at the same time, further AddGhost calls are dropped */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Ghost")
+	int32 MaxGhosts;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/** Puts the ghost mesh and material on the instances once their background load is done */
+	void OnGhostAssetsLoaded();
+
+	/** Adds the ghosts whose file finished loading */
+	void CollectLoadedGhosts();
+
+	/** Writes the instance transform of every ghost */
+	void UpdateInstances();
+
+	UPROPERTY(VisibleAnywhere, Category = "Ghost")
+	UInstancedStaticMeshComponent* InstancedMesh;
+
+	struct FPendingGhost
+	{
+		TFuture<FKZGhostTrack*> Track;
+		float StartTime;
+	};
+
+	TArray<TUniquePtr<FKZGhostTrack>> Ghosts;
+	TArray<FPendingGhost> PendingGhosts;
+
+	/** Instances allocated in InstancedMesh, one per ghost */
+	int32 NumInstances;
+};
@@ -0,0 +1,483 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZInputRecorder.h"
+#include "Async/Async.h"
+#include "Containers/CircularQueue.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformFilemanager.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/ThreadSafeBool.h"
+#include "Async/MappedFileHandle.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZInput, Log, All);
+
+namespace KZInputFormat
+{
+	static const uint32 Magic = 0x31525A4B; // "KZR1"
+	static const uint8 Version = 3;
+
+	// Frame flag bits, one per axis followed by these
+	static const uint8 DeltaTimeChanged = 1 << (int32)EKZInputAxis::Num;
+	static const uint8 HasTeleports = DeltaTimeChanged << 1;
+
+	/** Axis steps per unit, a power of two so every quantized value converts back to the same float */
+	static const float AxisScale = 4096.f;
+	static const float MaxAxis = 65536.f;
+
+	static const int32 QueueCapacity = 1 << 20;
+
+	/** Encoded bytes kept on the game thread while the queue is full, past them the recording stops */
+	static const int32 MaxSpillBytes = 4 << 20;
+
+	static void WriteVarint(TArray<uint8>& Out, uint32 Value)
+	{
+		while (Value >= 0x80)
+		{
+			Out.Add(uint8(Value) | 0x80);
+			Value >>= 7;
+		}
+		Out.Add(uint8(Value));
+	}
+
+	static bool ReadVarint(const uint8*& Cursor, const uint8* End, uint32& OutValue)
+	{
+		OutValue = 0;
+		for (int32 Shift = 0; Shift < 35 && Cursor < End; Shift += 7)
+		{
+			const uint8 Byte = *Cursor++;
+			OutValue |= uint32(Byte & 0x7F) << Shift;
+			if ((Byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	static void WriteRaw(TArray<uint8>& Out, const void* Data, int32 Num)
+	{
+		Out.Append(static_cast<const uint8*>(Data), Num);
+	}
+
+	static bool ReadRaw(const uint8*& Cursor, const uint8* End, void* Data, int32 Num)
+	{
+		if (End - Cursor < Num)
+			return false;
+		FMemory::Memcpy(Data, Cursor, Num);
+		Cursor += Num;
+		return true;
+	}
+
+	/** Float as the XOR of its bits with the previous value, the same value costs one byte */
+	static void WriteFloatDelta(TArray<uint8>& Out, float Value, float PreviousValue)
+	{
+		uint32 Bits, PreviousBits;
+		FMemory::Memcpy(&Bits, &Value, sizeof(float));
+		FMemory::Memcpy(&PreviousBits, &PreviousValue, sizeof(float));
+		WriteVarint(Out, Bits ^ PreviousBits);
+	}
+
+	static bool ReadFloatDelta(const uint8*& Cursor, const uint8* End, float& InOutValue)
+	{
+		uint32 Delta, Bits;
+		if (!ReadVarint(Cursor, End, Delta))
+			return false;
+		FMemory::Memcpy(&Bits, &InOutValue, sizeof(float));
+		Bits ^= Delta;
+		FMemory::Memcpy(&InOutValue, &Bits, sizeof(float));
+		return true;
+	}
+
+	static bool FloatBitsEqual(float A, float B)
+	{
+		return FMemory::Memcmp(&A, &B, sizeof(float)) == 0;
+	}
+
+	static int32 ToAxisSteps(float Value)
+	{
+		return FMath::RoundToInt(FMath::Clamp(Value, -MaxAxis, MaxAxis) * AxisScale);
+	}
+
+	/** Difference of two quantized axes, small ones of either sign take one byte */
+	static void WriteStepDelta(TArray<uint8>& Out, int32 Value, int32 PreviousValue)
+	{
+		const int32 Delta = Value - PreviousValue;
+		WriteVarint(Out, (uint32(Delta) << 1) ^ uint32(Delta >> 31));
+	}
+
+	static bool ReadStepDelta(const uint8*& Cursor, const uint8* End, int32& InOutValue)
+	{
+		uint32 ZigZag;
+		if (!ReadVarint(Cursor, End, ZigZag))
+			return false;
+		InOutValue += int32(ZigZag >> 1) ^ -int32(ZigZag & 1);
+		return true;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// FKZInputWriter
+
+/** Writer thread of a recording, moves the queued bytes to the file and closes it once the recorder is done */
+class FKZInputWriter : public FRunnable
+{
+public:
+	explicit FKZInputWriter(IFileHandle* InFileHandle)
+		: Queue(KZInputFormat::QueueCapacity)
+		, FileHandle(InFileHandle)
+		, Thread(nullptr)
+		, WakeEvent(FPlatformProcess::GetSynchEventFromPool())
+	{
+	}
+
+	/** Joins the thread, which closed the file when it returned. Never called on the game thread */
+	virtual ~FKZInputWriter()
+	{
+		if (Thread)
+		{
+			Thread->WaitForCompletion();
+			delete Thread;
+		}
+		FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+	}
+
+	void StartThread()
+	{
+		Thread = FRunnableThread::Create(this, TEXT("KZInputRecorder"), 0, TPri_BelowNormal);
+	}
+
+	/** Queues as many of the Num bytes as fit, returns the number queued. Game thread only */
+	int32 Push(const uint8* Data, int32 Num)
+	{
+		// Frames are a few bytes, the queue handles a few KB per second byte by byte
+		int32 Pushed = 0;
+		while (Pushed < Num && Queue.Enqueue(Data[Pushed]))
+			++Pushed;
+		return Pushed;
+	}
+
+	FORCEINLINE void Wake() { WakeEvent->Trigger(); }
+
+	/** Hands over the bytes the queue could not take, the thread writes them after the queue and closes the file */
+	void Finish(TArray<uint8>&& InRemaining)
+	{
+		Remaining = MoveTemp(InRemaining);
+		Stop();
+	}
+
+	// FRunnable
+	virtual uint32 Run() override
+	{
+		TArray<uint8> Chunk;
+		Chunk.Reserve(ChunkSize);
+		while (!bStopping)
+		{
+			WakeEvent->Wait(100);
+			Drain(Chunk);
+		}
+
+		// Nothing is queued past the stop, the last bytes follow the queue
+		Drain(Chunk);
+		FileHandle->Write(Remaining.GetData(), Remaining.Num());
+		FileHandle->Flush();
+		delete FileHandle;
+		FileHandle = nullptr;
+		return 0;
+	}
+
+	virtual void Stop() override
+	{
+		bStopping = true;
+		WakeEvent->Trigger();
+	}
+
+private:
+	static const int32 ChunkSize = 64 * 1024;
+
+	void Drain(TArray<uint8>& Chunk)
+	{
+		uint8 Byte;
+		while (Queue.Dequeue(Byte))
+		{
+			Chunk.Add(Byte);
+			if (Chunk.Num() == ChunkSize)
+			{
+				FileHandle->Write(Chunk.GetData(), Chunk.Num());
+				Chunk.Reset();
+			}
+		}
+
+		if (Chunk.Num() > 0)
+		{
+			FileHandle->Write(Chunk.GetData(), Chunk.Num());
+			Chunk.Reset();
+		}
+	}
+
+	TCircularQueue<uint8> Queue;
+	IFileHandle* FileHandle;
+	FRunnableThread* Thread;
+	FEvent* WakeEvent;
+	FThreadSafeBool bStopping;
+	TArray<uint8> Remaining;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// FKZInputRecorder
+
+FKZInputRecorder::FKZInputRecorder(FKZInputWriter* InWriter)
+	: Writer(InWriter)
+	, PreviousDeltaTime(0.f)
+	, NumFrames(0)
+	, NumBytes(0)
+	, bTruncated(false)
+{
+	FMemory::Memzero(PreviousAxis);
+}
+
+float FKZInputRecorder::QuantizeAxis(float Value)
+{
+	return KZInputFormat::ToAxisSteps(Value) / KZInputFormat::AxisScale;
+}
+
+TUniquePtr<FKZInputRecorder> FKZInputRecorder::Create(const FString& Filename, const FKZRecordingHeader& Header)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(Filename));
+	IFileHandle* FileHandle = PlatformFile.OpenWrite(*Filename);
+	if (FileHandle == nullptr)
+	{
+		UE_LOG(LogKZInput, Warning, TEXT("Could not create KZ recording %s"), *Filename);
+		return nullptr;
+	}
+
+	TUniquePtr<FKZInputRecorder> Recorder(new FKZInputRecorder(new FKZInputWriter(FileHandle)));
+
+	// The header is small enough to go through the queue like the frames
+	TArray<uint8>& Out = Recorder->Encoded;
+	KZInputFormat::WriteRaw(Out, &KZInputFormat::Magic, sizeof(uint32));
+	KZInputFormat::WriteRaw(Out, &KZInputFormat::Version, sizeof(uint8));
+	KZInputFormat::WriteRaw(Out, &Header.Location, sizeof(FVector));
+	KZInputFormat::WriteRaw(Out, &Header.ControlRotation, sizeof(FRotator));
+	KZInputFormat::WriteRaw(Out, &Header.Velocity, sizeof(FVector));
+	KZInputFormat::WriteRaw(Out, &Header.StrafeSpeed, sizeof(float));
+	Recorder->Spill.Append(Out);
+	Recorder->NumBytes += Out.Num();
+	Recorder->FlushSpill();
+
+	Recorder->Writer->StartThread();
+	return Recorder;
+}
+
+FKZInputRecorder::~FKZInputRecorder()
+{
+	// The writer thread writes out the rest and closes the file, a background task waits for it so the game thread never does
+	FKZInputWriter* FinishingWriter = Writer;
+	FinishingWriter->Finish(MoveTemp(Spill));
+	AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [FinishingWriter]()
+	{
+		delete FinishingWriter;
+	});
+
+	if (bTruncated)
+		UE_LOG(LogKZInput, Warning, TEXT("KZ recording truncated after %lld frames, the disk could not keep up"), NumFrames);
+	UE_LOG(LogKZInput, Log, TEXT("KZ recording closed: %lld frames, %lld bytes"), NumFrames, NumBytes);
+}
+
+void FKZInputRecorder::WriteFrame(const FKZInputFrame& Frame)
+{
+	// Frames are deltas of the previous ones, a recording missing one can not be replayed past it
+	if (bTruncated)
+		return;
+
+	Encoded.Reset();
+	Encoded.Add(0);
+
+	uint8 Flags = 0;
+	int32 Axis[(int32)EKZInputAxis::Num];
+	for (int32 Index = 0; Index < (int32)EKZInputAxis::Num; ++Index)
+	{
+		Axis[Index] = KZInputFormat::ToAxisSteps(Frame.Axis[Index]);
+		if (Axis[Index] != PreviousAxis[Index])
+		{
+			Flags |= 1 << Index;
+			KZInputFormat::WriteStepDelta(Encoded, Axis[Index], PreviousAxis[Index]);
+		}
+	}
+
+	if (!KZInputFormat::FloatBitsEqual(Frame.DeltaTime, PreviousDeltaTime))
+	{
+		Flags |= KZInputFormat::DeltaTimeChanged;
+		KZInputFormat::WriteFloatDelta(Encoded, Frame.DeltaTime, PreviousDeltaTime);
+	}
+
+	if (Frame.Teleports.Num() > 0)
+	{
+		Flags |= KZInputFormat::HasTeleports;
+		KZInputFormat::WriteVarint(Encoded, Frame.Teleports.Num());
+		for (const FKZTeleportEvent& Teleport : Frame.Teleports)
+		{
+			for (const FName& Name : { Teleport.To, Teleport.From })
+			{
+				// A name is written out the first time it is used and referenced by index after that
+				const int32* Index = NameIndices.Find(Name);
+				if (Index)
+				{
+					KZInputFormat::WriteVarint(Encoded, *Index);
+					continue;
+				}
+
+				const int32 NewIndex = NameIndices.Add(Name, NameIndices.Num());
+				KZInputFormat::WriteVarint(Encoded, NewIndex);
+				const FTCHARToUTF8 NameUTF8(*Name.ToString());
+				KZInputFormat::WriteVarint(Encoded, NameUTF8.Length());
+				KZInputFormat::WriteRaw(Encoded, NameUTF8.Get(), NameUTF8.Length());
+			}
+			KZInputFormat::WriteRaw(Encoded, &Teleport.Location, sizeof(FVector));
+		}
+	}
+
+	if (Spill.Num() + Encoded.Num() > KZInputFormat::MaxSpillBytes)
+	{
+		bTruncated = true;
+		return;
+	}
+
+	Encoded[0] = Flags;
+	PreviousDeltaTime = Frame.DeltaTime;
+	FMemory::Memcpy(PreviousAxis, Axis, sizeof(Axis));
+	++NumFrames;
+	NumBytes += Encoded.Num();
+
+	// Anything the queue can not take now waits for the next frame instead of blocking
+	if (Spill.Num() == 0)
+	{
+		const int32 Written = Writer->Push(Encoded.GetData(), Encoded.Num());
+		if (Written < Encoded.Num())
+			Spill.Append(Encoded.GetData() + Written, Encoded.Num() - Written);
+	}
+	else
+	{
+		Spill.Append(Encoded);
+		FlushSpill();
+	}
+	Writer->Wake();
+}
+
+void FKZInputRecorder::FlushSpill()
+{
+	const int32 Written = Writer->Push(Spill.GetData(), Spill.Num());
+	Spill.RemoveAt(0, Written, false);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// FKZInputReplay
+
+TUniquePtr<FKZInputReplay> FKZInputReplay::Open(const FString& Filename)
+{
+	TUniquePtr<FKZInputReplay> Replay(new FKZInputReplay());
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	Replay->MappedHandle = PlatformFile.OpenMapped(*Filename);
+	if (Replay->MappedHandle)
+		Replay->MappedRegion = Replay->MappedHandle->MapRegion();
+
+	if (Replay->MappedRegion)
+	{
+		Replay->Cursor = Replay->MappedRegion->GetMappedPtr();
+		Replay->End = Replay->Cursor + Replay->MappedRegion->GetMappedSize();
+	}
+	else if (FFileHelper::LoadFileToArray(Replay->Loaded, *Filename, FILEREAD_Silent))
+	{
+		Replay->Cursor = Replay->Loaded.GetData();
+		Replay->End = Replay->Cursor + Replay->Loaded.Num();
+	}
+	else
+	{
+		UE_LOG(LogKZInput, Warning, TEXT("Could not open KZ recording %s"), *Filename);
+		return nullptr;
+	}
+
+	uint32 Magic = 0;
+	uint8 Version = 0;
+	FKZRecordingHeader& Header = Replay->Header;
+	if (!KZInputFormat::ReadRaw(Replay->Cursor, Replay->End, &Magic, sizeof(uint32)) || Magic != KZInputFormat::Magic
+		|| !KZInputFormat::ReadRaw(Replay->Cursor, Replay->End, &Version, sizeof(uint8)) || Version != KZInputFormat::Version
+		|| !KZInputFormat::ReadRaw(Replay->Cursor, Replay->End, &Header.Location, sizeof(FVector))
+		|| !KZInputFormat::ReadRaw(Replay->Cursor, Replay->End, &Header.ControlRotation, sizeof(FRotator))
+		|| !KZInputFormat::ReadRaw(Replay->Cursor, Replay->End, &Header.Velocity, sizeof(FVector))
+		|| !KZInputFormat::ReadRaw(Replay->Cursor, Replay->End, &Header.StrafeSpeed, sizeof(float)))
+	{
+		UE_LOG(LogKZInput, Warning, TEXT("%s is not a KZ recording"), *Filename);
+		return nullptr;
+	}
+	return Replay;
+}
+
+FKZInputReplay::~FKZInputReplay()
+{
+	delete MappedRegion;
+	delete MappedHandle;
+}
+
+bool FKZInputReplay::ReadFrame(FKZInputFrame& OutFrame)
+{
+	if (Cursor >= End)
+		return false;
+
+	const uint8 Flags = *Cursor++;
+	for (int32 Axis = 0; Axis < (int32)EKZInputAxis::Num; ++Axis)
+	{
+		if (Flags & (1 << Axis))
+		{
+			if (!KZInputFormat::ReadStepDelta(Cursor, End, PreviousAxis[Axis]))
+				return false;
+			Previous.Axis[Axis] = PreviousAxis[Axis] / KZInputFormat::AxisScale;
+		}
+	}
+
+	if ((Flags & KZInputFormat::DeltaTimeChanged) && !KZInputFormat::ReadFloatDelta(Cursor, End, Previous.DeltaTime))
+		return false;
+
+	Previous.Teleports.Reset();
+	if (Flags & KZInputFormat::HasTeleports)
+	{
+		uint32 NumTeleports;
+		if (!KZInputFormat::ReadVarint(Cursor, End, NumTeleports))
+			return false;
+		for (uint32 Teleport = 0; Teleport < NumTeleports; ++Teleport)
+		{
+			FKZTeleportEvent Event;
+			if (!ReadName(Event.To) || !ReadName(Event.From) || !KZInputFormat::ReadRaw(Cursor, End, &Event.Location, sizeof(FVector)))
+				return false;
+			Previous.Teleports.Add(Event);
+		}
+	}
+
+	OutFrame = Previous;
+	return true;
+}
+
+bool FKZInputReplay::ReadName(FName& OutName)
+{
+	uint32 Index;
+	if (!KZInputFormat::ReadVarint(Cursor, End, Index) || Index > uint32(Names.Num()))
+		return false;
+
+	if (Index < uint32(Names.Num()))
+	{
+		OutName = Names[Index];
+		return true;
+	}
+
+	uint32 Length;
+	if (!KZInputFormat::ReadVarint(Cursor, End, Length) || uint32(End - Cursor) < Length)
+		return false;
+
+	const FUTF8ToTCHAR NameTCHAR(reinterpret_cast<const ANSICHAR*>(Cursor), Length);
+	OutName = FName(FString(NameTCHAR.Length(), NameTCHAR.Get()));
+	Names.Add(OutName);
+	Cursor += Length;
+	return true;
+}
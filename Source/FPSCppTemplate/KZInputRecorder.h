@@ -0,0 +1,130 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/** Axis inputs the KZ movement depends on, in recording order */
+enum class EKZInputAxis : uint8
+{
+	MoveForward,
+	MoveRight,
+	Turn,
+	LookUp,
+	Jump,
+	Num
+};
+
+/** A teleport through a portal, portals are identified by actor name */
+struct FKZTeleportEvent
+{
+	FName To;
+	FName From;
+	/** Where the character came out */
+	FVector Location;
+};
+
+/** Everything the character received in one frame */
+struct FKZInputFrame
+{
+	float DeltaTime = 0.f;
+	float Axis[(int32)EKZInputAxis::Num] = {};
+	TArray<FKZTeleportEvent, TInlineAllocator<2>> Teleports;
+};
+
+/** Character state a recording starts from */
+struct FKZRecordingHeader
+{
+	FVector Location = FVector::ZeroVector;
+	FRotator ControlRotation = FRotator::ZeroRotator;
+	FVector Velocity = FVector::ZeroVector;
+	float StrafeSpeed = 0.f;
+};
+
+class FKZInputWriter;
+
+/**
+ * Writes KZ input frames to a file.
+ * Each frame is a byte of changed-value flags followed by the changed values. Axes are quantized to steps of 1/4096 and
+ * stored as zigzag varints of their difference to the previous frame, so held keys cost nothing and mouse deltas a byte or two
+ * (a few MB per hour at 120 fps). The character plays the quantized axes while it records, so a replay moves exactly the same.
+ * Encoded frames go through a lock-free queue to a writer thread, the game thread never waits for the disk, not even when the
+ * recorder is destroyed: the writer drains the queue and closes the file on its own.
+ */
+class FPSCPPTEMPLATE_API FKZInputRecorder
+{
+public:
+	/** Axis Value as it is recorded and replayed */
+	static float QuantizeAxis(float Value);
+
+	/** Opens Filename for writing and starts the writer thread, nullptr if the file can not be created */
+	static TUniquePtr<FKZInputRecorder> Create(const FString& Filename, const FKZRecordingHeader& Header);
+
+	/** Hands what is left to the writer thread, which writes it out and closes the file in the background */
+	~FKZInputRecorder();
+
+	/** Encodes Frame and queues it for the writer thread. Game thread only */
+	void WriteFrame(const FKZInputFrame& Frame);
+
+	FORCEINLINE int64 GetNumFrames() const { return NumFrames; }
+	FORCEINLINE int64 GetNumBytes() const { return NumBytes; }
+
+	/** The writer fell more than MaxSpillBytes behind and the recording stopped at the last frame it kept */
+	FORCEINLINE bool IsTruncated() const { return bTruncated; }
+
+private:
+	explicit FKZInputRecorder(FKZInputWriter* InWriter);
+
+	/** Pushes Spill into the writer queue, keeping what does not fit for the next frame */
+	void FlushSpill();
+
+	/** Owned until the destructor hands it over */
+	FKZInputWriter* Writer;
+
+	// Game thread state
+	int32 PreviousAxis[(int32)EKZInputAxis::Num];
+	float PreviousDeltaTime;
+	TMap<FName, int32> NameIndices;
+	TArray<uint8> Encoded;
+	/** Encoded bytes that did not fit into the queue yet */
+	TArray<uint8> Spill;
+	int64 NumFrames;
+	int64 NumBytes;
+	bool bTruncated;
+};
+
+/** Reads back a recording written by FKZInputRecorder, memory mapping the file when the platform supports it */
+class FPSCPPTEMPLATE_API FKZInputReplay
+{
+public:
+	/** Opens Filename and reads its header, nullptr if it is missing or not a KZ recording */
+	static TUniquePtr<FKZInputReplay> Open(const FString& Filename);
+
+	~FKZInputReplay();
+
+	FORCEINLINE const FKZRecordingHeader& GetHeader() const { return Header; }
+
+	/** Decodes the next frame into OutFrame, false at the end of the recording or on corrupt data */
+	bool ReadFrame(FKZInputFrame& OutFrame);
+
+private:
+	FKZInputReplay() {}
+
+	bool ReadName(FName& OutName);
+
+	IMappedFileHandle* MappedHandle = nullptr;
+	IMappedFileRegion* MappedRegion = nullptr;
+	/** File contents when it could not be mapped */
+	TArray<uint8> Loaded;
+
+	const uint8* Cursor = nullptr;
+	const uint8* End = nullptr;
+
+	FKZRecordingHeader Header;
+	FKZInputFrame Previous;
+	int32 PreviousAxis[(int32)EKZInputAxis::Num] = {};
+	TArray<FName> Names;
+};
@@ -0,0 +1,358 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZNetTest.h"
+#include "FPSCppTemplateCharacter.h"
+#include "KZBenchmark.h"
+#include "KZCharacterMovementComponent.h"
+#include "PortalC.h"
+#include "EngineUtils.h"
+#include "Engine/NetConnection.h"
+#include "Engine/NetDriver.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/CommandLine.h"
+#include "Net/UnrealNetwork.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZNetTest, Log, All);
+
+namespace KZNetTest
+{
+	/** The server finishes this much later than the clients, so they are still connected for their summary */
+	static const float ServerFinishDelay = 2.f;
+}
+
+AKZNetTest::AKZNetTest()
+{
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.TickGroup = TG_PrePhysics;
+
+	bReplicates = true;
+	bAlwaysRelevant = true;
+	NetUpdateFrequency = 1.f;
+
+	NumClients = 1;
+	Duration = 60.f;
+	ReportInterval = 1.f;
+	PortalSpacing = 0.f;
+	PortalHalfExtent = FVector2D(400.f, 250.f);
+	PortalClass = TSoftClassPtr<APortalC>(FSoftObjectPath(TEXT("/Game/MyPortals/BP_Portal.BP_Portal_C")));
+
+	bRunning = false;
+	DrivenCharacter = nullptr;
+	Elapsed = 0.f;
+	NextReportTime = 0.f;
+	InRateSum = 0;
+	OutRateSum = 0;
+	NumRateSamples = 0;
+}
+
+void AKZNetTest::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	DOREPLIFETIME(AKZNetTest, Duration);
+	DOREPLIFETIME(AKZNetTest, PortalSpacing);
+	DOREPLIFETIME(AKZNetTest, bRunning);
+	DOREPLIFETIME(AKZNetTest, Lanes);
+}
+
+AKZNetTest* AKZNetTest::Start(UWorld* World, const TCHAR* Params, bool bQuitWhenDone)
+{
+	if (World == nullptr)
+		return nullptr;
+
+	if (World->GetNetMode() == NM_Client || World->GetNetMode() == NM_Standalone)
+	{
+		UE_LOG(LogKZNetTest, Warning, TEXT("The KZ net test runs on a dedicated or listen server"));
+		return nullptr;
+	}
+
+	for (TActorIterator<AKZNetTest> It(World); It; ++It)
+	{
+		UE_LOG(LogKZNetTest, Warning, TEXT("A KZ net test is already running"));
+		return *It;
+	}
+
+	AKZNetTest* NetTest = World->SpawnActorDeferred<AKZNetTest>(AKZNetTest::StaticClass(), FTransform::Identity);
+	if (NetTest == nullptr)
+		return nullptr;
+
+	FParse::Value(Params, TEXT("Clients="), NetTest->NumClients);
+	FParse::Value(Params, TEXT("Duration="), NetTest->Duration);
+	FParse::Value(Params, TEXT("PortalSpacing="), NetTest->PortalSpacing);
+	NetTest->bQuitWhenDone = bQuitWhenDone;
+	NetTest->FinishSpawning(FTransform::Identity);
+	return NetTest;
+}
+
+void AKZNetTest::OnPostLoadMap(UWorld* World)
+{
+	// Networked movement runs, e.g. -server -KZNetTest -Clients=2 -Duration=60 with clients joining from -game -nullrhi -KZNetTest
+	static bool bStarted = false;
+	if (!bStarted && World && World->IsGameWorld() && (World->GetNetMode() == NM_DedicatedServer || World->GetNetMode() == NM_ListenServer)
+		&& FParse::Param(FCommandLine::Get(), TEXT("KZNetTest")))
+	{
+		bStarted = true;
+		Start(World, FCommandLine::Get(), true);
+	}
+}
+
+void AKZNetTest::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (HasAuthority())
+	{
+		UE_LOG(LogKZNetTest, Display, TEXT("KZ net test waiting for %d clients, %.0f seconds"), NumClients, Duration);
+	}
+	else
+	{
+		// Clients are started separately, with or without the switch
+		bQuitWhenDone = FParse::Param(FCommandLine::Get(), TEXT("KZNetTest"));
+	}
+}
+
+void AKZNetTest::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	DestroyPortals();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void AKZNetTest::OnRep_Running()
+{
+	if (bRunning)
+	{
+		Elapsed = 0.f;
+		NextReportTime = ReportInterval;
+		SpawnPortals();
+		UE_LOG(LogKZNetTest, Display, TEXT("KZ net test started, %.0f seconds, %d portal pairs"), Duration, Portals.Num() / 2);
+	}
+}
+
+void AKZNetTest::PlaceLanes()
+{
+	Lanes.Reset();
+	if (PortalSpacing <= 0.f)
+		return;
+
+	for (TActorIterator<AFPSCppTemplateCharacter> It(GetWorld()); It; ++It)
+	{
+		if (It->GetController())
+			Lanes.Add(FTransform(FRotator(0.f, It->GetControlRotation().Yaw, 0.f), It->GetActorLocation()));
+	}
+}
+
+void AKZNetTest::SpawnPortals()
+{
+	DestroyPortals();
+	if (Lanes.Num() == 0)
+		return;
+
+	UClass* Class = PortalClass.LoadSynchronous();
+	if (Class == nullptr)
+	{
+		UE_LOG(LogKZNetTest, Warning, TEXT("KZ net test portal class %s not found, running without portals"), *PortalClass.ToString());
+		return;
+	}
+
+	APlayerController* PlayerController = GetLocalPlayerController();
+	AFPSCppTemplateCharacter* PlayerCharacter = PlayerController ? Cast<AFPSCppTemplateCharacter>(PlayerController->GetPawn()) : nullptr;
+	for (int32 Lane = 0; Lane < Lanes.Num(); ++Lane)
+	{
+		// The strafe script weaves around the start heading: the portal ahead faces the character, its exit sits at the
+		// start facing the same way, so every crossing sends the character back to run into the first one again
+		const FVector Forward = Lanes[Lane].GetRotation().GetForwardVector();
+		const FTransform Transforms[2] = {
+			FTransform((-Forward).Rotation(), Lanes[Lane].GetLocation() + Forward * PortalSpacing),
+			FTransform(Forward.Rotation(), Lanes[Lane].GetLocation()),
+		};
+
+		APortalC* PairPortals[2];
+		for (int32 Side = 0; Side < 2; ++Side)
+		{
+			FActorSpawnParameters SpawnParams;
+			SpawnParams.Name = *FString::Printf(TEXT("KZNetTestPortal_%d_%d"), Lane, Side);
+			SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+			SpawnParams.bDeferConstruction = true;
+			SpawnParams.ObjectFlags |= RF_Transient;
+			PairPortals[Side] = GetWorld()->SpawnActor<APortalC>(Class, Transforms[Side], SpawnParams);
+		}
+
+		for (int32 Side = 0; Side < 2; ++Side)
+		{
+			if (PairPortals[Side] == nullptr)
+				continue;
+			PairPortals[Side]->PortalToCPP = PairPortals[1 - Side];
+			PairPortals[Side]->PlayerRefCPP = PlayerCharacter;
+			PairPortals[Side]->OpeningHalfExtent = PortalHalfExtent;
+			// Spawned with the same name everywhere, so the crossings of the test portals reach the clients
+			PairPortals[Side]->bNetNameStable = true;
+			PairPortals[Side]->FinishSpawning(Transforms[Side]);
+			Portals.Add(PairPortals[Side]);
+		}
+	}
+}
+
+void AKZNetTest::DestroyPortals()
+{
+	for (APortalC* Portal : Portals)
+	{
+		if (Portal)
+			Portal->Destroy();
+	}
+	Portals.Reset();
+}
+
+APlayerController* AKZNetTest::GetLocalPlayerController() const
+{
+	if (GetNetMode() == NM_DedicatedServer)
+		return nullptr;
+
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		APlayerController* PlayerController = It->Get();
+		if (PlayerController && PlayerController->IsLocalController())
+			return PlayerController;
+	}
+	return nullptr;
+}
+
+AFPSCppTemplateCharacter* AKZNetTest::GetDrivenCharacter()
+{
+	APlayerController* PlayerController = GetLocalPlayerController();
+	AFPSCppTemplateCharacter* Character = PlayerController ? Cast<AFPSCppTemplateCharacter>(PlayerController->GetPawn()) : nullptr;
+	if (Character && Character != DrivenCharacter)
+	{
+		// After the player input, before the move it goes into
+		PrimaryActorTick.AddPrerequisite(PlayerController, PlayerController->PrimaryActorTick);
+		Character->GetCharacterMovement()->PrimaryComponentTick.AddPrerequisite(this, PrimaryActorTick);
+		DrivenCharacter = Character;
+	}
+	return Character;
+}
+
+void AKZNetTest::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (!bRunning)
+	{
+		UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+		if (HasAuthority() && NetDriver && NetDriver->ClientConnections.Num() >= NumClients)
+		{
+			PlaceLanes();
+			bRunning = true;
+			OnRep_Running();
+		}
+		return;
+	}
+
+	if (Elapsed < Duration)
+	{
+		if (AFPSCppTemplateCharacter* Character = GetDrivenCharacter())
+			AKZBenchmark::DriveCharacter(Character, Elapsed, DeltaTime);
+	}
+
+	Elapsed += DeltaTime;
+	if (Elapsed >= NextReportTime)
+	{
+		Report();
+		NextReportTime += ReportInterval;
+	}
+
+	if (Elapsed >= Duration + (HasAuthority() ? KZNetTest::ServerFinishDelay : 0.f))
+		Finish();
+}
+
+void AKZNetTest::Report()
+{
+	UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver == nullptr)
+		return;
+
+	if (UNetConnection* Connection = NetDriver->ServerConnection)
+	{
+		const UKZCharacterMovementComponent* Movement = DrivenCharacter ? Cast<UKZCharacterMovementComponent>(DrivenCharacter->GetCharacterMovement()) : nullptr;
+		UE_LOG(LogKZNetTest, Display, TEXT("%5.1fs: in %d B/s, out %d B/s, %d corrections, %d strafe resyncs, %d teleports (%d confirmed, %d fixups, %d corrected), speed %.0f"),
+			Elapsed, int32(Connection->InBytesPerSecond), int32(Connection->OutBytesPerSecond),
+			Movement ? Movement->GetNumClientCorrections() : 0, Movement ? Movement->GetNumStrafeResyncs() : 0,
+			Movement ? Movement->GetNumTeleports() : 0, Movement ? Movement->GetNumConfirmedTeleports() : 0, Movement ? Movement->GetNumTeleportFixups() : 0,
+			Movement ? Movement->GetNumTeleportCorrections() : 0, Movement ? Movement->Velocity.Size2D() : 0.f);
+		InRateSum += Connection->InBytesPerSecond;
+		OutRateSum += Connection->OutBytesPerSecond;
+		++NumRateSamples;
+	}
+
+	for (UNetConnection* Connection : NetDriver->ClientConnections)
+	{
+		int32 NumCorrections = 0;
+		int32 NumTeleports = 0;
+		int32 NumTeleportCorrections = 0;
+		for (TActorIterator<AFPSCppTemplateCharacter> It(GetWorld()); It; ++It)
+		{
+			const UKZCharacterMovementComponent* Movement = Cast<UKZCharacterMovementComponent>(It->GetCharacterMovement());
+			if (Movement && It->GetNetConnection() == Connection)
+			{
+				NumCorrections += Movement->GetNumServerCorrections();
+				NumTeleports += Movement->GetNumTeleports();
+				NumTeleportCorrections += Movement->GetNumTeleportCorrections();
+			}
+		}
+
+		UE_LOG(LogKZNetTest, Display, TEXT("%5.1fs: %s in %d B/s, out %d B/s, %d corrections, %d teleports (%d corrected)"),
+			Elapsed, *Connection->LowLevelGetRemoteAddress(), int32(Connection->InBytesPerSecond), int32(Connection->OutBytesPerSecond),
+			NumCorrections, NumTeleports, NumTeleportCorrections);
+		InRateSum += Connection->InBytesPerSecond;
+		OutRateSum += Connection->OutBytesPerSecond;
+		++NumRateSamples;
+	}
+}
+
+void AKZNetTest::Finish()
+{
+	int32 NumCorrections = 0;
+	int32 NumStrafeResyncs = 0;
+	int32 NumTeleports = 0;
+	int32 NumTeleportCorrections = 0;
+	int32 NumConfirmedTeleports = 0;
+	int32 NumTeleportFixups = 0;
+	for (TActorIterator<AFPSCppTemplateCharacter> It(GetWorld()); It; ++It)
+	{
+		if (const UKZCharacterMovementComponent* Movement = Cast<UKZCharacterMovementComponent>(It->GetCharacterMovement()))
+		{
+			NumCorrections += HasAuthority() ? Movement->GetNumServerCorrections() : Movement->GetNumClientCorrections();
+			NumStrafeResyncs += Movement->GetNumStrafeResyncs();
+			NumTeleports += Movement->GetNumTeleports();
+			NumTeleportCorrections += Movement->GetNumTeleportCorrections();
+			NumConfirmedTeleports += Movement->GetNumConfirmedTeleports();
+			NumTeleportFixups += Movement->GetNumTeleportFixups();
+		}
+	}
+
+	// Averages are per connection, a server with several clients sends and receives that much to each of them
+	const int32 NumSamples = FMath::Max(NumRateSamples, 1);
+	UE_LOG(LogKZNetTest, Display, TEXT("KZ net test done (%s): %.0f seconds, %d corrections (%.2f per minute), %d strafe resyncs, average in %lld B/s, out %lld B/s per connection"),
+		HasAuthority() ? TEXT("server") : TEXT("client"), Elapsed, NumCorrections, NumCorrections * 60.f / FMath::Max(Elapsed, 1.f), NumStrafeResyncs,
+		InRateSum / NumSamples, OutRateSum / NumSamples);
+	if (NumTeleports > 0)
+	{
+		UE_LOG(LogKZNetTest, Display, TEXT("KZ net test teleports (%s): %d, %d confirmed, %d fixups, %d corrected (%.1f%%)"),
+			HasAuthority() ? TEXT("server") : TEXT("client"), NumTeleports, NumConfirmedTeleports, NumTeleportFixups, NumTeleportCorrections,
+			NumTeleportCorrections * 100.f / NumTeleports);
+	}
+
+	bRunning = false;
+	SetActorTickEnabled(false);
+	if (bQuitWhenDone)
+		FPlatformMisc::RequestExit(false);
+}
+
+static FAutoConsoleCommand KZNetTestCommand(
+	TEXT("KZ.NetTest"),
+	TEXT("Drives the KZ character of every connected client and logs movement corrections and bandwidth, on a server. Optional arguments: Clients= Duration= PortalSpacing="),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		AKZNetTest::Start(World, *FString::Join(Args, TEXT(" ")), false);
+	}));
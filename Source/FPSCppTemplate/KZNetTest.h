@@ -0,0 +1,119 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "KZNetTest.generated.h"
+
+class AFPSCppTemplateCharacter;
+class APortalC;
+
+/**
+ * Multi-process check of the networked KZ movement. Spawned on the server, it replicates to every client and, once enough
+ * clients are connected, drives the local character of each of them with the benchmark strafe script for Duration seconds.
+ * Every process logs its movement corrections and the bytes per second of its connections once per ReportInterval and a
+ * summary at the end. Processes started with -KZNetTest quit when done, e.g.
+ * UE4Editor FPSCppTemplate MapName -server -log -KZNetTest -Clients=2 -Duration=60
+ * UE4Editor FPSCppTemplate 127.0.0.1 -game -nullrhi -log -KZNetTest		(once per client)
+ * Add -PktLag=100 -PktLoss=1 to the clients to test under latency and packet loss.
+ * With a PortalSpacing, every character gets a portal pair on its way that keeps sending it back to its start, and the
+ * summary gives the share of portal teleports that needed a position correction.
+ */
+UCLASS(config=Game, notplaceable)
+class FPSCPPTEMPLATE_API AKZNetTest : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AKZNetTest();
+
+	/** Spawns a test in the server World, Params overrides the config values (Clients=, Duration=) */
+	static AKZNetTest* Start(UWorld* World, const TCHAR* Params, bool bQuitWhenDone);
+
+	/** Called for every loaded map, the first server map starts the -KZNetTest run */
+	static void OnPostLoadMap(UWorld* World);
+
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
+	/** Connected clients the server waits for before starting */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Net Test")
+	int32 NumClients;
+
+	/** Seconds the clients strafe for */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Replicated, Category = "Net Test")
+	float Duration;
+
+	/** Seconds between two progress lines of the log */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Net Test")
+	float ReportInterval;
+
+	/** Distance from the start of each character to the portal ahead of it, 0 runs without portals */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Replicated, Category = "Net Test")
+	float PortalSpacing;
+
+	/** Opening of the test portals, wide enough for the weaving strafe path */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Net Test")
+	FVector2D PortalHalfExtent;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Net Test")
+	TSoftClassPtr<APortalC> PortalClass;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Net Test")
+	bool bQuitWhenDone = false;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	UFUNCTION()
+	void OnRep_Running();
+
+	/** Controller of the local player, none on a dedicated server. The remote clients' controllers of a server are never driven */
+	APlayerController* GetLocalPlayerController() const;
+
+	/** Character of the local player, ticking after this so it moves with the scripted input of the frame */
+	AFPSCppTemplateCharacter* GetDrivenCharacter();
+
+	/** Places a lane at the start of every character, on the server */
+	void PlaceLanes();
+
+	/**
+	 * Spawns the portal pair of every lane, on every process. Portals are not replicated, so they are named after their lane
+	 * for the portals of the teleport events the movement sends to resolve by name on the client
+	 */
+	void SpawnPortals();
+
+	void DestroyPortals();
+
+	/** Logs the corrections and bandwidth of every connection, and adds them to the summary */
+	void Report();
+
+	/** Logs the summary and stops */
+	void Finish();
+
+	/** Set by the server once NumClients are connected */
+	UPROPERTY(ReplicatedUsing = OnRep_Running)
+	bool bRunning;
+
+	/** Start location and heading of every character, replicated with bRunning */
+	UPROPERTY(Replicated)
+	TArray<FTransform> Lanes;
+
+	UPROPERTY(Transient)
+	TArray<APortalC*> Portals;
+
+	UPROPERTY(Transient)
+	AFPSCppTemplateCharacter* DrivenCharacter;
+
+	float Elapsed;
+	float NextReportTime;
+
+	/** Bytes per second summed over every connection of every report, for the averages of the summary */
+	int64 InRateSum;
+	int64 OutRateSum;
+	int32 NumRateSamples;
+};
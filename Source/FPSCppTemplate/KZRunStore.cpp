@@ -0,0 +1,383 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZRunStore.h"
+#include "FPSCppTemplate.h"
+#include "Async/Async.h"
+#include "Engine/World.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/CoreDelegates.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZRunStore, Log, All);
+
+DECLARE_CYCLE_STAT(TEXT("Run Store"), STAT_KZRunStore, STATGROUP_KZ);
+
+namespace KZRunStoreFormat
+{
+	static const uint32 Magic = 0x53525A4B; // "KZRS"
+	static const int32 Version = 1;
+
+	/** Table of the player settings */
+	static const TCHAR* SettingsTable = TEXT("_Settings");
+}
+
+const float FKZRunStore::BatchDelay = 2.f;
+FKZRunStore* FKZRunStore::Instance = nullptr;
+
+FKZRunStore::FKZRunStore()
+	: Now(FPlatformTime::Seconds())
+{
+	TickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FKZRunStore::Tick));
+	ExitHandle = FCoreDelegates::OnPreExit.AddLambda([]()
+	{
+		delete Instance;
+		Instance = nullptr;
+	});
+}
+
+FKZRunStore::~FKZRunStore()
+{
+	Flush();
+	FTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+	FCoreDelegates::OnPreExit.Remove(ExitHandle);
+}
+
+FKZRunStore& FKZRunStore::Get()
+{
+	check(IsInGameThread());
+	if (Instance == nullptr)
+		Instance = new FKZRunStore();
+	return *Instance;
+}
+
+FString FKZRunStore::GetMapKey(const UWorld* World)
+{
+	return World ? UWorld::RemovePIEPrefix(World->GetMapName()) : FString();
+}
+
+FString FKZRunStore::GetFilename(const FString& Map)
+{
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("KZResults"), FPaths::MakeValidFileName(Map)) + TEXT(".kzres");
+}
+
+void FKZRunStore::Preload(const FString& Map)
+{
+	FindOrLoadTable(Map);
+}
+
+void FKZRunStore::OnPostLoadMap(UWorld* World)
+{
+	if (World && World->IsGameWorld())
+		Get().Preload(GetMapKey(World));
+}
+
+bool FKZRunStore::IsLoaded(const FString& Map) const
+{
+	const FTable* Table = Tables.Find(Map);
+	return Table && Table->bLoaded;
+}
+
+FKZRunStore::FTable& FKZRunStore::FindOrLoadTable(const FString& Map)
+{
+	if (FTable* Table = Tables.Find(Map))
+		return *Table;
+
+	FTable& Table = Tables.Add(Map);
+	const FString Filename = GetFilename(Map);
+	Table.Load = Async<FTableData>(EAsyncExecution::ThreadPool, [Filename]() { return ReadFile(Filename); });
+	return Table;
+}
+
+bool FKZRunStore::SubmitRun(const FString& Map, const FKZRunResult& Run)
+{
+	FTable& Table = FindOrLoadTable(Map);
+	if (Table.DirtyTime < 0.)
+		Table.DirtyTime = Now;
+
+	if (!Table.bLoaded)
+	{
+		Table.Pending.Runs.Add(Run);
+		return false;
+	}
+
+	const FPlayerIndex* Index = Table.Index.Find(Run.PlayerId);
+	const bool bPersonalBest = Index == nullptr || Index->BestRun == INDEX_NONE || Run.Time < Table.Data.Runs[Index->BestRun].Time;
+	AddRun(Table, Run);
+	return bPersonalBest;
+}
+
+void FKZRunStore::AddRun(FTable& Table, const FKZRunResult& Run)
+{
+	TArray<FKZRunResult>& Runs = Table.Data.Runs;
+	Runs.Add(Run);
+
+	// Over the limit, the oldest run of the player goes unless it is the personal best
+	int32 NumPlayerRuns = 0;
+	for (const FKZRunResult& Other : Runs)
+		NumPlayerRuns += Other.PlayerId == Run.PlayerId ? 1 : 0;
+
+	if (NumPlayerRuns > MaxRunsPerPlayer + 1)
+	{
+		RebuildPlayerIndex(Table, Run.PlayerId);
+		const int32 BestRun = Table.Index.FindChecked(Run.PlayerId).BestRun;
+		for (int32 RunIndex = 0; RunIndex < Runs.Num(); ++RunIndex)
+		{
+			if (Runs[RunIndex].PlayerId == Run.PlayerId && RunIndex != BestRun)
+			{
+				Runs.RemoveAt(RunIndex);
+				break;
+			}
+		}
+
+		// Indices of every player after the removed run moved
+		Table.Index.Reset();
+		for (const FKZRunResult& Other : Runs)
+		{
+			if (!Table.Index.Contains(Other.PlayerId))
+				RebuildPlayerIndex(Table, Other.PlayerId);
+		}
+		return;
+	}
+
+	RebuildPlayerIndex(Table, Run.PlayerId);
+}
+
+void FKZRunStore::RebuildPlayerIndex(FTable& Table, const FString& PlayerId)
+{
+	FPlayerIndex& Index = Table.Index.FindOrAdd(PlayerId);
+	Index.BestRun = INDEX_NONE;
+	Index.BestSplits.Reset();
+
+	const TArray<FKZRunResult>& Runs = Table.Data.Runs;
+	for (int32 RunIndex = 0; RunIndex < Runs.Num(); ++RunIndex)
+	{
+		const FKZRunResult& Run = Runs[RunIndex];
+		if (Run.PlayerId != PlayerId)
+			continue;
+
+		if (Index.BestRun == INDEX_NONE || Run.Time < Runs[Index.BestRun].Time)
+			Index.BestRun = RunIndex;
+
+		for (int32 Split = 0; Split < Run.Splits.Num(); ++Split)
+		{
+			if (Split < Index.BestSplits.Num())
+				Index.BestSplits[Split] = FMath::Min(Index.BestSplits[Split], Run.Splits[Split]);
+			else
+				Index.BestSplits.Add(Run.Splits[Split]);
+		}
+	}
+}
+
+bool FKZRunStore::GetPersonalBest(const FString& Map, const FString& PlayerId, FKZRunResult& OutRun)
+{
+	const FTable& Table = FindOrLoadTable(Map);
+	const FPlayerIndex* Index = Table.bLoaded ? Table.Index.Find(PlayerId) : nullptr;
+	if (Index == nullptr || Index->BestRun == INDEX_NONE)
+		return false;
+
+	OutRun = Table.Data.Runs[Index->BestRun];
+	return true;
+}
+
+bool FKZRunStore::GetBestSplits(const FString& Map, const FString& PlayerId, TArray<float>& OutSplits)
+{
+	const FTable& Table = FindOrLoadTable(Map);
+	const FPlayerIndex* Index = Table.bLoaded ? Table.Index.Find(PlayerId) : nullptr;
+	if (Index == nullptr || Index->BestSplits.Num() == 0)
+		return false;
+
+	OutSplits = Index->BestSplits;
+	return true;
+}
+
+void FKZRunStore::SetSetting(const FString& PlayerId, const FString& Key, const FString& Value)
+{
+	FTable& Table = FindOrLoadTable(KZRunStoreFormat::SettingsTable);
+	FTableData& Target = Table.bLoaded ? Table.Data : Table.Pending;
+	Target.Settings.Add(PlayerId / Key, Value);
+	if (Table.DirtyTime < 0.)
+		Table.DirtyTime = Now;
+}
+
+bool FKZRunStore::GetSetting(const FString& PlayerId, const FString& Key, FString& OutValue)
+{
+	FTable& Table = FindOrLoadTable(KZRunStoreFormat::SettingsTable);
+	const FString SettingKey = PlayerId / Key;
+
+	// Settings changed while loading are already the newest
+	const FString* Value = Table.Pending.Settings.Find(SettingKey);
+	if (Value == nullptr)
+		Value = Table.Data.Settings.Find(SettingKey);
+	if (Value == nullptr)
+		return false;
+
+	OutValue = *Value;
+	return true;
+}
+
+bool FKZRunStore::Tick(float DeltaTime)
+{
+	FPS_SCOPE_CYCLE_COUNTER(KZ, STAT_KZRunStore);
+	Now = FPlatformTime::Seconds();
+
+	for (TPair<FString, FTable>& Pair : Tables)
+	{
+		FTable& Table = Pair.Value;
+		if (!Table.bLoaded)
+		{
+			if (Table.Load.IsReady())
+				FinishLoad(Table, Table.Load.Get());
+			continue;
+		}
+
+		if (Table.Write.IsValid() && Table.Write.IsReady())
+		{
+			// The changes it carried are still only in memory
+			if (!Table.Write.Get() && Table.DirtyTime < 0.)
+				Table.DirtyTime = Now;
+			Table.Write = TFuture<bool>();
+		}
+
+		// One write per file at a time, changes made meanwhile go with the next one
+		if (Table.DirtyTime >= 0. && Now - Table.DirtyTime >= BatchDelay && !Table.Write.IsValid())
+			StartWrite(Pair.Key, Table);
+	}
+	return true;
+}
+
+void FKZRunStore::FinishLoad(FTable& Table, const FTableData& Loaded)
+{
+	// Loaded belongs to the future, copied before the future goes
+	Table.Data = Loaded;
+	Table.Load = TFuture<FTableData>();
+	Table.bLoaded = true;
+
+	Table.Index.Reset();
+	for (const FKZRunResult& Run : Table.Data.Runs)
+	{
+		if (!Table.Index.Contains(Run.PlayerId))
+			RebuildPlayerIndex(Table, Run.PlayerId);
+	}
+
+	for (const FKZRunResult& Run : Table.Pending.Runs)
+		AddRun(Table, Run);
+	Table.Data.Settings.Append(Table.Pending.Settings);
+	Table.Pending = FTableData();
+}
+
+void FKZRunStore::StartWrite(const FString& Map, FTable& Table)
+{
+	Table.DirtyTime = -1.;
+	const FString Filename = GetFilename(Map);
+	Table.Write = Async<bool>(EAsyncExecution::ThreadPool, [Filename, Data = Table.Data]() { return WriteFile(Filename, Data); });
+}
+
+void FKZRunStore::Flush()
+{
+	for (TPair<FString, FTable>& Pair : Tables)
+	{
+		FTable& Table = Pair.Value;
+		if (!Table.bLoaded && Table.Load.IsValid())
+			FinishLoad(Table, Table.Load.Get());
+		if (Table.Write.IsValid())
+		{
+			Table.Write.Wait();
+			Table.Write = TFuture<bool>();
+		}
+		if (Table.DirtyTime >= 0.)
+		{
+			StartWrite(Pair.Key, Table);
+			Table.Write.Wait();
+			Table.Write = TFuture<bool>();
+		}
+	}
+}
+
+FKZRunStore::FTableData FKZRunStore::ReadFile(const FString& Filename)
+{
+	FTableData Data;
+	TArray<uint8> Bytes;
+	if (!FFileHelper::LoadFileToArray(Bytes, *Filename, FILEREAD_Silent))
+	{
+		// A crash while WriteFile replaced the file leaves only the complete temporary one
+		const FString TempFilename = Filename + TEXT(".tmp");
+		if (!FFileHelper::LoadFileToArray(Bytes, *TempFilename, FILEREAD_Silent))
+			return Data;
+		UE_LOG(LogKZRunStore, Display, TEXT("%s is missing, reading %s"), *Filename, *TempFilename);
+	}
+
+	FMemoryReader Reader(Bytes);
+	uint32 Magic = 0;
+	int32 Version = 0;
+	Reader << Magic << Version;
+	if (Magic != KZRunStoreFormat::Magic || Version != KZRunStoreFormat::Version)
+	{
+		UE_LOG(LogKZRunStore, Warning, TEXT("%s is not a KZ results file, starting over"), *Filename);
+		return Data;
+	}
+
+	Reader << Data.Runs << Data.Settings;
+	if (Reader.IsError())
+	{
+		UE_LOG(LogKZRunStore, Warning, TEXT("%s is corrupt, starting over"), *Filename);
+		return FTableData();
+	}
+	return Data;
+}
+
+bool FKZRunStore::WriteFile(const FString& Filename, const FTableData& Data)
+{
+	TArray<uint8> Bytes;
+	FMemoryWriter Writer(Bytes);
+	uint32 Magic = KZRunStoreFormat::Magic;
+	int32 Version = KZRunStoreFormat::Version;
+	Writer << Magic << Version;
+	Writer << const_cast<TArray<FKZRunResult>&>(Data.Runs) << const_cast<TMap<FString, FString>&>(Data.Settings);
+
+	// The old file stays whole until the new one is completely on disk, ReadFile falls back to the new one if the replace is cut short
+	const FString TempFilename = Filename + TEXT(".tmp");
+	if (!FFileHelper::SaveArrayToFile(Bytes, *TempFilename) || !IFileManager::Get().Move(*Filename, *TempFilename, true, true))
+	{
+		UE_LOG(LogKZRunStore, Warning, TEXT("Could not write KZ results %s"), *Filename);
+		return false;
+	}
+	return true;
+}
+
+// "KZ.Results" prints the personal best and best splits of every player with runs on the current map
+static FAutoConsoleCommand ResultsCommand(
+	TEXT("KZ.Results"),
+	TEXT("Logs the personal best and best splits of a player on the current map. Argument: player id."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		FKZRunStore& Store = FKZRunStore::Get();
+		const FString Map = FKZRunStore::GetMapKey(World);
+		const FString PlayerId = Args.Num() > 0 ? Args[0] : TEXT("Local");
+		if (!Store.IsLoaded(Map))
+		{
+			Store.Preload(Map);
+			UE_LOG(LogKZRunStore, Display, TEXT("KZ results of %s are loading, try again"), *Map);
+			return;
+		}
+
+		FKZRunResult Best;
+		TArray<float> BestSplits;
+		if (!Store.GetPersonalBest(Map, PlayerId, Best))
+		{
+			UE_LOG(LogKZRunStore, Display, TEXT("No KZ runs of %s on %s"), *PlayerId, *Map);
+			return;
+		}
+
+		Store.GetBestSplits(Map, PlayerId, BestSplits);
+		UE_LOG(LogKZRunStore, Display, TEXT("%s on %s: personal best %.3f s (%s)"), *PlayerId, *Map, Best.Time, *Best.Date.ToString());
+		for (int32 Split = 0; Split < Best.Splits.Num(); ++Split)
+		{
+			UE_LOG(LogKZRunStore, Display, TEXT("  split %d: %.3f s, best %.3f s"), Split + 1, Best.Splits[Split],
+				BestSplits.IsValidIndex(Split) ? BestSplits[Split] : Best.Splits[Split]);
+		}
+	}));
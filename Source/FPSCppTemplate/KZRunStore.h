@@ -0,0 +1,147 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "Containers/Ticker.h"
+#include "KZRunStore.generated.h"
+
+class UWorld;
+
+/** A finished KZ run */
+USTRUCT(BlueprintType)
+struct FKZRunResult
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Run")
+	FString PlayerId;
+
+	/** Seconds from the start to the finish */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Run")
+	float Time = 0.f;
+
+	/** Seconds from the start to each split, in order */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Run")
+	TArray<float> Splits;
+
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Run")
+	FDateTime Date;
+
+	friend FArchive& operator<<(FArchive& Ar, FKZRunResult& Run)
+	{
+		return Ar << Run.PlayerId << Run.Time << Run.Splits << Run.Date;
+	}
+};
+
+/**
+ * Run results by map and player, and player settings, kept in Saved/KZResults with one file per map.
+ * The game thread only ever works on the in-memory tables: a map is read on the thread pool the first time it is asked
+ * for (or preloaded when it starts), runs submitted meanwhile are merged once it is in, and lookups of a map still loading
+ * come back empty instead of waiting. Changes are batched for BatchDelay seconds, then a copy of the table is serialized
+ * on the thread pool and written to a temporary file that replaces the old one, so a crash never leaves half a file. Replacing
+ * deletes the old file before renaming the new one, a file missing after a crash in between is read from the temporary one.
+ * A failed write is retried BatchDelay later.
+ */
+class FPSCPPTEMPLATE_API FKZRunStore
+{
+public:
+	/** Seconds a changed table waits for more changes before it is written */
+	static const float BatchDelay;
+
+	/** Runs kept per player and map besides the personal best, the oldest go first */
+	static const int32 MaxRunsPerPlayer = 50;
+
+	static FKZRunStore& Get();
+
+	/** Key of the map World plays, without the editor's PIE prefix */
+	static FString GetMapKey(const UWorld* World);
+
+	/** Starts reading the results of Map in the background if they are not loaded yet */
+	void Preload(const FString& Map);
+
+	/** Called for every loaded map, preloads the results of game maps so they are in by the time the first run finishes */
+	static void OnPostLoadMap(UWorld* World);
+
+	bool IsLoaded(const FString& Map) const;
+
+	/** Adds a finished run, written with the next batch. Returns true if it beats the player's personal best known so far */
+	bool SubmitRun(const FString& Map, const FKZRunResult& Run);
+
+	/** Fastest run of the player on Map, false if there is none or the map is still loading */
+	bool GetPersonalBest(const FString& Map, const FString& PlayerId, FKZRunResult& OutRun);
+
+	/** Fastest time the player reached each split in on Map over all their runs, false if there is none or the map is still loading */
+	bool GetBestSplits(const FString& Map, const FString& PlayerId, TArray<float>& OutSplits);
+
+	/** Player settings are stored like the results of a map of their own */
+	void SetSetting(const FString& PlayerId, const FString& Key, const FString& Value);
+	bool GetSetting(const FString& PlayerId, const FString& Key, FString& OutValue);
+
+	/** Waits for the loads and writes in flight and writes every changed table now. Called on exit */
+	void Flush();
+
+private:
+	FKZRunStore();
+	~FKZRunStore();
+
+	/** Contents of one file */
+	struct FTableData
+	{
+		TArray<FKZRunResult> Runs;
+		TMap<FString, FString> Settings;
+	};
+
+	/** Personal best and best splits of a player, rebuilt whenever the player submits a run */
+	struct FPlayerIndex
+	{
+		int32 BestRun = INDEX_NONE;
+		TArray<float> BestSplits;
+	};
+
+	struct FTable
+	{
+		FTableData Data;
+		TMap<FString, FPlayerIndex> Index;
+		bool bLoaded = false;
+		TFuture<FTableData> Load;
+
+		/** Changes made while loading, applied on top of the file */
+		FTableData Pending;
+
+		/** Platform time of the first change not written yet, negative if none */
+		double DirtyTime = -1.;
+		TFuture<bool> Write;
+	};
+
+	/** Returns the table of Map, starting to load it if it was never asked for */
+	FTable& FindOrLoadTable(const FString& Map);
+
+	/** Adds Run to the loaded Table, dropping the player's oldest runs over the limit */
+	void AddRun(FTable& Table, const FKZRunResult& Run);
+
+	void RebuildPlayerIndex(FTable& Table, const FString& PlayerId);
+
+	/** Polls the loads and writes in flight and starts the writes that waited BatchDelay */
+	bool Tick(float DeltaTime);
+
+	/** Makes a loaded table current, merging the changes made while it loaded */
+	void FinishLoad(FTable& Table, const FTableData& Loaded);
+
+	/** Serializes a copy of the table on the thread pool and replaces its file */
+	void StartWrite(const FString& Map, FTable& Table);
+
+	static FString GetFilename(const FString& Map);
+
+	/** Runs on the thread pool */
+	static FTableData ReadFile(const FString& Filename);
+	static bool WriteFile(const FString& Filename, const FTableData& Data);
+
+	TMap<FString, FTable> Tables;
+	FDelegateHandle TickerHandle;
+	FDelegateHandle ExitHandle;
+	double Now;
+
+	static FKZRunStore* Instance;
+};
@@ -0,0 +1,112 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZStrafeSimulation.h"
+#include "KZStrafeTelemetry.h"
+
+void FKZStrafeSimulation::Reset(float Speed)
+{
+	Accumulator = 0.;
+	StepTurn = 0.;
+	StepStrafe = 0.;
+	PreviousSpeed = Speed;
+	CurrentSpeed = Speed;
+	NumSteps = 0;
+	ResetSyncRate();
+}
+
+void FKZStrafeSimulation::ResetSyncRate()
+{
+	StrafeSteps = 0;
+	SyncSteps = 0;
+}
+
+void FKZStrafeSimulation::OffsetSpeed(float Delta)
+{
+	PreviousSpeed += Delta;
+	CurrentSpeed += Delta;
+}
+
+int32 FKZStrafeSimulation::Advance(const FKZStrafeSettings& Settings, float DeltaTime, float TurnInput, float StrafeInput, bool bFalling, float GroundSpeed)
+{
+	if (DeltaTime <= 0.f || Settings.FixedTimeStep <= 0.f)
+		return 0;
+
+	// The frame's turn input is spread evenly over the frame, as a turn speed
+	const double TurnSpeed = TurnInput / DeltaTime;
+	const double StepTime = Settings.FixedTimeStep;
+	double Remaining = DeltaTime;
+	int32 NumStepsRun = 0;
+
+	while (Accumulator + Remaining >= StepTime)
+	{
+		const double Piece = StepTime - Accumulator;
+		StepTurn += TurnSpeed * Piece;
+		StepStrafe += StrafeInput * Piece;
+		Remaining -= Piece;
+		Accumulator = 0.;
+
+		Step(Settings, bFalling, GroundSpeed);
+		++NumStepsRun;
+	}
+
+	Accumulator += Remaining;
+	StepTurn += TurnSpeed * Remaining;
+	StepStrafe += StrafeInput * Remaining;
+	return NumStepsRun;
+}
+
+void FKZStrafeSimulation::Step(const FKZStrafeSettings& Settings, bool bFalling, float GroundSpeed)
+{
+	const double StepTime = Settings.FixedTimeStep;
+	const double AverageTurnSpeed = StepTurn / StepTime;
+	const double AverageStrafe = StepStrafe / StepTime;
+	StepTurn = 0.;
+	StepStrafe = 0.;
+
+	PreviousSpeed = CurrentSpeed;
+	++NumSteps;
+
+	uint8 Flags = bFalling ? FKZStrafeSample::Falling : 0;
+
+	// Losing speed on the ground or against a wall starts the strafe over
+	if (GroundSpeed <= Settings.ResetSpeed)
+	{
+		PreviousSpeed = CurrentSpeed = Settings.MinSpeed;
+		Flags |= FKZStrafeSample::Reset;
+	}
+	// Speed is gained while turning into the strafe direction at a sync turn speed, up to MaxSpeed
+	else if (bFalling && CurrentSpeed < Settings.MaxSpeed && AverageTurnSpeed * AverageStrafe > 0.)
+	{
+		const double AbsTurnSpeed = FMath::Abs(AverageTurnSpeed);
+		if (AbsTurnSpeed >= Settings.MinSyncTurnSpeed && AbsTurnSpeed < Settings.MaxSyncTurnSpeed)
+		{
+			CurrentSpeed += Settings.IncrementRate * Settings.FixedTimeStep;
+			++SyncSteps;
+			Flags |= FKZStrafeSample::Synced;
+		}
+		++StrafeSteps;
+		Flags |= FKZStrafeSample::Strafing;
+	}
+
+	if (Telemetry)
+	{
+		FKZStrafeSample Sample;
+		Sample.TurnSpeed = float(AverageTurnSpeed);
+		Sample.Speed = CurrentSpeed;
+		Sample.Gain = CurrentSpeed - PreviousSpeed;
+		Sample.StrafeDirection = AverageStrafe > 0. ? 1 : (AverageStrafe < 0. ? -1 : 0);
+		Sample.Flags = Flags;
+		Telemetry->AddSample(Sample);
+	}
+}
+
+float FKZStrafeSimulation::GetInterpolatedSpeed(const FKZStrafeSettings& Settings) const
+{
+	const float Alpha = Settings.FixedTimeStep > 0.f ? FMath::Clamp(float(Accumulator / Settings.FixedTimeStep), 0.f, 1.f) : 1.f;
+	return FMath::Lerp(PreviousSpeed, CurrentSpeed, Alpha);
+}
+
+float FKZStrafeSimulation::GetSyncRate() const
+{
+	return StrafeSteps > 0 ? float(double(SyncSteps) / StrafeSteps) : 0.f;
+}
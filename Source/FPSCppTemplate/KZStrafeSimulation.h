@@ -0,0 +1,91 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FKZStrafeTelemetry;
+
+/** Tuning of the KZ strafe speed gain, see the "KZ Jump" properties of AFPSCppTemplateCharacter */
+struct FKZStrafeSettings
+{
+	/** Length of one simulation step in seconds */
+	float FixedTimeStep = 1.f / 120.f;
+
+	/** Speed the strafe speed resets to */
+	float MinSpeed = 635.f;
+
+	/** No more speed is gained once the strafe speed reaches this */
+	float MaxSpeed = 3000.f;
+
+	/** Speed gained per second of synced strafing */
+	float IncrementRate = 150.f * 2.54f;
+
+	/** Strafe speed resets to MinSpeed while the ground speed is at or below this */
+	float ResetSpeed = 635.f * .33f;
+
+	/** Range of turn input per second that counts as synced with the strafe */
+	float MinSyncTurnSpeed = .99f * 60.f;
+	float MaxSyncTurnSpeed = 10.f * 60.f;
+};
+
+/**
+ * Fixed timestep KZ strafe speed simulation.
+ * Frame input is spread over the frame's time and averaged per step, so the gained speed and the sync rate only depend on
+ * the input over time and not on the frame rate. The speed handed to the movement component is interpolated between steps.
+ */
+class FPSCPPTEMPLATE_API FKZStrafeSimulation
+{
+public:
+	/** Clears the step accumulator and sync rate and sets the strafe speed */
+	void Reset(float Speed);
+
+	void ResetSyncRate();
+
+	/** Shifts the strafe speed by Delta, e.g. to apply a correction from the server */
+	void OffsetSpeed(float Delta);
+
+	/**
+	 * Advances by DeltaTime, running every step that completes within it. Returns the number of steps run.
+	 * @param TurnInput		Turn axis input of the frame (mouse delta, the yaw turned is proportional to it)
+	 * @param StrafeInput	Normalized MoveRight axis input of the frame
+	 * @param bFalling		Speed is only gained in the air
+	 * @param GroundSpeed	Current 2D velocity, compared against ResetSpeed
+	 */
+	int32 Advance(const FKZStrafeSettings& Settings, float DeltaTime, float TurnInput, float StrafeInput, bool bFalling, float GroundSpeed);
+
+	/** Strafe speed after the last step */
+	FORCEINLINE float GetSpeed() const { return CurrentSpeed; }
+
+	/** Strafe speed between the last two steps at the time left in the accumulator */
+	float GetInterpolatedSpeed(const FKZStrafeSettings& Settings) const;
+
+	/** Fraction of the strafing steps spent turning within the sync range, exact however long the session */
+	float GetSyncRate() const;
+
+	FORCEINLINE int64 GetNumSteps() const { return NumSteps; }
+
+	/** Every step from now on is sampled into Telemetry, nullptr to stop */
+	FORCEINLINE void SetTelemetry(FKZStrafeTelemetry* InTelemetry) { Telemetry = InTelemetry; }
+
+private:
+	void Step(const FKZStrafeSettings& Settings, bool bFalling, float GroundSpeed);
+
+	/** Time into the current step */
+	double Accumulator = 0.;
+
+	/** Turn and strafe input integrated over the current step */
+	double StepTurn = 0.;
+	double StepStrafe = 0.;
+
+	float PreviousSpeed = 0.f;
+	float CurrentSpeed = 0.f;
+
+	/** Steps spent turning into the strafe direction, and the ones of them within the sync range */
+	int64 StrafeSteps = 0;
+	int64 SyncSteps = 0;
+
+	int64 NumSteps = 0;
+
+	FKZStrafeTelemetry* Telemetry = nullptr;
+};
@@ -0,0 +1,53 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZStrafeSimulation.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FKZStrafeDeterminismTest, "FPSCppTemplate.KZ.StrafeDeterminism",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ServerContext | EAutomationTestFlags::ProductFilter)
+
+bool FKZStrafeDeterminismTest::RunTest(const FString& Parameters)
+{
+	// Strafes switch side every half second, turning at a sync speed. The stream ends with a second of no input so the
+	// last partial step of every frame rate does not change the speed
+	const int32 StrafeSeconds = 4;
+	const float TurnSpeed = 180.f;
+	const FKZStrafeSettings Settings;
+
+	float ReferenceSpeed = 0.f;
+	float ReferenceSyncRate = 0.f;
+	for (int32 FrameRate : { 30, 60, 144, 300 })
+	{
+		FKZStrafeSimulation Simulation;
+		Simulation.Reset(Settings.MinSpeed);
+
+		// Input is constant within a frame, frames of every tested rate line up with the half second switches
+		const float DeltaTime = 1.f / FrameRate;
+		for (int32 Frame = 0; Frame < (StrafeSeconds + 1) * FrameRate; ++Frame)
+		{
+			const bool bStrafing = Frame < StrafeSeconds * FrameRate;
+			const float Side = ((Frame * 2 / FrameRate) % 2 == 0) ? 1.f : -1.f;
+			Simulation.Advance(Settings, DeltaTime, bStrafing ? Side * TurnSpeed * DeltaTime : 0.f, bStrafing ? Side : 0.f, true, Simulation.GetSpeed());
+		}
+
+		if (FrameRate == 30)
+		{
+			ReferenceSpeed = Simulation.GetSpeed();
+			ReferenceSyncRate = Simulation.GetSyncRate();
+			TestTrue(TEXT("Strafing gains speed"), ReferenceSpeed > Settings.MinSpeed);
+			continue;
+		}
+
+		// Bit-exact, the fixed step makes every frame rate run the same steps
+		TestTrue(FString::Printf(TEXT("%d fps speed %.4f matches 30 fps %.4f"), FrameRate, Simulation.GetSpeed(), ReferenceSpeed),
+			Simulation.GetSpeed() == ReferenceSpeed);
+		TestTrue(FString::Printf(TEXT("%d fps sync rate %.4f matches 30 fps %.4f"), FrameRate, Simulation.GetSyncRate(), ReferenceSyncRate),
+			Simulation.GetSyncRate() == ReferenceSyncRate);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,211 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "KZStrafeTelemetry.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformFilemanager.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/Paths.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogKZTelemetry, Log, All);
+
+namespace KZTelemetry
+{
+	/** About 8 seconds of steps at 120 Hz, the worker wakes up long before it fills. A circular queue holds one item less */
+	static const int32 SampleCapacity = 1024;
+	static const int32 ReportCapacity = 64;
+
+	/** The game thread only wakes the worker once this much is queued, otherwise it polls */
+	static const int32 WakeThreshold = SampleCapacity / 4;
+	static const uint32 PollIntervalMs = 50;
+
+	static void WriteLine(IFileHandle* FileHandle, const FString& Line)
+	{
+		const FTCHARToUTF8 Utf8(*(Line + LINE_TERMINATOR));
+		FileHandle->Write(reinterpret_cast<const uint8*>(Utf8.Get()), Utf8.Length());
+	}
+}
+
+FKZStrafeTelemetry::FKZStrafeTelemetry(int32 InWindowJumps, IFileHandle* InFileHandle)
+	: Samples(KZTelemetry::SampleCapacity)
+	, Reports(KZTelemetry::ReportCapacity)
+	, Thread(nullptr)
+	, WakeEvent(FPlatformProcess::GetSynchEventFromPool())
+	, NumDroppedSamples(0)
+	, FileHandle(InFileHandle)
+	, bInJump(false)
+	, PreviousStrafeDirection(0)
+	, TurnSpeedSum(0.)
+	, NumJumps(0)
+	, WindowJumps(FMath::Max(InWindowJumps, 1))
+{
+	Window.Reserve(WindowJumps);
+}
+
+TUniquePtr<FKZStrafeTelemetry> FKZStrafeTelemetry::Create(int32 WindowJumps, const FString& CsvFilename)
+{
+	IFileHandle* FileHandle = nullptr;
+	if (!CsvFilename.IsEmpty())
+	{
+		IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+		PlatformFile.CreateDirectoryTree(*FPaths::GetPath(CsvFilename));
+		FileHandle = PlatformFile.OpenWrite(*CsvFilename);
+		if (FileHandle)
+			KZTelemetry::WriteLine(FileHandle, TEXT("Jump,AirSteps,StrafeSteps,SyncSteps,SyncRate,LeftSteps,RightSteps,StrafeSwitches,AverageTurnSpeed,StartSpeed,EndSpeed,MaxSpeed,Gain,WindowSyncRate,WindowGain"));
+		else
+			UE_LOG(LogKZTelemetry, Warning, TEXT("Could not create KZ telemetry file %s"), *CsvFilename);
+	}
+
+	TUniquePtr<FKZStrafeTelemetry> Telemetry(new FKZStrafeTelemetry(WindowJumps, FileHandle));
+	Telemetry->Thread = FRunnableThread::Create(Telemetry.Get(), TEXT("KZStrafeTelemetry"), 0, TPri_BelowNormal);
+	return Telemetry;
+}
+
+FKZStrafeTelemetry::~FKZStrafeTelemetry()
+{
+	if (Thread)
+	{
+		Thread->Kill(true);
+		delete Thread;
+	}
+	else
+	{
+		// No worker thread, finish synchronously
+		ProcessSamples();
+	}
+
+	FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+	if (FileHandle)
+	{
+		FileHandle->Flush();
+		delete FileHandle;
+	}
+
+	if (NumDroppedSamples > 0)
+		UE_LOG(LogKZTelemetry, Warning, TEXT("KZ telemetry dropped %lld samples"), NumDroppedSamples);
+}
+
+void FKZStrafeTelemetry::AddSample(const FKZStrafeSample& Sample)
+{
+	if (!Samples.Enqueue(Sample))
+	{
+		++NumDroppedSamples;
+		return;
+	}
+
+	if (Samples.Count() == uint32(KZTelemetry::WakeThreshold))
+		WakeEvent->Trigger();
+}
+
+uint32 FKZStrafeTelemetry::Run()
+{
+	while (!bStopping)
+	{
+		WakeEvent->Wait(KZTelemetry::PollIntervalMs);
+		ProcessSamples();
+	}
+
+	// Everything queued before Stop
+	ProcessSamples();
+	return 0;
+}
+
+void FKZStrafeTelemetry::Stop()
+{
+	bStopping = true;
+	WakeEvent->Trigger();
+}
+
+void FKZStrafeTelemetry::ProcessSamples()
+{
+	FKZStrafeSample Sample;
+	while (Samples.Dequeue(Sample))
+		ProcessSample(Sample);
+}
+
+void FKZStrafeTelemetry::ProcessSample(const FKZStrafeSample& Sample)
+{
+	const bool bFalling = (Sample.Flags & FKZStrafeSample::Falling) != 0;
+	if (!bFalling)
+	{
+		// Landed
+		if (bInJump)
+			FinishJump();
+		return;
+	}
+
+	if (!bInJump)
+	{
+		bInJump = true;
+		CurrentJump = FKZJumpStats();
+		CurrentJump.FirstJump = NumJumps;
+		CurrentJump.NumJumps = 1;
+		CurrentJump.StartSpeed = Sample.Speed - Sample.Gain;
+		CurrentJump.MaxSpeed = CurrentJump.StartSpeed;
+		PreviousStrafeDirection = 0;
+		TurnSpeedSum = 0.;
+	}
+
+	++CurrentJump.AirSteps;
+	if (Sample.Flags & FKZStrafeSample::Strafing)
+		++CurrentJump.StrafeSteps;
+	if (Sample.Flags & FKZStrafeSample::Synced)
+		++CurrentJump.SyncSteps;
+
+	if (Sample.StrafeDirection != 0)
+	{
+		++(Sample.StrafeDirection < 0 ? CurrentJump.LeftSteps : CurrentJump.RightSteps);
+		if (PreviousStrafeDirection != 0 && Sample.StrafeDirection != PreviousStrafeDirection)
+			++CurrentJump.StrafeSwitches;
+		PreviousStrafeDirection = Sample.StrafeDirection;
+	}
+
+	TurnSpeedSum += FMath::Abs(Sample.TurnSpeed);
+	CurrentJump.EndSpeed = Sample.Speed;
+	CurrentJump.MaxSpeed = FMath::Max(CurrentJump.MaxSpeed, Sample.Speed);
+}
+
+void FKZStrafeTelemetry::FinishJump()
+{
+	bInJump = false;
+	CurrentJump.AverageTurnSpeed = float(TurnSpeedSum / CurrentJump.AirSteps);
+	++NumJumps;
+
+	if (Window.Num() < WindowJumps)
+		Window.Add(CurrentJump);
+	else
+		Window[CurrentJump.FirstJump % Window.Num()] = CurrentJump;
+
+	// Integer counts are summed, the speeds come from the oldest and newest jump of the window
+	FKZJumpReport Report;
+	Report.Jump = CurrentJump;
+	FKZJumpStats& Sum = Report.Window;
+	double WindowTurnSum = 0.;
+	Sum.FirstJump = NumJumps - Window.Num();
+	Sum.NumJumps = Window.Num();
+	Sum.EndSpeed = CurrentJump.EndSpeed;
+	for (const FKZJumpStats& Jump : Window)
+	{
+		Sum.AirSteps += Jump.AirSteps;
+		Sum.StrafeSteps += Jump.StrafeSteps;
+		Sum.SyncSteps += Jump.SyncSteps;
+		Sum.LeftSteps += Jump.LeftSteps;
+		Sum.RightSteps += Jump.RightSteps;
+		Sum.StrafeSwitches += Jump.StrafeSwitches;
+		Sum.MaxSpeed = FMath::Max(Sum.MaxSpeed, Jump.MaxSpeed);
+		WindowTurnSum += double(Jump.AverageTurnSpeed) * Jump.AirSteps;
+		if (Jump.FirstJump == Sum.FirstJump)
+			Sum.StartSpeed = Jump.StartSpeed;
+	}
+	Sum.AverageTurnSpeed = Sum.AirSteps > 0 ? float(WindowTurnSum / Sum.AirSteps) : 0.f;
+
+	// The game thread only looks at the latest reports, so a full queue just loses this one
+	Reports.Enqueue(Report);
+
+	if (FileHandle)
+	{
+		const FKZJumpStats& Jump = Report.Jump;
+		KZTelemetry::WriteLine(FileHandle, FString::Printf(TEXT("%d,%d,%d,%d,%.4f,%d,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.4f,%.2f"),
+			Jump.FirstJump, Jump.AirSteps, Jump.StrafeSteps, Jump.SyncSteps, Jump.GetSyncRate(), Jump.LeftSteps, Jump.RightSteps, Jump.StrafeSwitches,
+			Jump.AverageTurnSpeed, Jump.StartSpeed, Jump.EndSpeed, Jump.MaxSpeed, Jump.GetGain(), Sum.GetSyncRate(), Sum.GetGain()));
+	}
+}
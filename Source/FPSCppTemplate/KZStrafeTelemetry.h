@@ -0,0 +1,164 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/CircularQueue.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "KZStrafeTelemetry.generated.h"
+
+class FRunnableThread;
+class FEvent;
+class IFileHandle;
+
+/** One fixed step of the strafe simulation */
+struct FKZStrafeSample
+{
+	enum EFlags : uint8
+	{
+		Falling = 1 << 0,
+		/** Turning into the strafe direction below the speed cap */
+		Strafing = 1 << 1,
+		/** Strafing within the sync turn speed range, the step gained speed */
+		Synced = 1 << 2,
+		/** Ground speed dropped to the reset speed, the strafe speed went back to the minimum */
+		Reset = 1 << 3,
+	};
+
+	/** Average turn input per second over the step */
+	float TurnSpeed = 0.f;
+
+	/** Strafe speed after the step */
+	float Speed = 0.f;
+
+	/** Strafe speed change of the step */
+	float Gain = 0.f;
+
+	/** -1 strafing left, 1 right, 0 none */
+	int8 StrafeDirection = 0;
+
+	uint8 Flags = 0;
+};
+
+/** Strafe statistics of a jump, take-off to landing, or of several jumps. Counted in simulation steps so sync rates are exact */
+USTRUCT(BlueprintType)
+struct FKZJumpStats
+{
+	GENERATED_BODY()
+
+	/** Index of the (first) jump since telemetry started */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	int32 FirstJump = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	int32 NumJumps = 0;
+
+	/** Steps in the air */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	int32 AirSteps = 0;
+
+	/** Steps turning into the strafe direction */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	int32 StrafeSteps = 0;
+
+	/** Strafe steps within the sync turn speed range */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	int32 SyncSteps = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	int32 LeftSteps = 0;
+
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	int32 RightSteps = 0;
+
+	/** Changes of strafe direction */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	int32 StrafeSwitches = 0;
+
+	/** Absolute turn input per second averaged over the air steps */
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	float AverageTurnSpeed = 0.f;
+
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	float StartSpeed = 0.f;
+
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	float EndSpeed = 0.f;
+
+	UPROPERTY(BlueprintReadOnly, Category = "KZ Telemetry")
+	float MaxSpeed = 0.f;
+
+	FORCEINLINE float GetSyncRate() const { return StrafeSteps > 0 ? float(double(SyncSteps) / StrafeSteps) : 0.f; }
+	FORCEINLINE float GetGain() const { return EndSpeed - StartSpeed; }
+};
+
+/** A finished jump and the window of jumps ending with it */
+struct FKZJumpReport
+{
+	FKZJumpStats Jump;
+	FKZJumpStats Window;
+};
+
+/**
+ * Per-jump KZ strafe telemetry.
+ * The strafe simulation pushes one sample per step into a fixed capacity queue; a worker thread splits the samples into jumps,
+ * aggregates them over a window of recent jumps, optionally appends them to a CSV file and hands the results back through
+ * a second queue. The game thread never allocates, locks or waits on the worker, samples are dropped if the worker falls behind.
+ */
+class FPSCPPTEMPLATE_API FKZStrafeTelemetry : public FRunnable
+{
+public:
+	/**
+	 * Starts the worker thread.
+	 * @param WindowJumps	Number of recent jumps the windowed statistics cover
+	 * @param CsvFilename	File the jumps are appended to, none if empty
+	 */
+	static TUniquePtr<FKZStrafeTelemetry> Create(int32 WindowJumps, const FString& CsvFilename);
+
+	/** Processes the queued samples and stops the worker thread */
+	virtual ~FKZStrafeTelemetry();
+
+	/** Queues a simulation step. Game thread only */
+	void AddSample(const FKZStrafeSample& Sample);
+
+	/** Takes the oldest jump finished by the worker, false if there is none. Game thread only */
+	FORCEINLINE bool PopJumpReport(FKZJumpReport& OutReport) { return Reports.Dequeue(OutReport); }
+
+	/** Samples dropped because the queue was full */
+	FORCEINLINE int64 GetNumDroppedSamples() const { return NumDroppedSamples; }
+
+	// FRunnable
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	FKZStrafeTelemetry(int32 InWindowJumps, IFileHandle* InFileHandle);
+
+	/** Aggregates everything in the sample queue. Worker thread only */
+	void ProcessSamples();
+	void ProcessSample(const FKZStrafeSample& Sample);
+	void FinishJump();
+
+	/** Lock-free single producer single consumer queues, game thread to worker and back */
+	TCircularQueue<FKZStrafeSample> Samples;
+	TCircularQueue<FKZJumpReport> Reports;
+
+	FRunnableThread* Thread;
+	FEvent* WakeEvent;
+	FThreadSafeBool bStopping;
+
+	// Game thread state
+	int64 NumDroppedSamples;
+
+	// Worker thread state
+	IFileHandle* FileHandle;
+	FKZJumpStats CurrentJump;
+	bool bInJump;
+	int8 PreviousStrafeDirection;
+	double TurnSpeedSum;
+	int32 NumJumps;
+	int32 WindowJumps;
+	/** Last WindowJumps jumps, oldest overwritten first */
+	TArray<FKZJumpStats> Window;
+};
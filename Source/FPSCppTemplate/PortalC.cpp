@@ -1,8 +1,22 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "PortalC.h"
+#include "FPSCppTemplate.h"
+#include "FPSCppTemplateHUD.h"
 #include "Kismet/GameplayStatics.h"
 #include "Camera/CameraComponent.h"
+#include "Math/TranslationMatrix.h"
+#include "KZAssetLoader.h"
+#include "KZBenchmark.h"
+#include "PortalManager.h"
+#include "PortalRenderTargetPool.h"
+#include "SceneManagement.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "Materials/MaterialInstanceDynamic.h"
+
+DECLARE_CYCLE_STAT(TEXT("Transform Update"), STAT_PortalTransformUpdate, STATGROUP_Portal);
+DECLARE_CYCLE_STAT(TEXT("Capture Setup"), STAT_PortalCaptureSetup, STATGROUP_Portal);
+DECLARE_CYCLE_STAT(TEXT("CaptureScene"), STAT_PortalCaptureScene, STATGROUP_Portal);
 
 
 // Sets default values
@@ -19,11 +33,7 @@ APortalC::APortalC()
 	RootCapsule->SetCollisionResponseToAllChannels(ECollisionResponse::ECR_Ignore);;
 
 	CoordCube = CreateDefaultSubobject<UStaticMeshComponent>(TEXT("MyCoordCube"));
-	UStaticMesh* Mesh = LoadObject<UStaticMesh>(nullptr, TEXT("/Game/Geometry/Meshes/1M_Cube"));
-	if (Mesh)
-	{
-		CoordCube->SetStaticMesh(Mesh);
-	}
+	CoordCubeMesh = TSoftObjectPtr<UStaticMesh>(FSoftObjectPath(TEXT("/Game/Geometry/Meshes/1M_Cube.1M_Cube")));
 	CoordCube->SetHiddenInGame(true);
 	CoordCube->SetCollisionResponseToAllChannels(ECollisionResponse::ECR_Ignore);;
 	CoordCube->SetupAttachment(RootCapsule);
@@ -31,7 +41,9 @@ APortalC::APortalC()
 
 	SceneCaptureCPP = CreateDefaultSubobject<USceneCaptureComponent2D>(TEXT("MySceneCapture"));
 	SceneCaptureCPP->SetupAttachment(RootCapsule);
-	
+	// Captures are issued manually by the APortalManager capture scheduler
+	SceneCaptureCPP->bCaptureEveryFrame = false;
+	SceneCaptureCPP->bCaptureOnMovement = false;
 
 	// Intialize variables
 	X = FVector(1,0,0);
@@ -42,6 +54,20 @@ APortalC::APortalC()
 	KCoordMat = CreateCoordMatrix(X, Y, Z);
 	JCoordInvMat = CreateCoordMatrix(X, Y, Z);
 	KCoordInvMat = CreateCoordMatrix(X, Y, Z);
+	CoordVersion = 0;
+
+	PortalPairMat = FMatrix::Identity;
+	CachedPairTo = nullptr;
+	CachedPairFromVersion = 0;
+	CachedPairToVersion = 0;
+
+	PortalBounds = FBox(ForceInit);
+	PortalBoundsVersion = MAX_uint32;
+	SpatialIndexId = INDEX_NONE;
+	Views.SetNum(1);
+	PortalSurfaceMaterialIndex = 0;
+	DefaultPrimitiveRenderMode = ESceneCapturePrimitiveRenderMode::PRM_RenderScenePrimitives;
+	PortalTextureParameterName = TEXT("PortalTexture");
 
 	PlayerCam = nullptr;
 	PortalToCPP = nullptr;
@@ -49,6 +75,7 @@ APortalC::APortalC()
 
 	DrawLocalCoord = false;
 	ActorTeleportPositiveOffset = 0.001;
+	OpeningHalfExtent = FVector2D::ZeroVector;
 }
 
 // Called when the game starts or when spawned
@@ -56,15 +83,63 @@ void APortalC::BeginPlay()
 {
 	Super::BeginPlay();
 	UpdateXYZFromCoordCube();
+	// Only rebuild the coord frame when the cube really moves instead of polling it every Tick
+	if (CoordCube)
+		CoordCubeTransformUpdatedHandle = CoordCube->TransformUpdated.AddUObject(this, &APortalC::OnCoordCubeTransformUpdated);
 	// These two references must be set in Blueprint
 
 	if (PlayerRefCPP)
 		PlayerCam = PlayerRefCPP->GetFirstPersonCameraComponent();
+
+	FPortalView& View = Views[0];
+	View.Capture = SceneCaptureCPP;
+	View.BaseTarget = SceneCaptureCPP->TextureTarget;
+	View.DisplayTarget = View.BaseTarget;
+	DefaultCaptureShowFlags = SceneCaptureCPP->ShowFlags;
+	DefaultHiddenComponents = SceneCaptureCPP->HiddenComponents;
+	DefaultPrimitiveRenderMode = SceneCaptureCPP->PrimitiveRenderMode;
+
+	PortalManager = APortalManager::Get(GetWorld());
+	if (PortalManager.IsValid())
+		PortalManager->RegisterPortal(this);
+}
+
+void APortalC::OnConstruction(const FTransform& Transform)
+{
+	Super::OnConstruction(Transform);
+
+	UWorld* World = GetWorld();
+	if (CoordCube && CoordCube->GetStaticMesh() == nullptr && World && !World->IsGameWorld())
+		CoordCube->SetStaticMesh(FKZAssetLoader::Get().LoadSynchronous(CoordCubeMesh));
+}
+
+void APortalC::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (CoordCube)
+		CoordCube->TransformUpdated.Remove(CoordCubeTransformUpdatedHandle);
+	RemoveExtraViews();
+	if (PortalManager.IsValid())
+	{
+		if (Views[0].DisplayTarget != Views[0].BaseTarget)
+			PortalManager->GetRenderTargetPool()->Release(Views[0].DisplayTarget);
+		PortalManager->UnregisterPortal(this);
+	}
+	Views[0].DisplayTarget = Views[0].BaseTarget;
+	Super::EndPlay(EndPlayReason);
+}
+
+void APortalC::OnCoordCubeTransformUpdated(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	UpdateXYZFromCoordCube();
+	if (PortalManager.IsValid())
+		PortalManager->MarkPortalMoved(this);
 }
 
 //Hang Yu
 void APortalC::UpdateXYZFromCoordCube()
 {
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalTransformUpdate);
+
 	if (CoordCube == nullptr)
 	{
 		if (GEngine)
@@ -79,16 +154,7 @@ void APortalC::UpdateXYZFromCoordCube()
 	FVector _Z = CoordCube->GetUpVector();
 	FVector _Origin = CoordCube->GetComponentLocation();
 
-	// Draw debug Coord Axis
-	if (DrawLocalCoord)
-	{
-		DrawDebugLine(GetWorld(), _Origin, _Origin + _X * 1000, FColor(255, 0, 0), false, -1, 0, 12.333);
-		DrawDebugLine(GetWorld(), _Origin, _Origin + _Y * 1000, FColor(0, 255, 0), false, -1, 0, 12.333);
-		DrawDebugLine(GetWorld(), _Origin, _Origin + _Z * 1000, FColor(0, 0, 255), false, -1, 0, 12.333);
-	}
-
-
-	if (!X.Equals(_X) || !Y.Equals(_Y) || !Z.Equals(_Y) || !Origin.Equals(_Origin))
+	if (!X.Equals(_X) || !Y.Equals(_Y) || !Z.Equals(_Z) || !Origin.Equals(_Origin))
 	{
 		// Part 1.
 		X = SetVector(_X);
@@ -100,6 +166,8 @@ void APortalC::UpdateXYZFromCoordCube()
 		JCoordInvMat = JCoordMat.Inverse();
 		KCoordMat = CreateCoordMatrix(-X, -Y, Z);
 		KCoordInvMat = KCoordMat.Inverse();
+		// Invalidate every portal pair matrix that was built from the old frame
+		++CoordVersion;
 /*
 		DrawDebugMatrix(JCoordMat, FColor::Red);
 		DrawDebugMatrix(JCoordInvMat, FColor::Green);
@@ -132,53 +200,392 @@ FVector APortalC::SetVector(const FVector V)
 	return FVector(V.X, V.Y, V.Z);
 }
 
-void APortalC::UpdateSceneCaptureWRTPlayerCamera()
+void APortalC::DrawDebugCoordAxis()
+{
+	DrawDebugLine(GetWorld(), Origin, Origin + X * 1000, FColor(255, 0, 0), false, -1, 0, 12.333);
+	DrawDebugLine(GetWorld(), Origin, Origin + Y * 1000, FColor(0, 255, 0), false, -1, 0, 12.333);
+	DrawDebugLine(GetWorld(), Origin, Origin + Z * 1000, FColor(0, 0, 255), false, -1, 0, 12.333);
+}
+
+const FMatrix& APortalC::GetPortalPairMatrix(const APortalC* To) const
+{
+	check(To);
+	if (CachedPairTo != To || CachedPairFromVersion != CoordVersion || CachedPairToVersion != To->CoordVersion)
+	{
+		// Row vectors: K inverse of this portal is applied first, then J of the other portal.
+		// The coord matrices carry a (1,1,1) W row, so only keep their rotation part and fold both origins in explicitly
+		FMatrix PairRotation = KCoordInvMat * To->JCoordMat;
+		PairRotation.RemoveTranslation();
+		PortalPairMat = FTranslationMatrix(-Origin) * PairRotation * FTranslationMatrix(To->Origin);
+
+		CachedPairTo = To;
+		CachedPairFromVersion = CoordVersion;
+		CachedPairToVersion = To->CoordVersion;
+	}
+	return PortalPairMat;
+}
+
+const FBox& APortalC::GetPortalBounds()
+{
+	if (PortalBoundsVersion != CoordVersion)
+	{
+		PortalBounds = GetComponentsBoundingBox(true);
+		PortalBoundsVersion = CoordVersion;
+	}
+	return PortalBounds;
+}
+
+FBox APortalC::GetIndexBounds()
+{
+	FBox IndexBounds = GetPortalBounds();
+	const FVector2D HalfExtent = GetOpeningHalfExtent();
+	IndexBounds += Origin + Y * HalfExtent.X + Z * HalfExtent.Y;
+	IndexBounds += Origin + Y * HalfExtent.X - Z * HalfExtent.Y;
+	IndexBounds += Origin - Y * HalfExtent.X + Z * HalfExtent.Y;
+	IndexBounds += Origin - Y * HalfExtent.X - Z * HalfExtent.Y;
+	return IndexBounds;
+}
+
+UCameraComponent* APortalC::GetCaptureViewCamera(int32 ViewIndex)
+{
+	if (PortalToCPP == nullptr)
+		return nullptr;
+
+	// Split-screen views are strictly the local players' own, PlayerRefCPP would render one of them twice or a camera no one looks through
+	if (PortalManager.IsValid() && PortalManager->GetNumLocalPlayers() > 1)
+		return PortalManager->GetLocalPlayerCamera(ViewIndex);
+
+	if (ViewIndex > 0)
+		return nullptr;
+
+	if (PlayerRefCPP)
+	{
+		if (PlayerCam == nullptr)
+			PlayerCam = PlayerRefCPP->GetFirstPersonCameraComponent();
+		return PlayerCam;
+	}
+
+	return PortalManager.IsValid() ? PortalManager->GetLocalPlayerCamera(0) : nullptr;
+}
+
+uint64 APortalC::GetLastCaptureFrame(int32 ViewIndex) const
+{
+	return Views.IsValidIndex(ViewIndex) ? Views[ViewIndex].LastCaptureFrame : 0;
+}
+
+FVector2D APortalC::GetOpeningHalfExtent() const
+{
+	if (!OpeningHalfExtent.IsNearlyZero())
+		return OpeningHalfExtent;
+	return FVector2D(RootCapsule->GetScaledCapsuleRadius(), RootCapsule->GetScaledCapsuleHalfHeight());
+}
+
+bool APortalC::IsNameStableForNetworking() const
+{
+	return bNetNameStable || Super::IsNameStableForNetworking();
+}
+
+bool APortalC::IntersectSegment(const FVector& Start, const FVector& End, float& OutTime) const
+{
+	// X, Y, Z are orthonormal, so dot products give the local frame coordinates
+	const FVector LocalStart = Start - Origin;
+	const float StartX = FVector::DotProduct(LocalStart, X);
+	if (StartX <= 0.f)
+		return false;
+
+	const FVector LocalEnd = End - Origin;
+	const float EndX = FVector::DotProduct(LocalEnd, X);
+	if (EndX > 0.f)
+		return false;
+
+	OutTime = StartX / (StartX - EndX);
+	const FVector LocalHit = FMath::Lerp(LocalStart, LocalEnd, OutTime);
+	const FVector2D HalfExtent = GetOpeningHalfExtent();
+	return FMath::Abs(FVector::DotProduct(LocalHit, Y)) <= HalfExtent.X && FMath::Abs(FVector::DotProduct(LocalHit, Z)) <= HalfExtent.Y;
+}
+
+void APortalC::SetPortalSurface(UPrimitiveComponent* Surface, int32 MaterialIndex)
+{
+	// The copies of the other views follow the new surface when they are needed next
+	RemoveExtraViews();
+	Views[0].Surface = Surface;
+	Views[0].SurfaceMID = Surface ? Surface->CreateAndSetMaterialInstanceDynamic(MaterialIndex) : nullptr;
+	PortalSurfaceMaterialIndex = MaterialIndex;
+}
+
+FPortalView* APortalC::FindOrAddView(int32 ViewIndex)
 {
-	if (PortalToCPP == nullptr || PlayerRefCPP == nullptr)
+	if (Views.IsValidIndex(ViewIndex) && Views[ViewIndex].Capture)
+		return &Views[ViewIndex];
+
+	if (Views.Num() <= ViewIndex)
+		Views.SetNum(ViewIndex + 1);
+
+	// Every view needs a surface of its own to show its capture on, and a target the size of the Blueprint one
+	const FPortalView& FirstView = Views[0];
+	if (FirstView.Surface == nullptr || FirstView.SurfaceMID == nullptr || FirstView.BaseTarget == nullptr || !PortalManager.IsValid())
+		return nullptr;
+
+	UPortalRenderTargetPool* Pool = PortalManager->GetRenderTargetPool();
+	UTextureRenderTarget2D* Target = Pool->Acquire(FirstView.BaseTarget->SizeX, FirstView.BaseTarget->SizeY, FirstView.BaseTarget->GetFormat());
+	if (Target == nullptr)
+		return nullptr;
+
+	FPortalView& View = Views[ViewIndex];
+	View.BaseTarget = Target;
+	View.DisplayTarget = Target;
+
+	// Copies of the Blueprint components, with the settings they have now
+	View.Capture = NewObject<USceneCaptureComponent2D>(this, NAME_None, RF_Transient, SceneCaptureCPP);
+	View.Capture->SetupAttachment(SceneCaptureCPP->GetAttachParent());
+	View.Capture->ShowFlags = DefaultCaptureShowFlags;
+	View.Capture->PrimitiveRenderMode = DefaultPrimitiveRenderMode;
+	View.Capture->TextureTarget = Target;
+	View.Capture->RegisterComponent();
+
+	View.Surface = NewObject<UPrimitiveComponent>(this, FirstView.Surface->GetClass(), NAME_None, RF_Transient, FirstView.Surface);
+	View.Surface->SetupAttachment(FirstView.Surface->GetAttachParent(), FirstView.Surface->GetAttachSocketName());
+	View.Surface->RegisterComponent();
+	View.SurfaceMID = View.Surface->CreateAndSetMaterialInstanceDynamicFromMaterial(PortalSurfaceMaterialIndex, FirstView.SurfaceMID->Parent);
+	View.SurfaceMID->SetTextureParameterValue(PortalTextureParameterName, Target);
+
+	// Each player only sees the surface of their own view, the first copy also hides view 0 from the others
+	if (!PortalManager->IsViewSurface(FirstView.Surface))
+		PortalManager->AddViewSurface(FirstView.Surface, 0);
+	PortalManager->AddViewSurface(View.Surface, ViewIndex);
+	return &View;
+}
+
+void APortalC::RemoveExtraViews()
+{
+	UPortalRenderTargetPool* Pool = PortalManager.IsValid() ? PortalManager->GetRenderTargetPool() : nullptr;
+	for (int32 ViewIndex = 1; ViewIndex < Views.Num(); ++ViewIndex)
+	{
+		FPortalView& View = Views[ViewIndex];
+		if (Pool && View.DisplayTarget && View.DisplayTarget != View.BaseTarget)
+			Pool->Release(View.DisplayTarget);
+		if (Pool && View.BaseTarget)
+			Pool->Release(View.BaseTarget);
+		if (View.Surface)
+		{
+			if (PortalManager.IsValid())
+				PortalManager->RemoveViewSurface(View.Surface);
+			View.Surface->DestroyComponent();
+		}
+		if (View.Capture)
+			View.Capture->DestroyComponent();
+	}
+
+	if (Views.Num() > 1 && PortalManager.IsValid() && Views[0].Surface)
+		PortalManager->RemoveViewSurface(Views[0].Surface);
+	Views.SetNum(1);
+}
+
+UTextureRenderTarget2D* APortalC::SelectDisplayTarget(FPortalView& View, float ScreenSize)
+{
+	UTextureRenderTarget2D* BaseTarget = View.BaseTarget;
+	UTextureRenderTarget2D*& DisplayTarget = View.DisplayTarget;
+
+	// Without a dynamic surface material the Blueprint target is the only one the surface can show
+	if (BaseTarget == nullptr || View.SurfaceMID == nullptr || !PortalManager.IsValid() || PortalManager->ResolutionLODs.Num() == 0)
+		return BaseTarget;
+
+	UPortalRenderTargetPool* Pool = PortalManager->GetRenderTargetPool();
+	const EPixelFormat Format = BaseTarget->GetFormat();
+	UTextureRenderTarget2D* NewTarget = nullptr;
+	for (int32 LOD = PortalManager->GetResolutionLOD(ScreenSize); LOD < PortalManager->ResolutionLODs.Num() && NewTarget == nullptr; ++LOD)
 	{
-		if (GEngine && bPrintPlayerRefNull)
+		const float Scale = PortalManager->ResolutionLODs[LOD].ResolutionScale;
+		if (Scale >= 1.f)
 		{
-			GEngine->AddOnScreenDebugMessage(-1, 2.0f, FColor::Red, "PortalToCPP or PlayerRefCPP is NULL!");
+			NewTarget = BaseTarget;
+			break;
 		}
+
+		const int32 SizeX = FMath::Max(FMath::RoundToInt(BaseTarget->SizeX * Scale), 16);
+		const int32 SizeY = FMath::Max(FMath::RoundToInt(BaseTarget->SizeY * Scale), 16);
+		if (DisplayTarget && DisplayTarget->SizeX == SizeX && DisplayTarget->SizeY == SizeY)
+			return DisplayTarget;
+
+		// Lower resolutions are tried until one fits in the render target memory budget
+		if (Pool->CanAcquire(SizeX, SizeY, Format))
+			NewTarget = Pool->Acquire(SizeX, SizeY, Format);
+	}
+
+	// Out of budget even at the lowest LOD, keep what we have
+	if (NewTarget == nullptr || NewTarget == DisplayTarget)
+		return DisplayTarget;
+
+	if (DisplayTarget != BaseTarget)
+		Pool->Release(DisplayTarget);
+	DisplayTarget = NewTarget;
+	View.SurfaceMID->SetTextureParameterValue(PortalTextureParameterName, DisplayTarget);
+	return DisplayTarget;
+}
+
+void APortalC::ApplyQualityLOD(FPortalView& View, int32 QualityLOD)
+{
+	if (QualityLOD == View.QualityLOD)
+		return;
+	View.QualityLOD = QualityLOD;
+
+	USceneCaptureComponent2D* Capture = View.Capture;
+	Capture->ShowFlags = DefaultCaptureShowFlags;
+	if (QualityLOD == INDEX_NONE || !PortalManager.IsValid() || !PortalManager->QualityLODs.IsValidIndex(QualityLOD))
 		return;
+
+	const FPortalQualityLOD& Quality = PortalManager->QualityLODs[QualityLOD];
+	if (!Quality.bShadows)
+		Capture->ShowFlags.SetDynamicShadows(false);
+	if (!Quality.bPostProcessing)
+		Capture->ShowFlags.SetPostProcessing(false);
+	if (!Quality.bAmbientOcclusion)
+	{
+		Capture->ShowFlags.SetAmbientOcclusion(false);
+		Capture->ShowFlags.SetDistanceFieldAO(false);
 	}
+	if (!Quality.bTranslucency)
+		Capture->ShowFlags.SetTranslucency(false);
+}
 
-	if (PlayerCam == nullptr)
-		PlayerCam = PlayerRefCPP->GetFirstPersonCameraComponent();
+void APortalC::CaptureFromPose(FPortalView& View, const FVector& Location, const FRotator& Rotation, UTextureRenderTarget2D* Target)
+{
+	USceneCaptureComponent2D* Capture = View.Capture;
+	Capture->TextureTarget = Target;
+	Capture->SetWorldLocationAndRotation(Location, Rotation);
 
-	if (SceneCaptureCPP->bEnableClipPlane)
+	// Only what can be seen through the opening of the other portal goes to the renderer. Blueprint primitive lists are left alone
+	if (Target && DefaultPrimitiveRenderMode == ESceneCapturePrimitiveRenderMode::PRM_RenderScenePrimitives && PortalManager.IsValid() && PortalManager->bCullCapturePrimitives)
 	{
-		SceneCaptureCPP->ClipPlaneBase = PortalToCPP->Origin;
-		SceneCaptureCPP->ClipPlaneNormal = PortalToCPP->X;
+		FPortalViewInfo CaptureView;
+		CaptureView.Init(Location, Rotation, Capture->FOVAngle, (float)Target->SizeX / (float)FMath::Max(Target->SizeY, 1));
+		const float MaxDistance = Capture->MaxViewDistanceOverride > 0.f ? Capture->MaxViewDistanceOverride : HALF_WORLD_MAX;
+		const bool bCulled = PortalManager->CullCapturePrimitives(CaptureView, this, MaxDistance, Capture->ShowOnlyComponents);
+		Capture->PrimitiveRenderMode = bCulled ? ESceneCapturePrimitiveRenderMode::PRM_UseShowOnlyList : DefaultPrimitiveRenderMode;
+	}
+
+	// Finally capture scene manually (need CaptureEveryFrame set to false)
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalCaptureScene);
+	Capture->CaptureScene();
+}
+
+bool APortalC::IsNestedPortalVisible(const USceneCaptureComponent2D* Capture, const FVector& Location, const FRotator& Rotation, const UTextureRenderTarget2D* Target, float MinPixelSize)
+{
+	FPortalViewInfo View;
+	View.Init(Location, Rotation, Capture->FOVAngle, (float)Target->SizeX / (float)FMath::Max(Target->SizeY, 1));
+
+	const FBox& Bounds = GetPortalBounds();
+	if (!View.Frustum.IntersectBox(Bounds.GetCenter(), Bounds.GetExtent()))
+		return false;
+
+	const float ScreenSize = ComputeBoundsScreenSize(Bounds.GetCenter(), Bounds.GetExtent().Size(), View.ViewOrigin, View.ProjectionMatrix);
+	return ScreenSize * 0.5f * Target->SizeY >= MinPixelSize;
+}
+
+int32 APortalC::UpdateSceneCaptureWRTPlayerCamera(float ScreenSize, int32 ViewIndex)
+{
+	// Inclusive of the CaptureScene calls, which have their own stat
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalCaptureSetup);
+
+	UCameraComponent* ViewCamera = GetCaptureViewCamera(ViewIndex);
+	if (ViewCamera == nullptr)
+	{
+		FKZDebugOverlay* DebugOverlay = bPrintPlayerRefNull ? AFPSCppTemplateHUD::GetDebugOverlay(GetWorld()) : nullptr;
+		if (DebugOverlay)
+			DebugOverlay->SetChannel(EKZDebugChannel::PortalLinks, FColor::Red, TEXT("PortalToCPP is NULL or no player to render it for!"));
+		return 0;
+	}
+
+	FPortalView* View = FindOrAddView(ViewIndex);
+	if (View == nullptr)
+		return 0;
+	USceneCaptureComponent2D* Capture = View->Capture;
+
+	// The other players' surfaces of every portal are at the same place as this view's own ones
+	if (PortalManager.IsValid() && View->HiddenSurfacesVersion != PortalManager->GetViewSurfacesVersion())
+	{
+		Capture->HiddenComponents = DefaultHiddenComponents;
+		PortalManager->GetSurfacesHiddenFromView(ViewIndex, Capture->HiddenComponents);
+		View->HiddenSurfacesVersion = PortalManager->GetViewSurfacesVersion();
+	}
+
+	if (Capture->bEnableClipPlane)
+	{
+		Capture->ClipPlaneBase = PortalToCPP->Origin;
+		Capture->ClipPlaneNormal = PortalToCPP->X;
 	} 
-	// Get 'indentical coordniate matrix' (in terms of portal)
-	FMatrix PFromKCoordInvMat = KCoordInvMat;
-	FMatrix PToJCoordMat = PortalToCPP->JCoordMat;
-
-	FVector ActorDeltaLocation = PlayerCam->GetComponentLocation() - Origin;
-	FVector ActorRotationVector = PlayerCam->GetComponentRotation().Vector();
-
-	// Part 1. Location
-	// Teleport Location is X-axis mirroring
-	// Use set actor location to teleport
-	FVector NewDeltaLocation = FVector((PToJCoordMat.TransformVector(PFromKCoordInvMat.TransformVector(ActorDeltaLocation))));
-	FVector NewLocation = PortalToCPP->Origin + NewDeltaLocation;
-	// Part 2. Rotation
-	// Use player controller to set rotation (using controller Roll, Pitch, Yaw set to 1 s.t. camera rotation = controller rotation)
-	FVector NewRotationVector = FVector(PToJCoordMat.TransformVector(PFromKCoordInvMat.TransformVector(ActorRotationVector)));
+	// Get the cached 'indentical coordniate matrix' (in terms of portal pair)
+	const FMatrix& PortalPairMatrix = GetPortalPairMatrix(PortalToCPP);
 
 	// Not only set the location and rotation, but also set the FOV angle (which is important to make clip plane effective visually, otherwise player can see the scene which are clipped)
-	SceneCaptureCPP->SetWorldLocationAndRotation(NewLocation, NewRotationVector.Rotation());
-	SceneCaptureCPP->FOVAngle = PlayerCam->FieldOfView;
-	// Finally capture scene manually (need CaptureEveryFrame set to false)
-	SceneCaptureCPP->CaptureScene();
+	Capture->FOVAngle = ViewCamera->FieldOfView;
+
+	// Resolution and show flag LODs
+	UTextureRenderTarget2D* OwnTarget = SelectDisplayTarget(*View, ScreenSize);
+	if (PortalManager.IsValid())
+		ApplyQualityLOD(*View, PortalManager->GetQualityLOD(FVector::Dist(ViewCamera->GetComponentLocation(), Origin)));
+
+	UPortalRenderTargetPool* Pool = PortalManager.IsValid() ? PortalManager->GetRenderTargetPool() : nullptr;
+	UMaterialInstanceDynamic* SurfaceMID = View->SurfaceMID;
+	const int32 MaxDepth = (OwnTarget && Pool && SurfaceMID) ? FMath::Max(PortalManager->MaxRecursionDepth, 1) : 1;
+
+	// Part 1. Location and Part 2. Rotation of every recursion level
+	// Teleport Location is X-axis mirroring, each level is the previous one mirrored once more through the pair
+	TArray<FVector, TInlineAllocator<8>> Locations;
+	TArray<FRotator, TInlineAllocator<8>> Rotations;
+	FVector Location = ViewCamera->GetComponentLocation();
+	FVector RotationVector = ViewCamera->GetComponentRotation().Vector();
+	while (Locations.Num() < MaxDepth)
+	{
+		Location = PortalPairMatrix.TransformPosition(Location);
+		RotationVector = PortalPairMatrix.TransformVector(RotationVector);
+		Locations.Add(Location);
+		Rotations.Add(RotationVector.Rotation());
+
+		// Stop as soon as this portal is too small (or not visible at all) inside the view just added
+		if (Locations.Num() < MaxDepth && !IsNestedPortalVisible(Capture, Location, Rotations.Last(), OwnTarget, PortalManager->RecursionMinPixelSize))
+			break;
+	}
+
+	const int32 Depth = Locations.Num();
+	if (Depth == 1)
+	{
+		CaptureFromPose(*View, Locations[0], Rotations[0], OwnTarget);
+		View->LastCaptureFrame = GFrameCounter;
+		return 1;
+	}
+
+	// Render the deepest level first. Each level samples the one below it through the surface material,
+	// the deepest one sees last frame's result. Pooled targets go back as soon as the level above has been captured
+	int32 NumCaptures = 0;
+	UTextureRenderTarget2D* Previous = OwnTarget;
+	for (int32 Level = Depth - 1; Level >= 0; --Level)
+	{
+		UTextureRenderTarget2D* Target = Level == 0 ? OwnTarget : Pool->Acquire(OwnTarget->SizeX, OwnTarget->SizeY, OwnTarget->GetFormat());
+		// Pool is over its memory budget, drop this level
+		if (Target == nullptr)
+			continue;
+		SurfaceMID->SetTextureParameterValue(PortalTextureParameterName, Previous);
+		CaptureFromPose(*View, Locations[Level], Rotations[Level], Target);
+		++NumCaptures;
+		if (Previous != OwnTarget)
+			Pool->Release(Previous);
+		Previous = Target;
+	}
+	SurfaceMID->SetTextureParameterValue(PortalTextureParameterName, OwnTarget);
+
+	View->LastCaptureFrame = GFrameCounter;
+	return NumCaptures;
 }
 
 // Called every frame
 void APortalC::Tick(float DeltaTime)
 {
-	UpdateXYZFromCoordCube();
-	UpdateSceneCaptureWRTPlayerCamera();
+	KZ_BENCHMARK_SCOPE(PortalTick);
+	// The coord frame is kept up to date by OnCoordCubeTransformUpdated, nothing to do here for static portals
+	// Scene captures are scheduled by APortalManager
+	if (DrawLocalCoord)
+		DrawDebugCoordAxis();
 	Super::Tick(DeltaTime);
 }
 
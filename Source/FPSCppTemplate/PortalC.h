@@ -13,6 +13,41 @@
 #include "FPSCppTemplateCharacter.h"
 #include "PortalC.generated.h"
 
+/**
+ * What one local player sees of a portal. View 0 is the Blueprint scene capture, its TextureTarget and the surface passed to
+ * SetPortalSurface(), every further split-screen player gets a copy of the capture and surface rendering into a pooled target
+ */
+USTRUCT()
+struct FPortalView
+{
+	GENERATED_BODY()
+
+	UPROPERTY(Transient)
+	USceneCaptureComponent2D* Capture = nullptr;
+
+	UPROPERTY(Transient)
+	UPrimitiveComponent* Surface = nullptr;
+
+	UPROPERTY(Transient)
+	class UMaterialInstanceDynamic* SurfaceMID = nullptr;
+
+	/** Full resolution target of the view */
+	UPROPERTY(Transient)
+	class UTextureRenderTarget2D* BaseTarget = nullptr;
+
+	/** Target currently sampled by the surface, either BaseTarget or a pooled lower resolution one */
+	UPROPERTY(Transient)
+	class UTextureRenderTarget2D* DisplayTarget = nullptr;
+
+	/** GFrameCounter of the last CaptureScene call */
+	uint64 LastCaptureFrame = 0;
+
+	int32 QualityLOD = INDEX_NONE;
+
+	/** APortalManager::GetViewSurfacesVersion() the hidden components of Capture were set up for */
+	uint32 HiddenSurfacesVersion = 0;
+};
+
 UCLASS()
 class FPSCPPTEMPLATE_API APortalC : public AActor
 {
@@ -35,17 +70,130 @@ public:
 
 	class UCameraComponent* PlayerCam;
 
+	/** Bumped every time X, Y, Z, Origin and the J/K coord matrices are rebuilt from CoordCube */
+	uint32 CoordVersion;
+
+	/**
+	 * Returns the precomposed From(this)->To portal pair matrix (K inverse of this portal, then J of the other portal, with both origins folded in).
+	 * Use TransformPosition for locations and TransformVector for directions/velocities.
+	 * The matrix is cached and only rebuilt when either portal's CoordCube has moved since the last call.
+	 */
+	const FMatrix& GetPortalPairMatrix(const APortalC* To) const;
+
+	/** World bounds of all portal components, recomputed only after the portal moved */
+	const FBox& GetPortalBounds();
+
+	/** Bounds registered in the APortalManager spatial index: the portal components and the opening */
+	FBox GetIndexBounds();
+
+	/** Id of this portal in the APortalManager spatial index */
+	int32 SpatialIndexId;
+
+	/**
+	 * Camera view ViewIndex of this portal is rendered for, nullptr if the portal is not linked or there is no such player.
+	 * With one local player view 0 is PlayerRefCPP's camera, or the local player's if not set. In split-screen view N is the camera
+	 * of local player N and PlayerRefCPP is ignored
+	 */
+	class UCameraComponent* GetCaptureViewCamera(int32 ViewIndex = 0);
+
+	/**
+	 * Places the capture of view ViewIndex behind PortalToCPP and captures the scene, called by APortalManager when scheduled.
+	 * Renders up to MaxRecursionDepth nested portal views, deepest first. Returns the number of CaptureScene calls.
+	 * ScreenSize is the projected size of the portal, it picks the render target resolution LOD.
+	 */
+	int32 UpdateSceneCaptureWRTPlayerCamera(float ScreenSize = 1.f, int32 ViewIndex = 0);
+
+	/** GFrameCounter of the last capture of view ViewIndex, 0 if it was never captured */
+	uint64 GetLastCaptureFrame(int32 ViewIndex) const;
+
+	/**
+	 * Registers the mesh showing this portal's capture, required for recursive portal views.
+	 * Its material gets a dynamic instance whose PortalTextureParameterName is pointed at each recursion level in turn.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Portal")
+	void SetPortalSurface(UPrimitiveComponent* Surface, int32 MaterialIndex = 0);
+
+	/**
+	 * Tests the segment Start->End against the portal opening in the portal's local frame.
+	 * Only a crossing from the front (+X) side to the back side counts. OutTime is the hit fraction along the segment.
+	 */
+	bool IntersectSegment(const FVector& Start, const FVector& End, float& OutTime) const;
+
+	/** Half width (Y) and half height (Z) of the portal opening, the RootCapsule size is used if not set */
+	FVector2D GetOpeningHalfExtent() const;
+
+	/**
+	 * Set by code spawning this portal under the same name on the server and every client, so RPCs can reference it
+	 * like a portal loaded with its level. Portals are not replicated, others spawned at runtime can not be referenced
+	 */
+	bool bNetNameStable = false;
+
+	// UObject
+	virtual bool IsNameStableForNetworking() const override;
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void OnConstruction(const FTransform& Transform) override;
 
 	// Utilities Hang Yu
 	void UpdateXYZFromCoordCube();
 	FMatrix CreateCoordMatrix(const FVector X, const FVector Y, const FVector Z);
 	void DrawDebugMatrix(const FMatrix Mat, const FColor C);
 	FVector SetVector(const FVector V);
+	void DrawDebugCoordAxis();
+
+	FBox PortalBounds;
+	uint32 PortalBoundsVersion;
+
+	/** Moves the capture of View to the given pose and renders into Target */
+	void CaptureFromPose(FPortalView& View, const FVector& Location, const FRotator& Rotation, class UTextureRenderTarget2D* Target);
+
+	/** Returns true if this portal is big enough in a Target sized view of Capture at the given pose to be worth another recursion level */
+	bool IsNestedPortalVisible(const USceneCaptureComponent2D* Capture, const FVector& Location, const FRotator& Rotation, const class UTextureRenderTarget2D* Target, float MinPixelSize);
 
-	void UpdateSceneCaptureWRTPlayerCamera();
+	/** Returns the render target shown on the surface of View for the given screen size, switching to a pooled one when the resolution LOD changes */
+	class UTextureRenderTarget2D* SelectDisplayTarget(FPortalView& View, float ScreenSize);
+
+	/** Restores the Blueprint show flags of View's capture and strips the ones turned off by QualityLODs[QualityLOD] */
+	void ApplyQualityLOD(FPortalView& View, int32 QualityLOD);
+
+	/**
+	 * Returns view ViewIndex, copying the capture and surface of view 0 the first time a split-screen player needs it.
+	 * nullptr if the view cannot be rendered: no surface to copy, no Blueprint target or the render target pool is over budget
+	 */
+	FPortalView* FindOrAddView(int32 ViewIndex);
+
+	/** Destroys the copies of the extra views and gives their targets back */
+	void RemoveExtraViews();
+
+	/** Views by local player index, view 0 always exists */
+	UPROPERTY(Transient)
+	TArray<FPortalView> Views;
+
+	/** Material index passed to SetPortalSurface(), the surface copies of the extra views use the same one */
+	int32 PortalSurfaceMaterialIndex;
+
+	FEngineShowFlags DefaultCaptureShowFlags = FEngineShowFlags(ESFIM_Game);
+
+	/** HiddenComponents set in Blueprint, the captures also hide the surfaces of the other views */
+	TArray<TWeakObjectPtr<UPrimitiveComponent>> DefaultHiddenComponents;
+
+	/** PrimitiveRenderMode set in Blueprint, captures are only culled to the portal opening if it renders the scene primitives */
+	ESceneCapturePrimitiveRenderMode DefaultPrimitiveRenderMode;
+
+	TWeakObjectPtr<class APortalManager> PortalManager;
+
+	/** Keeps the coord frame in sync with CoordCube, only fired when its transform actually changes */
+	void OnCoordCubeTransformUpdated(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport);
+	FDelegateHandle CoordCubeTransformUpdatedHandle;
+
+	// Portal pair cache, see GetPortalPairMatrix()
+	mutable FMatrix PortalPairMat;
+	mutable const APortalC* CachedPairTo;
+	mutable uint32 CachedPairFromVersion;
+	mutable uint32 CachedPairToVersion;
 
 public:	
 	// Called every frame
@@ -57,15 +205,24 @@ public:
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, category = References)
 	UStaticMeshComponent* CoordCube;
 
+	/** Mesh of the CoordCube, only loaded in the editor to place the portal with, the cube is hidden in game */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, category = References)
+	TSoftObjectPtr<UStaticMesh> CoordCubeMesh;
+
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, category = References)
 	USceneCaptureComponent2D* SceneCaptureCPP;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, category = References)
 	class APortalC* PortalToCPP;
 
+	/** Character the portal is rendered for with a single local player, ignored in split-screen */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, category = References)
 	class AFPSCppTemplateCharacter* PlayerRefCPP;
 
+	/** Texture parameter of the portal surface material sampling the capture, see SetPortalSurface() */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal")
+	FName PortalTextureParameterName;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Screen Debug")
 	bool bPrintPlayerRefNull = false;
 
@@ -74,4 +231,15 @@ public:
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, category = DebugCPP)
 	float ActorTeleportPositiveOffset;
+
+	/** Half width (X) and half height (Y) of the portal opening used by the swept crossing test, zero uses the RootCapsule size */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal")
+	FVector2D OpeningHalfExtent;
+
+	/**
+	 * Streaming levels on the other side of this portal, loaded before a player gets to cross it and unloaded once no player can
+	 * reach them any more, see APortalManager::bPredictiveStreaming. Read when the portal begins play
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal Streaming")
+	TArray<TSoftObjectPtr<UWorld>> DestinationLevels;
 };
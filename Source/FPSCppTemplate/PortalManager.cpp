@@ -0,0 +1,923 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PortalManager.h"
+#include "FPSCppTemplate.h"
+#include "FPSCppTemplateHUD.h"
+#include "KZBenchmark.h"
+#include "PortalC.h"
+#include "PortalPhysicsManager.h"
+#include "PortalRenderTargetPool.h"
+#include "EngineUtils.h"
+#include "SceneManagement.h"
+#include "Camera/CameraComponent.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/GameInstance.h"
+#include "Engine/Level.h"
+#include "Engine/LevelBounds.h"
+#include "Engine/LevelStreaming.h"
+#include "Engine/LocalPlayer.h"
+#include "GameFramework/PlayerController.h"
+#include "Kismet/GameplayStatics.h"
+#include "Math/InverseRotationMatrix.h"
+#include "Math/PerspectiveMatrix.h"
+#include "Math/TranslationMatrix.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogPortalManager, Log, All);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Captures Considered"), STAT_PortalCapturesConsidered, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Captures Skipped"), STAT_PortalCapturesSkipped, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Captures Deferred"), STAT_PortalCapturesDeferred, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Captures Executed"), STAT_PortalCapturesExecuted, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Scene Captures"), STAT_PortalSceneCaptures, STATGROUP_Portal);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Pooled Render Targets"), STAT_PortalRenderTargets, STATGROUP_Portal);
+DECLARE_MEMORY_STAT(TEXT("Pooled Render Target Memory"), STAT_PortalRenderTargetMemory, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Teleports"), STAT_PortalTeleports, STATGROUP_Portal);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Teleports Per Second"), STAT_PortalTeleportsPerSecond, STATGROUP_Portal);
+DECLARE_CYCLE_STAT(TEXT("Schedule Captures"), STAT_PortalScheduleCaptures, STATGROUP_Portal);
+DECLARE_CYCLE_STAT(TEXT("Cull Capture Primitives"), STAT_PortalCullPrimitives, STATGROUP_Portal);
+DECLARE_CYCLE_STAT(TEXT("Rebuild Primitive Index"), STAT_PortalRebuildPrimitiveIndex, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Capture Primitives Considered"), STAT_PortalPrimitivesConsidered, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Capture Primitives Shown"), STAT_PortalPrimitivesShown, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Shared Capture Culls"), STAT_PortalSharedCulls, STATGROUP_Portal);
+DECLARE_CYCLE_STAT(TEXT("Predict Streaming"), STAT_PortalPredictStreaming, STATGROUP_Portal);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Destination Levels Loaded"), STAT_PortalStreamedLevels, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Destination Level Loads"), STAT_PortalStreamingLoads, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Teleports Into Unloaded Levels"), STAT_PortalStreamingMisses, STATGROUP_Portal);
+
+APortalManager::APortalManager()
+{
+	PrimaryActorTick.bCanEverTick = true;
+	// Capture after the cameras have been updated for this frame
+	PrimaryActorTick.TickGroup = TG_PostUpdateWork;
+
+	CaptureBudgetPerFrame = 4;
+	RoundRobinCapturesPerFrame = 1;
+	MaxCaptureDistance = 20000.f;
+	MinCaptureScreenSize = 0.01f;
+	OccludedPriorityScale = 0.25f;
+	MaxRecursionDepth = 3;
+	RecursionMinPixelSize = 16.f;
+	RenderTargetMemoryBudgetMB = 256.f;
+	bCullCapturePrimitives = true;
+	bPredictiveStreaming = true;
+	StreamingLookAheadTime = 1.5f;
+	StreamingPreloadRadius = 3000.f;
+	StreamingUnloadDelay = 5.f;
+
+	ResolutionLODs.Add(FPortalResolutionLOD(0.4f, 1.f));
+	ResolutionLODs.Add(FPortalResolutionLOD(0.15f, 0.5f));
+	ResolutionLODs.Add(FPortalResolutionLOD(0.05f, 0.25f));
+	ResolutionLODs.Add(FPortalResolutionLOD(0.f, 0.125f));
+
+	FPortalQualityLOD MidQuality;
+	MidQuality.MinDistance = 3000.f;
+	MidQuality.bAmbientOcclusion = false;
+	MidQuality.bPostProcessing = false;
+	QualityLODs.Add(MidQuality);
+
+	FPortalQualityLOD LowQuality = MidQuality;
+	LowQuality.MinDistance = 8000.f;
+	LowQuality.bShadows = false;
+	LowQuality.bTranslucency = false;
+	QualityLODs.Add(LowQuality);
+
+	RenderTargetPool = CreateDefaultSubobject<UPortalRenderTargetPool>(TEXT("RenderTargetPool"));
+}
+
+APortalManager* APortalManager::Get(UWorld* World, bool bCreateIfMissing)
+{
+	if (World == nullptr)
+		return nullptr;
+
+	for (TActorIterator<APortalManager> It(World); It; ++It)
+	{
+		if (!It->IsPendingKill())
+			return *It;
+	}
+
+	if (!bCreateIfMissing || World->bIsTearingDown)
+		return nullptr;
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	return World->SpawnActor<APortalManager>(SpawnParams);
+}
+
+void APortalManager::BeginPlay()
+{
+	Super::BeginPlay();
+
+	ActorSpawnedHandle = GetWorld()->AddOnActorSpawnedHandler(FOnActorSpawned::FDelegate::CreateUObject(this, &APortalManager::OnActorSpawned));
+	FWorldDelegates::LevelAddedToWorld.AddUObject(this, &APortalManager::OnLevelsChanged);
+	FWorldDelegates::LevelRemovedFromWorld.AddUObject(this, &APortalManager::OnLevelsChanged);
+
+	// Physics bodies cross portals too
+	APortalPhysicsManager::Get(GetWorld());
+}
+
+void APortalManager::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	GetWorld()->RemoveOnActorSpawnedHandler(ActorSpawnedHandle);
+	FWorldDelegates::LevelAddedToWorld.RemoveAll(this);
+	FWorldDelegates::LevelRemovedFromWorld.RemoveAll(this);
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void APortalManager::RegisterPortal(APortalC* Portal)
+{
+	if (Portal == nullptr || Portals.Contains(Portal))
+		return;
+
+	Portals.Add(Portal);
+	Portal->SpatialIndexId = SpatialIndex.Add(Portal->GetIndexBounds());
+	if (SpatialIndexPortals.Num() <= Portal->SpatialIndexId)
+		SpatialIndexPortals.SetNumZeroed(Portal->SpatialIndexId + 1);
+	SpatialIndexPortals[Portal->SpatialIndexId] = Portal;
+
+	TArray<int32> LevelIds;
+	for (const TSoftObjectPtr<UWorld>& Level : Portal->DestinationLevels)
+	{
+		if (!Level.IsNull())
+			LevelIds.AddUnique(FindOrAddStreamedLevel(FName(*Level.GetLongPackageName())));
+	}
+	if (LevelIds.Num() > 0)
+		PortalDestinationLevels.Add(Portal, MoveTemp(LevelIds));
+}
+
+void APortalManager::UnregisterPortal(APortalC* Portal)
+{
+	if (Portal == nullptr || Portals.RemoveSwap(Portal) == 0)
+		return;
+
+	SpatialIndex.Remove(Portal->SpatialIndexId);
+	SpatialIndexPortals[Portal->SpatialIndexId] = nullptr;
+	Portal->SpatialIndexId = INDEX_NONE;
+	MovedPortals.RemoveSwap(Portal);
+	PortalDestinationLevels.Remove(Portal);
+}
+
+void APortalManager::MarkPortalMoved(APortalC* Portal)
+{
+	if (Portal->SpatialIndexId != INDEX_NONE)
+		MovedPortals.AddUnique(Portal);
+}
+
+void APortalManager::FlushMovedPortals()
+{
+	for (APortalC* Portal : MovedPortals)
+	{
+		SpatialIndex.Update(Portal->SpatialIndexId, Portal->GetIndexBounds());
+	}
+	MovedPortals.Reset();
+}
+
+void APortalManager::GatherQueryResults(TArray<APortalC*>& OutPortals) const
+{
+	for (int32 Id : QueryIds)
+	{
+		OutPortals.Add(SpatialIndexPortals[Id]);
+	}
+}
+
+void APortalManager::QueryPortalsNearPoint(const FVector& Point, float Radius, TArray<APortalC*>& OutPortals)
+{
+	FlushMovedPortals();
+	KZ_BENCHMARK_SCOPE(PortalQueries);
+	QueryIds.Reset();
+	SpatialIndex.QueryPoint(Point, Radius, QueryIds);
+	GatherQueryResults(OutPortals);
+}
+
+void APortalManager::QueryPortalsAlongSegment(const FVector& Start, const FVector& End, TArray<APortalC*>& OutPortals)
+{
+	FlushMovedPortals();
+	KZ_BENCHMARK_SCOPE(PortalQueries);
+	QueryIds.Reset();
+	SpatialIndex.QuerySegment(Start, End, QueryIds);
+	GatherQueryResults(OutPortals);
+}
+
+void APortalManager::QueryPortalsInFrustum(const FPortalViewInfo& View, float MaxDistance, TArray<APortalC*>& OutPortals)
+{
+	FlushMovedPortals();
+	KZ_BENCHMARK_SCOPE(PortalQueries);
+	QueryIds.Reset();
+	SpatialIndex.QueryFrustum(View.Frustum, View.ViewOrigin, MaxDistance, QueryIds);
+	GatherQueryResults(OutPortals);
+}
+
+APortalC* APortalManager::FindFirstCrossing(const FVector& Start, const FVector& End, const APortalC* Ignore, float& OutTime)
+{
+	APortalC* FirstPortal = nullptr;
+	OutTime = 1.f;
+	QueryPortals.Reset();
+	QueryPortalsAlongSegment(Start, End, QueryPortals);
+	for (APortalC* Portal : QueryPortals)
+	{
+		float Time;
+		if (Portal != Ignore && Portal->PortalToCPP && Portal->IntersectSegment(Start, End, Time) && Time <= OutTime)
+		{
+			FirstPortal = Portal;
+			OutTime = Time;
+		}
+	}
+	return FirstPortal;
+}
+
+void APortalManager::OnActorSpawned(AActor* Actor)
+{
+	// A dirty index picks the actor up when it is rebuilt
+	if (!bPrimitiveIndexDirty)
+		AddActorPrimitives(Actor);
+}
+
+void APortalManager::OnLevelsChanged(ULevel* Level, UWorld* World)
+{
+	if (World == GetWorld())
+		bPrimitiveIndexDirty = true;
+}
+
+void APortalManager::RebuildPrimitiveIndex()
+{
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalRebuildPrimitiveIndex);
+
+	PrimitiveIndex.Reset();
+	IndexedPrimitives.Reset();
+	MovablePrimitives.Reset();
+	for (TActorIterator<AActor> It(GetWorld()); It; ++It)
+	{
+		AddActorPrimitives(*It);
+	}
+	bPrimitiveIndexDirty = false;
+}
+
+void APortalManager::AddActorPrimitives(AActor* Actor)
+{
+	if (Actor == nullptr || Actor->IsPendingKill())
+		return;
+
+	TInlineComponentArray<UPrimitiveComponent*> Components(Actor);
+	for (UPrimitiveComponent* Component : Components)
+	{
+		if (Component->Mobility == EComponentMobility::Movable || !Component->IsRegistered())
+		{
+			MovablePrimitives.Add(Component);
+			continue;
+		}
+
+		const int32 Id = PrimitiveIndex.Add(Component->Bounds.GetBox());
+		if (IndexedPrimitives.Num() <= Id)
+			IndexedPrimitives.SetNum(Id + 1);
+		IndexedPrimitives[Id] = Component;
+	}
+}
+
+/**
+ * Edges of a portal opening, corner k to corner k + 1. A view behind the portal sees through it the frustum whose sides contain
+ * the edges, each leaning outwards by its slope: the distance it widens per unit in front of the portal
+ */
+struct FPortalOpeningEdges
+{
+	FVector Corners[4];
+	FVector Centers[4];
+	/** In the portal plane, away from the opening */
+	FVector Outwards[4];
+
+	explicit FPortalOpeningEdges(const APortalC* Portal)
+	{
+		const FVector& Origin = Portal->Origin;
+		const FVector2D HalfExtent = Portal->GetOpeningHalfExtent();
+		const FVector HalfY = Portal->Y * HalfExtent.X;
+		const FVector HalfZ = Portal->Z * HalfExtent.Y;
+		Corners[0] = Origin + HalfY + HalfZ;
+		Corners[1] = Origin - HalfY + HalfZ;
+		Corners[2] = Origin - HalfY - HalfZ;
+		Corners[3] = Origin + HalfY - HalfZ;
+		Outwards[0] = Portal->Z;
+		Outwards[1] = -Portal->Y;
+		Outwards[2] = -Portal->Z;
+		Outwards[3] = Portal->Y;
+		for (int32 Edge = 0; Edge < 4; ++Edge)
+		{
+			Centers[Edge] = (Corners[Edge] + Corners[(Edge + 1) % 4]) * 0.5f;
+		}
+	}
+
+	/** Slopes of the sides seen from Eye, which has to be behind the portal */
+	void ComputeSlopes(const APortalC* Portal, const FVector& Eye, float OutSlopes[4]) const
+	{
+		for (int32 Edge = 0; Edge < 4; ++Edge)
+		{
+			const FVector ToEdge = Centers[Edge] - Eye;
+			OutSlopes[Edge] = FVector::DotProduct(ToEdge, Outwards[Edge]) / FVector::DotProduct(ToEdge, Portal->X);
+		}
+	}
+
+	/** Replaces the planes of OutFrustum with the sides of the given slopes and the portal plane */
+	void BuildFrustum(const APortalC* Portal, const float Slopes[4], FConvexVolume& OutFrustum) const
+	{
+		OutFrustum.Planes.Reset();
+		for (int32 Edge = 0; Edge < 4; ++Edge)
+		{
+			const FPlane Plane(Corners[Edge], Corners[(Edge + 1) % 4], Centers[Edge] + Portal->X + Outwards[Edge] * Slopes[Edge]);
+			// The center of the opening is inside, every plane is turned to face away from it
+			OutFrustum.Planes.Add(Plane.PlaneDot(Portal->Origin) > 0.f ? Plane.Flip() : Plane);
+		}
+		OutFrustum.Planes.Add(FPlane(Portal->Origin, -Portal->X));
+	}
+};
+
+const APortalManager::FSharedCaptureCull* APortalManager::FindOrAddSharedCull(APortalC* Portal, float MaxDistance)
+{
+	for (int32 Index = 0; Index < NumSharedCulls; ++Index)
+	{
+		if (SharedCulls[Index].Portal == Portal)
+			return SharedCulls[Index].bValid ? &SharedCulls[Index] : nullptr;
+	}
+
+	// Entries are reused from frame to frame, so are their id arrays
+	if (NumSharedCulls == SharedCulls.Num())
+		SharedCulls.AddDefaulted();
+	FSharedCaptureCull& Shared = SharedCulls[NumSharedCulls++];
+	Shared.Portal = Portal;
+	Shared.bValid = false;
+	Shared.Ids.Reset();
+
+	// The level 0 capture positions of all views: every view's camera mirrored through the pair
+	const APortalC* Exit = Portal->PortalToCPP;
+	const FMatrix& PortalPairMatrix = Portal->GetPortalPairMatrix(Exit);
+	const FPortalOpeningEdges Edges(Exit);
+	int32 NumEyes = 0;
+	float MaxEyeDistance = 0.f;
+	for (int32 ViewIndex = 0; ViewIndex < FMath::Max(GetNumLocalPlayers(), 1); ++ViewIndex)
+	{
+		const UCameraComponent* Camera = Portal->GetCaptureViewCamera(ViewIndex);
+		if (Camera == nullptr)
+			continue;
+
+		const FVector Eye = PortalPairMatrix.TransformPosition(Camera->GetComponentLocation());
+		if (FVector::DotProduct(Eye - Exit->Origin, Exit->X) > -KINDA_SMALL_NUMBER)
+			continue;
+
+		float Slopes[4];
+		Edges.ComputeSlopes(Exit, Eye, Slopes);
+		for (int32 Edge = 0; Edge < 4; ++Edge)
+		{
+			Shared.Slopes[Edge] = NumEyes == 0 ? Slopes[Edge] : FMath::Max(Shared.Slopes[Edge], Slopes[Edge]);
+		}
+		MaxEyeDistance = FMath::Max(MaxEyeDistance, FVector::Dist(Eye, Exit->Origin));
+		++NumEyes;
+	}
+
+	// A single view gains nothing over its own lookup
+	if (NumEyes < 2)
+		return nullptr;
+
+	// The widest sides hold the frustum of every view, the views only filter what is found here
+	Edges.BuildFrustum(Exit, Shared.Slopes, CaptureFrustum);
+	CaptureFrustum.Init();
+	Shared.MaxDistance = MaxDistance;
+	{
+		KZ_BENCHMARK_SCOPE(PortalQueries);
+		PrimitiveIndex.QueryFrustum(CaptureFrustum, Exit->Origin, MaxDistance + MaxEyeDistance, Shared.Ids);
+	}
+	Shared.bValid = true;
+	return &Shared;
+}
+
+bool APortalManager::CullCapturePrimitives(const FPortalViewInfo& View, APortalC* Portal, float MaxDistance, TArray<TWeakObjectPtr<UPrimitiveComponent>>& OutShowOnly)
+{
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalCullPrimitives);
+
+	// The capture sits behind the linked portal and looks out of its front, a view in the portal plane sees nothing through it
+	const APortalC* Exit = Portal->PortalToCPP;
+	if (Exit == nullptr || FVector::DotProduct(View.ViewOrigin - Exit->Origin, Exit->X) > -KINDA_SMALL_NUMBER)
+		return false;
+
+	if (bPrimitiveIndexDirty)
+		RebuildPrimitiveIndex();
+
+	const FPortalOpeningEdges Edges(Exit);
+	float Slopes[4];
+	Edges.ComputeSlopes(Exit, View.ViewOrigin, Slopes);
+
+	// Level 0 views of split-screen players share one lookup, deeper recursion levels are outside of it and look up on their own
+	const FSharedCaptureCull* Shared = GetNumLocalPlayers() > 1 ? FindOrAddSharedCull(Portal, MaxDistance) : nullptr;
+	if (Shared && MaxDistance <= Shared->MaxDistance)
+	{
+		for (int32 Edge = 0; Edge < 4 && Shared; ++Edge)
+		{
+			if (Slopes[Edge] > Shared->Slopes[Edge])
+				Shared = nullptr;
+		}
+	}
+	else
+	{
+		Shared = nullptr;
+	}
+
+	Edges.BuildFrustum(Exit, Slopes, CaptureFrustum);
+	CaptureFrustum.Planes.Append(View.Frustum.Planes);
+	CaptureFrustum.Init();
+
+	const float MaxDistanceSquared = FMath::Square(MaxDistance);
+	OutShowOnly.Reset();
+	if (Shared)
+	{
+		for (int32 Id : Shared->Ids)
+		{
+			const FBox& Bounds = PrimitiveIndex.GetBounds(Id);
+			if (IndexedPrimitives[Id].IsValid()
+				&& Bounds.ComputeSquaredDistanceToPoint(View.ViewOrigin) <= MaxDistanceSquared
+				&& CaptureFrustum.IntersectBox(Bounds.GetCenter(), Bounds.GetExtent()))
+			{
+				OutShowOnly.Add(IndexedPrimitives[Id]);
+			}
+		}
+		++SharedCullsThisFrame;
+	}
+	else
+	{
+		PrimitiveQueryIds.Reset();
+		{
+			KZ_BENCHMARK_SCOPE(PortalQueries);
+			PrimitiveIndex.QueryFrustum(CaptureFrustum, View.ViewOrigin, MaxDistance, PrimitiveQueryIds);
+		}
+		for (int32 Id : PrimitiveQueryIds)
+		{
+			if (IndexedPrimitives[Id].IsValid())
+				OutShowOnly.Add(IndexedPrimitives[Id]);
+		}
+	}
+
+	for (int32 Index = MovablePrimitives.Num() - 1; Index >= 0; --Index)
+	{
+		const UPrimitiveComponent* Component = MovablePrimitives[Index].Get();
+		if (Component == nullptr)
+		{
+			// Destroyed since it was added
+			MovablePrimitives.RemoveAtSwap(Index, 1, false);
+			continue;
+		}
+
+		if (Component->IsRegistered()
+			&& Component->Bounds.GetBox().ComputeSquaredDistanceToPoint(View.ViewOrigin) <= MaxDistanceSquared
+			&& CaptureFrustum.IntersectBox(Component->Bounds.Origin, Component->Bounds.BoxExtent))
+		{
+			OutShowOnly.Add(MovablePrimitives[Index]);
+		}
+	}
+
+	++CulledCapturesThisFrame;
+	PrimitivesConsideredThisFrame += PrimitiveIndex.Num() + MovablePrimitives.Num();
+	PrimitivesShownThisFrame += OutShowOnly.Num();
+	return true;
+}
+
+void APortalManager::UpdateLocalPlayers()
+{
+	LocalPlayerCameras.Reset();
+	const UGameInstance* GameInstance = GetGameInstance();
+	if (GameInstance == nullptr)
+		return;
+
+	for (const ULocalPlayer* LocalPlayer : GameInstance->GetLocalPlayers())
+	{
+		APlayerController* PC = LocalPlayer ? LocalPlayer->PlayerController : nullptr;
+		const AFPSCppTemplateCharacter* Character = PC ? Cast<AFPSCppTemplateCharacter>(PC->GetPawn()) : nullptr;
+		const int32 PlayerIndex = LocalPlayerCameras.Add(Character ? Character->GetFirstPersonCameraComponent() : nullptr);
+
+		// A player that joined or got a new controller has not hidden the other views' surfaces yet
+		if (LocalPlayerControllers.Num() <= PlayerIndex)
+			LocalPlayerControllers.SetNum(PlayerIndex + 1);
+		if (LocalPlayerControllers[PlayerIndex].Get() != PC)
+		{
+			LocalPlayerControllers[PlayerIndex] = PC;
+			if (PC)
+				GetSurfacesHiddenFromView(PlayerIndex, PC->HiddenPrimitiveComponents);
+		}
+	}
+}
+
+UCameraComponent* APortalManager::GetLocalPlayerCamera(int32 PlayerIndex) const
+{
+	return LocalPlayerCameras.IsValidIndex(PlayerIndex) ? LocalPlayerCameras[PlayerIndex] : nullptr;
+}
+
+void APortalManager::AddViewSurface(UPrimitiveComponent* Surface, int32 ViewIndex)
+{
+	ViewSurfaces.Emplace(Surface, ViewIndex);
+	++ViewSurfacesVersion;
+	for (int32 PlayerIndex = 0; PlayerIndex < LocalPlayerControllers.Num(); ++PlayerIndex)
+	{
+		APlayerController* PC = LocalPlayerControllers[PlayerIndex].Get();
+		if (PC && PlayerIndex != ViewIndex)
+			PC->HiddenPrimitiveComponents.Add(Surface);
+	}
+}
+
+void APortalManager::RemoveViewSurface(UPrimitiveComponent* Surface)
+{
+	ViewSurfaces.RemoveAllSwap([Surface](const TPair<TWeakObjectPtr<UPrimitiveComponent>, int32>& ViewSurface) { return ViewSurface.Key == Surface; });
+	++ViewSurfacesVersion;
+	for (const TWeakObjectPtr<APlayerController>& PC : LocalPlayerControllers)
+	{
+		if (PC.IsValid())
+			PC->HiddenPrimitiveComponents.Remove(Surface);
+	}
+}
+
+bool APortalManager::IsViewSurface(const UPrimitiveComponent* Surface) const
+{
+	return ViewSurfaces.ContainsByPredicate([Surface](const TPair<TWeakObjectPtr<UPrimitiveComponent>, int32>& ViewSurface) { return ViewSurface.Key == Surface; });
+}
+
+void APortalManager::GetSurfacesHiddenFromView(int32 ViewIndex, TArray<TWeakObjectPtr<UPrimitiveComponent>>& OutSurfaces) const
+{
+	for (const TPair<TWeakObjectPtr<UPrimitiveComponent>, int32>& ViewSurface : ViewSurfaces)
+	{
+		if (ViewSurface.Value != ViewIndex)
+			OutSurfaces.Add(ViewSurface.Key);
+	}
+}
+
+void FPortalViewInfo::Init(const FVector& InViewOrigin, const FRotator& InViewRotation, float InFOV, float InAspectRatio)
+{
+	ViewOrigin = InViewOrigin;
+
+	// Same view/projection setup as the engine uses for a perspective FMinimalViewInfo
+	const float HalfXFOV = FMath::DegreesToRadians(FMath::Max(0.001f, InFOV) * 0.5f);
+	const float HalfYFOV = FMath::Atan(FMath::Tan(HalfXFOV) / FMath::Max(0.01f, InAspectRatio));
+	ProjectionMatrix = FReversedZPerspectiveMatrix(HalfXFOV, HalfYFOV, 1.f, 1.f, GNearClippingPlane, GNearClippingPlane);
+
+	const FMatrix ViewMatrix = FTranslationMatrix(-ViewOrigin)
+		* FInverseRotationMatrix(InViewRotation)
+		* FMatrix(FPlane(0, 0, 1, 0), FPlane(1, 0, 0, 0), FPlane(0, 1, 0, 0), FPlane(0, 0, 0, 1));
+	ViewProjectionMatrix = ViewMatrix * ProjectionMatrix;
+	GetViewFrustumBounds(Frustum, ViewProjectionMatrix, false);
+}
+
+const FPortalViewInfo& APortalManager::GetViewInfo(const UCameraComponent* Camera)
+{
+	for (const FPortalViewInfo& View : FrameViews)
+	{
+		if (View.Camera == Camera)
+			return View;
+	}
+
+	FPortalViewInfo& View = FrameViews[FrameViews.AddDefaulted()];
+	View.Camera = Camera;
+
+	float AspectRatio = Camera->AspectRatio;
+	const APawn* Pawn = Cast<APawn>(Camera->GetOwner());
+	const APlayerController* PC = Pawn ? Cast<APlayerController>(Pawn->GetController()) : nullptr;
+	if (PC)
+	{
+		int32 SizeX = 0, SizeY = 0;
+		PC->GetViewportSize(SizeX, SizeY);
+		// A split-screen player only gets its part of the viewport
+		const ULocalPlayer* LocalPlayer = PC->GetLocalPlayer();
+		const FVector2D SplitSize = LocalPlayer ? LocalPlayer->Size : FVector2D(1.f, 1.f);
+		if (SizeX > 0 && SizeY > 0 && SplitSize.X > 0.f && SplitSize.Y > 0.f)
+			AspectRatio = (SizeX * SplitSize.X) / (SizeY * SplitSize.Y);
+	}
+
+	View.Init(Camera->GetComponentLocation(), Camera->GetComponentRotation(), Camera->FieldOfView, AspectRatio);
+	return View;
+}
+
+int32 APortalManager::GetResolutionLOD(float ScreenSize) const
+{
+	for (int32 Index = 0; Index < ResolutionLODs.Num(); ++Index)
+	{
+		if (ScreenSize >= ResolutionLODs[Index].MinScreenSize)
+			return Index;
+	}
+	return ResolutionLODs.Num() - 1;
+}
+
+int32 APortalManager::GetQualityLOD(float Distance) const
+{
+	int32 LOD = INDEX_NONE;
+	for (int32 Index = 0; Index < QualityLODs.Num() && Distance >= QualityLODs[Index].MinDistance; ++Index)
+	{
+		LOD = Index;
+	}
+	return LOD;
+}
+
+float APortalManager::ComputeCapturePriority(APortalC* Portal, const FPortalViewInfo& View, float& OutScreenSize) const
+{
+	const FBox& Bounds = Portal->GetPortalBounds();
+	const FVector Center = Bounds.GetCenter();
+	const FVector Extent = Bounds.GetExtent();
+
+	if (FVector::DistSquared(View.ViewOrigin, Center) > FMath::Square(MaxCaptureDistance))
+		return 0.f;
+
+	if (!View.Frustum.IntersectBox(Center, Extent))
+		return 0.f;
+
+	const float ScreenSize = ComputeBoundsScreenSize(Center, Extent.Size(), View.ViewOrigin, View.ProjectionMatrix);
+	OutScreenSize = ScreenSize;
+	if (ScreenSize < MinCaptureScreenSize)
+		return 0.f;
+
+	// Screen coverage grows with the square of the projected size
+	float Priority = ScreenSize * ScreenSize;
+	// The renderer did not draw the portal surface lately, most likely it is hidden behind something
+	if (!Portal->WasRecentlyRendered(0.1f))
+		Priority *= OccludedPriorityScale;
+	return FMath::Max(Priority, SMALL_NUMBER);
+}
+
+void APortalManager::ScheduleCaptures()
+{
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalScheduleCaptures);
+
+	FPortalCaptureStats Stats;
+	CulledCapturesThisFrame = 0;
+	PrimitivesConsideredThisFrame = 0;
+	PrimitivesShownThisFrame = 0;
+	SharedCullsThisFrame = 0;
+	NumSharedCulls = 0;
+	Candidates.Reset();
+	FrameViews.Reset();
+	RenderTargetPool->MemoryBudgetBytes = (int64)(RenderTargetMemoryBudgetMB * 1024.f * 1024.f);
+	UpdateLocalPlayers();
+
+	// One view per camera the portals are rendered for: every split-screen player's, or the PlayerRefCPP one of a single player
+	const int32 NumPortalViews = FMath::Max(GetNumLocalPlayers(), 1);
+	for (APortalC* Portal : Portals)
+	{
+		if (Portal == nullptr || Portal->IsPendingKill())
+			continue;
+
+		for (int32 ViewIndex = 0; ViewIndex < NumPortalViews; ++ViewIndex)
+		{
+			if (UCameraComponent* Camera = Portal->GetCaptureViewCamera(ViewIndex))
+			{
+				GetViewInfo(Camera);
+				++Stats.Considered;
+			}
+		}
+	}
+
+	// Only the portals the spatial index finds in a view's frustum get ranked, once per portal view looking through that camera
+	for (const FPortalViewInfo& View : FrameViews)
+	{
+		QueryPortals.Reset();
+		QueryPortalsInFrustum(View, MaxCaptureDistance, QueryPortals);
+		for (APortalC* Portal : QueryPortals)
+		{
+			if (Portal->IsPendingKill())
+				continue;
+
+			for (int32 ViewIndex = 0; ViewIndex < NumPortalViews; ++ViewIndex)
+			{
+				if (Portal->GetCaptureViewCamera(ViewIndex) != View.Camera)
+					continue;
+
+				float ScreenSize = 0.f;
+				const float Priority = ComputeCapturePriority(Portal, View, ScreenSize);
+				if (Priority > 0.f)
+					Candidates.Add({ Portal, ViewIndex, Priority, ScreenSize });
+			}
+		}
+	}
+	Stats.Skipped = Stats.Considered - Candidates.Num();
+
+	// A portal in view shows its destination whether or not a player is about to cross it, the next UpdateStreaming keeps it in
+	if (bPredictiveStreaming && PortalDestinationLevels.Num() > 0)
+	{
+		const float Now = GetWorld()->GetTimeSeconds();
+		for (const FCaptureCandidate& Candidate : Candidates)
+			MarkDestinationLevelsWanted(Candidate.Portal, Now);
+	}
+
+	// Best screen coverage first, the oldest capture wins a tie. All players' views share the budget
+	Candidates.Sort([](const FCaptureCandidate& A, const FCaptureCandidate& B)
+	{
+		if (A.Priority != B.Priority)
+			return A.Priority > B.Priority;
+		return A.Portal->GetLastCaptureFrame(A.ViewIndex) < B.Portal->GetLastCaptureFrame(B.ViewIndex);
+	});
+
+	const int32 NumBudgeted = FMath::Min(FMath::Max(CaptureBudgetPerFrame, 0), Candidates.Num());
+	for (int32 Index = 0; Index < NumBudgeted; ++Index)
+	{
+		const FCaptureCandidate& Candidate = Candidates[Index];
+		Stats.SceneCaptures += Candidate.Portal->UpdateSceneCaptureWRTPlayerCamera(Candidate.ScreenSize, Candidate.ViewIndex);
+		++Stats.Executed;
+	}
+
+	// Round-robin over the rest: the visible portals that waited the longest get the spare slots
+	for (int32 Slot = 0; Slot < RoundRobinCapturesPerFrame; ++Slot)
+	{
+		int32 OldestIndex = INDEX_NONE;
+		uint64 OldestFrame = 0;
+		for (int32 Index = NumBudgeted; Index < Candidates.Num(); ++Index)
+		{
+			const uint64 LastCaptureFrame = Candidates[Index].Portal->GetLastCaptureFrame(Candidates[Index].ViewIndex);
+			if (LastCaptureFrame != GFrameCounter && (OldestIndex == INDEX_NONE || LastCaptureFrame < OldestFrame))
+			{
+				OldestIndex = Index;
+				OldestFrame = LastCaptureFrame;
+			}
+		}
+		if (OldestIndex == INDEX_NONE)
+			break;
+		const FCaptureCandidate& Candidate = Candidates[OldestIndex];
+		Stats.SceneCaptures += Candidate.Portal->UpdateSceneCaptureWRTPlayerCamera(Candidate.ScreenSize, Candidate.ViewIndex);
+		++Stats.Executed;
+	}
+
+	Stats.Deferred = Candidates.Num() - Stats.Executed;
+	Stats.RenderTargetsAllocated = RenderTargetPool->GetNumAllocated();
+	Stats.RenderTargetMemoryMB = RenderTargetPool->GetAllocatedBytes() / (1024.f * 1024.f);
+	Stats.CulledCaptures = CulledCapturesThisFrame;
+	Stats.PrimitivesConsidered = PrimitivesConsideredThisFrame;
+	Stats.PrimitivesShown = PrimitivesShownThisFrame;
+	Stats.SharedCulls = SharedCullsThisFrame;
+	CaptureStats = Stats;
+
+	INC_DWORD_STAT_BY(STAT_PortalCapturesConsidered, Stats.Considered);
+	INC_DWORD_STAT_BY(STAT_PortalCapturesSkipped, Stats.Skipped);
+	INC_DWORD_STAT_BY(STAT_PortalCapturesDeferred, Stats.Deferred);
+	INC_DWORD_STAT_BY(STAT_PortalCapturesExecuted, Stats.Executed);
+	INC_DWORD_STAT_BY(STAT_PortalSceneCaptures, Stats.SceneCaptures);
+	INC_DWORD_STAT_BY(STAT_PortalPrimitivesConsidered, Stats.PrimitivesConsidered);
+	INC_DWORD_STAT_BY(STAT_PortalPrimitivesShown, Stats.PrimitivesShown);
+	INC_DWORD_STAT_BY(STAT_PortalSharedCulls, Stats.SharedCulls);
+	SET_DWORD_STAT(STAT_PortalRenderTargets, Stats.RenderTargetsAllocated);
+	SET_MEMORY_STAT(STAT_PortalRenderTargetMemory, RenderTargetPool->GetAllocatedBytes());
+	CSV_CUSTOM_STAT(Portal, CapturesExecuted, Stats.Executed, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(Portal, SceneCaptures, Stats.SceneCaptures, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(Portal, CapturePrimitivesShown, Stats.PrimitivesShown, ECsvCustomStatOp::Set);
+}
+
+void APortalManager::NotifyTeleport(const APortalC* From)
+{
+	++TeleportsThisFrame;
+
+	const TArray<int32>* LevelIds = From ? PortalDestinationLevels.Find(From) : nullptr;
+	if (LevelIds == nullptr)
+		return;
+
+	for (int32 LevelId : *LevelIds)
+	{
+		FStreamedLevel& Level = StreamedLevels[LevelId];
+		const ULevelStreaming* Streaming = Level.Streaming.Get();
+		if (Streaming && !Streaming->IsLevelVisible())
+		{
+			// The prediction was late, the engine now has to finish the load while the player is already there.
+			// Projectiles can miss every frame, the stat counts them and the log names each level once
+			if (!Level.bMissLogged)
+			{
+				UE_LOG(LogPortalManager, Warning, TEXT("Teleported through %s before %s was in, later misses are only counted in the stats"), *From->GetName(), *Level.PackageName.ToString());
+				Level.bMissLogged = true;
+			}
+			else
+			{
+				UE_LOG(LogPortalManager, Verbose, TEXT("Teleported through %s before %s was in"), *From->GetName(), *Level.PackageName.ToString());
+			}
+			++StreamingMissesThisFrame;
+		}
+	}
+}
+
+void APortalManager::MarkDestinationLevelsWanted(const APortalC* Portal, float Now)
+{
+	if (const TArray<int32>* LevelIds = Portal->PortalToCPP ? PortalDestinationLevels.Find(Portal) : nullptr)
+	{
+		for (int32 LevelId : *LevelIds)
+			StreamedLevels[LevelId].LastWantedTime = Now;
+	}
+}
+
+int32 APortalManager::FindOrAddStreamedLevel(FName PackageName)
+{
+	const int32 Existing = StreamedLevels.IndexOfByPredicate([PackageName](const FStreamedLevel& Level) { return Level.PackageName == PackageName; });
+	if (Existing != INDEX_NONE)
+		return Existing;
+
+	FStreamedLevel& Level = StreamedLevels[StreamedLevels.AddDefaulted()];
+	Level.PackageName = PackageName;
+	// Levels loaded from the start get the unload delay to be reached
+	Level.LastWantedTime = GetWorld()->GetTimeSeconds();
+	return StreamedLevels.Num() - 1;
+}
+
+void APortalManager::UpdateStreaming()
+{
+	if (!bPredictiveStreaming || StreamedLevels.Num() == 0)
+		return;
+
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalPredictStreaming);
+
+	const float Now = GetWorld()->GetTimeSeconds();
+	for (FStreamedLevel& Level : StreamedLevels)
+	{
+		// Streaming levels can be added to the world at any time
+		if (!Level.Streaming.IsValid())
+			Level.Streaming = UGameplayStatics::GetStreamingLevel(this, Level.PackageName);
+
+		ULevelStreaming* Streaming = Level.Streaming.Get();
+		if (Streaming && Level.Bounds.IsValid == 0 && Streaming->GetLoadedLevel())
+			Level.Bounds = ALevelBounds::CalculateLevelBounds(Streaming->GetLoadedLevel());
+	}
+
+	// The server streams for every player, a client only has its own
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		const APawn* Pawn = It->IsValid() ? (*It)->GetPawn() : nullptr;
+		if (Pawn == nullptr)
+			continue;
+
+		// Portals close by, and the ones the player runs into before long at the current velocity
+		const FVector Location = Pawn->GetActorLocation();
+		const FVector Velocity = Pawn->GetVelocity();
+		QueryPortals.Reset();
+		QueryPortalsNearPoint(Location, StreamingPreloadRadius, QueryPortals);
+		if (!Velocity.IsNearlyZero())
+			QueryPortalsAlongSegment(Location, Location + Velocity * StreamingLookAheadTime, QueryPortals);
+
+		for (const APortalC* Portal : QueryPortals)
+			MarkDestinationLevelsWanted(Portal, Now);
+
+		// The level the player is in, e.g. right after a teleport with the portal already behind
+		for (FStreamedLevel& Level : StreamedLevels)
+		{
+			if (Level.Bounds.IsValid && Level.Bounds.ComputeSquaredDistanceToPoint(Location) <= FMath::Square(StreamingPreloadRadius))
+				Level.LastWantedTime = Now;
+		}
+	}
+
+	int32 NumLoaded = 0;
+	for (FStreamedLevel& Level : StreamedLevels)
+	{
+		ULevelStreaming* Streaming = Level.Streaming.Get();
+		if (Streaming == nullptr)
+			continue;
+
+		// Loads are asynchronous, the level is made visible as soon as it is in
+		const bool bWanted = Now - Level.LastWantedTime <= StreamingUnloadDelay;
+		if (bWanted && !Streaming->ShouldBeLoaded())
+		{
+			UE_LOG(LogPortalManager, Verbose, TEXT("Loading %s"), *Level.PackageName.ToString());
+			Streaming->SetShouldBeLoaded(true);
+			Streaming->SetShouldBeVisible(true);
+			INC_DWORD_STAT(STAT_PortalStreamingLoads);
+		}
+		else if (!bWanted && Streaming->ShouldBeLoaded())
+		{
+			UE_LOG(LogPortalManager, Verbose, TEXT("Unloading %s"), *Level.PackageName.ToString());
+			Streaming->SetShouldBeVisible(false);
+			Streaming->SetShouldBeLoaded(false);
+		}
+
+		if (Streaming->IsLevelLoaded())
+			++NumLoaded;
+	}
+
+	SET_DWORD_STAT(STAT_PortalStreamedLevels, NumLoaded);
+	CSV_CUSTOM_STAT(Portal, DestinationLevelsLoaded, NumLoaded, ECsvCustomStatOp::Set);
+}
+
+void APortalManager::UpdateTeleportStats(float DeltaTime)
+{
+	TeleportWindowCount += TeleportsThisFrame;
+	TeleportWindowTime += DeltaTime;
+	if (TeleportWindowTime >= 1.f)
+	{
+		TeleportsPerSecond = TeleportWindowCount / TeleportWindowTime;
+		TeleportWindowCount = 0;
+		TeleportWindowTime = 0.f;
+	}
+
+	INC_DWORD_STAT_BY(STAT_PortalTeleports, TeleportsThisFrame);
+	SET_FLOAT_STAT(STAT_PortalTeleportsPerSecond, TeleportsPerSecond);
+	CSV_CUSTOM_STAT(Portal, Teleports, TeleportsThisFrame, ECsvCustomStatOp::Set);
+	INC_DWORD_STAT_BY(STAT_PortalStreamingMisses, StreamingMissesThisFrame);
+	TeleportsThisFrame = 0;
+	StreamingMissesThisFrame = 0;
+}
+
+// Called every frame
+void APortalManager::Tick(float DeltaTime)
+{
+	KZ_BENCHMARK_SCOPE(PortalCapture);
+	Super::Tick(DeltaTime);
+	UpdateStreaming();
+	ScheduleCaptures();
+	UpdateTeleportStats(DeltaTime);
+
+	FKZDebugOverlay* DebugOverlay = bPrintCaptureStats ? AFPSCppTemplateHUD::GetDebugOverlay(GetWorld()) : nullptr;
+	if (DebugOverlay)
+	{
+		DebugOverlay->SetChannel(EKZDebugChannel::PortalCaptures, FColor(0, 255, 255), TEXT("Portal captures: %d executed (%d scene captures), %d deferred, %d skipped, %d targets %.1f MB, %d/%d primitives"),
+			CaptureStats.Executed, CaptureStats.SceneCaptures, CaptureStats.Deferred, CaptureStats.Skipped, CaptureStats.RenderTargetsAllocated, CaptureStats.RenderTargetMemoryMB,
+			CaptureStats.PrimitivesShown, CaptureStats.PrimitivesConsidered);
+	}
+}
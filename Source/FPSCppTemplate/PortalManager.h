@@ -0,0 +1,402 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "ConvexVolume.h"
+#include "PortalSpatialIndex.h"
+#include "PortalManager.generated.h"
+
+class APortalC;
+class APlayerController;
+class UCameraComponent;
+class ULevelStreaming;
+class UPortalRenderTargetPool;
+class UPrimitiveComponent;
+
+/** Camera data needed to rank portals, built once per camera per frame */
+struct FPortalViewInfo
+{
+	const UCameraComponent* Camera;
+	FVector ViewOrigin;
+	FMatrix ProjectionMatrix;
+	FMatrix ViewProjectionMatrix;
+	FConvexVolume Frustum;
+
+	/** Fills in everything but Camera for a perspective view at the given pose */
+	void Init(const FVector& InViewOrigin, const FRotator& InViewRotation, float InFOV, float InAspectRatio);
+};
+
+/** Render target resolution used by portals covering at least MinScreenSize of the screen */
+USTRUCT(BlueprintType)
+struct FPortalResolutionLOD
+{
+	GENERATED_BODY()
+
+	FPortalResolutionLOD() {}
+	FPortalResolutionLOD(float InMinScreenSize, float InResolutionScale) : MinScreenSize(InMinScreenSize), ResolutionScale(InResolutionScale) {}
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal LOD")
+	float MinScreenSize = 0.f;
+
+	/** Scale of the portal's own TextureTarget size */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal LOD")
+	float ResolutionScale = 1.f;
+};
+
+/** Capture show flags used by portals at least MinDistance away from the camera */
+USTRUCT(BlueprintType)
+struct FPortalQualityLOD
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal LOD")
+	float MinDistance = 0.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal LOD")
+	bool bShadows = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal LOD")
+	bool bPostProcessing = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal LOD")
+	bool bAmbientOcclusion = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Portal LOD")
+	bool bTranslucency = true;
+};
+
+/** Capture counts of the last scheduled frame */
+USTRUCT(BlueprintType)
+struct FPortalCaptureStats
+{
+	GENERATED_BODY()
+
+	/** Portal views looked at by the scheduler, one per registered portal and local player */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 Considered = 0;
+
+	/** Portals not captured because they are off-screen, too far, too small or not linked */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 Skipped = 0;
+
+	/** Visible portals pushed back to a later frame because the budget was spent */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 Deferred = 0;
+
+	/** Portals whose capture was refreshed */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 Executed = 0;
+
+	/** CaptureScene calls issued, including the recursion levels of executed portals */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 SceneCaptures = 0;
+
+	/** Render targets owned by the pool, in use or free */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 RenderTargetsAllocated = 0;
+
+	/** Memory of the pooled render targets */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	float RenderTargetMemoryMB = 0.f;
+
+	/** Scene captures rendered with a primitive list culled to the portal opening */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 CulledCaptures = 0;
+
+	/** Primitives of the scene, summed over the culled captures: what each would have considered without the list */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 PrimitivesConsidered = 0;
+
+	/** Primitives left in the lists of the culled captures */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 PrimitivesShown = 0;
+
+	/** Culled captures that picked their static primitives from a lookup shared with the other local players' views */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	int32 SharedCulls = 0;
+};
+
+/**
+ * World-level portal manager, spawned on demand by the first portal that begins play.
+ * Owns the portal registry and decides which portal scene captures are refreshed each frame.
+ */
+UCLASS(config=Game, notplaceable)
+class FPSCPPTEMPLATE_API APortalManager : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	APortalManager();
+
+	/** Returns the manager of World, spawning one if bCreateIfMissing is set */
+	static APortalManager* Get(UWorld* World, bool bCreateIfMissing = true);
+
+	void RegisterPortal(APortalC* Portal);
+	void UnregisterPortal(APortalC* Portal);
+
+	/** Queues Portal for a spatial index update, called whenever its coord frame is rebuilt */
+	void MarkPortalMoved(APortalC* Portal);
+
+	FORCEINLINE const TArray<APortalC*>& GetPortals() const { return Portals; }
+
+	/** Portals whose bounds are within Radius of Point */
+	void QueryPortalsNearPoint(const FVector& Point, float Radius, TArray<APortalC*>& OutPortals);
+
+	/** Portals whose bounds the segment Start->End passes through */
+	void QueryPortalsAlongSegment(const FVector& Start, const FVector& End, TArray<APortalC*>& OutPortals);
+
+	/** Portals whose bounds are inside View's frustum and within MaxDistance */
+	void QueryPortalsInFrustum(const FPortalViewInfo& View, float MaxDistance, TArray<APortalC*>& OutPortals);
+
+	/**
+	 * Returns the linked portal whose opening the segment Start->End crosses first (front to back), nullptr if none.
+	 * OutTime is the hit fraction along the segment. Ignore is skipped, e.g. the portal just exited.
+	 */
+	APortalC* FindFirstCrossing(const FVector& Start, const FVector& End, const APortalC* Ignore, float& OutTime);
+
+	/**
+	 * Fills OutShowOnly with the primitives a capture of Portal at View can see through the opening of the portal it is linked to:
+	 * the frustum from the view origin through the opening's edges, starting at the portal plane, within View's own frustum and MaxDistance.
+	 * Static primitives are looked up once per frame and portal for all the local players' views together.
+	 * Returns false if View is not behind the linked portal, the capture then has to render the whole scene
+	 */
+	bool CullCapturePrimitives(const FPortalViewInfo& View, APortalC* Portal, float MaxDistance, TArray<TWeakObjectPtr<UPrimitiveComponent>>& OutShowOnly);
+
+	/** Local (split-screen) players of the game, a portal is rendered once for each of them */
+	FORCEINLINE int32 GetNumLocalPlayers() const { return LocalPlayerCameras.Num(); }
+
+	/** First person camera of local player PlayerIndex this frame, nullptr if the player has no character */
+	UCameraComponent* GetLocalPlayerCamera(int32 PlayerIndex) const;
+
+	/** Hides Surface, the portal surface of view ViewIndex, from every other local player and from the captures of their views */
+	void AddViewSurface(UPrimitiveComponent* Surface, int32 ViewIndex);
+	void RemoveViewSurface(UPrimitiveComponent* Surface);
+	bool IsViewSurface(const UPrimitiveComponent* Surface) const;
+
+	/** Appends the surfaces of the views other than ViewIndex */
+	void GetSurfacesHiddenFromView(int32 ViewIndex, TArray<TWeakObjectPtr<UPrimitiveComponent>>& OutSurfaces) const;
+
+	/** Bumped whenever a view surface is added or removed */
+	FORCEINLINE uint32 GetViewSurfacesVersion() const { return ViewSurfacesVersion; }
+
+	/** Counts a character, projectile or physics body teleport for the teleport stats. From is the portal entered, its destination levels should be in by now */
+	void NotifyTeleport(const APortalC* From);
+
+	FORCEINLINE UPortalRenderTargetPool* GetRenderTargetPool() const { return RenderTargetPool; }
+
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+	/** Number of best ranked portals captured every frame */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Capture")
+	int32 CaptureBudgetPerFrame;
+
+	/** Extra captures per frame handed out round-robin to visible portals that lost out on the budget */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Capture")
+	int32 RoundRobinCapturesPerFrame;
+
+	/** Portals further away from the camera are not captured at all */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Capture")
+	float MaxCaptureDistance;
+
+	/** Portals whose projected screen size is below this are not captured */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Capture")
+	float MinCaptureScreenSize;
+
+	/** Priority scale of portals in the frustum that the renderer did not draw recently (e.g. behind a wall) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Capture")
+	float OccludedPriorityScale;
+
+	/** Number of portal-in-portal views rendered per capture, 1 renders the portal alone. At most CaptureBudget * MaxRecursionDepth scene captures per frame */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Capture", meta = (ClampMin = "1"))
+	int32 MaxRecursionDepth;
+
+	/** Recursion stops once the nested portal covers fewer pixels than this (projected radius) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Capture")
+	float RecursionMinPixelSize;
+
+	/**
+	 * Render portal captures with the primitives culled on the CPU to the frustum through the portal opening instead of the whole
+	 * scene. Primitives outside the opening no longer cast dynamic shadows into the capture
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Capture")
+	bool bCullCapturePrimitives;
+
+	/** Render target resolution by projected screen size, ordered from the biggest MinScreenSize down */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal LOD")
+	TArray<FPortalResolutionLOD> ResolutionLODs;
+
+	/** Capture show flags by camera distance, ordered from the smallest MinDistance up. Closer portals keep the Blueprint show flags */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal LOD")
+	TArray<FPortalQualityLOD> QualityLODs;
+
+	/** VRAM cap of the pooled portal render targets, 0 means unlimited. Portals fall back to lower resolutions once it is reached */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal LOD")
+	float RenderTargetMemoryBudgetMB;
+
+	/** Load the DestinationLevels of portals before players get to them, and unload them once no player can reach them */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Streaming")
+	bool bPredictiveStreaming;
+
+	/** Seconds of a player's current velocity the path to the next portal is predicted over */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Streaming")
+	float StreamingLookAheadTime;
+
+	/** Portals this close to a player have their destination loaded, and a level stays loaded while a player is this close to its bounds */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Streaming")
+	float StreamingPreloadRadius;
+
+	/** Seconds a destination level stays loaded after the last player got out of its reach, so turning back does not load it again */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Portal Streaming")
+	float StreamingUnloadDelay;
+
+	/** Returns the index in ResolutionLODs for a portal of the given screen size */
+	int32 GetResolutionLOD(float ScreenSize) const;
+
+	/** Returns the index in QualityLODs for a portal at the given distance, INDEX_NONE for full quality */
+	int32 GetQualityLOD(float Distance) const;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	FPortalCaptureStats CaptureStats;
+
+	/** Teleports through any portal, averaged over the last second */
+	UPROPERTY(BlueprintReadOnly, Category = "Portal Capture")
+	float TeleportsPerSecond = 0.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Screen Debug")
+	bool bPrintCaptureStats = false;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/** Ranks the views of all registered portals and spends the capture budget on them */
+	void ScheduleCaptures();
+
+	/** Collects the cameras of the local players for this frame */
+	void UpdateLocalPlayers();
+
+	/** Publishes the teleports of this frame and updates TeleportsPerSecond */
+	void UpdateTeleportStats(float DeltaTime);
+
+	/** Predicts which destination levels the players can get to and streams them in and out */
+	void UpdateStreaming();
+
+	/** Keeps the destination levels of Portal loaded for another StreamingUnloadDelay from Now */
+	void MarkDestinationLevelsWanted(const APortalC* Portal, float Now);
+
+	/** Returns the id of the destination level PackageName, adding it if new */
+	int32 FindOrAddStreamedLevel(FName PackageName);
+
+	/** Brings the spatial index up to date with the portals moved since the last query */
+	void FlushMovedPortals();
+
+	/** Indexes the primitives of every actor in the world again, after levels were streamed in or out */
+	void RebuildPrimitiveIndex();
+
+	/** Adds the primitives of Actor to the capture culling: static ones to the grid, movable ones to the list tested every capture */
+	void AddActorPrimitives(AActor* Actor);
+
+	void OnActorSpawned(AActor* Actor);
+	void OnLevelsChanged(ULevel* Level, UWorld* World);
+
+	/** Converts index ids to portals */
+	void GatherQueryResults(TArray<APortalC*>& OutPortals) const;
+
+	/** Returns the view of Camera for this frame, built on first use */
+	const FPortalViewInfo& GetViewInfo(const UCameraComponent* Camera);
+
+	/** Returns the capture priority of Portal seen from View, 0 if it should not be captured. OutScreenSize is the projected size */
+	float ComputeCapturePriority(APortalC* Portal, const FPortalViewInfo& View, float& OutScreenSize) const;
+
+	UPROPERTY(Transient)
+	TArray<APortalC*> Portals;
+
+	UPROPERTY(Transient)
+	UPortalRenderTargetPool* RenderTargetPool;
+
+	struct FCaptureCandidate
+	{
+		APortalC* Portal;
+		int32 ViewIndex;
+		float Priority;
+		float ScreenSize;
+	};
+
+	/** Static primitives the level 0 captures of Portal can see through its linked portal from any local player's view */
+	struct FSharedCaptureCull
+	{
+		const APortalC* Portal = nullptr;
+		/** Sides of the frustum through the opening, the widest of all the views, see CullCapturePrimitives() */
+		float Slopes[4];
+		float MaxDistance = 0.f;
+		TArray<int32> Ids;
+		bool bValid = false;
+	};
+
+	/** Returns the shared culling of Portal for this frame, looked up on first use. nullptr if fewer than two views capture it */
+	const FSharedCaptureCull* FindOrAddSharedCull(APortalC* Portal, float MaxDistance);
+
+	FPortalSpatialIndex SpatialIndex;
+	/** Registered portal of every spatial index id */
+	TArray<APortalC*> SpatialIndexPortals;
+	TArray<APortalC*> MovedPortals;
+
+	/** Static and stationary primitives of the world, by their bounds, and the primitive of every id */
+	FPortalSpatialIndex PrimitiveIndex;
+	TArray<TWeakObjectPtr<UPrimitiveComponent>> IndexedPrimitives;
+	/** Primitives that can move, or were not registered yet when indexed, culled by their current bounds */
+	TArray<TWeakObjectPtr<UPrimitiveComponent>> MovablePrimitives;
+	bool bPrimitiveIndexDirty = true;
+	FDelegateHandle ActorSpawnedHandle;
+
+	/** Culling counts of the captures issued this frame */
+	int32 CulledCapturesThisFrame = 0;
+	int32 PrimitivesConsideredThisFrame = 0;
+	int32 PrimitivesShownThisFrame = 0;
+	int32 SharedCullsThisFrame = 0;
+
+	/** Shared culling of the portals captured this frame, the first NumSharedCulls are in use */
+	TArray<FSharedCaptureCull> SharedCulls;
+	int32 NumSharedCulls = 0;
+
+	/** Local player cameras of this frame and the player controllers the view surfaces were hidden from, by player index */
+	TArray<UCameraComponent*> LocalPlayerCameras;
+	TArray<TWeakObjectPtr<APlayerController>> LocalPlayerControllers;
+
+	/** Portal surfaces of every view, see AddViewSurface() */
+	TArray<TPair<TWeakObjectPtr<UPrimitiveComponent>, int32>> ViewSurfaces;
+	uint32 ViewSurfacesVersion = 0;
+
+	/** A level in the DestinationLevels of a registered portal */
+	struct FStreamedLevel
+	{
+		FName PackageName;
+		TWeakObjectPtr<ULevelStreaming> Streaming;
+		/** Bounds of the level when it was last loaded, players inside keep it loaded */
+		FBox Bounds = FBox(ForceInit);
+		/** World time a player could last reach the level */
+		float LastWantedTime = 0.f;
+		/** Set once a teleport arrived before the level was in, later misses are only counted */
+		bool bMissLogged = false;
+	};
+
+	TArray<FStreamedLevel> StreamedLevels;
+	/** Destination level ids of the registered portals that have any */
+	TMap<const APortalC*, TArray<int32>> PortalDestinationLevels;
+	int32 StreamingMissesThisFrame = 0;
+
+	int32 TeleportsThisFrame = 0;
+	int32 TeleportWindowCount = 0;
+	float TeleportWindowTime = 0.f;
+
+	// Scratch storage reused every frame
+	TArray<FCaptureCandidate> Candidates;
+	TArray<FPortalViewInfo> FrameViews;
+	TArray<int32> QueryIds;
+	TArray<int32> PrimitiveQueryIds;
+	FConvexVolume CaptureFrustum;
+	TArray<APortalC*> QueryPortals;
+};
@@ -0,0 +1,89 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FPSTestWorld.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "FPSCppTemplateCharacter.h"
+#include "PortalC.h"
+#include "PortalManager.h"
+#include "Misc/AutomationTest.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/TextureRenderTarget2D.h"
+
+/** Spawns a portal linked to nothing yet, rendering into a render target of its own through Surface like the Blueprint portal does */
+static APortalC* SpawnTestPortal(UWorld* World, const FTransform& Transform, AFPSCppTemplateCharacter* Player, UStaticMesh* SurfaceMesh)
+{
+	APortalC* Portal = World->SpawnActorDeferred<APortalC>(APortalC::StaticClass(), Transform, nullptr, nullptr, ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+	UTextureRenderTarget2D* Target = NewObject<UTextureRenderTarget2D>(Portal);
+	Target->InitAutoFormat(256, 256);
+	Portal->SceneCaptureCPP->TextureTarget = Target;
+	Portal->PlayerRefCPP = Player;
+	Portal->FinishSpawning(Transform);
+
+	UStaticMeshComponent* Surface = NewObject<UStaticMeshComponent>(Portal);
+	Surface->SetStaticMesh(SurfaceMesh);
+	Surface->SetupAttachment(Portal->GetRootComponent());
+	Surface->RegisterComponent();
+	Portal->SetPortalSurface(Surface);
+	return Portal;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPortalCaptureBudgetTest, "FPSCppTemplate.Portal.CaptureBudget",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FPortalCaptureBudgetTest::RunTest(const FString& Parameters)
+{
+	UStaticMesh* SurfaceMesh = LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Plane.Plane"));
+	if (!TestNotNull(TEXT("Surface mesh"), SurfaceMesh))
+		return false;
+
+	FFPSTestWorld World;
+	AFPSCppTemplateCharacter* Player = World->SpawnActor<AFPSCppTemplateCharacter>(FVector::ZeroVector, FRotator::ZeroRotator);
+	if (!TestNotNull(TEXT("Player"), Player))
+		return false;
+
+	// Facing pairs around the player, the ones ahead look into the ones behind: every capture of the front portals can recurse
+	const int32 NumPairs = 5;
+	for (int32 Pair = 0; Pair < NumPairs; ++Pair)
+	{
+		const float Y = (Pair - NumPairs / 2) * 150.f;
+		APortalC* Front = SpawnTestPortal(World.Get(), FTransform(FRotator(0.f, 180.f, 0.f), FVector(600.f, Y, 0.f)), Player, SurfaceMesh);
+		APortalC* Back = SpawnTestPortal(World.Get(), FTransform(FRotator::ZeroRotator, FVector(-600.f, Y, 0.f)), Player, SurfaceMesh);
+		Front->PortalToCPP = Back;
+		Back->PortalToCPP = Front;
+	}
+
+	APortalManager* PortalManager = APortalManager::Get(World.Get(), false);
+	if (!TestNotNull(TEXT("Portal manager"), PortalManager))
+		return false;
+	TestEqual(TEXT("Registered portals"), PortalManager->GetPortals().Num(), NumPairs * 2);
+
+	PortalManager->CaptureBudgetPerFrame = 2;
+	PortalManager->RoundRobinCapturesPerFrame = 1;
+	PortalManager->RecursionMinPixelSize = 0.f;
+	PortalManager->RenderTargetMemoryBudgetMB = 0.f;
+	PortalManager->ResolutionLODs.Reset();
+	const int32 MaxExecuted = PortalManager->CaptureBudgetPerFrame + PortalManager->RoundRobinCapturesPerFrame;
+
+	for (int32 Depth = 1; Depth <= 4; ++Depth)
+	{
+		PortalManager->MaxRecursionDepth = Depth;
+		for (int32 Frame = 0; Frame < 4; ++Frame)
+		{
+			PortalManager->Tick(1.f / 60.f);
+			const FPortalCaptureStats& Stats = PortalManager->CaptureStats;
+			TestTrue(FString::Printf(TEXT("Depth %d: portals captured"), Depth), Stats.Executed > 0);
+			TestTrue(FString::Printf(TEXT("Depth %d: %d portals captured, budget %d"), Depth, Stats.Executed, MaxExecuted), Stats.Executed <= MaxExecuted);
+			TestTrue(FString::Printf(TEXT("Depth %d: %d scene captures, budget %d"), Depth, Stats.SceneCaptures, MaxExecuted * Depth),
+				Stats.SceneCaptures >= Stats.Executed && Stats.SceneCaptures <= MaxExecuted * Depth);
+			if (Depth > 1)
+				TestTrue(FString::Printf(TEXT("Depth %d: %d scene captures recurse past the %d portals captured"), Depth, Stats.SceneCaptures, Stats.Executed),
+					Stats.SceneCaptures > Stats.Executed);
+		}
+	}
+	return true;
+}
+
+#endif
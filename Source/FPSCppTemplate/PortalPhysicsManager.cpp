@@ -0,0 +1,227 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PortalPhysicsManager.h"
+#include "FPSCppTemplate.h"
+#include "KZBenchmark.h"
+#include "PortalC.h"
+#include "PortalManager.h"
+#include "EngineUtils.h"
+#include "Components/PrimitiveComponent.h"
+#include "GameFramework/Pawn.h"
+
+DECLARE_CYCLE_STAT(TEXT("Physics Body Crossings"), STAT_PortalPhysicsUpdate, STATGROUP_Portal);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Physics Bodies"), STAT_PortalPhysicsBodies, STATGROUP_Portal);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Physics Body Teleports"), STAT_PortalPhysicsTeleports, STATGROUP_Portal);
+
+/** Direction * Rotation part of the row vector matrix whose first three rows are Row0..Row2 */
+static FORCEINLINE VectorRegister TransformDirection(const VectorRegister& Direction, const VectorRegister& Row0, const VectorRegister& Row1, const VectorRegister& Row2)
+{
+	return VectorMultiplyAdd(VectorReplicate(Direction, 0), Row0, VectorMultiplyAdd(VectorReplicate(Direction, 1), Row1, VectorMultiply(VectorReplicate(Direction, 2), Row2)));
+}
+
+APortalPhysicsManager::APortalPhysicsManager()
+{
+	PrimaryActorTick.bCanEverTick = true;
+	// Bodies are moved before the physics step would run them into the wall behind the portal
+	PrimaryActorTick.TickGroup = TG_PrePhysics;
+}
+
+APortalPhysicsManager* APortalPhysicsManager::Get(UWorld* World, bool bCreateIfMissing)
+{
+	if (World == nullptr)
+		return nullptr;
+
+	for (TActorIterator<APortalPhysicsManager> It(World); It; ++It)
+	{
+		if (!It->IsPendingKill())
+			return *It;
+	}
+
+	if (!bCreateIfMissing || World->bIsTearingDown)
+		return nullptr;
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	return World->SpawnActor<APortalPhysicsManager>(SpawnParams);
+}
+
+void APortalPhysicsManager::BeginPlay()
+{
+	Super::BeginPlay();
+
+	for (TActorIterator<AActor> It(GetWorld()); It; ++It)
+	{
+		AddActorBody(*It);
+	}
+	ActorSpawnedHandle = GetWorld()->AddOnActorSpawnedHandler(FOnActorSpawned::FDelegate::CreateUObject(this, &APortalPhysicsManager::AddActorBody));
+}
+
+void APortalPhysicsManager::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	GetWorld()->RemoveOnActorSpawnedHandler(ActorSpawnedHandle);
+	DEC_DWORD_STAT_BY(STAT_PortalPhysicsBodies, Bodies.Num());
+	Bodies.Reset();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void APortalPhysicsManager::AddActorBody(AActor* Actor)
+{
+	// Pawns go through portals with their movement component
+	if (Actor == nullptr || Actor->IsPendingKill() || Actor->IsA<APawn>())
+		return;
+
+	UPrimitiveComponent* Root = Cast<UPrimitiveComponent>(Actor->GetRootComponent());
+	if (Root && Root->Mobility == EComponentMobility::Movable && Root->BodyInstance.bSimulatePhysics)
+		AddBody(Root);
+}
+
+void APortalPhysicsManager::AddBody(UPrimitiveComponent* Body)
+{
+	if (Body == nullptr || Bodies.Contains(Body))
+		return;
+
+	Bodies.Add(Body);
+	INC_DWORD_STAT(STAT_PortalPhysicsBodies);
+}
+
+void APortalPhysicsManager::FindCrossings(APortalManager* PortalManager, float DeltaTime)
+{
+	Crossings.Reset();
+	Locations.Reset();
+	for (int32 Index = Bodies.Num() - 1; Index >= 0; --Index)
+	{
+		UPrimitiveComponent* Body = Bodies[Index].Get();
+		if (Body == nullptr)
+		{
+			// Destroyed since it was added
+			Bodies.RemoveAtSwap(Index, 1, false);
+			DEC_DWORD_STAT(STAT_PortalPhysicsBodies);
+			continue;
+		}
+
+		// Sleeping bodies stay where they are, replicated ones are carried by the server and follow
+		if (!Body->IsSimulatingPhysics() || !Body->RigidBodyIsAwake())
+			continue;
+		const AActor* Owner = Body->GetOwner();
+		if (Owner && Owner->GetIsReplicated() && !Owner->HasAuthority())
+			continue;
+
+		// Segment the physics step is about to move the body along
+		const FVector Start = Body->GetComponentLocation();
+		const FVector End = Start + Body->GetPhysicsLinearVelocity() * DeltaTime;
+		float Time;
+		const APortalC* From = PortalManager->FindFirstCrossing(Start, End, nullptr, Time);
+		if (From == nullptr)
+			continue;
+
+		Crossings.Add({ Body, From });
+		Locations.Add(FMath::Lerp(Start, End, Time));
+	}
+
+	if (Crossings.Num() == 0)
+		return;
+
+	// Crossings of the same portal next to each other, so its pair is loaded once. The locations move along
+	TArray<int32, TInlineAllocator<64>> Order;
+	Order.SetNumUninitialized(Crossings.Num());
+	for (int32 Index = 0; Index < Order.Num(); ++Index)
+		Order[Index] = Index;
+	Order.Sort([this](int32 A, int32 B) { return Crossings[A].From < Crossings[B].From; });
+
+	TArray<FCrossing, TInlineAllocator<64>> SortedCrossings;
+	TArray<FVector, TInlineAllocator<64>> SortedLocations;
+	for (int32 Index : Order)
+	{
+		SortedCrossings.Add(Crossings[Index]);
+		SortedLocations.Add(Locations[Index]);
+	}
+
+	const int32 NumCrossings = Crossings.Num();
+	Rotations.SetNumUninitialized(NumCrossings);
+	LinearVelocities.SetNumUninitialized(NumCrossings);
+	AngularVelocities.SetNumUninitialized(NumCrossings);
+	ExitOffsets.SetNumUninitialized(NumCrossings);
+	for (int32 Index = 0; Index < NumCrossings; ++Index)
+	{
+		const FCrossing& Crossing = SortedCrossings[Index];
+		Crossings[Index] = Crossing;
+		Locations[Index] = SortedLocations[Index];
+		Rotations[Index] = Crossing.Body->GetComponentQuat();
+		LinearVelocities[Index] = Crossing.Body->GetPhysicsLinearVelocity();
+		AngularVelocities[Index] = Crossing.Body->GetPhysicsAngularVelocityInDegrees();
+		// Half the depth of the bounds along the portal normal, the body keeps its orientation to the portal through the pair
+		ExitOffsets[Index] = FVector::DotProduct(Crossing.Body->Bounds.BoxExtent, Crossing.From->X.GetAbs()) + Crossing.From->PortalToCPP->ActorTeleportPositiveOffset;
+	}
+}
+
+void APortalPhysicsManager::TransformCrossings()
+{
+	const int32 NumCrossings = Crossings.Num();
+	for (int32 First = 0; First < NumCrossings;)
+	{
+		const APortalC* From = Crossings[First].From;
+		const APortalC* To = From->PortalToCPP;
+		int32 Last = First + 1;
+		while (Last < NumCrossings && Crossings[Last].From == From)
+			++Last;
+
+		// Row vectors: location * M is x * Row0 + y * Row1 + z * Row2 + Row3, directions leave out the translation row
+		const FMatrix& PortalPairMatrix = From->GetPortalPairMatrix(To);
+		const VectorRegister Row0 = VectorLoadAligned(PortalPairMatrix.M[0]);
+		const VectorRegister Row1 = VectorLoadAligned(PortalPairMatrix.M[1]);
+		const VectorRegister Row2 = VectorLoadAligned(PortalPairMatrix.M[2]);
+		const VectorRegister Row3 = VectorLoadAligned(PortalPairMatrix.M[3]);
+		const FQuat PairRotation(PortalPairMatrix);
+		const VectorRegister PairQuat = VectorLoadAligned(&PairRotation);
+		const VectorRegister ExitNormal = VectorLoadFloat3_W0(&To->X);
+
+		for (int32 Index = First; Index < Last; ++Index)
+		{
+			const VectorRegister Location = VectorLoadFloat3_W1(&Locations[Index]);
+			VectorRegister NewLocation = VectorMultiplyAdd(VectorReplicate(Location, 0), Row0,
+				VectorMultiplyAdd(VectorReplicate(Location, 1), Row1, VectorMultiplyAdd(VectorReplicate(Location, 2), Row2, Row3)));
+			NewLocation = VectorMultiplyAdd(VectorSetFloat1(ExitOffsets[Index]), ExitNormal, NewLocation);
+			VectorStoreFloat3(NewLocation, &Locations[Index]);
+
+			VectorStoreFloat3(TransformDirection(VectorLoadFloat3(&LinearVelocities[Index]), Row0, Row1, Row2), &LinearVelocities[Index]);
+			VectorStoreFloat3(TransformDirection(VectorLoadFloat3(&AngularVelocities[Index]), Row0, Row1, Row2), &AngularVelocities[Index]);
+			VectorStore(VectorQuaternionMultiply2(PairQuat, VectorLoad(&Rotations[Index])), &Rotations[Index]);
+		}
+		First = Last;
+	}
+}
+
+void APortalPhysicsManager::ApplyCrossings(APortalManager* PortalManager)
+{
+	for (int32 Index = 0; Index < Crossings.Num(); ++Index)
+	{
+		UPrimitiveComponent* Body = Crossings[Index].Body;
+		Body->SetWorldLocationAndRotation(Locations[Index], Rotations[Index], false, nullptr, ETeleportType::TeleportPhysics);
+		Body->SetPhysicsLinearVelocity(LinearVelocities[Index]);
+		Body->SetPhysicsAngularVelocityInDegrees(AngularVelocities[Index]);
+		PortalManager->NotifyTeleport(Crossings[Index].From);
+	}
+	INC_DWORD_STAT_BY(STAT_PortalPhysicsTeleports, Crossings.Num());
+}
+
+// Called every frame
+void APortalPhysicsManager::Tick(float DeltaTime)
+{
+	KZ_BENCHMARK_SCOPE(PortalPhysics);
+	Super::Tick(DeltaTime);
+
+	APortalManager* PortalManager = APortalManager::Get(GetWorld(), false);
+	if (PortalManager == nullptr || PortalManager->GetPortals().Num() == 0 || Bodies.Num() == 0 || DeltaTime <= 0.f)
+		return;
+
+	FPS_SCOPE_CYCLE_COUNTER(Portal, STAT_PortalPhysicsUpdate);
+	FindCrossings(PortalManager, DeltaTime);
+	if (Crossings.Num() == 0)
+		return;
+
+	TransformCrossings();
+	ApplyCrossings(PortalManager);
+	if (FKZBenchmarkRecorder::bRecording)
+		FKZBenchmarkRecorder::PortalPhysicsTeleports += Crossings.Num();
+}
@@ -0,0 +1,73 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "PortalPhysicsManager.generated.h"
+
+class APortalC;
+class APortalManager;
+class UPrimitiveComponent;
+
+/**
+ * Carries simulating physics bodies through portals, spawned along with the APortalManager.
+ * Bodies are looked at before the physics step: the ones whose velocity takes them through a portal opening this frame are
+ * collected first, then all of them are remapped through their portal pair at once, grouped by portal so each pair matrix is
+ * loaded into vector registers a single time, and moved to the linked portal with their rotation, linear and angular velocity.
+ * Movable physics actors are picked up when the map starts or they spawn, bodies that only start simulating later are added
+ * with AddBody(), e.g. by the projectile impulses.
+ */
+UCLASS(notplaceable)
+class FPSCPPTEMPLATE_API APortalPhysicsManager : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	APortalPhysicsManager();
+
+	/** Returns the manager of World, spawning one if bCreateIfMissing is set */
+	static APortalPhysicsManager* Get(UWorld* World, bool bCreateIfMissing = true);
+
+	/** Tracks Body for portal crossings, it is only looked at while it simulates and is awake */
+	void AddBody(UPrimitiveComponent* Body);
+
+	FORCEINLINE int32 Num() const { return Bodies.Num(); }
+
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/** Adds the root of Actor if it is a movable body set to simulate */
+	void AddActorBody(AActor* Actor);
+
+	/** Collects the bodies whose move this frame crosses a portal opening, grouped by portal */
+	void FindCrossings(APortalManager* PortalManager, float DeltaTime);
+
+	/** Remaps the state of every crossing through its portal pair */
+	void TransformCrossings();
+
+	/** Teleports the bodies to their remapped state */
+	void ApplyCrossings(APortalManager* PortalManager);
+
+	TArray<TWeakObjectPtr<UPrimitiveComponent>> Bodies;
+	FDelegateHandle ActorSpawnedHandle;
+
+	struct FCrossing
+	{
+		UPrimitiveComponent* Body;
+		const APortalC* From;
+	};
+
+	// Crossings of this frame, structure of arrays in FCrossing order, reused every tick
+	TArray<FCrossing> Crossings;
+	TArray<FVector> Locations;
+	TArray<FQuat> Rotations;
+	TArray<FVector> LinearVelocities;
+	TArray<FVector> AngularVelocities;
+	/** Distance the body is pushed out of the linked portal so it does not reach behind it */
+	TArray<float> ExitOffsets;
+};
@@ -0,0 +1,71 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PortalRenderTargetPool.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "RHI.h"
+
+UTextureRenderTarget2D* UPortalRenderTargetPool::Acquire(int32 SizeX, int32 SizeY, EPixelFormat Format)
+{
+	for (int32 Index = FreeTargets.Num() - 1; Index >= 0; --Index)
+	{
+		UTextureRenderTarget2D* Target = FreeTargets[Index];
+		if (Target->SizeX == SizeX && Target->SizeY == SizeY && Target->GetFormat() == Format)
+		{
+			FreeTargets.RemoveAtSwap(Index);
+			return Target;
+		}
+	}
+
+	const int64 TargetBytes = CalcTargetBytes(SizeX, SizeY, Format);
+	if (!TrimFreeTargets(TargetBytes))
+		return nullptr;
+
+	UTextureRenderTarget2D* Target = NewObject<UTextureRenderTarget2D>(this);
+	Target->ClearColor = FLinearColor::Black;
+	Target->InitCustomFormat(SizeX, SizeY, Format, false);
+	AllTargets.Add(Target);
+	AllocatedBytes += TargetBytes;
+	return Target;
+}
+
+bool UPortalRenderTargetPool::CanAcquire(int32 SizeX, int32 SizeY, EPixelFormat Format) const
+{
+	int64 FreeBytes = 0;
+	for (const UTextureRenderTarget2D* Target : FreeTargets)
+	{
+		if (Target->SizeX == SizeX && Target->SizeY == SizeY && Target->GetFormat() == Format)
+			return true;
+		FreeBytes += CalcTargetBytes(Target->SizeX, Target->SizeY, Target->GetFormat());
+	}
+	return MemoryBudgetBytes <= 0 || AllocatedBytes - FreeBytes + CalcTargetBytes(SizeX, SizeY, Format) <= MemoryBudgetBytes;
+}
+
+int64 UPortalRenderTargetPool::CalcTargetBytes(int32 SizeX, int32 SizeY, EPixelFormat Format)
+{
+	const FPixelFormatInfo& FormatInfo = GPixelFormats[Format];
+	const int64 BlocksX = FMath::DivideAndRoundUp(SizeX, FormatInfo.BlockSizeX);
+	const int64 BlocksY = FMath::DivideAndRoundUp(SizeY, FormatInfo.BlockSizeY);
+	return BlocksX * BlocksY * FormatInfo.BlockBytes;
+}
+
+bool UPortalRenderTargetPool::TrimFreeTargets(int64 BytesNeeded)
+{
+	while (MemoryBudgetBytes > 0 && AllocatedBytes + BytesNeeded > MemoryBudgetBytes)
+	{
+		if (FreeTargets.Num() == 0)
+			return false;
+
+		UTextureRenderTarget2D* Target = FreeTargets.Pop(false);
+		AllTargets.RemoveSwap(Target);
+		AllocatedBytes -= CalcTargetBytes(Target->SizeX, Target->SizeY, Target->GetFormat());
+		// Give the GPU memory back now instead of waiting for garbage collection
+		Target->ReleaseResource();
+	}
+	return true;
+}
+
+void UPortalRenderTargetPool::Release(UTextureRenderTarget2D* Target)
+{
+	if (Target && AllTargets.Contains(Target))
+		FreeTargets.AddUnique(Target);
+}
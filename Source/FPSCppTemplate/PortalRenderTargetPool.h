@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "PixelFormat.h"
+#include "PortalRenderTargetPool.generated.h"
+
+class UTextureRenderTarget2D;
+
+/**
+ * Render targets shared by all portal captures of a world.
+ * Captures are enqueued in order on the render thread, so a target can be released and handed to the next portal as soon as its capture has been issued.
+ */
+UCLASS()
+class FPSCPPTEMPLATE_API UPortalRenderTargetPool : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	/**
+	 * Returns a free render target of the given size and format, creating one if none is left.
+	 * Free targets of other sizes are destroyed to make room, returns nullptr if the memory budget would still be exceeded.
+	 */
+	UTextureRenderTarget2D* Acquire(int32 SizeX, int32 SizeY, EPixelFormat Format);
+
+	/** Gives Target back to the pool */
+	void Release(UTextureRenderTarget2D* Target);
+
+	/** Returns true if a target of the given size and format can be handed out without going over budget */
+	bool CanAcquire(int32 SizeX, int32 SizeY, EPixelFormat Format) const;
+
+	/** Pool memory limit in bytes, 0 means unlimited */
+	int64 MemoryBudgetBytes = 0;
+
+	FORCEINLINE int32 GetNumAllocated() const { return AllTargets.Num(); }
+	FORCEINLINE int32 GetNumInUse() const { return AllTargets.Num() - FreeTargets.Num(); }
+	FORCEINLINE int64 GetAllocatedBytes() const { return AllocatedBytes; }
+
+private:
+	static int64 CalcTargetBytes(int32 SizeX, int32 SizeY, EPixelFormat Format);
+
+	/** Destroys free targets until BytesNeeded more fit in the budget, returns true on success */
+	bool TrimFreeTargets(int64 BytesNeeded);
+
+	int64 AllocatedBytes = 0;
+
+private:
+	UPROPERTY(Transient)
+	TArray<UTextureRenderTarget2D*> AllTargets;
+
+	UPROPERTY(Transient)
+	TArray<UTextureRenderTarget2D*> FreeTargets;
+};
@@ -0,0 +1,352 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PortalSpatialIndex.h"
+#include "PortalManager.h"
+#include "ConvexVolume.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogPortalSpatialIndex, Log, All);
+
+FPortalSpatialIndex::FPortalSpatialIndex(float InCellSize, int32 InMaxElementCells)
+	: CellSize(FMath::Max(InCellSize, 1.f))
+	, InvCellSize(1.f / FMath::Max(InCellSize, 1.f))
+	, MaxElementCells(FMath::Max(InMaxElementCells, 1))
+	, NumElements(0)
+	, CurrentQueryStamp(0)
+{
+}
+
+FIntVector FPortalSpatialIndex::GetCell(const FVector& Location) const
+{
+	return FIntVector(FMath::FloorToInt(Location.X * InvCellSize), FMath::FloorToInt(Location.Y * InvCellSize), FMath::FloorToInt(Location.Z * InvCellSize));
+}
+
+int32 FPortalSpatialIndex::Add(const FBox& Bounds)
+{
+	const int32 Id = FreeIds.Num() > 0 ? FreeIds.Pop(false) : Elements.AddDefaulted();
+	FElement& Element = Elements[Id];
+	Element.Bounds = Bounds;
+	Element.MinCell = GetCell(Bounds.Min);
+	Element.MaxCell = GetCell(Bounds.Max);
+	Element.bValid = true;
+	Element.bLarge = false;
+	Element.QueryStamp = 0;
+	AddToCells(Id);
+	++NumElements;
+	return Id;
+}
+
+void FPortalSpatialIndex::Update(int32 Id, const FBox& Bounds)
+{
+	check(Elements.IsValidIndex(Id) && Elements[Id].bValid);
+	FElement& Element = Elements[Id];
+	const FIntVector MinCell = GetCell(Bounds.Min);
+	const FIntVector MaxCell = GetCell(Bounds.Max);
+	Element.Bounds = Bounds;
+	// Small moves stay inside the same cells, only the bounds change
+	if (MinCell == Element.MinCell && MaxCell == Element.MaxCell)
+		return;
+
+	RemoveFromCells(Id);
+	Element.MinCell = MinCell;
+	Element.MaxCell = MaxCell;
+	AddToCells(Id);
+}
+
+void FPortalSpatialIndex::Remove(int32 Id)
+{
+	if (!Elements.IsValidIndex(Id) || !Elements[Id].bValid)
+		return;
+
+	RemoveFromCells(Id);
+	Elements[Id].bValid = false;
+	FreeIds.Add(Id);
+	--NumElements;
+}
+
+void FPortalSpatialIndex::Reset()
+{
+	Elements.Reset();
+	FreeIds.Reset();
+	Cells.Reset();
+	LargeIds.Reset();
+	NumElements = 0;
+}
+
+void FPortalSpatialIndex::AddToCells(int32 Id)
+{
+	FElement& Element = Elements[Id];
+	const FIntVector NumCells = Element.MaxCell - Element.MinCell + FIntVector(1);
+	Element.bLarge = (int64)NumCells.X * NumCells.Y * NumCells.Z > MaxElementCells;
+	if (Element.bLarge)
+	{
+		LargeIds.Add(Id);
+		return;
+	}
+
+	for (int32 CellX = Element.MinCell.X; CellX <= Element.MaxCell.X; ++CellX)
+		for (int32 CellY = Element.MinCell.Y; CellY <= Element.MaxCell.Y; ++CellY)
+			for (int32 CellZ = Element.MinCell.Z; CellZ <= Element.MaxCell.Z; ++CellZ)
+			{
+				Cells.FindOrAdd(FIntVector(CellX, CellY, CellZ)).Add(Id);
+			}
+}
+
+void FPortalSpatialIndex::RemoveFromCells(int32 Id)
+{
+	const FElement& Element = Elements[Id];
+	if (Element.bLarge)
+	{
+		LargeIds.RemoveSwap(Id);
+		return;
+	}
+
+	for (int32 CellX = Element.MinCell.X; CellX <= Element.MaxCell.X; ++CellX)
+		for (int32 CellY = Element.MinCell.Y; CellY <= Element.MaxCell.Y; ++CellY)
+			for (int32 CellZ = Element.MinCell.Z; CellZ <= Element.MaxCell.Z; ++CellZ)
+			{
+				const FIntVector Cell(CellX, CellY, CellZ);
+				if (TArray<int32>* CellIds = Cells.Find(Cell))
+				{
+					CellIds->RemoveSwap(Id);
+					if (CellIds->Num() == 0)
+						Cells.Remove(Cell);
+				}
+			}
+}
+
+template<typename FilterType>
+void FPortalSpatialIndex::GatherCell(const FIntVector& Cell, TArray<int32>& OutIds, FilterType Filter) const
+{
+	const TArray<int32>* CellIds = Cells.Find(Cell);
+	if (CellIds == nullptr)
+		return;
+
+	for (int32 Id : *CellIds)
+	{
+		const FElement& Element = Elements[Id];
+		if (Element.QueryStamp != CurrentQueryStamp)
+		{
+			Element.QueryStamp = CurrentQueryStamp;
+			if (Filter(Element.Bounds))
+				OutIds.Add(Id);
+		}
+	}
+}
+
+template<typename FilterType>
+void FPortalSpatialIndex::GatherLarge(TArray<int32>& OutIds, FilterType Filter) const
+{
+	for (int32 Id : LargeIds)
+	{
+		const FElement& Element = Elements[Id];
+		Element.QueryStamp = CurrentQueryStamp;
+		if (Filter(Element.Bounds))
+			OutIds.Add(Id);
+	}
+}
+
+void FPortalSpatialIndex::QueryPoint(const FVector& Point, float Radius, TArray<int32>& OutIds) const
+{
+	++CurrentQueryStamp;
+	const FIntVector MinCell = GetCell(Point - FVector(Radius));
+	const FIntVector MaxCell = GetCell(Point + FVector(Radius));
+	const float RadiusSquared = FMath::Square(Radius);
+	auto Filter = [&Point, RadiusSquared](const FBox& Bounds) { return Bounds.ComputeSquaredDistanceToPoint(Point) <= RadiusSquared; };
+	GatherLarge(OutIds, Filter);
+
+	for (int32 CellX = MinCell.X; CellX <= MaxCell.X; ++CellX)
+		for (int32 CellY = MinCell.Y; CellY <= MaxCell.Y; ++CellY)
+			for (int32 CellZ = MinCell.Z; CellZ <= MaxCell.Z; ++CellZ)
+			{
+				GatherCell(FIntVector(CellX, CellY, CellZ), OutIds, Filter);
+			}
+}
+
+void FPortalSpatialIndex::QuerySegment(const FVector& Start, const FVector& End, TArray<int32>& OutIds) const
+{
+	++CurrentQueryStamp;
+	const FVector Delta = End - Start;
+	auto Filter = [&Start, &End, &Delta](const FBox& Bounds) { return FMath::LineBoxIntersection(Bounds, Start, End, Delta); };
+	GatherLarge(OutIds, Filter);
+
+	// Walk the cells along the segment (3D DDA)
+	const FIntVector StartCell = GetCell(Start);
+	const FIntVector EndCell = GetCell(End);
+	int32 Cell[3] = { StartCell.X, StartCell.Y, StartCell.Z };
+	int32 Step[3];
+	float NextT[3];
+	float DeltaT[3];
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		if (Delta[Axis] > 0.f)
+		{
+			Step[Axis] = 1;
+			NextT[Axis] = ((Cell[Axis] + 1) * CellSize - Start[Axis]) / Delta[Axis];
+			DeltaT[Axis] = CellSize / Delta[Axis];
+		}
+		else if (Delta[Axis] < 0.f)
+		{
+			Step[Axis] = -1;
+			NextT[Axis] = (Cell[Axis] * CellSize - Start[Axis]) / Delta[Axis];
+			DeltaT[Axis] = -CellSize / Delta[Axis];
+		}
+		else
+		{
+			Step[Axis] = 0;
+			NextT[Axis] = BIG_NUMBER;
+			DeltaT[Axis] = BIG_NUMBER;
+		}
+	}
+
+	const int32 NumSteps = FMath::Abs(EndCell.X - StartCell.X) + FMath::Abs(EndCell.Y - StartCell.Y) + FMath::Abs(EndCell.Z - StartCell.Z);
+	for (int32 StepIndex = 0; StepIndex <= NumSteps; ++StepIndex)
+	{
+		GatherCell(FIntVector(Cell[0], Cell[1], Cell[2]), OutIds, Filter);
+
+		const int32 Axis = NextT[0] < NextT[1] ? (NextT[0] < NextT[2] ? 0 : 2) : (NextT[1] < NextT[2] ? 1 : 2);
+		Cell[Axis] += Step[Axis];
+		NextT[Axis] += DeltaT[Axis];
+	}
+}
+
+void FPortalSpatialIndex::QueryFrustum(const FConvexVolume& Frustum, const FVector& ViewOrigin, float MaxDistance, TArray<int32>& OutIds) const
+{
+	++CurrentQueryStamp;
+	const float MaxDistanceSquared = FMath::Square(MaxDistance);
+	auto Filter = [&Frustum, &ViewOrigin, MaxDistanceSquared](const FBox& Bounds)
+	{
+		return Bounds.ComputeSquaredDistanceToPoint(ViewOrigin) <= MaxDistanceSquared && Frustum.IntersectBox(Bounds.GetCenter(), Bounds.GetExtent());
+	};
+	GatherLarge(OutIds, Filter);
+	const FVector HalfCell(CellSize * 0.5f);
+	auto IsCellVisible = [&](const FIntVector& Cell)
+	{
+		const FVector CellCenter = FVector(Cell.X, Cell.Y, Cell.Z) * CellSize + HalfCell;
+		return FBox(CellCenter - HalfCell, CellCenter + HalfCell).ComputeSquaredDistanceToPoint(ViewOrigin) <= MaxDistanceSquared
+			&& Frustum.IntersectBox(CellCenter, HalfCell);
+	};
+
+	// Walk whichever is smaller: the cells in range of the view, or the occupied cells
+	const FIntVector MinCell = GetCell(ViewOrigin - FVector(MaxDistance));
+	const FIntVector MaxCell = GetCell(ViewOrigin + FVector(MaxDistance));
+	const int64 NumCellsInRange = (int64)(MaxCell.X - MinCell.X + 1) * (MaxCell.Y - MinCell.Y + 1) * (MaxCell.Z - MinCell.Z + 1);
+	if (NumCellsInRange <= Cells.Num())
+	{
+		for (int32 CellX = MinCell.X; CellX <= MaxCell.X; ++CellX)
+			for (int32 CellY = MinCell.Y; CellY <= MaxCell.Y; ++CellY)
+				for (int32 CellZ = MinCell.Z; CellZ <= MaxCell.Z; ++CellZ)
+				{
+					const FIntVector Cell(CellX, CellY, CellZ);
+					if (Cells.Contains(Cell) && IsCellVisible(Cell))
+						GatherCell(Cell, OutIds, Filter);
+				}
+	}
+	else
+	{
+		for (const TPair<FIntVector, TArray<int32>>& Pair : Cells)
+		{
+			if (IsCellVisible(Pair.Key))
+				GatherCell(Pair.Key, OutIds, Filter);
+		}
+	}
+}
+
+// Times point, segment and frustum queries against linear scans for growing portal counts, e.g. "Portal.BenchmarkSpatialIndex 10000".
+// The PortalQueries section of KZ.Benchmark times the queries of a running game
+static FAutoConsoleCommand BenchmarkSpatialIndexCommand(
+	TEXT("Portal.BenchmarkSpatialIndex"),
+	TEXT("Times portal spatial index queries for 10 to 1000 portals. Optional argument: number of queries per portal count, a tenth of them are frustum queries."),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumQueries = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 10000;
+		// Portals spread over a course of fixed size, queries are player moves of a 300 fps frame at 3000 uu/s
+		const float WorldExtent = 50000.f;
+		const FVector PortalExtent(20.f, 100.f, 150.f);
+		const float MoveLength = 10.f;
+		// Capture views as the portal manager queries them, at its default capture distance
+		const float MaxCaptureDistance = 20000.f;
+		const int32 NumFrustumQueries = FMath::Max(NumQueries / 10, 1);
+
+		for (int32 NumPortals : { 10, 100, 1000 })
+		{
+			FRandomStream Random(NumPortals);
+			FPortalSpatialIndex Index;
+			TArray<FBox> Boxes;
+			for (int32 PortalIndex = 0; PortalIndex < NumPortals; ++PortalIndex)
+			{
+				const FVector Center(Random.FRandRange(-WorldExtent, WorldExtent), Random.FRandRange(-WorldExtent, WorldExtent), Random.FRandRange(0.f, 5000.f));
+				Boxes.Add(FBox(Center - PortalExtent, Center + PortalExtent));
+				Index.Add(Boxes.Last());
+			}
+
+			TArray<FVector> Starts;
+			TArray<FVector> Ends;
+			for (int32 Query = 0; Query < NumQueries; ++Query)
+			{
+				Starts.Add(FVector(Random.FRandRange(-WorldExtent, WorldExtent), Random.FRandRange(-WorldExtent, WorldExtent), Random.FRandRange(0.f, 5000.f)));
+				Ends.Add(Starts.Last() + Random.GetUnitVector() * MoveLength);
+			}
+
+			TArray<FPortalViewInfo> Views;
+			Views.SetNum(NumFrustumQueries);
+			for (int32 Query = 0; Query < NumFrustumQueries; ++Query)
+				Views[Query].Init(Starts[Query], FRotator(Random.FRandRange(-30.f, 30.f), Random.FRandRange(-180.f, 180.f), 0.f), 90.f, 16.f / 9.f);
+
+			TArray<int32> Results;
+			int32 NumHits = 0;
+			double StartTime = FPlatformTime::Seconds();
+			for (int32 Query = 0; Query < NumQueries; ++Query)
+			{
+				Results.Reset();
+				Index.QuerySegment(Starts[Query], Ends[Query], Results);
+				NumHits += Results.Num();
+			}
+			const double SegmentTime = FPlatformTime::Seconds() - StartTime;
+
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Query = 0; Query < NumQueries; ++Query)
+			{
+				Results.Reset();
+				Index.QueryPoint(Starts[Query], 500.f, Results);
+				NumHits += Results.Num();
+			}
+			const double PointTime = FPlatformTime::Seconds() - StartTime;
+
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Query = 0; Query < NumQueries; ++Query)
+			{
+				const FVector Delta = Ends[Query] - Starts[Query];
+				for (const FBox& Box : Boxes)
+				{
+					NumHits += FMath::LineBoxIntersection(Box, Starts[Query], Ends[Query], Delta) ? 1 : 0;
+				}
+			}
+			const double LinearTime = FPlatformTime::Seconds() - StartTime;
+
+			StartTime = FPlatformTime::Seconds();
+			for (const FPortalViewInfo& View : Views)
+			{
+				Results.Reset();
+				Index.QueryFrustum(View.Frustum, View.ViewOrigin, MaxCaptureDistance, Results);
+				NumHits += Results.Num();
+			}
+			const double FrustumTime = FPlatformTime::Seconds() - StartTime;
+
+			StartTime = FPlatformTime::Seconds();
+			for (const FPortalViewInfo& View : Views)
+			{
+				for (const FBox& Box : Boxes)
+				{
+					NumHits += Box.ComputeSquaredDistanceToPoint(View.ViewOrigin) <= FMath::Square(MaxCaptureDistance)
+						&& View.Frustum.IntersectBox(Box.GetCenter(), Box.GetExtent()) ? 1 : 0;
+				}
+			}
+			const double LinearFrustumTime = FPlatformTime::Seconds() - StartTime;
+
+			UE_LOG(LogPortalSpatialIndex, Display, TEXT("%4d portals: segment %.3f us, point %.3f us, linear scan %.3f us, frustum %.3f us, linear frustum scan %.3f us per query (%d hits)"),
+				NumPortals, SegmentTime * 1e6 / NumQueries, PointTime * 1e6 / NumQueries, LinearTime * 1e6 / NumQueries,
+				FrustumTime * 1e6 / NumFrustumQueries, LinearFrustumTime * 1e6 / NumFrustumQueries, NumHits);
+		}
+	}));
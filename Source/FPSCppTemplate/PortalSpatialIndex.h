@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FConvexVolume;
+
+/**
+ * Uniform grid over axis aligned boxes, used to find portals near a point, segment or view frustum without scanning all of them.
+ * Elements are identified by the id returned from Add(). Only the cells an element's bounds touch are updated when it moves.
+ * Elements touching more than MaxElementCells cells, like landscapes or sky spheres, are kept in a list every query tests.
+ */
+class FPSCPPTEMPLATE_API FPortalSpatialIndex
+{
+public:
+	explicit FPortalSpatialIndex(float InCellSize = 2000.f, int32 InMaxElementCells = 64);
+
+	/** Inserts Bounds and returns its id */
+	int32 Add(const FBox& Bounds);
+
+	/** Moves element Id to Bounds */
+	void Update(int32 Id, const FBox& Bounds);
+
+	void Remove(int32 Id);
+
+	void Reset();
+
+	/** Elements whose bounds are within Radius of Point */
+	void QueryPoint(const FVector& Point, float Radius, TArray<int32>& OutIds) const;
+
+	/** Elements whose bounds the segment Start->End passes through */
+	void QuerySegment(const FVector& Start, const FVector& End, TArray<int32>& OutIds) const;
+
+	/** Elements whose bounds intersect Frustum, limited to MaxDistance around ViewOrigin */
+	void QueryFrustum(const FConvexVolume& Frustum, const FVector& ViewOrigin, float MaxDistance, TArray<int32>& OutIds) const;
+
+	/** Bounds element Id was added or last moved with */
+	FORCEINLINE const FBox& GetBounds(int32 Id) const { return Elements[Id].Bounds; }
+
+	FORCEINLINE int32 Num() const { return NumElements; }
+	FORCEINLINE float GetCellSize() const { return CellSize; }
+
+private:
+	struct FElement
+	{
+		FBox Bounds;
+		FIntVector MinCell;
+		FIntVector MaxCell;
+		bool bValid;
+		/** Too large for the grid, in LargeIds */
+		bool bLarge;
+		/** Stamp of the last query that reported this element, so elements spanning several cells are reported once */
+		mutable uint32 QueryStamp;
+	};
+
+	FIntVector GetCell(const FVector& Location) const;
+	void AddToCells(int32 Id);
+	void RemoveFromCells(int32 Id);
+
+	/** Appends the elements of Cell passing Filter that were not yet reported by the current query */
+	template<typename FilterType>
+	void GatherCell(const FIntVector& Cell, TArray<int32>& OutIds, FilterType Filter) const;
+
+	/** Appends the large elements passing Filter, the first thing every query does */
+	template<typename FilterType>
+	void GatherLarge(TArray<int32>& OutIds, FilterType Filter) const;
+
+	float CellSize;
+	float InvCellSize;
+	int32 MaxElementCells;
+	int32 NumElements;
+	mutable uint32 CurrentQueryStamp;
+
+	TArray<FElement> Elements;
+	TArray<int32> FreeIds;
+	TMap<FIntVector, TArray<int32>> Cells;
+	TArray<int32> LargeIds;
+};
@@ -0,0 +1,57 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "PortalSpatialIndex.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Misc/AutomationTest.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPortalSpatialIndexLargeElementsTest, "FPSCppTemplate.Portal.SpatialIndexLargeElements",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FPortalSpatialIndexLargeElementsTest::RunTest(const FString& Parameters)
+{
+	FPortalSpatialIndex Index(1000.f, 8);
+	const int32 Small = Index.Add(FBox(FVector(-50.f), FVector(50.f)));
+	// A landscape sized element would touch a billion cells of the grid
+	const int32 Large = Index.Add(FBox(FVector(-1e6f, -1e6f, -100.f), FVector(1e6f, 1e6f, 0.f)));
+	TestEqual(TEXT("Elements"), Index.Num(), 2);
+
+	TArray<int32> Ids;
+	Index.QueryPoint(FVector::ZeroVector, 10.f, Ids);
+	TestTrue(TEXT("Point query finds the small element"), Ids.Contains(Small));
+	TestTrue(TEXT("Point query finds the large element"), Ids.Contains(Large));
+	TestEqual(TEXT("Point query reports each element once"), Ids.Num(), 2);
+
+	Ids.Reset();
+	Index.QueryPoint(FVector(5e5f, 5e5f, -50.f), 10.f, Ids);
+	TestTrue(TEXT("Far point query finds the large element only"), Ids == TArray<int32>({ Large }));
+
+	Ids.Reset();
+	Index.QuerySegment(FVector(5e5f, 0.f, 100.f), FVector(5e5f, 0.f, -200.f), Ids);
+	TestTrue(TEXT("Segment query finds the large element"), Ids == TArray<int32>({ Large }));
+
+	Ids.Reset();
+	Index.QuerySegment(FVector(5e5f, 0.f, 100.f), FVector(5e5f, 0.f, 50.f), Ids);
+	TestEqual(TEXT("Segment query misses the large element"), Ids.Num(), 0);
+
+	// Shrunk into the grid, then out of it again
+	Index.Update(Large, FBox(FVector(2000.f), FVector(2100.f)));
+	Ids.Reset();
+	Index.QueryPoint(FVector::ZeroVector, 10.f, Ids);
+	TestTrue(TEXT("Shrunk element left the large list"), Ids == TArray<int32>({ Small }));
+
+	Index.Update(Small, FBox(FVector(-1e5f), FVector(1e5f)));
+	Ids.Reset();
+	Index.QueryPoint(FVector(-5e4f), 10.f, Ids);
+	TestTrue(TEXT("Grown element joined the large list"), Ids == TArray<int32>({ Small }));
+
+	Index.Remove(Small);
+	Ids.Reset();
+	Index.QueryPoint(FVector(-5e4f), 10.f, Ids);
+	TestEqual(TEXT("Removed large element is not reported"), Ids.Num(), 0);
+	TestEqual(TEXT("Elements after removal"), Index.Num(), 1);
+	return true;
+}
+
+#endif
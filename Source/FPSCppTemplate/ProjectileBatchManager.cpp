@@ -0,0 +1,446 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ProjectileBatchManager.h"
+#include "FPSCppTemplate.h"
+#include "FPSCppTemplateProjectile.h"
+#include "FPSCppTemplateCharacter.h"
+#include "KZAssetLoader.h"
+#include "KZBenchmark.h"
+#include "ProjectilePool.h"
+#include "PortalC.h"
+#include "PortalManager.h"
+#include "PortalPhysicsManager.h"
+#include "EngineUtils.h"
+#include "Async/ParallelFor.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Components/SphereComponent.h"
+#include "Engine/StaticMesh.h"
+#include "GameFramework/ProjectileMovementComponent.h"
+#include "HAL/IConsoleManager.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogProjectileBatch, Log, All);
+
+DECLARE_CYCLE_STAT(TEXT("Batch Simulate"), STAT_ProjectileBatchSimulate, STATGROUP_Projectile);
+DECLARE_CYCLE_STAT(TEXT("Batch Sweeps"), STAT_ProjectileBatchSweeps, STATGROUP_Projectile);
+DECLARE_CYCLE_STAT(TEXT("Batch Instances"), STAT_ProjectileBatchInstances, STATGROUP_Projectile);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Lightweight Projectiles"), STAT_LightweightProjectiles, STATGROUP_Projectile);
+
+AProjectileBatchManager::AProjectileBatchManager()
+{
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.TickGroup = TG_PrePhysics;
+
+	InstancedMesh = CreateDefaultSubobject<UInstancedStaticMeshComponent>(TEXT("InstancedMesh"));
+	InstancedMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	InstancedMesh->SetMobility(EComponentMobility::Movable);
+	InstancedMesh->SetGenerateOverlapEvents(false);
+	RootComponent = InstancedMesh;
+
+	ProjectileMesh = TSoftObjectPtr<UStaticMesh>(FSoftObjectPath(TEXT("/Game/FirstPerson/Meshes/FirstPersonProjectileMesh.FirstPersonProjectileMesh")));
+	ProjectileMeshScale = FVector(0.06f);
+	MinParallelSweeps = 64;
+	MaxProjectiles = 20000;
+
+	InitialSpeed = 3000.f;
+	MaxSpeed = 3000.f;
+	GravityZ = 0.f;
+	bShouldBounce = true;
+	Bounciness = 0.6f;
+	Friction = 0.2f;
+	bBounceAngleAffectsFriction = false;
+	BounceVelocityStopSimulatingThreshold = 5.f;
+	MaxSimulationIterations = 8;
+	InitialLifeSpan = 3.f;
+	CollisionRadius = 5.f;
+	CollisionProfileName = TEXT("Projectile");
+	NumInstances = 0;
+	NumVisibleInstances = 0;
+}
+
+AProjectileBatchManager* AProjectileBatchManager::Get(UWorld* World, TSubclassOf<AFPSCppTemplateProjectile> Class, bool bCreateIfMissing)
+{
+	if (World == nullptr || Class == nullptr)
+		return nullptr;
+
+	for (TActorIterator<AProjectileBatchManager> It(World); It; ++It)
+	{
+		if (!It->IsPendingKill() && It->ProjectileClass == Class)
+			return *It;
+	}
+
+	if (!bCreateIfMissing || World->bIsTearingDown)
+		return nullptr;
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	AProjectileBatchManager* Manager = World->SpawnActor<AProjectileBatchManager>(SpawnParams);
+	if (Manager)
+		Manager->InitFromClass(Class);
+	return Manager;
+}
+
+void AProjectileBatchManager::BeginPlay()
+{
+	Super::BeginPlay();
+
+	// Projectiles fired before the mesh is in simulate all the same, their instances show up with it
+	FKZAssetLoader::Get().RequestAsyncLoad(ProjectileMesh.ToSoftObjectPath(), FStreamableDelegate::CreateUObject(this, &AProjectileBatchManager::OnProjectileMeshLoaded));
+}
+
+void AProjectileBatchManager::OnProjectileMeshLoaded()
+{
+	if (UStaticMesh* Mesh = ProjectileMesh.Get())
+		InstancedMesh->SetStaticMesh(Mesh);
+}
+
+void AProjectileBatchManager::InitFromClass(TSubclassOf<AFPSCppTemplateProjectile> Class)
+{
+	ProjectileClass = Class;
+
+	const AFPSCppTemplateProjectile* Defaults = Class->GetDefaultObject<AFPSCppTemplateProjectile>();
+	const UProjectileMovementComponent* Movement = Defaults->GetProjectileMovement();
+	InitialSpeed = Movement->InitialSpeed;
+	MaxSpeed = Movement->MaxSpeed;
+	GravityZ = GetWorld()->GetGravityZ() * Movement->ProjectileGravityScale;
+	bShouldBounce = Movement->bShouldBounce;
+	Bounciness = Movement->Bounciness;
+	Friction = Movement->Friction;
+	bBounceAngleAffectsFriction = Movement->bBounceAngleAffectsFriction;
+	BounceVelocityStopSimulatingThreshold = Movement->BounceVelocityStopSimulatingThreshold;
+	MaxSimulationIterations = FMath::Max(Movement->MaxSimulationIterations, 1);
+	InitialLifeSpan = Defaults->InitialLifeSpan;
+
+	const USphereComponent* CollisionComp = Defaults->GetCollisionComp();
+	CollisionRadius = CollisionComp->GetScaledSphereRadius();
+	CollisionProfileName = CollisionComp->GetCollisionProfileName();
+}
+
+void AProjectileBatchManager::Fire(const FVector& Location, const FRotator& Rotation)
+{
+	if (Positions.Num() >= MaxProjectiles)
+		return;
+
+	Positions.Add(Location);
+	Velocities.Add(Rotation.Vector() * InitialSpeed);
+	LifeSpans.Add(InitialLifeSpan > 0.f ? InitialLifeSpan : BIG_NUMBER);
+	BounceCounts.Add(0);
+	INC_DWORD_STAT(STAT_LightweightProjectiles);
+}
+
+void AProjectileBatchManager::Reset()
+{
+	DEC_DWORD_STAT_BY(STAT_LightweightProjectiles, Positions.Num());
+	Positions.Reset();
+	Velocities.Reset();
+	LifeSpans.Reset();
+	BounceCounts.Reset();
+	UpdateInstances();
+}
+
+void AProjectileBatchManager::RemoveProjectile(int32 Index)
+{
+	Positions.RemoveAtSwap(Index, 1, false);
+	Velocities.RemoveAtSwap(Index, 1, false);
+	LifeSpans.RemoveAtSwap(Index, 1, false);
+	BounceCounts.RemoveAtSwap(Index, 1, false);
+	DEC_DWORD_STAT(STAT_LightweightProjectiles);
+}
+
+FVector AProjectileBatchManager::ComputeVelocity(const FVector& InVelocity, float DeltaTime) const
+{
+	const FVector NewVelocity = InVelocity + FVector(0.f, 0.f, GravityZ * DeltaTime);
+	return (MaxSpeed > 0.f) ? NewVelocity.GetClampedToMaxSize(MaxSpeed) : NewVelocity;
+}
+
+FVector AProjectileBatchManager::ComputeBounceResult(const FVector& InVelocity, const FHitResult& Hit) const
+{
+	FVector TempVelocity = InVelocity;
+	const FVector Normal = Hit.Normal;
+	const float VDotNormal = (TempVelocity | Normal);
+
+	// Only if velocity is opposed by normal or parallel
+	if (VDotNormal <= 0.f)
+	{
+		// Project velocity onto normal in reflected direction, then only tangential velocity is affected by friction
+		const FVector ProjectedNormal = Normal * -VDotNormal;
+		TempVelocity += ProjectedNormal;
+		const float ScaledFriction = bBounceAngleAffectsFriction ? FMath::Clamp(-VDotNormal / TempVelocity.Size(), 0.f, 1.f) * Friction : Friction;
+		TempVelocity *= FMath::Clamp(1.f - ScaledFriction, 0.f, 1.f);
+
+		// Coefficient of restitution only applies perpendicular to impact
+		TempVelocity += (ProjectedNormal * FMath::Max(Bounciness, 0.f));
+		if (MaxSpeed > 0.f)
+			TempVelocity = TempVelocity.GetClampedToMaxSize(MaxSpeed);
+	}
+	return TempVelocity;
+}
+
+void AProjectileBatchManager::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	Simulate(DeltaTime);
+	CSV_CUSTOM_STAT(Projectile, LightweightProjectiles, Positions.Num(), ECsvCustomStatOp::Set);
+}
+
+void AProjectileBatchManager::Simulate(float DeltaTime)
+{
+	FPS_SCOPE_CYCLE_COUNTER(Projectile, STAT_ProjectileBatchSimulate);
+	KZ_BENCHMARK_SCOPE(ProjectileBatch);
+
+	const int32 NumProjectiles = Positions.Num();
+	if (NumProjectiles == 0 && NumVisibleInstances == 0)
+		return;
+
+	TimeRemaining.SetNumUninitialized(NumProjectiles, false);
+	StartVelocities.SetNumUninitialized(NumProjectiles, false);
+	MoveEnds.SetNumUninitialized(NumProjectiles, false);
+	Hits.SetNum(NumProjectiles, false);
+	bKilled.Reset();
+	bKilled.AddZeroed(NumProjectiles);
+
+	// Pass 1: life spans, resting projectiles (stopped after their last bounce) do not move any more
+	Moving.Reset();
+	for (int32 Index = 0; Index < NumProjectiles; ++Index)
+	{
+		LifeSpans[Index] -= DeltaTime;
+		if (LifeSpans[Index] <= 0.f)
+			bKilled[Index] = 1;
+		else if (!Velocities[Index].IsZero())
+		{
+			Moving.Add(Index);
+			TimeRemaining[Index] = DeltaTime;
+		}
+	}
+
+	APortalManager* PortalManager = APortalManager::Get(GetWorld(), false);
+	if (PortalManager && PortalManager->GetPortals().Num() == 0)
+		PortalManager = nullptr;
+
+	UWorld* World = GetWorld();
+	const FCollisionShape Shape = FCollisionShape::MakeSphere(CollisionRadius);
+	const FCollisionQueryParams QueryParams(FName(TEXT("LightweightProjectile")), false, this);
+
+	// Like UProjectileMovementComponent, the time left after a bounce is flown in the next iteration
+	for (int32 Iteration = 0; Iteration < MaxSimulationIterations && Moving.Num() > 0; ++Iteration)
+	{
+		// Pass 2: integrate velocity and carry projectiles through portals (the portal queries share scratch, so game thread only)
+		for (int32 Index : Moving)
+		{
+			const float TimeTick = TimeRemaining[Index];
+			StartVelocities[Index] = Velocities[Index];
+			Velocities[Index] = ComputeVelocity(StartVelocities[Index], TimeTick);
+			MoveEnds[Index] = Positions[Index] + StartVelocities[Index] * TimeTick + (Velocities[Index] - StartVelocities[Index]) * (0.5f * TimeTick);
+
+			float Time;
+			const APortalC* TeleportFrom = PortalManager ? PortalManager->FindFirstCrossing(Positions[Index], MoveEnds[Index], nullptr, Time) : nullptr;
+			if (TeleportFrom)
+			{
+				// Fly the rest of the step from the linked portal, one crossing per iteration like the actor projectiles
+				const APortalC* TeleportTo = TeleportFrom->PortalToCPP;
+				const FMatrix& PortalPairMatrix = TeleportFrom->GetPortalPairMatrix(TeleportTo);
+				PortalManager->NotifyTeleport(TeleportFrom);
+				const FVector Exit = PortalPairMatrix.TransformPosition(FMath::Lerp(Positions[Index], MoveEnds[Index], Time)) + TeleportTo->X * CollisionRadius;
+				StartVelocities[Index] = PortalPairMatrix.TransformVector(ComputeVelocity(StartVelocities[Index], TimeTick * Time));
+				TimeRemaining[Index] = TimeTick * (1.f - Time);
+
+				Positions[Index] = Exit;
+				Velocities[Index] = ComputeVelocity(StartVelocities[Index], TimeRemaining[Index]);
+				MoveEnds[Index] = Exit + StartVelocities[Index] * TimeRemaining[Index] + (Velocities[Index] - StartVelocities[Index]) * (0.5f * TimeRemaining[Index]);
+			}
+		}
+
+		// Pass 3: one sweep per moving projectile. Scene queries only read the physics scene, so they can run on workers
+		{
+			FPS_SCOPE_CYCLE_COUNTER(Projectile, STAT_ProjectileBatchSweeps);
+			ParallelFor(Moving.Num(), [&](int32 MovingIndex)
+			{
+				const int32 Index = Moving[MovingIndex];
+				Hits[Index].Reset(1.f, false);
+				World->SweepSingleByProfile(Hits[Index], Positions[Index], MoveEnds[Index], FQuat::Identity, CollisionProfileName, Shape, QueryParams);
+			}, Moving.Num() < MinParallelSweeps);
+		}
+
+		// Pass 4: apply the sweep results, same OnHit and bounce rules as the actor projectile
+		int32 NumStillMoving = 0;
+		for (int32 Index : Moving)
+		{
+			const FHitResult& Hit = Hits[Index];
+			if (!Hit.bBlockingHit)
+			{
+				Positions[Index] = MoveEnds[Index];
+				continue;
+			}
+
+			const float TimeTick = TimeRemaining[Index];
+			if (Hit.bStartPenetrating)
+			{
+				// Pushed out of the geometry, the step is tried again in the next iteration
+				Positions[Index] += Hit.Normal * (Hit.PenetrationDepth + KINDA_SMALL_NUMBER);
+				Velocities[Index] = StartVelocities[Index];
+				Moving[NumStillMoving++] = Index;
+				continue;
+			}
+
+			Positions[Index] = Hit.Location;
+
+			// AFPSCppTemplateProjectile::OnHit, which sees the velocity from before the move
+			UPrimitiveComponent* OtherComp = Hit.GetComponent();
+			if (Hit.GetActor() != nullptr && OtherComp != nullptr && OtherComp->IsSimulatingPhysics())
+			{
+				OtherComp->AddImpulseAtLocation(StartVelocities[Index] * 100.0f, Positions[Index]);
+				if (APortalPhysicsManager* PhysicsManager = APortalPhysicsManager::Get(World, false))
+					PhysicsManager->AddBody(OtherComp);
+				bKilled[Index] = 1;
+				continue;
+			}
+
+			const FVector ImpactVelocity = (Hit.Time > KINDA_SMALL_NUMBER) ? ComputeVelocity(StartVelocities[Index], TimeTick * Hit.Time) : StartVelocities[Index];
+			if (!bShouldBounce)
+			{
+				Velocities[Index] = FVector::ZeroVector;
+				continue;
+			}
+
+			Velocities[Index] = ComputeBounceResult(ImpactVelocity, Hit);
+			++BounceCounts[Index];
+			if (Velocities[Index].SizeSquared() < FMath::Square(BounceVelocityStopSimulatingThreshold))
+			{
+				Velocities[Index] = FVector::ZeroVector;
+				continue;
+			}
+
+			TimeRemaining[Index] = TimeTick * (1.f - Hit.Time);
+			if (TimeRemaining[Index] > KINDA_SMALL_NUMBER)
+				Moving[NumStillMoving++] = Index;
+		}
+		Moving.SetNum(NumStillMoving, false);
+	}
+
+	// Killed projectiles are swapped out from the back, so the ones swapped in were already visited
+	for (int32 Index = NumProjectiles - 1; Index >= 0; --Index)
+	{
+		if (bKilled[Index])
+			RemoveProjectile(Index);
+	}
+
+	UpdateInstances();
+}
+
+void AProjectileBatchManager::UpdateInstances()
+{
+	FPS_SCOPE_CYCLE_COUNTER(Projectile, STAT_ProjectileBatchInstances);
+
+	// Instances are never removed: projectile i is drawn by instance i and the unused ones are scaled to zero once
+	const int32 NumProjectiles = Positions.Num();
+	for (int32 Index = 0; Index < NumProjectiles; ++Index)
+	{
+		const FTransform Transform(Velocities[Index].Rotation(), Positions[Index], ProjectileMeshScale);
+		if (Index < NumInstances)
+			InstancedMesh->UpdateInstanceTransform(Index, Transform, true, false, true);
+		else
+			InstancedMesh->AddInstanceWorldSpace(Transform);
+	}
+
+	const FTransform Hidden(FQuat::Identity, GetActorLocation(), FVector::ZeroVector);
+	for (int32 Index = NumProjectiles; Index < NumVisibleInstances; ++Index)
+	{
+		InstancedMesh->UpdateInstanceTransform(Index, Hidden, true, false, true);
+	}
+
+	NumInstances = FMath::Max(NumInstances, NumProjectiles);
+	NumVisibleInstances = NumProjectiles;
+	InstancedMesh->MarkRenderStateDirty();
+}
+
+// Times the lightweight projectiles against pooled projectile actors, e.g. "Projectile.BenchmarkBatch 60"
+static FAutoConsoleCommand BenchmarkBatchCommand(
+	TEXT("Projectile.BenchmarkBatch"),
+	TEXT("Times 1k and 10k projectiles simulated by actors and by the batch manager. Optional argument: number of 60 Hz steps."),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const int32 NumSteps = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 60;
+		const float DeltaTime = 1.f / 60.f;
+
+		const AFPSCppTemplateCharacter* Character = World ? Cast<AFPSCppTemplateCharacter>(World->GetFirstPlayerController() ? World->GetFirstPlayerController()->GetPawn() : nullptr) : nullptr;
+		if (Character == nullptr || Character->ProjectileClass == nullptr)
+		{
+			UE_LOG(LogProjectileBatch, Warning, TEXT("Projectile.BenchmarkBatch needs a player character with a projectile class"));
+			return;
+		}
+
+		const TSubclassOf<AFPSCppTemplateProjectile> Class = Character->ProjectileClass;
+		const FVector Origin = Character->GetActorLocation() + FVector(0.f, 0.f, 200.f);
+		AProjectilePool* ProjectilePool = AProjectilePool::Get(World);
+		AProjectileBatchManager* Manager = AProjectileBatchManager::Get(World, Class);
+		if (ProjectilePool == nullptr || Manager == nullptr)
+			return;
+
+		// Nothing else moves the projectiles while they are timed, the world stays paused until the end of the command
+		const bool bWorldTicked = World->ShouldTick();
+		World->SetShouldTick(false);
+		const bool bManagerTicked = Manager->IsActorTickEnabled();
+		Manager->SetActorTickEnabled(false);
+		const int32 SavedMaxPoolSize = ProjectilePool->MaxPoolSize;
+
+		for (int32 NumProjectiles : { 1000, 10000 })
+		{
+			// Same shots for both paths: upwards half sphere around the player
+			FRandomStream Random(NumProjectiles);
+			TArray<FRotator> Directions;
+			for (int32 Shot = 0; Shot < NumProjectiles; ++Shot)
+			{
+				FVector Direction = Random.GetUnitVector();
+				Direction.Z = FMath::Abs(Direction.Z);
+				Directions.Add(Direction.Rotation());
+			}
+
+			// Every actor comes from the pool, past MaxPoolSize they would be spawned and destroyed by each run
+			ProjectilePool->MaxPoolSize = FMath::Max(SavedMaxPoolSize, NumProjectiles);
+			TArray<AFPSCppTemplateProjectile*> Actors;
+			for (const FRotator& Direction : Directions)
+			{
+				if (AFPSCppTemplateProjectile* Projectile = ProjectilePool->Acquire(Class, Origin, Direction))
+					Actors.Add(Projectile);
+			}
+
+			// Ticked through their own tick functions, as the world would tick them
+			double StartTime = FPlatformTime::Seconds();
+			for (int32 Step = 0; Step < NumSteps; ++Step)
+			{
+				for (AFPSCppTemplateProjectile* Projectile : Actors)
+				{
+					UProjectileMovementComponent* Movement = Projectile->GetProjectileMovement();
+					if (Projectile->IsProjectileActive() && Movement->IsComponentTickEnabled())
+						Movement->TickComponent(DeltaTime, LEVELTICK_All, &Movement->PrimaryComponentTick);
+				}
+			}
+			const double ActorTime = FPlatformTime::Seconds() - StartTime;
+
+			for (AFPSCppTemplateProjectile* Projectile : Actors)
+			{
+				ProjectilePool->Release(Projectile);
+			}
+
+			Manager->Reset();
+			for (const FRotator& Direction : Directions)
+			{
+				Manager->Fire(Origin, Direction);
+			}
+
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Step = 0; Step < NumSteps; ++Step)
+			{
+				Manager->Simulate(DeltaTime);
+			}
+			const double BatchTime = FPlatformTime::Seconds() - StartTime;
+			Manager->Reset();
+
+			UE_LOG(LogProjectileBatch, Display, TEXT("%5d projectiles: actors %.3f ms, batch %.3f ms per step (%d steps)"),
+				NumProjectiles, ActorTime * 1e3 / NumSteps, BatchTime * 1e3 / NumSteps, NumSteps);
+		}
+
+		ProjectilePool->MaxPoolSize = SavedMaxPoolSize;
+		Manager->SetActorTickEnabled(bManagerTicked);
+		World->SetShouldTick(bWorldTicked);
+	}));
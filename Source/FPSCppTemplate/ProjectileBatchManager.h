@@ -0,0 +1,119 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "ProjectileBatchManager.generated.h"
+
+class AFPSCppTemplateProjectile;
+class UInstancedStaticMeshComponent;
+class UStaticMesh;
+
+/**
+ * Simulates lightweight projectiles of one projectile class without an actor per projectile.
+ * State is kept as structure of arrays and stepped in one pass per tick: velocities are integrated together, the sweeps of
+ * a step run as one batch (in parallel on the task graph) and every projectile is drawn as an instance of one mesh component.
+ * Movement, bounce and OnHit impulse follow the UProjectileMovementComponent and OnHit of the class defaults.
+ */
+UCLASS(config=Game, notplaceable)
+class FPSCPPTEMPLATE_API AProjectileBatchManager : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AProjectileBatchManager();
+
+	/** Returns the manager simulating Class in World, spawning one if bCreateIfMissing is set */
+	static AProjectileBatchManager* Get(UWorld* World, TSubclassOf<AFPSCppTemplateProjectile> Class, bool bCreateIfMissing = true);
+
+	/** Adds a projectile at Location flying along Rotation at the class InitialSpeed */
+	void Fire(const FVector& Location, const FRotator& Rotation);
+
+	/** Advances all projectiles by DeltaTime and updates their instances, called by Tick */
+	void Simulate(float DeltaTime);
+
+	/** Removes all projectiles */
+	void Reset();
+
+	FORCEINLINE int32 Num() const { return Positions.Num(); }
+
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+	/** Mesh drawn for every projectile, the Blueprint projectile mesh is not available without an actor */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Lightweight Projectile")
+	TSoftObjectPtr<UStaticMesh> ProjectileMesh;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Lightweight Projectile")
+	FVector ProjectileMeshScale;
+
+	/** Sweeps are spread over task graph workers once a step has at least this many moving projectiles */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Lightweight Projectile")
+	int32 MinParallelSweeps;
+
+	/** Projectiles alive at the same time, further Fire calls are dropped */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Lightweight Projectile")
+	int32 MaxProjectiles;
+
+protected:
+	virtual void BeginPlay() override;
+
+	/** Puts the projectile mesh on the instances once its background load is done */
+	void OnProjectileMeshLoaded();
+
+	/** Copies the movement and collision settings of the projectile class defaults */
+	void InitFromClass(TSubclassOf<AFPSCppTemplateProjectile> Class);
+
+	/** Velocity after DeltaTime of gravity, clamped to MaxSpeed */
+	FVector ComputeVelocity(const FVector& InVelocity, float DeltaTime) const;
+
+	/** Velocity after bouncing off Hit, same as UProjectileMovementComponent::ComputeBounceResult */
+	FVector ComputeBounceResult(const FVector& InVelocity, const FHitResult& Hit) const;
+
+	/** Swaps the last projectile into Index */
+	void RemoveProjectile(int32 Index);
+
+	/** Writes the instance transforms of all projectiles and hides the instances no projectile uses */
+	void UpdateInstances();
+
+	UPROPERTY(VisibleAnywhere, Category = "Lightweight Projectile")
+	UInstancedStaticMeshComponent* InstancedMesh;
+
+	UPROPERTY(Transient)
+	TSubclassOf<AFPSCppTemplateProjectile> ProjectileClass;
+
+	// Class defaults of ProjectileClass
+	float InitialSpeed;
+	float MaxSpeed;
+	float GravityZ;
+	bool bShouldBounce;
+	float Bounciness;
+	float Friction;
+	bool bBounceAngleAffectsFriction;
+	float BounceVelocityStopSimulatingThreshold;
+	int32 MaxSimulationIterations;
+	float InitialLifeSpan;
+	float CollisionRadius;
+	FName CollisionProfileName;
+
+	// Projectile state, one entry per projectile
+	TArray<FVector> Positions;
+	TArray<FVector> Velocities;
+	TArray<float> LifeSpans;
+	TArray<int32> BounceCounts;
+
+	// Scratch storage of one simulation step, reused every tick
+	TArray<int32> Moving;
+	TArray<float> TimeRemaining;
+	TArray<FVector> StartVelocities;
+	TArray<FVector> MoveEnds;
+	TArray<FHitResult> Hits;
+	TArray<uint8> bKilled;
+
+	/** Instances allocated in InstancedMesh, unused ones are scaled to zero */
+	int32 NumInstances;
+
+	/** Instances drawing a projectile after the last update */
+	int32 NumVisibleInstances;
+};
@@ -0,0 +1,228 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ProjectilePool.h"
+#include "FPSCppTemplate.h"
+#include "FPSCppTemplateProjectile.h"
+#include "KZBenchmark.h"
+#include "PortalC.h"
+#include "PortalManager.h"
+#include "EngineUtils.h"
+#include "GameFramework/ProjectileMovementComponent.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Pool Hits"), STAT_ProjectilePoolHits, STATGROUP_Projectile);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Pool Misses"), STAT_ProjectilePoolMisses, STATGROUP_Projectile);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Actor Spawns"), STAT_ProjectileActorSpawns, STATGROUP_Projectile);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Active Projectiles"), STAT_ProjectilesActive, STATGROUP_Projectile);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Portal Crossings"), STAT_ProjectilePortalCrossings, STATGROUP_Projectile);
+DECLARE_CYCLE_STAT(TEXT("Projectile Portal Crossings"), STAT_ProjectileUpdatePortalCrossings, STATGROUP_Projectile);
+DECLARE_CYCLE_STAT(TEXT("Projectile Spawn"), STAT_ProjectileSpawn, STATGROUP_Projectile);
+
+AProjectilePool::AProjectilePool()
+{
+	// Ticks before the projectile movement components so crossings are handled before they hit what is behind the portal
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.TickGroup = TG_PrePhysics;
+
+	PrewarmCount = 32;
+	MaxPoolSize = 256;
+}
+
+AProjectilePool* AProjectilePool::Get(UWorld* World, bool bCreateIfMissing)
+{
+	if (World == nullptr)
+		return nullptr;
+
+	for (TActorIterator<AProjectilePool> It(World); It; ++It)
+	{
+		if (!It->IsPendingKill())
+			return *It;
+	}
+
+	if (!bCreateIfMissing || World->bIsTearingDown)
+		return nullptr;
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	return World->SpawnActor<AProjectilePool>(SpawnParams);
+}
+
+AFPSCppTemplateProjectile* AProjectilePool::SpawnPooledProjectile(TSubclassOf<AFPSCppTemplateProjectile> Class)
+{
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	SpawnParams.ObjectFlags |= RF_Transient;
+	AFPSCppTemplateProjectile* Projectile = GetWorld()->SpawnActor<AFPSCppTemplateProjectile>(Class, GetActorLocation(), FRotator::ZeroRotator, SpawnParams);
+	if (Projectile)
+	{
+		INC_DWORD_STAT(STAT_ProjectileActorSpawns);
+		Projectile->OwningPool = this;
+		Projectile->bPooled = true;
+		Projectile->GetProjectileMovement()->AddTickPrerequisiteActor(this);
+		Projectile->DeactivateProjectile();
+	}
+	return Projectile;
+}
+
+void AProjectilePool::Prewarm(TSubclassOf<AFPSCppTemplateProjectile> Class)
+{
+	if (Class == nullptr)
+		return;
+
+	FProjectilePoolList& Pool = Pools.FindOrAdd(Class);
+	while (Pool.NumPooled < FMath::Min(PrewarmCount, MaxPoolSize))
+	{
+		AFPSCppTemplateProjectile* Projectile = SpawnPooledProjectile(Class);
+		if (Projectile == nullptr)
+			break;
+		Pool.Free.Add(Projectile);
+		++Pool.NumPooled;
+	}
+}
+
+AFPSCppTemplateProjectile* AProjectilePool::Acquire(TSubclassOf<AFPSCppTemplateProjectile> Class, FVector Location, const FRotator& Rotation, ESpawnActorCollisionHandlingMethod CollisionHandling)
+{
+	FPS_SCOPE_CYCLE_COUNTER(Projectile, STAT_ProjectileSpawn);
+
+	if (Class == nullptr)
+		return nullptr;
+
+	// Same placement rules SpawnActor applies, tested with the class defaults like SpawnActor does
+	if (CollisionHandling != ESpawnActorCollisionHandlingMethod::AlwaysSpawn && CollisionHandling != ESpawnActorCollisionHandlingMethod::Undefined)
+	{
+		AActor* Template = Class->GetDefaultObject<AActor>();
+		if (GetWorld()->EncroachingBlockingGeometry(Template, Location, Rotation))
+		{
+			if (CollisionHandling == ESpawnActorCollisionHandlingMethod::DontSpawnIfColliding)
+				return nullptr;
+			if (!GetWorld()->FindTeleportSpot(Template, Location, Rotation)
+				&& CollisionHandling == ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButDontSpawnIfColliding)
+				return nullptr;
+		}
+	}
+
+	FProjectilePoolList& Pool = Pools.FindOrAdd(Class);
+	AFPSCppTemplateProjectile* Projectile = nullptr;
+	while (Pool.Free.Num() > 0 && Projectile == nullptr)
+	{
+		Projectile = Pool.Free.Pop(false);
+		if (Projectile == nullptr || Projectile->IsPendingKill())
+		{
+			--Pool.NumPooled;
+			Projectile = nullptr;
+		}
+	}
+
+	if (Projectile)
+	{
+		++PoolStats.Hits;
+		INC_DWORD_STAT(STAT_ProjectilePoolHits);
+	}
+	else
+	{
+		++PoolStats.Misses;
+		INC_DWORD_STAT(STAT_ProjectilePoolMisses);
+		Projectile = SpawnPooledProjectile(Class);
+		if (Projectile == nullptr)
+			return nullptr;
+
+		if (Pool.NumPooled < MaxPoolSize)
+		{
+			++Pool.NumPooled;
+			++PoolStats.Growth;
+		}
+		else
+		{
+			// Pool is full, this one is destroyed when it expires
+			Projectile->bPooled = false;
+		}
+	}
+
+	Projectile->ActivateProjectile(Location, Rotation);
+	Projectile->ActiveIndex = ActiveProjectiles.Add(Projectile);
+	++PoolStats.Active;
+	INC_DWORD_STAT(STAT_ProjectilesActive);
+	return Projectile;
+}
+
+void AProjectilePool::Release(AFPSCppTemplateProjectile* Projectile)
+{
+	if (Projectile == nullptr || !Projectile->IsProjectileActive())
+		return;
+
+	// Swap the last active projectile into the released slot
+	if (ActiveProjectiles.IsValidIndex(Projectile->ActiveIndex) && ActiveProjectiles[Projectile->ActiveIndex] == Projectile)
+	{
+		ActiveProjectiles.RemoveAtSwap(Projectile->ActiveIndex, 1, false);
+		if (ActiveProjectiles.IsValidIndex(Projectile->ActiveIndex))
+			ActiveProjectiles[Projectile->ActiveIndex]->ActiveIndex = Projectile->ActiveIndex;
+	}
+	Projectile->ActiveIndex = INDEX_NONE;
+
+	--PoolStats.Active;
+	DEC_DWORD_STAT(STAT_ProjectilesActive);
+	if (!Projectile->bPooled)
+	{
+		Projectile->Destroy();
+		return;
+	}
+
+	Projectile->DeactivateProjectile();
+	Pools.FindOrAdd(Projectile->GetClass()).Free.Add(Projectile);
+}
+
+void AProjectilePool::Tick(float DeltaTime)
+{
+	KZ_BENCHMARK_SCOPE(ProjectilePool);
+	Super::Tick(DeltaTime);
+
+	UpdatePortalCrossings(DeltaTime);
+	CSV_CUSTOM_STAT(Projectile, ActiveProjectiles, PoolStats.Active, ECsvCustomStatOp::Set);
+}
+
+void AProjectilePool::UpdatePortalCrossings(float DeltaTime)
+{
+	FPS_SCOPE_CYCLE_COUNTER(Projectile, STAT_ProjectileUpdatePortalCrossings);
+
+	APortalManager* PortalManager = APortalManager::Get(GetWorld(), false);
+	if (PortalManager == nullptr || PortalManager->GetPortals().Num() == 0 || DeltaTime <= 0.f)
+		return;
+
+	for (int32 Index = ActiveProjectiles.Num() - 1; Index >= 0; --Index)
+	{
+		AFPSCppTemplateProjectile* Projectile = ActiveProjectiles[Index];
+		if (Projectile == nullptr || Projectile->IsPendingKill())
+		{
+			// Destroyed by something other than the pool
+			ActiveProjectiles.RemoveAtSwap(Index, 1, false);
+			if (ActiveProjectiles.IsValidIndex(Index))
+				ActiveProjectiles[Index]->ActiveIndex = Index;
+			--PoolStats.Active;
+			DEC_DWORD_STAT(STAT_ProjectilesActive);
+			continue;
+		}
+
+		// Segment the movement component is about to fly this tick
+		const UProjectileMovementComponent* Movement = Projectile->GetProjectileMovement();
+		if (Movement->UpdatedComponent == nullptr || !Movement->IsActive())
+			continue;
+
+		const FVector Start = Projectile->GetActorLocation();
+		const FVector End = Start + Movement->ComputeMoveDelta(Movement->Velocity, DeltaTime);
+		float Time;
+		const APortalC* TeleportFrom = PortalManager->FindFirstCrossing(Start, End, nullptr, Time);
+		if (TeleportFrom)
+		{
+			Projectile->TeleportThroughPortal(TeleportFrom, FMath::Lerp(Start, End, Time));
+			PortalManager->NotifyTeleport(TeleportFrom);
+			INC_DWORD_STAT(STAT_ProjectilePortalCrossings);
+		}
+	}
+}
+
+void AProjectilePool::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	DEC_DWORD_STAT_BY(STAT_ProjectilesActive, PoolStats.Active);
+	PoolStats.Active = 0;
+	ActiveProjectiles.Reset();
+	Super::EndPlay(EndPlayReason);
+}
@@ -0,0 +1,107 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "ProjectilePool.generated.h"
+
+class AFPSCppTemplateProjectile;
+
+/** Inactive projectiles of one class */
+USTRUCT()
+struct FProjectilePoolList
+{
+	GENERATED_BODY()
+
+	UPROPERTY(Transient)
+	TArray<AFPSCppTemplateProjectile*> Free;
+
+	/** Pooled projectiles of this class, active or not */
+	int32 NumPooled = 0;
+};
+
+/** Pool counters since the pool was created */
+USTRUCT(BlueprintType)
+struct FProjectilePoolStats
+{
+	GENERATED_BODY()
+
+	/** Acquires served from an inactive projectile */
+	UPROPERTY(BlueprintReadOnly, Category = "Projectile Pool")
+	int32 Hits = 0;
+
+	/** Acquires that had to spawn a new actor */
+	UPROPERTY(BlueprintReadOnly, Category = "Projectile Pool")
+	int32 Misses = 0;
+
+	/** Actors added to the pool after pre-warming */
+	UPROPERTY(BlueprintReadOnly, Category = "Projectile Pool")
+	int32 Growth = 0;
+
+	/** Projectiles currently flying */
+	UPROPERTY(BlueprintReadOnly, Category = "Projectile Pool")
+	int32 Active = 0;
+};
+
+/**
+ * World-level pool of projectile actors, spawned on demand.
+ * Projectiles are deactivated and reused instead of destroyed, so steady fire spawns no actors and creates no garbage.
+ */
+UCLASS(config=Game, notplaceable)
+class FPSCPPTEMPLATE_API AProjectilePool : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AProjectilePool();
+
+	/** Returns the pool of World, spawning one if bCreateIfMissing is set */
+	static AProjectilePool* Get(UWorld* World, bool bCreateIfMissing = true);
+
+	/** Makes sure PrewarmCount inactive projectiles of Class exist */
+	void Prewarm(TSubclassOf<AFPSCppTemplateProjectile> Class);
+
+	/**
+	 * Fires a projectile of Class from Location/Rotation, reusing an inactive one when possible.
+	 * Follows the spawn collision handling of CollisionHandling and returns nullptr if the projectile could not be placed.
+	 */
+	AFPSCppTemplateProjectile* Acquire(TSubclassOf<AFPSCppTemplateProjectile> Class, FVector Location, const FRotator& Rotation,
+		ESpawnActorCollisionHandlingMethod CollisionHandling = ESpawnActorCollisionHandlingMethod::AlwaysSpawn);
+
+	/** Deactivates Projectile and keeps it for the next Acquire */
+	void Release(AFPSCppTemplateProjectile* Projectile);
+
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
+	/** Inactive projectiles created per class before the first shot */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Projectile Pool")
+	int32 PrewarmCount;
+
+	/** Upper bound of pooled projectiles per class, extra ones are destroyed when they expire */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Config, Category = "Projectile Pool")
+	int32 MaxPoolSize;
+
+	UPROPERTY(BlueprintReadOnly, Category = "Projectile Pool")
+	FProjectilePoolStats PoolStats;
+
+protected:
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/** Spawns a projectile of Class owned by this pool, inactive */
+	AFPSCppTemplateProjectile* SpawnPooledProjectile(TSubclassOf<AFPSCppTemplateProjectile> Class);
+
+	/**
+	 * Sends active projectiles that are about to fly into a portal through it, before their movement ticks.
+	 * One segment query per projectile, so there is no overlap component per projectile and no per-crossing allocation.
+	 */
+	void UpdatePortalCrossings(float DeltaTime);
+
+	UPROPERTY(Transient)
+	TMap<UClass*, FProjectilePoolList> Pools;
+
+	/** Projectiles handed out by Acquire and not released yet, pooled or not */
+	UPROPERTY(Transient)
+	TArray<AFPSCppTemplateProjectile*> ActiveProjectiles;
+};
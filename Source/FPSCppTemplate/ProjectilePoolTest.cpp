@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FPSTestWorld.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "FPSCppTemplateProjectile.h"
+#include "ProjectilePool.h"
+#include "Misc/AutomationTest.h"
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FProjectilePoolSteadyStateTest, "FPSCppTemplate.Projectile.PoolSteadyState",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::ClientContext | EAutomationTestFlags::ProductFilter)
+
+bool FProjectilePoolSteadyStateTest::RunTest(const FString& Parameters)
+{
+	FFPSTestWorld World;
+	AProjectilePool* Pool = AProjectilePool::Get(World.Get());
+	if (!TestNotNull(TEXT("Projectile pool"), Pool))
+		return false;
+
+	const TSubclassOf<AFPSCppTemplateProjectile> Class = AFPSCppTemplateProjectile::StaticClass();
+	Pool->Prewarm(Class);
+
+	int32 NumSpawned = 0;
+	const FDelegateHandle SpawnedHandle = World->AddOnActorSpawnedHandler(FOnActorSpawned::FDelegate::CreateLambda([&NumSpawned](AActor* Actor)
+	{
+		if (Actor->IsA<AFPSCppTemplateProjectile>())
+			++NumSpawned;
+	}));
+
+	// Two shots a frame, each flying for ShotFrames frames: fewer projectiles in the air than the pool was pre-warmed with
+	const int32 ShotsPerFrame = 2;
+	const int32 ShotFrames = FMath::Max(Pool->PrewarmCount / ShotsPerFrame - 1, 1);
+	TArray<AFPSCppTemplateProjectile*> InFlight;
+	for (int32 Frame = 0; Frame < 600; ++Frame)
+	{
+		for (int32 Shot = 0; Shot < ShotsPerFrame; ++Shot)
+		{
+			AFPSCppTemplateProjectile* Projectile = Pool->Acquire(Class, FVector(0.f, Shot * 100.f, 0.f), FRotator::ZeroRotator);
+			if (!TestNotNull(TEXT("Acquired projectile"), Projectile))
+				break;
+			InFlight.Add(Projectile);
+		}
+
+		// The oldest shots of the frame expire
+		while (InFlight.Num() > ShotFrames * ShotsPerFrame)
+		{
+			Pool->Release(InFlight[0]);
+			InFlight.RemoveAt(0, 1, false);
+		}
+	}
+
+	World->RemoveOnActorSpawnedHandler(SpawnedHandle);
+
+	TestEqual(TEXT("Projectile actors spawned after pre-warming"), NumSpawned, 0);
+	TestEqual(TEXT("Pool misses"), Pool->PoolStats.Misses, 0);
+	TestEqual(TEXT("Pool growth"), Pool->PoolStats.Growth, 0);
+	TestEqual(TEXT("Active projectiles"), Pool->PoolStats.Active, InFlight.Num());
+	return true;
+}
+
+#endif